@@ -0,0 +1,597 @@
+#include <ctype.h>
+#include <stdarg.h>
+
+#include "asm.h"
+#include "interrupts.h"
+
+
+typedef struct {
+    char name[VM_ASM_NAME_SIZE];
+    uint16_t value;
+    uint8_t used;
+} VM_AsmSymbol;
+
+typedef struct {
+    uint8_t *image;
+    uint32_t image_size;
+    uint32_t addr;      //32-bit so that running off the end of memory can be detected
+    uint32_t end;       //highest address written + 1
+    uint8_t pass;
+    uint8_t undefined;  //the last expression used a symbol that isn't defined (yet)
+    VM_AsmResult *result;
+    VM_AsmSymbol *symbols;
+    uint32_t symbol_count, symbol_capacity;
+} VM_Asm;
+
+
+static const struct {
+    const char *name;
+    uint16_t value;
+} vm_asm_predefined[] = {
+    { "I_INFO", I_INFO },
+    { "I_GPIO_CFG", I_GPIO_CFG },
+    { "I_GPIO_SET", I_GPIO_SET },
+    { "I_GPIO_GET", I_GPIO_GET },
+    { "I_VIDEO_PUTPIXEL", I_VIDEO_PUTPIXEL },
+    { "I_VIDEO_GETPIXEL", I_VIDEO_GETPIXEL },
+    { "I_VIDEO_FILL", I_VIDEO_FILL },
+    { "I_VIDEO_LINE", I_VIDEO_LINE },
+    { "I_VIDEO_CIRCLE", I_VIDEO_CIRCLE },
+    { "I_VIDEO_PRINT", I_VIDEO_PRINT },
+    { "I_VIDEO_UPDATE", I_VIDEO_UPDATE },
+    { "I_SLEEP", I_SLEEP },
+    { "I_WAIT_INPUT", I_WAIT_INPUT },
+    { "I_VIDEO_PIXELS", I_VIDEO_PIXELS },
+    { "I_VIDEO_HLINE", I_VIDEO_HLINE },
+    { "I_VIDEO_WINDOW", I_VIDEO_WINDOW },
+    { "I_VIDEO_BLIT", I_VIDEO_BLIT },
+    { "I_PROFILE", I_PROFILE },
+    { "I_USER", I_USER },
+};
+
+
+//records the first error, always returns -1
+static int vm_asm_error (VM_Asm *as, const char *fmt, ...) {
+    if (as->result->error[0] != 0) return -1;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(as->result->error, sizeof(as->result->error), fmt, args);
+    va_end(args);
+    return -1;
+}
+
+
+static const char *vm_asm_skip (const char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+    return p;
+}
+
+
+static uint8_t vm_asm_is_ident (char ch, uint8_t first) {
+    return isalpha((uint8_t)ch) || ch == '_' || (!first && isdigit((uint8_t)ch));
+}
+
+
+static uint32_t vm_asm_hash (const char *name) {
+    uint32_t hash = 2166136261u;
+    for (const char *c = name; *c != 0; c++) hash = (hash ^ (uint8_t)*c) * 16777619u;
+    return hash;
+}
+
+
+//doubles the symbol table, returns -1 if there isn't enough memory
+static int vm_asm_grow (VM_Asm *as) {
+    uint32_t capacity = as->symbol_capacity * 2;
+    VM_AsmSymbol *symbols = calloc(capacity, sizeof(VM_AsmSymbol));
+    if (symbols == NULL) return -1;
+    for (uint32_t i = 0; i < as->symbol_capacity; i++) {
+        VM_AsmSymbol *sym = &as->symbols[i];
+        if (sym->used == 0) continue;
+        uint32_t slot = vm_asm_hash(sym->name);
+        while (symbols[slot & (capacity - 1)].used != 0) slot++;
+        symbols[slot & (capacity - 1)] = *sym;
+    }
+    free(as->symbols);
+    as->symbols = symbols;
+    as->symbol_capacity = capacity;
+    return 0;
+}
+
+
+/*
+*  Symbol table, open addressing with linear probing on an FNV-1a hash of the name.
+*  Returns the symbol's slot, claiming an empty one if 'create' is set, or NULL.
+*/
+static VM_AsmSymbol *vm_asm_symbol (VM_Asm *as, const char *name, uint8_t create) {
+    if (create && (as->symbol_count + 1) * 4 > as->symbol_capacity * 3 && vm_asm_grow(as) != 0) return NULL;
+    uint32_t slot = vm_asm_hash(name);
+    while (1) {
+        VM_AsmSymbol *sym = &as->symbols[slot++ & (as->symbol_capacity - 1)];
+        if (sym->used == 0) {
+            if (create == 0) return NULL;
+            snprintf(sym->name, VM_ASM_NAME_SIZE, "%s", name);
+            sym->used = 1;
+            as->symbol_count++;
+            return sym;
+        }
+        if (strcmp(sym->name, name) == 0) return sym;
+    }
+}
+
+
+static int vm_asm_define (VM_Asm *as, const char *name, uint16_t value) {
+    if (strlen(name) >= VM_ASM_NAME_SIZE) return vm_asm_error(as, "symbol '%s' is too long", name);
+    if (as->pass == 1 && vm_asm_symbol(as, name, 0) != NULL) {
+        return vm_asm_error(as, "'%s' is already defined", name);
+    }
+    VM_AsmSymbol *sym = vm_asm_symbol(as, name, 1);
+    if (sym == NULL) return vm_asm_error(as, "out of memory for symbols");
+    sym->value = value;
+    return 0;
+}
+
+
+//copies an identifier at 'p' into 'name', returns the character after it
+static const char *vm_asm_ident (const char *p, char *name) {
+    uint8_t len = 0;
+    while (vm_asm_is_ident(*p, len == 0)) {
+        if (len < VM_ASM_NAME_SIZE) name[len] = *p;
+        len++;
+        p++;
+    }
+    name[len < VM_ASM_NAME_SIZE ? len : VM_ASM_NAME_SIZE - 1] = 0;
+    return p;
+}
+
+
+//reads one (possibly escaped) character of a string or character literal
+static const char *vm_asm_char (const char *p, uint8_t *ch) {
+    if (*p != '\\') {
+        *ch = *p;
+        return p + 1;
+    }
+    p++;
+    switch (*p) {
+        case 'n': *ch = '\n'; break;
+        case 'r': *ch = '\r'; break;
+        case 't': *ch = '\t'; break;
+        case '0': *ch = 0; break;
+        default: *ch = *p;
+    }
+    return p + 1;
+}
+
+
+static int vm_asm_term (VM_Asm *as, const char **pp, uint16_t *value) {
+    const char *p = vm_asm_skip(*pp);
+    char name[VM_ASM_NAME_SIZE];
+
+    if (isdigit((uint8_t)*p)) {
+        uint32_t v = 0;
+        uint8_t base = 10, digits = 0;
+        if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+            base = 16;
+            p += 2;
+        } else if (p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) {
+            base = 2;
+            p += 2;
+        }
+        while (isxdigit((uint8_t)*p)) {
+            uint8_t d = isdigit((uint8_t)*p) ? *p - '0' : (tolower((uint8_t)*p) - 'a' + 10);
+            if (d >= base) break;
+            v = v * base + d;
+            if (v > 0xffff) return vm_asm_error(as, "number is larger than 16 bits");
+            digits++;
+            p++;
+        }
+        if (digits == 0 || vm_asm_is_ident(*p, 0)) return vm_asm_error(as, "bad number");
+        *value = v;
+    } else if (*p == '\'') {
+        uint8_t ch;
+        p = vm_asm_char(p + 1, &ch);
+        if (*p != '\'') return vm_asm_error(as, "unterminated character");
+        *value = ch;
+        p++;
+    } else if (*p == '$') {
+        *value = as->addr;
+        p++;
+    } else if (vm_asm_is_ident(*p, 1)) {
+        p = vm_asm_ident(p, name);
+        VM_AsmSymbol *sym = vm_asm_symbol(as, name, 0);
+        if (sym == NULL) {
+            if (as->pass == 2) return vm_asm_error(as, "undefined symbol '%s'", name);
+            as->undefined = 1;
+            *value = 0;
+        } else {
+            *value = sym->value;
+        }
+    } else {
+        return vm_asm_error(as, "expected a value");
+    }
+    *pp = p;
+    return 0;
+}
+
+
+//parses terms joined by '+' and '-', arithmetic wraps at 16 bits
+static int vm_asm_expr (VM_Asm *as, const char **pp, uint16_t *value) {
+    const char *p = vm_asm_skip(*pp);
+    uint16_t total = 0, term = 0;
+    char op = '+';
+    if (*p == '-') {
+        op = '-';
+        p++;
+    }
+    while (1) {
+        if (vm_asm_term(as, &p, &term) != 0) return -1;
+        total = op == '+' ? total + term : total - term;
+        p = vm_asm_skip(p);
+        if (*p != '+' && *p != '-') break;
+        op = *p++;
+    }
+    *value = total;
+    *pp = p;
+    return 0;
+}
+
+
+//an expression that must make up the rest of 'text'
+static int vm_asm_value (VM_Asm *as, const char *text, uint16_t *value) {
+    const char *p = text;
+    if (vm_asm_expr(as, &p, value) != 0) return -1;
+    if (*vm_asm_skip(p) != 0) return vm_asm_error(as, "unexpected '%s'", vm_asm_skip(p));
+    return 0;
+}
+
+
+static int vm_asm_emit (VM_Asm *as, uint8_t byte) {
+    if (as->addr > 0xffff) return vm_asm_error(as, "program runs past the end of memory");
+    if (as->pass == 2) {
+        uint32_t offset = as->addr - as->result->origin;
+        if (offset >= as->image_size) return vm_asm_error(as, "program does not fit in the image");
+        as->image[offset] = byte;
+    }
+    as->addr++;
+    if (as->addr > as->end) as->end = as->addr;
+    return 0;
+}
+
+
+static int vm_asm_emit16 (VM_Asm *as, uint16_t value) {
+    if (vm_asm_emit(as, HBYTE(value)) != 0) return -1;
+    return vm_asm_emit(as, LBYTE(value));
+}
+
+
+/*
+*  Splits 'text' at top level commas (not inside quotes or brackets) into at most 'max'
+*  trimmed, NUL terminated fields. Returns the number of fields or -1.
+*/
+static int vm_asm_split (VM_Asm *as, char *text, char **fields, uint8_t max) {
+    int count = 0;
+    char *p = (char *)vm_asm_skip(text);
+    if (*p == 0) return 0;
+    while (1) {
+        if (count == max) return vm_asm_error(as, "too many operands");
+        fields[count++] = (char *)vm_asm_skip(p);
+        uint8_t depth = 0;
+        char quote = 0;
+        for (; *p != 0; p++) {
+            if (quote != 0) {
+                if (*p == '\\' && p[1] != 0) p++;
+                else if (*p == quote) quote = 0;
+            } else if (*p == '"' || *p == '\'') {
+                quote = *p;
+            } else if (*p == '[') {
+                depth++;
+            } else if (*p == ']' && depth > 0) {
+                depth--;
+            } else if (*p == ',' && depth == 0) {
+                break;
+            }
+        }
+        char *end = p;
+        while (end > fields[count - 1] && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        if (*p == 0) {
+            *end = 0;
+            return count;
+        }
+        *end = 0;
+        p++;
+    }
+}
+
+
+static int vm_asm_string (VM_Asm *as, const char *p, uint8_t terminate) {
+    uint8_t ch;
+    p++;
+    while (*p != '"') {
+        if (*p == 0) return vm_asm_error(as, "unterminated string");
+        p = vm_asm_char(p, &ch);
+        if (vm_asm_emit(as, ch) != 0) return -1;
+    }
+    if (*vm_asm_skip(p + 1) != 0) return vm_asm_error(as, "unexpected '%s'", vm_asm_skip(p + 1));
+    return terminate ? vm_asm_emit(as, 0) : 0;
+}
+
+
+static int vm_asm_directive (VM_Asm *as, const char *name, char *args) {
+    char *fields[32];
+    uint16_t value;
+    int count = vm_asm_split(as, args, fields, 32);
+    if (count < 0) return -1;
+
+    if (strcmp(name, "org") == 0) {
+        if (count != 1) return vm_asm_error(as, ".org takes an address");
+        as->undefined = 0;
+        if (vm_asm_value(as, fields[0], &value) != 0) return -1;
+        if (as->undefined) return vm_asm_error(as, ".org must not refer to later symbols");
+        if (value < as->result->origin) return vm_asm_error(as, ".org 0x%04x is below the origin", value);
+        as->addr = value;
+        return 0;
+    }
+    if (strcmp(name, "equ") == 0) {
+        char symbol[VM_ASM_NAME_SIZE];
+        if (count != 2 || *vm_asm_skip(vm_asm_ident(fields[0], symbol)) != 0 || symbol[0] == 0) {
+            return vm_asm_error(as, ".equ takes a name and a value");
+        }
+        if (vm_asm_value(as, fields[1], &value) != 0) return -1;
+        return vm_asm_define(as, symbol, value);
+    }
+    if (strcmp(name, "byte") == 0 || strcmp(name, "word") == 0) {
+        uint8_t word = name[0] == 'w';
+        for (int i = 0; i < count; i++) {
+            if (!word && fields[i][0] == '"') {
+                if (vm_asm_string(as, fields[i], 0) != 0) return -1;
+                continue;
+            }
+            if (vm_asm_value(as, fields[i], &value) != 0) return -1;
+            if ((word ? vm_asm_emit16(as, value) : vm_asm_emit(as, LBYTE(value))) != 0) return -1;
+        }
+        return 0;
+    }
+    if (strcmp(name, "string") == 0) {
+        if (count != 1 || fields[0][0] != '"') return vm_asm_error(as, ".string takes a quoted string");
+        return vm_asm_string(as, fields[0], 1);
+    }
+    return vm_asm_error(as, "unknown directive '.%s'", name);
+}
+
+
+static int vm_asm_operand (VM_Asm *as, char *text, char *mode, uint16_t *value) {
+    size_t len = strlen(text);
+    if (len >= 4 && strncmp(text, "[[", 2) == 0 && strcmp(text + len - 2, "]]") == 0) {
+        text[len - 2] = 0;
+        *mode = 'p';
+        return vm_asm_value(as, text + 2, value);
+    }
+    if (len >= 2 && text[0] == '[' && text[len - 1] == ']') {
+        text[len - 1] = 0;
+        *mode = 'm';
+        return vm_asm_value(as, text + 1, value);
+    }
+    if (len == 2 && (text[0] == 'r' || text[0] == 'R') && isdigit((uint8_t)text[1])) {
+        *mode = 'r';
+        *value = text[1] - '0';
+        return 0;
+    }
+    if (len == 2 && tolower((uint8_t)text[0]) == 's' && tolower((uint8_t)text[1]) == 'p') {
+        *mode = 'r';
+        *value = VM_REG_SP;
+        return 0;
+    }
+    *mode = 'i';
+    return vm_asm_value(as, text, value);
+}
+
+
+static int vm_asm_instruction (VM_Asm *as, const char *mnemonic, char *args) {
+    char *fields[3], modes[3] = { ' ', ' ', ' ' }, name[VM_ASM_NAME_SIZE];
+    uint16_t values[3] = { 0, 0, 0 };
+    const VM_Op *op = NULL;
+    int dst = -1, src = -1;
+    int count = vm_asm_split(as, args, fields, 3);
+    if (count < 0) return -1;
+
+    uint8_t len;
+    for (len = 0; mnemonic[len] != 0 && len < VM_ASM_NAME_SIZE - 1; len++) name[len] = tolower((uint8_t)mnemonic[len]);
+    name[len] = 0;
+    for (int i = 0; i < count; i++) {
+        if (vm_asm_operand(as, fields[i], &modes[i], &values[i]) != 0) return -1;
+    }
+
+    //with one operand it may be either the source or the destination
+    if (count == 0) {
+        op = vm_find_op(name, ' ', ' ');
+    } else if (count == 1) {
+        if ((op = vm_find_op(name, modes[0], ' ')) != NULL) src = 0;
+        else if ((op = vm_find_op(name, ' ', modes[0])) != NULL) dst = 0;
+    } else if (count == 2) {
+        op = vm_find_op(name, modes[1], modes[0]);
+        dst = 0;
+        src = 1;
+    } else if (modes[1] == 'r' && (modes[2] == 'r' || modes[2] == 'i')) {
+        //three operands: dst, register A, then B as smode 'R' or 'I'
+        op = vm_find_op(name, modes[2] == 'r' ? 'R' : 'I', modes[0]);
+        dst = 0;
+        src = 2;
+    }
+    if (op == NULL) {
+        for (uint16_t i = 0; i < 256; i++) {
+            const VM_Op *other = vm_find_opcode(i);
+            if (other != NULL && strcmp(other->name, name) == 0) {
+                return vm_asm_error(as, "'%s' doesn't take these operands", name);
+            }
+        }
+        return vm_asm_error(as, "unknown instruction '%s'", name);
+    }
+
+    if (vm_asm_emit(as, op->opcode) != 0) return -1;
+    if (dst >= 0) {
+        if ((modes[dst] == 'r' ? vm_asm_emit(as, values[dst]) : vm_asm_emit16(as, values[dst])) != 0) return -1;
+    }
+    if (count == 3 && vm_asm_emit(as, values[1]) != 0) return -1;
+    if (src >= 0) {
+        if ((modes[src] == 'r' ? vm_asm_emit(as, values[src]) : vm_asm_emit16(as, values[src])) != 0) return -1;
+    }
+    return 0;
+}
+
+
+//removes a trailing ';' or '//' comment, ignoring those inside quotes
+static void vm_asm_strip_comment (char *line) {
+    char quote = 0;
+    for (char *p = line; *p != 0; p++) {
+        if (quote != 0) {
+            if (*p == '\\' && p[1] != 0) p++;
+            else if (*p == quote) quote = 0;
+        } else if (*p == '"' || *p == '\'') {
+            quote = *p;
+        } else if (*p == ';' || (p[0] == '/' && p[1] == '/')) {
+            *p = 0;
+            return;
+        }
+    }
+}
+
+
+static int vm_asm_line (VM_Asm *as, char *line) {
+    char name[VM_ASM_NAME_SIZE];
+    const char *p;
+    vm_asm_strip_comment(line);
+    p = vm_asm_skip(line);
+
+    //labels
+    while (vm_asm_is_ident(*p, 1)) {
+        const char *after = vm_asm_ident(p, name);
+        if (*after != ':') break;
+        if (vm_asm_define(as, name, as->addr) != 0) return -1;
+        p = vm_asm_skip(after + 1);
+    }
+    if (*p == 0) return 0;
+
+    if (*p == '.') {
+        p = vm_asm_ident(p + 1, name);
+        return vm_asm_directive(as, name, (char *)p);
+    }
+    if (!vm_asm_is_ident(*p, 1)) return vm_asm_error(as, "unexpected '%s'", p);
+    p = vm_asm_ident(p, name);
+    if (*vm_asm_skip(p) == '=') {
+        uint16_t value;
+        if (vm_asm_value(as, vm_asm_skip(p) + 1, &value) != 0) return -1;
+        return vm_asm_define(as, name, value);
+    }
+    return vm_asm_instruction(as, name, (char *)p);
+}
+
+
+static int vm_asm_pass (VM_Asm *as, const char *source) {
+    char line[VM_ASM_LINE_SIZE];
+    uint16_t number = 0;
+    as->addr = as->result->origin;
+    as->end = as->addr;
+    while (*source != 0) {
+        const char *eol = strchr(source, '\n');
+        size_t len = eol != NULL ? (size_t)(eol - source) : strlen(source);
+        number++;
+        if (len >= VM_ASM_LINE_SIZE) {
+            as->result->line = number;
+            return vm_asm_error(as, "line is too long");
+        }
+        memcpy(line, source, len);
+        line[len] = 0;
+        if (vm_asm_line(as, line) != 0) {
+            as->result->line = number;
+            return -1;
+        }
+        source += len;
+        if (*source == '\n') source++;
+    }
+    return 0;
+}
+
+
+/*
+*  Assembles 'source' for loading at 'origin' into 'image' (unused bytes are zeroed).
+*  Returns 0 on success with the image length in 'result', or -1 with the error and
+*  line number in 'result'.
+*/
+int vm_assemble (const char *source, uint16_t origin, uint8_t *image, uint32_t image_size, VM_AsmResult *result) {
+    memset(result, 0, sizeof(VM_AsmResult));
+    result->origin = origin;
+    VM_Asm *as = calloc(1, sizeof(VM_Asm));
+    if (as != NULL) {
+        as->symbol_capacity = VM_ASM_SYMBOLS;
+        as->symbols = calloc(as->symbol_capacity, sizeof(VM_AsmSymbol));
+    }
+    if (as == NULL || as->symbols == NULL) {
+        free(as);
+        snprintf(result->error, sizeof(result->error), "out of memory");
+        return -1;
+    }
+    as->image = image;
+    as->image_size = image_size;
+    as->result = result;
+
+    int status = 0;
+    as->pass = 1;
+    for (uint8_t i = 0; i < sizeof(vm_asm_predefined) / sizeof(vm_asm_predefined[0]) && status == 0; i++) {
+        status = vm_asm_define(as, vm_asm_predefined[i].name, vm_asm_predefined[i].value);
+    }
+    //pass 1 finds the address of every label, pass 2 emits the code
+    if (status == 0) status = vm_asm_pass(as, source);
+    if (status == 0) {
+        as->pass = 2;
+        memset(image, 0, image_size);
+        status = vm_asm_pass(as, source);
+    }
+    if (status == 0) result->length = as->end - origin;
+    free(as->symbols);
+    free(as);
+    return status;
+}
+
+
+static uint8_t vm_disasm_operand (const uint8_t *mem, uint16_t addr, char mode, char *text, size_t text_size) {
+    uint16_t value = SHORT(mem[addr], mem[(uint16_t)(addr + 1)]);
+    char a[8], b[8];
+    uint8_t size;
+    switch (mode) {
+        case 'r':
+            if (mem[addr] == VM_REG_SP) snprintf(text, text_size, "sp");
+            else snprintf(text, text_size, "r%d", mem[addr]);
+            return 1;
+        case 'i': snprintf(text, text_size, "0x%04x", value); return 2;
+        case 'm': snprintf(text, text_size, "[0x%04x]", value); return 2;
+        case 'p': snprintf(text, text_size, "[[0x%04x]]", value); return 2;
+        case 'R': //register A then register B
+        case 'I': //register A then an immediate
+            vm_disasm_operand(mem, addr, 'r', a, sizeof(a));
+            size = vm_disasm_operand(mem, (uint16_t)(addr + 1), mode == 'R' ? 'r' : 'i', b, sizeof(b));
+            snprintf(text, text_size, "%s, %s", a, b);
+            return 1 + size;
+    }
+    text[0] = 0;
+    return 0;
+}
+
+
+/*
+*  Writes the instruction at 'addr' in 64K 'mem' as assembler source.
+*  Returns its length in bytes, bytes that aren't an opcode become a 1 byte '.byte'.
+*/
+uint8_t vm_disassemble (const uint8_t *mem, uint16_t addr, char *text, size_t text_size) {
+    const VM_Op *op = vm_find_opcode(mem[addr]);
+    char dst[16], src[16];
+    uint8_t size = 1;
+    if (op == NULL) {
+        snprintf(text, text_size, ".byte 0x%02x", mem[addr]);
+        return 1;
+    }
+    size += vm_disasm_operand(mem, addr + size, op->dmode, dst, sizeof(dst));
+    size += vm_disasm_operand(mem, addr + size, op->smode, src, sizeof(src));
+    if (dst[0] != 0 && src[0] != 0) snprintf(text, text_size, "%s %s, %s", op->name, dst, src);
+    else if (dst[0] != 0 || src[0] != 0) snprintf(text, text_size, "%s %s", op->name, dst[0] != 0 ? dst : src);
+    else snprintf(text, text_size, "%s", op->name);
+    return size;
+}
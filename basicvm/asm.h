@@ -0,0 +1,50 @@
+#ifndef _ASM_H_
+#define _ASM_H_
+
+#include "vm.h"
+
+/*
+*  Two-pass assembler and disassembler for basicvm.
+*
+*  One statement per line, ';' or '//' start a comment:
+*      label:                  defines 'label' as the current address
+*      NAME = expr             defines a constant (also '.equ NAME, expr')
+*      mov r0, 0x1234          destination first, then source
+*      add r1, r2, 4           three-operand ALU (add sub mul div and or xor shl shr):
+*                              r1 = r2 + 4, the last operand a register or an immediate
+*  Operands:
+*      r0..r9, sp              register ('sp' is the stack pointer)
+*      expr                    immediate
+*      [expr]                  memory at address
+*      [[expr]]                memory at the address stored at address
+*  pushm/popm take a mask of r0..r9, bit n for rn (pushm 0x3e saves r1..r5).
+*  movs, stos and cmps take no operands and work on r3 bytes, wrapping past 0xffff:
+*      movs                    copy from [r2] to [r1], the blocks may overlap
+*      stos                    fill [r1] with the low byte of r2
+*      cmps                    compare [r1] with [r2], r0 = bytes equal before the first
+*                              difference, which sets the flags like cmp (je when all equal)
+*  Expressions are numbers (123, 0x7b, 0b1111011, 'c'), symbols and '$' (the current
+*  address) joined with '+' and '-'. The I_* interrupt numbers are predefined.
+*  Directives:
+*      .org expr               continue assembling at this address
+*      .byte expr, "text", ... bytes and strings
+*      .word expr, ...         16-bit big-endian values
+*      .string "text"          a zero terminated string
+*/
+
+#define VM_ASM_SYMBOLS   64   //initial symbol table entries, grows as needed (power of two)
+#define VM_ASM_NAME_SIZE 32   //longest symbol name + 1
+#define VM_ASM_LINE_SIZE 256  //longest source line + 1
+
+typedef struct {
+    uint16_t origin;    //address of image[0]
+    uint16_t length;    //bytes of image used
+    uint16_t line;      //line of the error, 0 if none
+    char error[64];
+} VM_AsmResult;
+
+
+int vm_assemble (const char *source, uint16_t origin, uint8_t *image, uint32_t image_size, VM_AsmResult *result);
+uint8_t vm_disassemble (const uint8_t *mem, uint16_t addr, char *text, size_t text_size);
+
+#endif
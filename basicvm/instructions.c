@@ -1,11 +1,13 @@
 #include "vm.h"
 #include "instructions.h"
 #include "interrupts.h"
+#include "snapshot.h"
+#include "profile.h"
 
 
 //00
 uint8_t vm_instruction_hlt (struct VM *vm) {
-    vm->flags[F_HALT] = 1;
+    vm->flags |= VM_FLAG(F_HALT);
     return 0;
 }
 
@@ -14,85 +16,160 @@ uint8_t vm_instruction_nop (struct VM *vm) {
     return 0;
 }
 
+//bytes that aren't an instruction, PC stays on them
+uint8_t vm_instruction_invalid (struct VM *vm) {
+    vm_fault(vm, VM_FAULT_OPCODE);
+    return 1;
+}
+
+//instructions naming a register that doesn't exist decode to this (see vm_decode_at()), PC stays on them
+uint8_t vm_instruction_register (struct VM *vm) {
+    vm_fault(vm, VM_FAULT_REGISTER);
+    return 1;
+}
+
 //02
 uint8_t vm_instruction_stdout (struct VM *vm) {
     char ch = LBYTE(vm->reg[0]);
-    #ifdef DEBUG
-        printf("stdout: 0x%02x '%c'\n", ch, (ch < 32 ? '.' : (ch > 127 ? '.' : ch)));
-    #endif
-    #ifndef DEBUG
-        putchar(ch);
-        fflush(stdout);
-    #endif
+    putchar(ch);
+    fflush(stdout);
     return 0;
 }
 
 //03
 uint8_t vm_instruction_stdin (struct VM *vm) {
-    uint8_t ch;
-    fcntl(0, F_SETFL, O_NONBLOCK);
-    int byte_read = read(0, &ch, 1);
-    fcntl(0, F_SETFL, ~O_NONBLOCK);
-    if (byte_read > 0) {
-        vm->op_dst = ch;
-        vm->flags[F_ZERO] = 0;
-        vm->flags[F_DATA] = 1;
+    uint32_t value;
+    if (!vm_replay_next(vm, VM_INPUT_STDIN, &value)) {
+        uint8_t ch;
+        #ifdef PICO_LCD_BASE
+            int byte_read = vm->input != NULL ? input_queue_read(vm->input, &ch, 1) : input_read(&ch, 1);
+        #else
+            static uint8_t nonblocking = 0;
+            if (nonblocking == 0) {
+                fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK);
+                nonblocking = 1;
+            }
+            int byte_read = read(0, &ch, 1);
+        #endif
+        value = byte_read > 0 ? ch : VM_INPUT_NONE;
+        vm_replay_log(vm, VM_INPUT_STDIN, value);
+    }
+    if (value != VM_INPUT_NONE) {
+        vm->op_dst = value;
+        vm_set_flag(vm, F_ZERO, 0);
+        vm_set_flag(vm, F_DATA, 1);
     } else {
-        vm->flags[F_ZERO] = 1;
-        vm->flags[F_DATA] = 0;
+        vm_set_flag(vm, F_ZERO, 1);
+        vm_set_flag(vm, F_DATA, 0);
     }
     return 0;
 }
 
 //04
 uint8_t vm_instruction_int (struct VM *vm) {
-    switch (vm->op_src) {
-        case I_INFO:
-            return vm_int_info(vm);
-            break;
-        case I_GPIO_CFG: //pin, direction, pullup/pulldown
-            return vm_int_gpio_cfg(vm);
-            break;
-        case I_GPIO_SET: //pin, level
-            return vm_int_gpio_set(vm);
-            break;
-        case I_GPIO_GET: //pin
-            return vm_int_gpio_get(vm);
-            break;
-        case I_VIDEO_PUTPIXEL: //x, y, colour
-            return vm_int_video_putpixel(vm);
-            break;
-        case I_VIDEO_GETPIXEL: //x, y
-            return vm_int_video_getpixel(vm);
-            break;
-        case I_VIDEO_FILL: //x, y, w, h, colour
-            return vm_int_video_fill(vm);
-            break;
-        case I_VIDEO_LINE: //sx, sy, dx, dy, colour
-            return vm_int_video_line(vm);
-            break;
-        case I_VIDEO_CIRCLE: //cx, cy, radius, colour
-            return vm_int_video_circle(vm);
-            break;
-        case I_VIDEO_PRINT: //x, y, char, colour
-            return vm_int_video_print(vm);
-            break;
-    }
+    vm->yield = vm_interrupt(vm, vm->op_src);
     return 0;
 }
 
+
+/*
+*  Native handler of each interrupt number, NULL where there's none (those do nothing).
+*  The built-in ones are below I_USER, firmware modules add theirs with vm_int_register().
+*/
+static VM_IntHandler vm_int_table[VM_INT_COUNT] = {
+    [I_INFO]           = vm_int_info,
+    [I_GPIO_CFG]       = vm_int_gpio_cfg,
+    [I_GPIO_SET]       = vm_int_gpio_set,
+    [I_GPIO_GET]       = vm_int_gpio_get,
+    [I_VIDEO_PUTPIXEL] = vm_int_video_putpixel,
+    [I_VIDEO_GETPIXEL] = vm_int_video_getpixel,
+    [I_VIDEO_FILL]     = vm_int_video_fill,
+    [I_VIDEO_LINE]     = vm_int_video_line,
+    [I_VIDEO_CIRCLE]   = vm_int_video_circle,
+    [I_VIDEO_PRINT]    = vm_int_video_print,
+    [I_VIDEO_UPDATE]   = vm_int_video_update,
+    [I_SLEEP]          = vm_int_sleep,
+    [I_WAIT_INPUT]     = vm_int_wait_input,
+    [I_VIDEO_PIXELS]   = vm_int_video_pixels,
+    [I_VIDEO_HLINE]    = vm_int_video_hline,
+    [I_VIDEO_WINDOW]   = vm_int_video_window,
+    [I_VIDEO_BLIT]     = vm_int_video_blit,
+    [I_PROFILE]        = vm_int_profile,
+};
+
+
+/*
+*  Makes 'handler' the native handler of interrupt 'num' for every VM, NULL removes it.
+*  Returns the handler it replaces. Register at init, before any VM runs, the table isn't
+*  locked against a VM on the other core.
+*/
+VM_IntHandler vm_int_register (uint8_t num, VM_IntHandler handler) {
+    VM_IntHandler previous = vm_int_table[num];
+    vm_int_table[num] = handler;
+    return previous;
+}
+
+
+//dispatches interrupt 'num', returns VM_INT_CONTINUE or VM_INT_YIELD
+uint8_t vm_interrupt (struct VM *vm, uint16_t num) {
+    VM_TRACE_INT(vm, num);
+    VM_PROFILE_INT(vm, num);
+    VM_IntHandler handler = num < VM_INT_COUNT ? vm_int_table[num] : NULL;
+    return handler != NULL ? handler(vm) : VM_INT_CONTINUE;
+}
+
 //05..06
 uint8_t vm_instruction_call (struct VM *vm) {
+    if (vm_push(vm, vm->pc + vm->op_size) == 0) return 1;
+    vm->pc = vm->op_src;
+    return 1;
+}
+
+//09
+uint8_t vm_instruction_ret (struct VM *vm) {
+    vm->pc = vm_pop(vm);
+    return 1;
+}
+
+//0a..0b
+uint8_t vm_instruction_push (struct VM *vm) {
+    return vm_push(vm, vm->op_src) == 0;
+}
+
+//0c
+uint8_t vm_instruction_pop (struct VM *vm) {
+    vm->op_dst = vm_pop(vm);
+    return 0;
+}
+
+//0d, pushes the registers in the mask (bit n is Rn) from R0 up
+uint8_t vm_instruction_pushm (struct VM *vm) {
+    uint16_t mask = vm->op_src, bytes = 0;
+    for (uint8_t i = 0; i < 10; i++) bytes += (mask >> i) & 1 ? 2 : 0;
+    if ((uint16_t)(vm->reg[VM_REG_SP] - bytes) < vm->stack_limit) {
+        vm_fault(vm, VM_FAULT_STACK);
+        return 1;
+    }
+    for (uint8_t i = 0; i < 10; i++) {
+        if ((mask >> i) & 1) vm_push(vm, vm->reg[i]);
+    }
+    return 0;
+}
+
+//0e, pops the registers in the mask from R9 down, undoing pushm
+uint8_t vm_instruction_popm (struct VM *vm) {
+    uint16_t mask = vm->op_src;
+    for (int8_t i = 9; i >= 0; i--) {
+        if ((mask >> i) & 1) vm->reg[i] = vm_pop(vm);
+    }
     return 0;
 }
 
 //07..08
 uint8_t vm_instruction_cmp (struct VM *vm) {
-    uint16_t val = vm->op_src;
-    vm->flags[F_GREATER] = vm->reg[0] > val ? 1 : 0;
-    vm->flags[F_LESS] = vm->reg[0] < val ? 1 : 0;
-    vm->flags[F_EQUAL] = val == vm->reg[0];
-    vm->flags[F_ZERO] = vm->reg[0] == 0 ? 1 : 0;
+    vm->cmp_a = vm->reg[0];
+    vm->cmp_b = vm->op_src;
+    vm->lazy |= VM_LAZY_CMP;
     return 0;
 }
 
@@ -102,44 +179,78 @@ uint8_t vm_instruction_mov (struct VM *vm) {
     return 0;
 }
 
+//the block instructions below work on R3 bytes at R1 (and R2), wrapping past 0xffff
+
+//42, copies from R2 to R1, the blocks may overlap
+uint8_t vm_instruction_movs (struct VM *vm) {
+    return vm_block_move(vm, vm->reg[1], vm->reg[2], vm->reg[3]) == 0;
+}
+
+//43, fills R1 with the low byte of R2
+uint8_t vm_instruction_stos (struct VM *vm) {
+    return vm_block_set(vm, vm->reg[1], LBYTE(vm->reg[2]), vm->reg[3]) == 0;
+}
+
+//44, compares R1 with R2 like cmp does their first different bytes, R0 = the number of bytes before them
+uint8_t vm_instruction_cmps (struct VM *vm) {
+    uint16_t a = vm->reg[1], b = vm->reg[2], same = vm_block_compare(vm, a, b, vm->reg[3]);
+    uint8_t equal = same == vm->reg[3];
+    vm->reg[0] = same;
+    vm->cmp_a = equal ? 0 : vm_read8(vm, a + same);
+    vm->cmp_b = equal ? 0 : vm_read8(vm, b + same);
+    vm->lazy |= VM_LAZY_CMP;
+    return 0;
+}
+
 //20
 uint8_t vm_instruction_inc (struct VM *vm) {
-    vm->flags[F_OVERFLOW] = vm->op_src == 0xffff;
+    vm->ovr_val = (uint32_t)vm->op_src + 1;
+    vm->lazy |= VM_LAZY_OVR;
     vm->op_dst = vm->op_src + 1;
     return 0;
 }
 
 //21
 uint8_t vm_instruction_dec (struct VM *vm) {
-    vm->flags[F_UNDERFLOW] = vm->op_src == 0x0000;
+    vm->und_val = (int32_t)vm->op_src - 1;
+    vm->lazy |= VM_LAZY_UND;
     vm->op_dst = vm->op_src - 1;
     return 0;
 }
 
-//22
+//the ALU instructions below use op_a, which is R0 in their two-operand forms
+
+//22, 30..31
 uint8_t vm_instruction_add (struct VM *vm) {
-    vm->flags[F_OVERFLOW] = (uint32_t)(vm->reg[0] + vm->op_src) > 0xffff;
-    vm->op_dst = vm->reg[0] + vm->op_src;
+    vm->ovr_val = (uint32_t)vm->op_a + vm->op_src;
+    vm->lazy |= VM_LAZY_OVR;
+    vm->op_dst = vm->op_a + vm->op_src;
     return 0;
 }
 
-//23
+//23, 32..33
 uint8_t vm_instruction_sub (struct VM *vm) {
-    vm->flags[F_UNDERFLOW] = (int32_t)(vm->reg[0] - vm->op_src) < 0x0000;
-    vm->op_dst = vm->reg[0] - vm->op_src;
+    vm->und_val = (int32_t)vm->op_a - vm->op_src;
+    vm->lazy |= VM_LAZY_UND;
+    vm->op_dst = vm->op_a - vm->op_src;
     return 0;
 }
 
-//24
+//24, 34..35
 uint8_t vm_instruction_mul (struct VM *vm) {
-    vm->flags[F_OVERFLOW] = (uint32_t)(vm->reg[0] * vm->op_src) > 0xffff;
-    vm->op_dst = vm->reg[0] * vm->op_src;
+    vm->ovr_val = (uint32_t)vm->op_a * vm->op_src;
+    vm->lazy |= VM_LAZY_OVR;
+    vm->op_dst = vm->op_a * vm->op_src;
     return 0;
 }
 
-//25
+//25, 36..37
 uint8_t vm_instruction_div (struct VM *vm) {
-    vm->op_dst = vm->reg[0] / vm->op_src;
+    if (vm->op_src == 0) {
+        vm_fault(vm, VM_FAULT_DIVIDE);
+        return 1;
+    }
+    vm->op_dst = vm->op_a / vm->op_src;
     return 0;
 }
 
@@ -155,64 +266,94 @@ uint8_t vm_instruction_shr (struct VM *vm) {
     return 0;
 }
 
+//28, 38..39
+uint8_t vm_instruction_and (struct VM *vm) {
+    vm->op_dst = vm->op_a & vm->op_src;
+    return 0;
+}
+
+//29, 3a..3b
+uint8_t vm_instruction_or (struct VM *vm) {
+    vm->op_dst = vm->op_a | vm->op_src;
+    return 0;
+}
+
+//2a, 3c..3d
+uint8_t vm_instruction_xor (struct VM *vm) {
+    vm->op_dst = vm->op_a ^ vm->op_src;
+    return 0;
+}
+
+//3e..3f, shifts A left by the low 4 bits of B
+uint8_t vm_instruction_shlv (struct VM *vm) {
+    vm->op_dst = vm->op_a << (vm->op_src & 15);
+    return 0;
+}
+
+//40..41
+uint8_t vm_instruction_shrv (struct VM *vm) {
+    vm->op_dst = vm->op_a >> (vm->op_src & 15);
+    return 0;
+}
+
 //e0..e1
 uint8_t vm_instruction_jmp (struct VM *vm) {
     vm->pc = vm->op_src;
-    return 0;
+    return 1;
 }
 
 //e2..e3
 uint8_t vm_instruction_je (struct VM *vm) {
-    if (vm->flags[F_EQUAL] == 0) return 0;        
+    if (vm_flag(vm, F_EQUAL) == 0) return 0;        
     vm->pc = vm->op_src;
     return 1;
 }
 
 //e4..e5
 uint8_t vm_instruction_jne (struct VM *vm) {
-    if (vm->flags[F_EQUAL] == 1) return 0;        
+    if (vm_flag(vm, F_EQUAL) == 1) return 0;        
     vm->pc = vm->op_src;
     return 1;
 }
 
 //e6..e7
 uint8_t vm_instruction_jz (struct VM *vm) {
-    if (vm->flags[F_ZERO] == 0) return 0;        
+    if (vm_flag(vm, F_ZERO) == 0) return 0;        
     vm->pc = vm->op_src;
     return 1;
 }
 
 //e8..e9
 uint8_t vm_instruction_jnz (struct VM *vm) {
-    if (vm->flags[F_ZERO] == 1) return 0;        
+    if (vm_flag(vm, F_ZERO) == 1) return 0;        
     vm->pc = vm->op_src;
     return 1;
 }
 
 //ea..eb
 uint8_t vm_instruction_jl (struct VM *vm) {
-    if (vm->flags[F_LESS] == 0) return 0;        
+    if (vm_flag(vm, F_LESS) == 0) return 0;        
     vm->pc = vm->op_src;
     return 1;
 }
 
 //ec..ed
 uint8_t vm_instruction_jle (struct VM *vm) {
-    if (vm->flags[F_LESS] == 0 && vm->flags[F_EQUAL] == 0) return 0;        
+    if (vm_flag(vm, F_LESS) == 0 && vm_flag(vm, F_EQUAL) == 0) return 0;        
     vm->pc = vm->op_src;
     return 1;
 }
 
 //ee..ef
 uint8_t vm_instruction_jg (struct VM *vm) {
-    if (vm->flags[F_GREATER] == 0) return 0;        
+    if (vm_flag(vm, F_GREATER) == 0) return 0;        
     vm->pc = vm->op_src;
     return 1;
 }
 
 //f0..f1
 uint8_t vm_instruction_jge (struct VM *vm) {
-    if (vm->flags[F_GREATER] == 0 && vm->flags[F_EQUAL] == 0) return 0;        
+    if (vm_flag(vm, F_GREATER) == 0 && vm_flag(vm, F_EQUAL) == 0) return 0;        
     vm->pc = vm->op_src;
     return 1;
 }
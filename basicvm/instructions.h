@@ -5,13 +5,24 @@
 
 uint8_t vm_instruction_hlt (struct VM *vm);
 uint8_t vm_instruction_nop (struct VM *vm);
+uint8_t vm_instruction_invalid (struct VM *vm);
+uint8_t vm_instruction_register (struct VM *vm);
 uint8_t vm_instruction_stdout (struct VM *vm);
 uint8_t vm_instruction_stdin (struct VM *vm);
 uint8_t vm_instruction_int (struct VM *vm);
+uint8_t vm_interrupt (struct VM *vm, uint16_t num);
 uint8_t vm_instruction_call (struct VM *vm);
+uint8_t vm_instruction_ret (struct VM *vm);
+uint8_t vm_instruction_push (struct VM *vm);
+uint8_t vm_instruction_pop (struct VM *vm);
+uint8_t vm_instruction_pushm (struct VM *vm);
+uint8_t vm_instruction_popm (struct VM *vm);
 uint8_t vm_instruction_cmp (struct VM *vm);
 
 uint8_t vm_instruction_mov (struct VM *vm);
+uint8_t vm_instruction_movs (struct VM *vm);
+uint8_t vm_instruction_stos (struct VM *vm);
+uint8_t vm_instruction_cmps (struct VM *vm);
 
 uint8_t vm_instruction_inc (struct VM *vm);
 uint8_t vm_instruction_dec (struct VM *vm);
@@ -21,6 +32,11 @@ uint8_t vm_instruction_mul (struct VM *vm);
 uint8_t vm_instruction_div (struct VM *vm);
 uint8_t vm_instruction_shl (struct VM *vm);
 uint8_t vm_instruction_shr (struct VM *vm);
+uint8_t vm_instruction_and (struct VM *vm);
+uint8_t vm_instruction_or (struct VM *vm);
+uint8_t vm_instruction_xor (struct VM *vm);
+uint8_t vm_instruction_shlv (struct VM *vm);
+uint8_t vm_instruction_shrv (struct VM *vm);
 
 uint8_t vm_instruction_jmp (struct VM *vm);
 uint8_t vm_instruction_je (struct VM *vm);
@@ -1,5 +1,9 @@
 #include <stdio.h>
 #include "interrupts.h"
+#include "scheduler.h"
+#include "video.h"
+#include "snapshot.h"
+#include "profile.h"
 
 
 uint8_t vm_int_info (struct VM *vm) {
@@ -11,7 +15,6 @@ uint8_t vm_int_gpio_cfg (struct VM *vm) {
     uint8_t pin = LBYTE(vm->reg[1]);
     uint8_t dir = LBYTE(vm->reg[2]);
     uint8_t pullup = LBYTE(vm->reg[3]);
-    printf("INT_GPIO_CFG: NYI (pin:%d, dir:%d, pullup:%d)\n", pin, dir, pullup);
     #ifdef PICO_LCD_BASE
         //GPIO stuff...
     #endif
@@ -21,110 +24,181 @@ uint8_t vm_int_gpio_cfg (struct VM *vm) {
 uint8_t vm_int_gpio_set (struct VM *vm) {
     uint8_t pin = LBYTE(vm->reg[1]);
     uint8_t level = LBYTE(vm->reg[2]);
-    printf("INT_GPIO_SET: NYI (pin:%d, level:%d)\n", pin, level);
     #ifdef PICO_LCD_BASE
         //GPIO stuff...
     #endif
     return 0;
 }
 
+//R0 = the level
 uint8_t vm_int_gpio_get (struct VM *vm) {
     uint8_t pin = LBYTE(vm->reg[1]);
-    printf("INT_GPIO_GET: NYI (pin:%d)\n", pin);
-    #ifdef PICO_LCD_BASE
-        //GPIO stuff...
-    #endif
+    uint32_t level = 0;
+    if (!vm_replay_next(vm, VM_INPUT_GPIO, &level)) {
+        #ifdef PICO_LCD_BASE
+            level = gpio_get(pin);
+        #endif
+        vm_replay_log(vm, VM_INPUT_GPIO, level);
+    }
+    vm->reg[0] = level;
     return 0;
 }
 
+//passes R1..R5 on as a video command, see video.h
+static void vm_int_video (struct VM *vm, uint8_t op) {
+    VM_VideoCmd cmd = { op, { vm->reg[1], vm->reg[2], vm->reg[3], vm->reg[4], vm->reg[5] } };
+    vm_video_submit(vm, &cmd);
+}
+
 uint8_t vm_int_video_putpixel (struct VM *vm) {
-    uint16_t x = vm->reg[1];
-    uint16_t y = vm->reg[2];
-    uint16_t colour = vm->reg[3];
-    printf("INT_VIDEO_PUTPIXEL: (x:%d, y:%d, colour:0x%04x)\n", x, y, colour);
-    #ifdef PICO_LCD_BASE
-        surface_putpixel(vm->video, x, y, colour);
-    #endif
+    vm_int_video(vm, I_VIDEO_PUTPIXEL);
     return 0;
 }
 
 uint8_t vm_int_video_getpixel (struct VM *vm) {
     uint16_t x = vm->reg[1];
     uint16_t y = vm->reg[2];
-    printf("INT_VIDEO_GETPIXEL: (x:%d, y:%d)\n", x, y);
+    //the answer must include everything drawn before it
+    VM_VideoCmd flush = { VM_VIDEO_FLUSH };
+    vm_video_submit(vm, &flush);
+    if (vm->video_queue != NULL) vm_video_sync(vm->video_queue);
+    uint32_t colour;
+    if (vm_replay_next(vm, VM_INPUT_PIXEL, &colour)) {
+        vm->reg[0] = colour;
+        return 0;
+    }
     #ifdef PICO_LCD_BASE
-        vm->reg[0] = surface_getpixel(vm->video, x, y);
+        if (vm->display != NULL) vm->reg[0] = surface_getpixel(vm->display->video, x, y);
     #endif
+    vm_replay_log(vm, VM_INPUT_PIXEL, vm->reg[0]);
     return 0;
 }
 
 uint8_t vm_int_video_fill (struct VM *vm) {
-    uint16_t x = vm->reg[1];
-    uint16_t y = vm->reg[2];
-    uint16_t width = vm->reg[3];
-    uint16_t height = vm->reg[4];
-    uint16_t colour = vm->reg[5];
-    printf("INT_VIDEO_FILL: (x:%d, y:%d, w:%d, h:%d, colour:0x%04x)\n", 
-        x, y, width, height, colour
-    );
-    #ifdef PICO_LCD_BASE
-        Surface *fill = surface_create(4, 4);
-        surface_fill(fill, colour);
-        Rect src = { 0, 0, 4, 4 };
-        Rect dst = { x, y, width, height };
-        surface_scaleblit(vm->video, fill, &dst, &src);
-    #endif
+    vm_int_video(vm, I_VIDEO_FILL);
     return 0;
 }
 
 uint8_t vm_int_video_line (struct VM *vm) {
-    uint16_t sx = vm->reg[1];
-    uint16_t sy = vm->reg[2];
-    uint16_t dx = vm->reg[3];
-    uint16_t dy = vm->reg[4];
-    uint16_t colour = vm->reg[5];
-    printf("INT_VIDEO_LINE: (sx:%d, sy:%d, dx:%d, dy:%d, colour:0x%04x)\n", 
-        sx, sy, dx, dy, colour
-    );
-    #ifdef PICO_LCD_BASE
-        surface_line(vm->video, sx, sy, dx, dy, colour);
-    #endif
+    vm_int_video(vm, I_VIDEO_LINE);
     return 0;
 }
 
 uint8_t vm_int_video_circle (struct VM *vm) {
-    uint16_t cx = vm->reg[1];
-    uint16_t cy = vm->reg[2];
-    uint16_t radius = vm->reg[3];
-    uint16_t colour = vm->reg[4];
-    printf("INT_VIDEO_CIRCLE: NYI (cx:%d, cy:%d, radius:%d, colour:0x%04x)\n", 
-        cx, cy, radius, colour
-    );
-    #ifdef PICO_LCD_BASE
-        //soon(tm)
-    #endif
+    vm_int_video(vm, I_VIDEO_CIRCLE);
     return 0;
 }
 
 uint8_t vm_int_video_print (struct VM *vm) {
-    uint16_t x = vm->reg[1];
-    uint16_t y = vm->reg[2];
-    uint8_t ch = LBYTE(vm->reg[3]);
-    uint16_t colour = vm->reg[4];
-    printf("INT_VIDEO_PRINT: (x:%d, y:%d, ch:'%c', colour:0x%04x)\n", 
-        x, y, ch, colour
-    );
-    #ifdef PICO_LCD_BASE
-        char text[] = { ch, 0 };
-        font_print(vm->video, vm->font, text, x, y, colour);
-    #endif
+    vm_int_video(vm, I_VIDEO_PRINT);
     return 0;
 }
 
 uint8_t vm_int_video_update (struct VM *vm) {
-    printf("INT_VIDEO_UPDATE\n");
+    vm_int_video(vm, I_VIDEO_UPDATE);
+    return VM_INT_YIELD;
+}
+
+uint8_t vm_int_video_pixels (struct VM *vm) {
+    uint16_t addr = vm->reg[1];
+    uint16_t count = vm->reg[2];
+    for (uint16_t i = 0; i < count; i++, addr += 6) {
+        VM_VideoCmd cmd = { I_VIDEO_PUTPIXEL, { vm_read16(vm, addr), vm_read16(vm, addr + 2), vm_read16(vm, addr + 4) } };
+        vm_video_submit(vm, &cmd);
+    }
+    return 0;
+}
+
+//the colours follow the command five at a time, copied now as memory may change before they're drawn
+static void vm_int_video_row (struct VM *vm, uint16_t x, uint16_t y, uint16_t addr, uint16_t count) {
+    VM_VideoCmd cmd = { I_VIDEO_HLINE, { x, y, count } };
+    vm_video_submit(vm, &cmd);
+    VM_VideoCmd data = { VM_VIDEO_DATA };
+    for (uint16_t i = 0; i < count; i++, addr += 2) {
+        data.args[i % 5] = vm_read16(vm, addr);
+        if (i % 5 == 4 || i == count - 1) vm_video_submit(vm, &data);
+    }
+}
+
+uint8_t vm_int_video_hline (struct VM *vm) {
+    vm_int_video_row(vm, vm->reg[1], vm->reg[2], vm->reg[3], vm->reg[4]);
+    return 0;
+}
+
+/*
+*  The rows are mapped as a linear framebuffer: pixel (x, row + y) is the word at
+*  address + y * stride + x * 2 (RGB565, stored big-endian like the VM's words), where
+*  the stride is the screen's width * 2 (320 bytes on the 160 pixel LCD). Rows don't line
+*  up with pages, so the address must be page aligned and the rows must make up whole
+*  pages (a multiple of 4 on that LCD), or nothing is mapped. R0 is the number of bytes
+*  mapped, 0 if none.
+*  Writes to the window don't go through the display list: commands still in it are drawn
+*  over them at the next I_VIDEO_UPDATE.
+*  A VM with a video queue runs apart from the display's owner (on core 1), which may be
+*  sending the surface to the LCD at any moment, so it never gets a window.
+*/
+uint8_t vm_int_video_window (struct VM *vm) {
+    uint16_t addr = vm->reg[1];
+    uint16_t row = vm->reg[2];
+    uint16_t rows = vm->reg[3];
+    uint32_t mapped = 0;
+    vm_unmap_window(vm);
     #ifdef PICO_LCD_BASE
-        lcd_draw_surface(vm->video);
+        Surface *video = vm->display != NULL ? vm->display->video : NULL;
+        if (vm->video_queue == NULL && video != NULL && rows > 0 && row < video->height) {
+            if (rows > video->height - row) rows = video->height - row;
+            mapped = vm_map_window(vm, addr, (uint8_t *)(video->pixels + row * video->width), (uint32_t)rows * video->width * 2);
+        }
     #endif
+    vm->reg[0] = mapped;
+    return 0;
+}
+
+//'height' rows of 'width' colours, one after the other
+uint8_t vm_int_video_blit (struct VM *vm) {
+    uint16_t x = vm->reg[1];
+    uint16_t y = vm->reg[2];
+    uint16_t width = vm->reg[3];
+    uint16_t height = vm->reg[4];
+    uint16_t addr = vm->reg[5];
+    for (uint16_t i = 0; i < height; i++, addr += width * 2) vm_int_video_row(vm, x, y + i, addr, width);
+    return 0;
+}
+
+
+/*
+*  The waits only block under a scheduler (see scheduler.h), anywhere else the VM just yields
+*  and carries on, so programs should still check the time or F_DATA afterwards.
+*/
+uint8_t vm_int_sleep (struct VM *vm) {
+    vm->wait = VM_WAIT_TIMER;
+    vm->wake_us = vm_replay_time_us(vm) + (uint64_t)vm->reg[1] * 1000;
+    return VM_INT_YIELD;
+}
+
+uint8_t vm_int_wait_input (struct VM *vm) {
+    uint32_t ready;
+    if (!vm_replay_next(vm, VM_INPUT_READY, &ready)) {
+        ready = vm_input_ready(vm);
+        vm_replay_log(vm, VM_INPUT_READY, ready);
+    }
+    if (ready) return 0;
+    //played back, what it waited for is already in the log
+    if (vm->replay == NULL || vm->replay->mode != VM_REPLAY_PLAY) vm->wait = VM_WAIT_INPUT;
+    return VM_INT_YIELD;
+}
+
+
+//0 for every counter unless built with VM_PROFILE and a VM_Profile is attached
+uint8_t vm_int_profile (struct VM *vm) {
+    uint32_t value = 0;
+    if (!vm_replay_next(vm, VM_INPUT_PROFILE, &value)) {
+        #ifdef VM_PROFILE
+            if (vm->profile != NULL) value = vm_profile_read(vm->profile, vm->reg[1], vm->reg[2]);
+        #endif
+        vm_replay_log(vm, VM_INPUT_PROFILE, value);
+    }
+    vm->reg[0] = value & 0xffff;
+    vm->reg[1] = value >> 16;
     return 0;
 }
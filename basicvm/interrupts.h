@@ -7,7 +7,7 @@
 #define I_INFO           0 //Display VM info to stdout (version, credits, etc)
 #define I_GPIO_CFG       1 //Configure Pico GPIO pin [pin, direction, pullup_pulldown]
 #define I_GPIO_SET       2 //Set Pico GPIO pin high/low logic level [pin, level]
-#define I_GPIO_GET       3 //Get Pico GPIO pin logic level [pin]
+#define I_GPIO_GET       3 //Get Pico GPIO pin logic level into R0 [pin]
 #define I_VIDEO_PUTPIXEL 4 //Set a pixel colour on the video display [x, y, colour]
 #define I_VIDEO_GETPIXEL 5 //Get a pixel colour from the video display [x, y]
 #define I_VIDEO_FILL     6 //Fill a rectangle on the video display [x, y, width, height, colour]
@@ -15,6 +15,28 @@
 #define I_VIDEO_CIRCLE   8 //Draw a circle on the video display [cx, cy, radius, colour]
 #define I_VIDEO_PRINT    9 //Print a character to the video display [x, y, char, colour]
 #define I_VIDEO_UPDATE   0x0a
+#define I_SLEEP          0x0b //Sleep, letting other scheduled VMs run [milliseconds]
+#define I_WAIT_INPUT     0x0c //Wait until the stdin instruction has something to read
+#define I_VIDEO_PIXELS   0x0d //Set pixels listed in memory as x, y, colour words [address, count]
+#define I_VIDEO_HLINE    0x0e //Set a row of pixels to colours in memory [x, y, address, count]
+#define I_VIDEO_WINDOW   0x0f //Map screen rows into memory at a page as a linear framebuffer, R0 = bytes mapped, 0 rows to unmap [address, first row, rows]
+#define I_VIDEO_BLIT     0x10 //Copy a rectangle of colours in memory to the screen [x, y, width, height, address]
+#define I_PROFILE        0x11 //Read a profile counter into R0 (low) and R1 (high), see profile.h [counter, index]
+#define I_USER           0x80 //First of the numbers left to firmware modules, see vm_int_register()
+
+#define VM_INT_COUNT 256 //interrupt numbers with a handler slot, 'int' with a larger one does nothing
+
+/*
+*  An interrupt handler takes its arguments from R1 up (in the order listed above), leaves
+*  its results in R0 (and R1 for a second word), and returns VM_INT_CONTINUE or
+*  VM_INT_YIELD. It may also block the VM through 'wait' (see scheduler.h). A handler
+*  that reads something from outside the VM goes through vm_replay_next()/vm_replay_log()
+*  so that runs can be replayed (see snapshot.h).
+*  To stop the program a handler calls vm_fault() (or a vm_write*() runs out of memory),
+*  which sets F_HALT. vm_run() checks it after every interrupt and halts with PC past the
+*  'int', whatever the handler returns.
+*/
+typedef uint8_t (*VM_IntHandler)(struct VM *vm);
 
 uint8_t vm_int_info (struct VM *vm);
 uint8_t vm_int_gpio_cfg (struct VM *vm);
@@ -27,5 +49,13 @@ uint8_t vm_int_video_line (struct VM *vm);
 uint8_t vm_int_video_circle (struct VM *vm);
 uint8_t vm_int_video_print (struct VM *vm);
 uint8_t vm_int_video_update (struct VM *vm);
+uint8_t vm_int_sleep (struct VM *vm);
+uint8_t vm_int_wait_input (struct VM *vm);
+uint8_t vm_int_video_pixels (struct VM *vm);
+uint8_t vm_int_video_hline (struct VM *vm);
+uint8_t vm_int_video_window (struct VM *vm);
+uint8_t vm_int_video_blit (struct VM *vm);
+uint8_t vm_int_profile (struct VM *vm);
+VM_IntHandler vm_int_register (uint8_t num, VM_IntHandler handler);
 
 #endif
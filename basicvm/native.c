@@ -0,0 +1,56 @@
+#include "vm.h"
+
+
+/*
+*  Programs translated ahead of time to C by tools/vm2c.
+*  The generated code keeps registers and flags in locals and works on the same struct VM,
+*  so the interpreter can pick up wherever it stops. It stops (returning VM_NATIVE_EXIT)
+*  when it reaches code it didn't translate or when the program writes to its own code,
+*  which also detaches the translation for good (see vm_invalidate()).
+*/
+
+
+//maps the image a translation was generated from (shared, see vm_map()) and attaches the translation
+void vm_native_load (struct VM *vm, const VM_Native *native) {
+    vm->native = NULL;
+    vm_map(vm, native->image, native->length, native->origin);
+    vm->native = native;
+    //writes to the translated code must detach it (see vm_invalidate())
+    vm_cover(vm, native->origin, native->origin + native->length);
+    vm->pc = native->origin;
+}
+
+
+//executes the instruction at 'pc' like vm_run()'s generic handler, for instructions vm2c doesn't inline
+void vm_native_step (struct VM *vm, uint16_t pc) {
+    VM_Decoded *op = vm_decode(vm, pc);
+    uint8_t dkind = op->dkind, size = op->size;
+    uint16_t dval = op->dval;
+    vm->pc = pc;
+    vm->opcode = op->opcode;
+    vm->op_a = vm->reg[op->aval];
+    vm->op_src = vm_operand(vm, op->skind, op->sval);
+    vm->op_size = size;
+    vm->yield = 0;
+    if (op->func(vm) == 0) {
+        vm_writeback(vm, dkind, dval);
+        vm->pc = pc + size;
+    }
+}
+
+
+/*
+*  As vm_run(), but runs the attached translation when there is one.
+*  Translated code checks its budget per basic block, so it may stop a few instructions
+*  early; the interpreter finishes the slice so the result is the same as vm_run().
+*/
+uint8_t vm_run_native (struct VM *vm, uint32_t max_steps) {
+    if (vm->native == NULL) return vm_run(vm, max_steps);
+    if (vm->flags & VM_FLAG(F_HALT)) return VM_RUN_HALT;
+    uint64_t start = vm->icount;
+    uint8_t result = vm->native->run(vm, max_steps);
+    if (result == VM_RUN_HALT || result == VM_RUN_INTERRUPT) return result;
+    uint32_t done = vm->icount - start;
+    if (done >= max_steps) return VM_RUN_BUDGET;
+    return vm_run(vm, max_steps - done);
+}
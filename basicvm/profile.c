@@ -0,0 +1,173 @@
+#include "vm.h"
+#include "profile.h"
+#include "scheduler.h"
+
+
+//clears the counters, 'clock_hz' is the CPU clock the cycle estimates are in (0 if unknown)
+void vm_profile_init (VM_Profile *profile, uint32_t clock_hz) {
+    memset(profile, 0, sizeof(VM_Profile));
+    profile->clock_hz = clock_hz;
+}
+
+
+//asks for a sample of the next instruction, safe to call from a timer interrupt or signal handler
+void vm_profile_tick (VM_Profile *profile) {
+    profile->sample_due = 1;
+}
+
+
+//counts an instruction about to execute, use VM_PROFILE_OP() rather than calling this directly
+void vm_profile_op (VM_Profile *profile, uint16_t pc, const VM_Decoded *op) {
+    profile->instructions++;
+    profile->ops[op->opcode]++;
+    profile->smodes[op->skind]++;
+    profile->dmodes[op->dkind]++;
+    profile->handlers[op->base]++;
+    if (profile->sample_due) {
+        profile->sample_due = 0;
+        profile->samples++;
+        profile->handler_samples[op->base]++;
+        if (profile->pcs[pc >> VM_PROFILE_SHIFT] != 0xffff) profile->pcs[pc >> VM_PROFILE_SHIFT]++;
+    }
+}
+
+
+//only time inside vm_run() is sampled, a tick that came while the VM wasn't running is dropped
+void vm_profile_enter (VM_Profile *profile) {
+    profile->sample_due = 0;
+    profile->entered_us = vm_time_us();
+}
+
+void vm_profile_leave (VM_Profile *profile) {
+    profile->run_us += vm_time_us() - profile->entered_us;
+}
+
+
+//one counter (VM_PROFILE_*), 0 for an index out of range
+uint32_t vm_profile_read (VM_Profile *profile, uint16_t counter, uint16_t index) {
+    switch (counter) {
+        case VM_PROFILE_OPS:
+            return index < 256 ? profile->ops[index] : 0;
+        case VM_PROFILE_INTS:
+            return index < 256 ? profile->ints[index] : 0;
+        case VM_PROFILE_PCS:
+            return profile->pcs[index >> VM_PROFILE_SHIFT];
+        case VM_PROFILE_SMODES:
+            return index < VM_PROFILE_MODES ? profile->smodes[index] : 0;
+        case VM_PROFILE_DMODES:
+            return index < VM_PROFILE_MODES ? profile->dmodes[index] : 0;
+        case VM_PROFILE_HANDLERS:
+            return index < VM_H_COUNT ? profile->handlers[index] : 0;
+        case VM_PROFILE_TOTALS:
+            if (index == 0) return profile->instructions;
+            if (index == 1) return profile->samples;
+            if (index == 2) return profile->run_us;
+            return 0;
+    }
+    return 0;
+}
+
+
+static void vm_profile_put (uint8_t *out, uint32_t value) {
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+    out[2] = (value >> 16) & 0xff;
+    out[3] = value >> 24;
+}
+
+static uint32_t vm_profile_get (const uint8_t *in) {
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+
+//the counters in dump order, with how many of each
+#define VM_PROFILE_TABLES(profile) { \
+        { (profile)->ops, 256 }, \
+        { (profile)->ints, 256 }, \
+        { (profile)->smodes, VM_PROFILE_MODES }, \
+        { (profile)->dmodes, VM_PROFILE_MODES }, \
+        { (profile)->handlers, VM_H_COUNT }, \
+        { (profile)->handler_samples, VM_H_COUNT }, \
+    }
+
+typedef struct {
+    uint32_t *counts;
+    uint16_t length;
+} VM_ProfileTable;
+
+
+/*
+*  Writes the profile as one chunk: the header (magic, version, length), instructions
+*  (two words), samples, microseconds (two words), clock, VM_H_COUNT, the counter tables
+*  in the order of VM_PROFILE_TABLES, then the number of histogram buckets with samples
+*  and a word of bucket << 16 | samples for each. Every word is 32-bit little-endian.
+*/
+void vm_profile_dump (VM_Profile *profile, FILE *out) {
+    VM_ProfileTable tables[] = VM_PROFILE_TABLES(profile);
+    uint8_t word[4];
+    uint32_t length = 9 + 7 * 4, buckets = 0;
+    for (uint8_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) length += tables[t].length * 4;
+    for (uint32_t i = 0; i < VM_PROFILE_BUCKETS; i++) buckets += profile->pcs[i] != 0;
+    length += 4 + buckets * 4;
+
+    uint8_t header[9];
+    memcpy(header, VM_PROFILE_MAGIC, 4);
+    header[4] = VM_PROFILE_VERSION;
+    vm_profile_put(header + 5, length);
+    fwrite(header, 1, sizeof(header), out);
+    uint32_t totals[] = {
+        profile->instructions & 0xffffffff, profile->instructions >> 32, profile->samples,
+        profile->run_us & 0xffffffff, profile->run_us >> 32, profile->clock_hz, VM_H_COUNT
+    };
+    for (uint8_t i = 0; i < sizeof(totals) / sizeof(totals[0]); i++) {
+        vm_profile_put(word, totals[i]);
+        fwrite(word, 1, 4, out);
+    }
+    for (uint8_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) {
+        for (uint16_t i = 0; i < tables[t].length; i++) {
+            vm_profile_put(word, tables[t].counts[i]);
+            fwrite(word, 1, 4, out);
+        }
+    }
+    vm_profile_put(word, buckets);
+    fwrite(word, 1, 4, out);
+    for (uint32_t i = 0; i < VM_PROFILE_BUCKETS; i++) {
+        if (profile->pcs[i] == 0) continue;
+        vm_profile_put(word, i << 16 | profile->pcs[i]);
+        fwrite(word, 1, 4, out);
+    }
+    fflush(out);
+}
+
+
+/*
+*  Reads a chunk written by vm_profile_dump() into 'profile', returns its length or 0 if
+*  'data' doesn't start with one from a build with the same handlers.
+*/
+uint32_t vm_profile_load (VM_Profile *profile, const uint8_t *data, uint32_t size) {
+    if (size < 9 + 7 * 4 || memcmp(data, VM_PROFILE_MAGIC, 4) != 0 || data[4] != VM_PROFILE_VERSION) return 0;
+    uint32_t length = vm_profile_get(data + 5);
+    if (length > size || vm_profile_get(data + 9 + 6 * 4) != VM_H_COUNT) return 0;
+    VM_ProfileTable tables[] = VM_PROFILE_TABLES(profile);
+    uint32_t expected = 9 + 7 * 4 + 4;
+    for (uint8_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) expected += tables[t].length * 4;
+    if (length < expected) return 0;
+
+    const uint8_t *p = data + 9;
+    vm_profile_init(profile, vm_profile_get(p + 20));
+    profile->instructions = vm_profile_get(p) | (uint64_t)vm_profile_get(p + 4) << 32;
+    profile->samples = vm_profile_get(p + 8);
+    profile->run_us = vm_profile_get(p + 12) | (uint64_t)vm_profile_get(p + 16) << 32;
+    p += 7 * 4;
+    for (uint8_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) {
+        for (uint16_t i = 0; i < tables[t].length; i++, p += 4) tables[t].counts[i] = vm_profile_get(p);
+    }
+    uint32_t buckets = vm_profile_get(p);
+    p += 4;
+    if (length != expected + buckets * 4) return 0;
+    for (uint32_t i = 0; i < buckets; i++, p += 4) {
+        uint32_t entry = vm_profile_get(p);
+        profile->pcs[(entry >> 16) % VM_PROFILE_BUCKETS] = entry & 0xffff;
+    }
+    return length;
+}
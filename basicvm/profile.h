@@ -0,0 +1,91 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include "vm.h"
+
+/*
+*  Execution profile.
+*  Build with VM_PROFILE defined to compile the counters in, otherwise the VM_PROFILE_*
+*  macros expand to nothing. A VM_Profile attached to a VM counts each instruction it
+*  runs by opcode, by the addressing modes of its operands and by handler (VM_H_*), and
+*  each interrupt by number. Superinstructions are split back up while profiling so that
+*  every instruction is counted on its own. Translated code (vm_run_native()) isn't.
+*
+*  Something periodic (a repeating timer on the Pico, SIGPROF on the host) calls
+*  vm_profile_tick() and the next instruction the VM runs takes a sample: its PC goes
+*  into a histogram of VM_PROFILE_BUCKET byte buckets and its handler gets a sample.
+*  Along with the time spent in vm_run() and the CPU clock, a handler's share of the
+*  samples over its share of the instructions estimates the cycles it takes.
+*
+*  Programs read the counters with I_PROFILE, vm_profile_dump() writes them out in chunks
+*  like vm_trace_dump() and tools/vmprof renders them as a flat profile.
+*/
+
+#define VM_PROFILE_SHIFT 3                          //PCs per histogram bucket, as a power of two
+#define VM_PROFILE_BUCKET (1 << VM_PROFILE_SHIFT)
+#define VM_PROFILE_BUCKETS (65536 >> VM_PROFILE_SHIFT)
+#define VM_PROFILE_MODES 5                          //VM_OPND_NONE..VM_OPND_PTR
+
+//I_PROFILE R1, which counter R2 indexes
+#define VM_PROFILE_OPS      0 //instructions by opcode
+#define VM_PROFILE_INTS     1 //interrupts by number
+#define VM_PROFILE_PCS      2 //samples by PC
+#define VM_PROFILE_SMODES   3 //instructions by VM_OPND_* of the source
+#define VM_PROFILE_DMODES   4 //instructions by VM_OPND_* of the destination
+#define VM_PROFILE_HANDLERS 5 //instructions by VM_H_* handler
+#define VM_PROFILE_TOTALS   6 //0: instructions, 1: samples, 2: microseconds in vm_run()
+
+//vm_profile_dump() chunk header, followed by the counters
+#define VM_PROFILE_MAGIC "VMPF"
+#define VM_PROFILE_VERSION 1
+
+
+typedef struct VM_Profile {
+    uint32_t ops[256];
+    uint32_t ints[256];
+    uint32_t smodes[VM_PROFILE_MODES], dmodes[VM_PROFILE_MODES];
+    uint32_t handlers[VM_H_COUNT];
+    uint32_t handler_samples[VM_H_COUNT];
+    uint16_t pcs[VM_PROFILE_BUCKETS];   //samples by PC / VM_PROFILE_BUCKET, they stop at 0xffff
+    uint64_t instructions;
+    uint32_t samples;
+    volatile uint8_t sample_due;        //set by vm_profile_tick()
+    uint64_t run_us;                    //time spent in vm_run()
+    uint64_t entered_us;                //when vm_run() was entered
+    uint32_t clock_hz;                  //CPU clock for the cycle estimates, 0 if unknown
+} VM_Profile;
+
+#ifdef VM_PROFILE
+    #define VM_PROFILE_OP(vm, pc, op) do { \
+            if ((vm)->profile != NULL) vm_profile_op((vm)->profile, pc, op); \
+        } while (0)
+    #define VM_PROFILE_INT(vm, num) do { \
+            if ((vm)->profile != NULL) (vm)->profile->ints[(num) & 0xff]++; \
+        } while (0)
+    #define VM_PROFILE_ENTER(vm) do { \
+            if ((vm)->profile != NULL) vm_profile_enter((vm)->profile); \
+        } while (0)
+    #define VM_PROFILE_LEAVE(vm) do { \
+            if ((vm)->profile != NULL) vm_profile_leave((vm)->profile); \
+        } while (0)
+    //superinstructions are split back up while profiling, as while tracing
+    #define VM_PROFILE_HANDLER(vm, op) ((vm)->profile != NULL ? (op)->base : VM_TRACE_HANDLER(vm, op))
+#else
+    #define VM_PROFILE_OP(vm, pc, op)
+    #define VM_PROFILE_INT(vm, num)
+    #define VM_PROFILE_ENTER(vm)
+    #define VM_PROFILE_LEAVE(vm)
+    #define VM_PROFILE_HANDLER(vm, op) VM_TRACE_HANDLER(vm, op)
+#endif
+
+
+void vm_profile_init (VM_Profile *profile, uint32_t clock_hz);
+void vm_profile_tick (VM_Profile *profile);
+void vm_profile_op (VM_Profile *profile, uint16_t pc, const VM_Decoded *op);
+void vm_profile_enter (VM_Profile *profile);
+void vm_profile_leave (VM_Profile *profile);
+uint32_t vm_profile_read (VM_Profile *profile, uint16_t counter, uint16_t index);
+void vm_profile_dump (VM_Profile *profile, FILE *out);
+uint32_t vm_profile_load (VM_Profile *profile, const uint8_t *data, uint32_t size);
+
+#endif
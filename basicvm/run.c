@@ -0,0 +1,598 @@
+#include "vm.h"
+#include "instructions.h"
+#include "profile.h"
+
+
+/*
+*  Threaded-code interpreter loop.
+*  Each decoded instruction carries a handler index (VM_H_*) chosen when it was decoded,
+*  common instructions get a handler specialised for their addressing modes and everything
+*  else goes through VM_H_GENERIC, which behaves exactly like vm_step().
+*  Superinstructions (VM_H_MOVI_N and on) run a whole sequence fused by vm_decode(), they
+*  count as every instruction they cover and fall back to the first one's own handler
+*  when less budget than that is left.
+*
+*  With GCC/Clang the handlers jump straight to each other through a table of label
+*  addresses (computed goto), otherwise a switch is used. Define VM_NO_COMPUTED_GOTO
+*  to force the switch.
+*/
+#if defined(__GNUC__) && !defined(VM_NO_COMPUTED_GOTO)
+    #define VM_THREADED
+#endif
+
+//stop GCC merging the handlers' dispatch jumps back into a single shared one
+#if defined(VM_THREADED) && !defined(__clang__)
+    #define VM_RUN_ATTR __attribute__((optimize("no-gcse", "no-crossjumping")))
+#else
+    #define VM_RUN_ATTR
+#endif
+
+#ifdef VM_THREADED
+    #define HANDLER(name) L_##name:
+    #define DISPATCH() goto *handlers[VM_PROFILE_HANDLER(vm, op)]
+    #define UNFUSED() goto *handlers[op->base]
+#else
+    #define HANDLER(name) case name:
+    #define DISPATCH() do { handler = VM_PROFILE_HANDLER(vm, op); goto dispatch; } while (0)
+    #define UNFUSED() do { handler = op->base; goto dispatch; } while (0)
+#endif
+
+//finish the current instruction and move to the one at 'target'
+#define NEXT_AT(target) do { \
+        pc = (target); \
+        if (--budget == 0) goto budget; \
+        op = &vm->decoded[pc & (VM_DECODE_SIZE - 1)]; \
+        if (op->size == 0 || op->pc != pc) op = vm_decode(vm, pc); \
+        VM_TRACE_OP(vm, pc, op); \
+        VM_PROFILE_OP(vm, pc, op); \
+        DISPATCH(); \
+    } while (0)
+
+#define NEXT() NEXT_AT(pc + op->size)
+#define BRANCH_IF(cond) NEXT_AT((cond) ? op->sval : pc + op->size)
+
+//operands of the fused entry being executed
+#define FUSED() (&vm->fused[pc & (VM_DECODE_SIZE - 1)])
+
+//flags are set lazily (see vm.h), conditional jumps read a pending cmp's operands directly
+#define SET_CMP(x, y) do { vm->cmp_a = (x); vm->cmp_b = (y); vm->lazy |= VM_LAZY_CMP; } while (0)
+#define SET_OVR(wide) do { vm->ovr_val = (wide); vm->lazy |= VM_LAZY_OVR; } while (0)
+#define SET_UND(wide) do { vm->und_val = (wide); vm->lazy |= VM_LAZY_UND; } while (0)
+#define COND(flag, lazy_cond) ((vm->lazy & VM_LAZY_CMP) ? (lazy_cond) : (vm->flags & VM_FLAG(flag)) != 0)
+#define IS_EQUAL() COND(F_EQUAL, vm->cmp_a == vm->cmp_b)
+#define IS_ZERO() COND(F_ZERO, vm->cmp_a == 0)
+#define IS_LESS() COND(F_LESS, vm->cmp_a < vm->cmp_b)
+#define IS_GREATER() COND(F_GREATER, vm->cmp_a > vm->cmp_b)
+#define HALTED() ((vm->flags & VM_FLAG(F_HALT)) != 0)
+
+//does 'cmp a, b' then takes the fused conditional jump, 'skip' counts the other fused instructions
+#define CMP_BRANCH(f, skip) do { \
+        uint8_t cond = (a > b) | (a < b) << 1 | (a == b) << 2 | (a == 0) << 3; \
+        SET_CMP(a, b); \
+        budget -= (skip); \
+        NEXT_AT(((cond & (f)->cond) != 0) != ((f)->cond >> 7) ? (f)->target : pc + op->span); \
+    } while (0)
+
+#define R vm->reg
+
+//operands of a three-operand ALU instruction, B a register (_R) or the immediate (_I)
+#define ALU3_R() do { a = R[op->aval]; b = R[op->sval]; } while (0)
+#define ALU3_I() do { a = R[op->aval]; b = op->sval; } while (0)
+
+
+//Runs until the VM halts, an interrupt yields, or 'max_steps' instructions have executed
+VM_RUN_ATTR uint8_t vm_run (struct VM *vm, uint32_t max_steps) {
+    #ifdef VM_THREADED
+    static void *handlers[VM_H_COUNT] = {
+        [VM_H_GENERIC] = &&L_VM_H_GENERIC,
+        [VM_H_HLT]     = &&L_VM_H_HLT,
+        [VM_H_NOP]     = &&L_VM_H_NOP,
+        [VM_H_INT]     = &&L_VM_H_INT,
+        [VM_H_MOV_IR]  = &&L_VM_H_MOV_IR,
+        [VM_H_MOV_RR]  = &&L_VM_H_MOV_RR,
+        [VM_H_MOV_MR]  = &&L_VM_H_MOV_MR,
+        [VM_H_MOV_RM]  = &&L_VM_H_MOV_RM,
+        [VM_H_INC]     = &&L_VM_H_INC,
+        [VM_H_DEC]     = &&L_VM_H_DEC,
+        [VM_H_ADD]     = &&L_VM_H_ADD,
+        [VM_H_SUB]     = &&L_VM_H_SUB,
+        [VM_H_MUL]     = &&L_VM_H_MUL,
+        [VM_H_SHL]     = &&L_VM_H_SHL,
+        [VM_H_SHR]     = &&L_VM_H_SHR,
+        [VM_H_CMP_I]   = &&L_VM_H_CMP_I,
+        [VM_H_CMP_R]   = &&L_VM_H_CMP_R,
+        [VM_H_JMP_I]   = &&L_VM_H_JMP_I,
+        [VM_H_JE_I]    = &&L_VM_H_JE_I,
+        [VM_H_JNE_I]   = &&L_VM_H_JNE_I,
+        [VM_H_JZ_I]    = &&L_VM_H_JZ_I,
+        [VM_H_JNZ_I]   = &&L_VM_H_JNZ_I,
+        [VM_H_JL_I]    = &&L_VM_H_JL_I,
+        [VM_H_JLE_I]   = &&L_VM_H_JLE_I,
+        [VM_H_JG_I]    = &&L_VM_H_JG_I,
+        [VM_H_JGE_I]   = &&L_VM_H_JGE_I,
+        [VM_H_CALL_I]  = &&L_VM_H_CALL_I,
+        [VM_H_RET]     = &&L_VM_H_RET,
+        [VM_H_PUSH_I]  = &&L_VM_H_PUSH_I,
+        [VM_H_PUSH_R]  = &&L_VM_H_PUSH_R,
+        [VM_H_POP]     = &&L_VM_H_POP,
+        [VM_H_PUSHM]   = &&L_VM_H_PUSHM,
+        [VM_H_POPM]    = &&L_VM_H_POPM,
+        [VM_H_ADD3_R]  = &&L_VM_H_ADD3_R,
+        [VM_H_ADD3_I]  = &&L_VM_H_ADD3_I,
+        [VM_H_SUB3_R]  = &&L_VM_H_SUB3_R,
+        [VM_H_SUB3_I]  = &&L_VM_H_SUB3_I,
+        [VM_H_MUL3_R]  = &&L_VM_H_MUL3_R,
+        [VM_H_MUL3_I]  = &&L_VM_H_MUL3_I,
+        [VM_H_AND3_R]  = &&L_VM_H_AND3_R,
+        [VM_H_AND3_I]  = &&L_VM_H_AND3_I,
+        [VM_H_OR3_R]   = &&L_VM_H_OR3_R,
+        [VM_H_OR3_I]   = &&L_VM_H_OR3_I,
+        [VM_H_XOR3_R]  = &&L_VM_H_XOR3_R,
+        [VM_H_XOR3_I]  = &&L_VM_H_XOR3_I,
+        [VM_H_SHL3_R]  = &&L_VM_H_SHL3_R,
+        [VM_H_SHL3_I]  = &&L_VM_H_SHL3_I,
+        [VM_H_SHR3_R]  = &&L_VM_H_SHR3_R,
+        [VM_H_SHR3_I]  = &&L_VM_H_SHR3_I,
+        [VM_H_MOVI_N]   = &&L_VM_H_MOVI_N,
+        [VM_H_MOVI_INT] = &&L_VM_H_MOVI_INT,
+        [VM_H_CMPI_JCC] = &&L_VM_H_CMPI_JCC,
+        [VM_H_CMPR_JCC] = &&L_VM_H_CMPR_JCC,
+        [VM_H_INC_JCC]  = &&L_VM_H_INC_JCC,
+        [VM_H_DEC_JCC]  = &&L_VM_H_DEC_JCC,
+    };
+    #endif
+    uint32_t budget = max_steps;
+    uint16_t pc = vm->pc;
+    uint16_t a, b;
+    uint8_t result;
+    VM_Decoded *op;
+    VM_Fused *f;
+    #ifndef VM_THREADED
+    uint8_t handler;
+    #endif
+
+    if (HALTED()) return VM_RUN_HALT;
+    if (max_steps == 0) return VM_RUN_BUDGET;
+    VM_PROFILE_ENTER(vm);
+    op = vm_decode(vm, pc);
+    VM_TRACE_OP(vm, pc, op);
+    VM_PROFILE_OP(vm, pc, op);
+    DISPATCH();
+
+    #ifndef VM_THREADED
+    dispatch:
+    switch (handler) {
+    #endif
+
+    HANDLER(VM_H_GENERIC) {
+        uint8_t dkind = op->dkind, size = op->size;
+        uint16_t dval = op->dval;
+        vm->pc = pc;
+        vm->opcode = op->opcode;
+        vm->op_a = R[op->aval];
+        vm->op_src = vm_operand(vm, op->skind, op->sval);
+        vm->op_size = size;
+        vm->yield = 0;
+        if (op->func(vm) == 0) {
+            vm_writeback(vm, dkind, dval);
+            vm->pc = pc + size;
+        }
+        pc = vm->pc;
+        if (HALTED()) {
+            budget--;
+            goto halt;
+        }
+        if (vm->yield != 0) goto yield;
+        NEXT_AT(pc);
+    }
+
+    HANDLER(VM_H_HLT) {
+        vm->flags |= VM_FLAG(F_HALT);
+        pc += op->size;
+        budget--;
+        goto halt;
+    }
+
+    HANDLER(VM_H_NOP) {
+        NEXT();
+    }
+
+    HANDLER(VM_H_INT) {
+        uint8_t size = op->size;
+        vm->pc = pc;
+        vm->op_src = op->sval;
+        result = vm_interrupt(vm, op->sval);
+        pc = vm->pc + size;
+        if (HALTED()) {
+            budget--;
+            goto halt;
+        }
+        if (result != VM_INT_CONTINUE) goto yield;
+        NEXT_AT(pc);
+    }
+
+    HANDLER(VM_H_MOV_IR) {
+        R[op->dval] = op->sval;
+        NEXT();
+    }
+
+    HANDLER(VM_H_MOV_RR) {
+        R[op->dval] = R[op->sval];
+        NEXT();
+    }
+
+    HANDLER(VM_H_MOV_MR) {
+        R[op->dval] = vm_read16(vm, op->sval);
+        NEXT();
+    }
+
+    HANDLER(VM_H_MOV_RM) {
+        uint8_t size = op->size;
+        if (!vm_write16(vm, op->dval, R[op->sval])) goto memory_fault;
+        NEXT_AT(pc + size); //the write may have invalidated 'op'
+    }
+
+    HANDLER(VM_H_INC) {
+        a = R[op->sval];
+        SET_OVR((uint32_t)a + 1);
+        R[0] = a + 1;
+        NEXT();
+    }
+
+    HANDLER(VM_H_DEC) {
+        a = R[op->sval];
+        SET_UND((int32_t)a - 1);
+        R[0] = a - 1;
+        NEXT();
+    }
+
+    HANDLER(VM_H_ADD) {
+        a = R[0];
+        b = R[op->sval];
+        SET_OVR((uint32_t)a + b);
+        R[0] = a + b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_SUB) {
+        a = R[0];
+        b = R[op->sval];
+        SET_UND((int32_t)a - b);
+        R[0] = a - b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_MUL) {
+        a = R[0];
+        b = R[op->sval];
+        SET_OVR((uint32_t)a * b);
+        R[0] = a * b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_SHL) {
+        R[0] = R[op->sval] << 1;
+        NEXT();
+    }
+
+    HANDLER(VM_H_SHR) {
+        R[0] = R[op->sval] >> 1;
+        NEXT();
+    }
+
+    HANDLER(VM_H_CMP_I) {
+        a = R[0];
+        b = op->sval;
+        SET_CMP(a, b);
+        NEXT();
+    }
+
+    HANDLER(VM_H_CMP_R) {
+        a = R[0];
+        b = R[op->sval];
+        SET_CMP(a, b);
+        NEXT();
+    }
+
+    HANDLER(VM_H_JMP_I) {
+        NEXT_AT(op->sval);
+    }
+
+    HANDLER(VM_H_JE_I) {
+        BRANCH_IF(IS_EQUAL());
+    }
+
+    HANDLER(VM_H_JNE_I) {
+        BRANCH_IF(!IS_EQUAL());
+    }
+
+    HANDLER(VM_H_JZ_I) {
+        BRANCH_IF(IS_ZERO());
+    }
+
+    HANDLER(VM_H_JNZ_I) {
+        BRANCH_IF(!IS_ZERO());
+    }
+
+    HANDLER(VM_H_JL_I) {
+        BRANCH_IF(IS_LESS());
+    }
+
+    HANDLER(VM_H_JLE_I) {
+        BRANCH_IF(IS_LESS() || IS_EQUAL());
+    }
+
+    HANDLER(VM_H_JG_I) {
+        BRANCH_IF(IS_GREATER());
+    }
+
+    HANDLER(VM_H_JGE_I) {
+        BRANCH_IF(IS_GREATER() || IS_EQUAL());
+    }
+
+    //the stack handlers write through vm_write16(), which may invalidate 'op'
+    HANDLER(VM_H_CALL_I) {
+        uint16_t target = op->sval, sp = R[VM_REG_SP] - 2;
+        if (sp < vm->stack_limit) goto stack_fault;
+        R[VM_REG_SP] = sp;
+        if (!vm_write16(vm, sp, pc + op->size)) goto memory_fault;
+        NEXT_AT(target);
+    }
+
+    HANDLER(VM_H_RET) {
+        uint16_t sp = R[VM_REG_SP];
+        R[VM_REG_SP] = sp + 2;
+        NEXT_AT(vm_read16(vm, sp));
+    }
+
+    HANDLER(VM_H_PUSH_I) {
+        uint8_t size = op->size;
+        uint16_t sp = R[VM_REG_SP] - 2;
+        if (sp < vm->stack_limit) goto stack_fault;
+        R[VM_REG_SP] = sp;
+        if (!vm_write16(vm, sp, op->sval)) goto memory_fault;
+        NEXT_AT(pc + size);
+    }
+
+    HANDLER(VM_H_PUSH_R) {
+        uint8_t size = op->size;
+        uint16_t sp = R[VM_REG_SP] - 2;
+        if (sp < vm->stack_limit) goto stack_fault;
+        R[VM_REG_SP] = sp;
+        if (!vm_write16(vm, sp, R[op->sval])) goto memory_fault;
+        NEXT_AT(pc + size);
+    }
+
+    HANDLER(VM_H_POP) {
+        uint16_t sp = R[VM_REG_SP];
+        R[VM_REG_SP] = sp + 2;
+        R[op->dval] = vm_read16(vm, sp);
+        NEXT();
+    }
+
+    HANDLER(VM_H_PUSHM) {
+        uint8_t size = op->size;
+        uint16_t mask = op->sval, sp = R[VM_REG_SP], bytes = 0;
+        for (uint8_t i = 0; i < 10; i++) bytes += (mask >> i) & 1 ? 2 : 0;
+        if ((uint16_t)(sp - bytes) < vm->stack_limit) goto stack_fault;
+        for (uint8_t i = 0; i < 10; i++) {
+            if ((mask >> i) & 1) {
+                sp -= 2;
+                if (!vm_write16(vm, sp, R[i])) goto memory_fault;
+            }
+        }
+        R[VM_REG_SP] = sp;
+        NEXT_AT(pc + size);
+    }
+
+    HANDLER(VM_H_POPM) {
+        uint16_t mask = op->sval, sp = R[VM_REG_SP];
+        for (int8_t i = 9; i >= 0; i--) {
+            if ((mask >> i) & 1) {
+                R[i] = vm_read16(vm, sp);
+                sp += 2;
+            }
+        }
+        R[VM_REG_SP] = sp;
+        NEXT();
+    }
+
+    HANDLER(VM_H_ADD3_R) {
+        ALU3_R();
+        SET_OVR((uint32_t)a + b);
+        R[op->dval] = a + b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_ADD3_I) {
+        ALU3_I();
+        SET_OVR((uint32_t)a + b);
+        R[op->dval] = a + b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_SUB3_R) {
+        ALU3_R();
+        SET_UND((int32_t)a - b);
+        R[op->dval] = a - b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_SUB3_I) {
+        ALU3_I();
+        SET_UND((int32_t)a - b);
+        R[op->dval] = a - b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_MUL3_R) {
+        ALU3_R();
+        SET_OVR((uint32_t)a * b);
+        R[op->dval] = a * b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_MUL3_I) {
+        ALU3_I();
+        SET_OVR((uint32_t)a * b);
+        R[op->dval] = a * b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_AND3_R) {
+        ALU3_R();
+        R[op->dval] = a & b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_AND3_I) {
+        ALU3_I();
+        R[op->dval] = a & b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_OR3_R) {
+        ALU3_R();
+        R[op->dval] = a | b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_OR3_I) {
+        ALU3_I();
+        R[op->dval] = a | b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_XOR3_R) {
+        ALU3_R();
+        R[op->dval] = a ^ b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_XOR3_I) {
+        ALU3_I();
+        R[op->dval] = a ^ b;
+        NEXT();
+    }
+
+    HANDLER(VM_H_SHL3_R) {
+        ALU3_R();
+        R[op->dval] = a << (b & 15);
+        NEXT();
+    }
+
+    HANDLER(VM_H_SHL3_I) {
+        ALU3_I();
+        R[op->dval] = a << (b & 15);
+        NEXT();
+    }
+
+    HANDLER(VM_H_SHR3_R) {
+        ALU3_R();
+        R[op->dval] = a >> (b & 15);
+        NEXT();
+    }
+
+    HANDLER(VM_H_SHR3_I) {
+        ALU3_I();
+        R[op->dval] = a >> (b & 15);
+        NEXT();
+    }
+
+    HANDLER(VM_H_MOVI_N) {
+        uint8_t count = op->count;
+        if (budget < count) UNFUSED();
+        f = FUSED();
+        for (uint8_t i = 0; i < count; i++) R[f->reg[i]] = f->imm[i];
+        budget -= count - 1;
+        NEXT_AT(pc + op->span);
+    }
+
+    HANDLER(VM_H_MOVI_INT) {
+        uint8_t count = op->count - 1;
+        if (budget < op->count) UNFUSED();
+        f = FUSED();
+        for (uint8_t i = 0; i < count; i++) R[f->reg[i]] = f->imm[i];
+        budget -= count;
+        vm->pc = pc + op->span - 3; //'int imm' is the last 3 bytes
+        vm->op_src = f->target;
+        result = vm_interrupt(vm, f->target);
+        pc = vm->pc + 3;
+        if (HALTED()) {
+            budget--;
+            goto halt;
+        }
+        if (result != VM_INT_CONTINUE) goto yield;
+        NEXT_AT(pc);
+    }
+
+    HANDLER(VM_H_CMPI_JCC) {
+        if (budget < 2) UNFUSED();
+        f = FUSED();
+        a = R[0];
+        b = op->sval;
+        CMP_BRANCH(f, 1);
+    }
+
+    HANDLER(VM_H_CMPR_JCC) {
+        if (budget < 2) UNFUSED();
+        f = FUSED();
+        a = R[0];
+        b = R[op->sval];
+        CMP_BRANCH(f, 1);
+    }
+
+    HANDLER(VM_H_INC_JCC) {
+        if (budget < 3) UNFUSED();
+        f = FUSED();
+        a = R[op->sval];
+        SET_OVR((uint32_t)a + 1);
+        R[0] = a = a + 1;
+        b = f->cmp_kind == VM_OPND_IMM ? f->cmp_val : R[f->cmp_val];
+        CMP_BRANCH(f, 2);
+    }
+
+    HANDLER(VM_H_DEC_JCC) {
+        if (budget < 3) UNFUSED();
+        f = FUSED();
+        a = R[op->sval];
+        SET_UND((int32_t)a - 1);
+        R[0] = a = a - 1;
+        b = f->cmp_kind == VM_OPND_IMM ? f->cmp_val : R[f->cmp_val];
+        CMP_BRANCH(f, 2);
+    }
+
+    #ifndef VM_THREADED
+    }
+    #endif
+
+    //not reached, every handler ends by jumping to the next instruction or an exit below
+    halt:
+        vm->pc = pc;
+        vm->icount += max_steps - budget;
+        VM_PROFILE_LEAVE(vm);
+        return VM_RUN_HALT;
+
+    yield:
+        vm->pc = pc;
+        vm->icount += max_steps - budget + 1;
+        VM_PROFILE_LEAVE(vm);
+        return VM_RUN_INTERRUPT;
+
+    budget:
+        vm->pc = pc;
+        vm->icount += max_steps;
+        VM_PROFILE_LEAVE(vm);
+        return VM_RUN_BUDGET;
+
+    //the stack would go below its limit, the faulting instruction counts as executed like 'hlt'
+    stack_fault:
+        vm_fault(vm, VM_FAULT_STACK);
+        budget--;
+        goto halt;
+
+    //a write needed a page and there was no RAM for it, vm_page_own() has faulted the VM
+    memory_fault:
+        budget--;
+        goto halt;
+}
@@ -0,0 +1,169 @@
+#include "vm.h"
+#include "scheduler.h"
+
+#ifndef PICO_LCD_BASE
+#include <poll.h>
+#include <time.h>
+#endif
+
+
+//microseconds since an arbitrary point, for timers and accounting
+uint64_t vm_time_us () {
+    #ifdef PICO_LCD_BASE
+        return time_us_64();
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    #endif
+}
+
+
+//1 if the stdin instruction has something to read
+uint8_t vm_input_ready (struct VM *vm) {
+    #ifdef PICO_LCD_BASE
+        return (vm->input != NULL ? input_queue_available(vm->input) : input_available()) > 0;
+    #else
+        struct pollfd fd = { 0, POLLIN, 0 };
+        return poll(&fd, 1, 0) > 0;
+    #endif
+}
+
+
+static void vm_sleep_us (uint64_t us) {
+    #ifdef PICO_LCD_BASE
+        sleep_us(us);
+    #else
+        usleep(us);
+    #endif
+}
+
+
+void vm_sched_init (VM_Sched *sched) {
+    memset(sched, 0, sizeof(VM_Sched));
+    sched->started = vm_time_us();
+}
+
+
+/*
+*  Adds a VM to be run 'slice' instructions at a time (0 for VM_SCHED_SLICE), starting at its PC.
+*  Returns the task index, or -1 if the scheduler is full.
+*/
+int vm_sched_add (VM_Sched *sched, struct VM *vm, const char *name, uint32_t slice) {
+    for (uint8_t i = 0; i < VM_SCHED_MAX; i++) {
+        VM_Task *task = &sched->tasks[i];
+        if (task->state != VM_TASK_FREE) continue;
+        memset(task, 0, sizeof(VM_Task));
+        task->vm = vm;
+        snprintf(task->name, sizeof(task->name), "%s", name);
+        task->slice = slice != 0 ? slice : VM_SCHED_SLICE;
+        task->state = (vm->flags & VM_FLAG(F_HALT)) ? VM_TASK_HALTED : VM_TASK_READY;
+        vm->wait = VM_WAIT_NONE;
+        return i;
+    }
+    return -1;
+}
+
+
+void vm_sched_remove (VM_Sched *sched, struct VM *vm) {
+    VM_Task *task = vm_sched_task(sched, vm);
+    if (task != NULL) memset(task, 0, sizeof(VM_Task));
+}
+
+
+//the task running 'vm', NULL if it isn't scheduled
+VM_Task *vm_sched_task (VM_Sched *sched, struct VM *vm) {
+    for (uint8_t i = 0; i < VM_SCHED_MAX; i++) {
+        if (sched->tasks[i].state != VM_TASK_FREE && sched->tasks[i].vm == vm) return &sched->tasks[i];
+    }
+    return NULL;
+}
+
+
+//makes a blocked task ready if what it waits for has happened
+static void vm_sched_wake (VM_Task *task, uint64_t now) {
+    struct VM *vm = task->vm;
+    if (vm->wait == VM_WAIT_TIMER && now < vm->wake_us) return;
+    if (vm->wait == VM_WAIT_INPUT && !vm_input_ready(vm)) return;
+    vm->wait = VM_WAIT_NONE;
+    task->state = VM_TASK_READY;
+    task->blocked_us += now - task->blocked_at;
+}
+
+
+/*
+*  Runs the scheduled VMs for about 'max_us': one slice of the next ready VM at a time,
+*  sleeping while they are all blocked. A slice that starts before the time is up is
+*  finished, so 0 runs a single slice if any VM is ready.
+*  Returns the number of VMs that haven't halted.
+*/
+uint8_t vm_sched_run (VM_Sched *sched, uint32_t max_us) {
+    uint64_t now = vm_time_us(), end = now + max_us;
+    while (1) {
+        VM_Task *task = NULL;
+        uint8_t alive = 0, input = 0;
+        uint64_t wake = end;
+
+        for (uint8_t i = 0; i < VM_SCHED_MAX; i++) {
+            uint8_t index = (sched->next + i) % VM_SCHED_MAX;
+            VM_Task *t = &sched->tasks[index];
+            if (t->state == VM_TASK_BLOCKED) vm_sched_wake(t, now);
+            if (t->state == VM_TASK_READY && task == NULL) {
+                task = t;
+                sched->next = (index + 1) % VM_SCHED_MAX;
+            }
+            if (t->state == VM_TASK_BLOCKED) {
+                if (t->vm->wait == VM_WAIT_TIMER && t->vm->wake_us < wake) wake = t->vm->wake_us;
+                if (t->vm->wait == VM_WAIT_INPUT) input = 1;
+            }
+            if (t->state == VM_TASK_READY || t->state == VM_TASK_BLOCKED) alive++;
+        }
+        if (alive == 0) return 0;
+
+        if (task == NULL) {
+            //everything is blocked: sleep until the first timer, checking input meanwhile
+            if (now >= end) return alive;
+            if (input && wake > now + VM_SCHED_POLL_US) wake = now + VM_SCHED_POLL_US;
+            vm_sleep_us(wake - now);
+            uint64_t after = vm_time_us();
+            sched->idle_us += after - now;
+            now = after;
+            continue;
+        }
+
+        struct VM *vm = task->vm;
+        uint64_t icount = vm->icount;
+        uint8_t result = vm_run_native(vm, task->slice);
+        uint64_t after = vm_time_us();
+        task->run_us += after - now;
+        task->instructions += vm->icount - icount;
+        task->slices++;
+        now = after;
+        if (result == VM_RUN_HALT) {
+            task->state = VM_TASK_HALTED;
+        } else if (vm->wait != VM_WAIT_NONE) {
+            task->state = VM_TASK_BLOCKED;
+            task->blocked_at = now;
+        }
+        if (now >= end) return alive;
+    }
+}
+
+
+//prints each task's accounting and RAM (vm_ram()) to stdout
+void vm_sched_report (VM_Sched *sched) {
+    static const char *states[] = { "free", "ready", "blocked", "halted" };
+    uint64_t now = vm_time_us(), elapsed = now - sched->started;
+    if (elapsed == 0) elapsed = 1;
+    printf("[SCHED] %-15s %-8s %8s %12s %10s %10s %6s %8s\n", "VM", "STATE", "SLICES", "INSTRUCTIONS", "RUN ms", "BLOCK ms", "CPU", "RAM");
+    for (uint8_t i = 0; i < VM_SCHED_MAX; i++) {
+        VM_Task *task = &sched->tasks[i];
+        if (task->state == VM_TASK_FREE) continue;
+        uint64_t blocked = task->blocked_us + (task->state == VM_TASK_BLOCKED ? now - task->blocked_at : 0);
+        printf("[SCHED] %-15s %-8s %8lu %12llu %10.1f %10.1f %5.1f%% %8lu\n",
+            task->name, states[task->state], (unsigned long)task->slices, (unsigned long long)task->instructions,
+            task->run_us / 1e3, blocked / 1e3, task->run_us * 100.0 / elapsed, (unsigned long)vm_ram(task->vm)
+        );
+    }
+    printf("[SCHED] idle %.1fms of %.1fms\n", sched->idle_us / 1e3, elapsed / 1e3);
+}
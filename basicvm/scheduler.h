@@ -0,0 +1,55 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include "vm.h"
+
+/*
+*  Cooperative scheduler for several VMs.
+*  Ready VMs are run round-robin, each for up to its own slice of instructions (or until
+*  an interrupt yields). A VM blocked on a timer (I_SLEEP) or on input (I_WAIT_INPUT) is
+*  skipped until it can continue, and when nothing is ready the scheduler sleeps instead
+*  of spinning. Time spent running each VM is accounted per task.
+*  The VMs themselves are owned by the caller.
+*/
+
+#define VM_SCHED_MAX     4      //VMs one scheduler can host
+#define VM_SCHED_SLICE   10000  //default instructions per slice
+#define VM_SCHED_POLL_US 1000   //how often input is polled while every VM is blocked
+
+//VM_Task 'state'
+#define VM_TASK_FREE    0
+#define VM_TASK_READY   1
+#define VM_TASK_BLOCKED 2 //waiting, see struct VM 'wait'
+#define VM_TASK_HALTED  3 //kept for its accounting until removed
+
+
+typedef struct {
+    struct VM *vm;
+    char name[16];
+    uint8_t state;          //VM_TASK_*
+    uint32_t slice;         //instructions per slice
+    uint32_t slices;        //slices run
+    uint64_t instructions;  //instructions executed
+    uint64_t run_us;        //time spent running
+    uint64_t blocked_us;    //time spent blocked
+    uint64_t blocked_at;    //when it last blocked
+} VM_Task;
+
+typedef struct {
+    VM_Task tasks[VM_SCHED_MAX];
+    uint8_t next;           //task to look at first
+    uint64_t idle_us;       //time spent sleeping with nothing to run
+    uint64_t started;       //when vm_sched_init() was called
+} VM_Sched;
+
+
+uint64_t vm_time_us ();
+uint8_t vm_input_ready (struct VM *vm);
+void vm_sched_init (VM_Sched *sched);
+int vm_sched_add (VM_Sched *sched, struct VM *vm, const char *name, uint32_t slice);
+void vm_sched_remove (VM_Sched *sched, struct VM *vm);
+VM_Task *vm_sched_task (VM_Sched *sched, struct VM *vm);
+uint8_t vm_sched_run (VM_Sched *sched, uint32_t max_us);
+void vm_sched_report (VM_Sched *sched);
+
+#endif
@@ -0,0 +1,231 @@
+#include "vm.h"
+#include "snapshot.h"
+#include "scheduler.h"
+
+
+static void vm_put16 (uint8_t *out, uint16_t value) {
+    out[0] = LBYTE(value);
+    out[1] = HBYTE(value);
+}
+
+static void vm_put32 (uint8_t *out, uint32_t value) {
+    vm_put16(out, value & 0xffff);
+    vm_put16(out + 2, value >> 16);
+}
+
+static uint16_t vm_get16 (const uint8_t *in) {
+    return in[0] | in[1] << 8;
+}
+
+static uint32_t vm_get32 (const uint8_t *in) {
+    return vm_get16(in) | (uint32_t)vm_get16(in + 2) << 16;
+}
+
+
+//1 if page 'n' goes in a snapshot: not a window, and not all zeroes
+static uint8_t vm_snapshot_page (struct VM *vm, uint16_t n) {
+    if (VM_PAGE_WINDOW(vm, n) || vm->page[n] == vm_zero_page) return 0;
+    return memcmp(vm->page[n], vm_zero_page, VM_PAGE_SIZE) != 0;
+}
+
+
+/*
+*  Writes a snapshot of 'vm' to 'buffer' if it fits in 'size' bytes.
+*  Returns the snapshot's length either way, call with a size of 0 to find it out.
+*/
+uint32_t vm_snapshot (struct VM *vm, uint8_t *buffer, uint32_t size) {
+    uint16_t pages = 0;
+    for (uint16_t i = 0; i < VM_PAGE_COUNT; i++) pages += vm_snapshot_page(vm, i);
+    uint32_t length = VM_SNAPSHOT_SIZE(pages);
+    if (length > size) return length;
+
+    uint8_t *p = buffer;
+    memcpy(p, VM_SNAPSHOT_MAGIC, 4);
+    p[4] = VM_SNAPSHOT_VERSION;
+    vm_put32(p + 5, length);
+    vm_put16(p + 9, vm->pc);
+    for (uint8_t i = 0; i < VM_REG_COUNT; i++) vm_put16(p + 11 + i * 2, vm->reg[i]);
+    vm_put16(p + 33, vm_flags(vm));
+    vm_put16(p + 35, vm->stack_limit);
+    p[37] = vm->fault;
+    p[38] = vm->wait;
+    //a timer is kept as the time it has left, the clock won't read the same where it's restored
+    uint64_t now = vm_time_us();
+    vm_put32(p + 39, vm->wait == VM_WAIT_TIMER && vm->wake_us > now ? vm->wake_us - now : 0);
+    vm_put32(p + 43, vm->icount & 0xffffffff);
+    vm_put32(p + 47, vm->icount >> 32);
+    vm_put16(p + 51, pages);
+    p += VM_SNAPSHOT_HEADER;
+    for (uint16_t i = 0; i < VM_PAGE_COUNT; i++) {
+        if (!vm_snapshot_page(vm, i)) continue;
+        *p++ = i;
+        memcpy(p, vm->page[i], VM_PAGE_SIZE);
+        p += VM_PAGE_SIZE;
+    }
+    return length;
+}
+
+
+/*
+*  Puts 'vm' back into the state a snapshot was taken in. Its display, trace and replay
+*  stay attached and its window stays mapped.
+*  Returns the snapshot's length, or 0 if 'data' doesn't hold one (the VM is unchanged)
+*  or there was no RAM for its pages (the VM has faulted with VM_FAULT_MEMORY).
+*/
+uint32_t vm_restore (struct VM *vm, const uint8_t *data, uint32_t size) {
+    if (size < VM_SNAPSHOT_HEADER || memcmp(data, VM_SNAPSHOT_MAGIC, 4) != 0 || data[4] != VM_SNAPSHOT_VERSION) return 0;
+    uint32_t length = vm_get32(data + 5);
+    uint16_t pages = vm_get16(data + 51);
+    if (pages > VM_PAGE_COUNT || length != VM_SNAPSHOT_SIZE(pages) || length > size) return 0;
+
+    //the pages must be in order, checked before anything changes
+    const uint8_t *p = data + VM_SNAPSHOT_HEADER;
+    for (uint16_t i = 1; i < pages; i++) {
+        if (p[i * (1 + VM_PAGE_SIZE)] <= p[(i - 1) * (1 + VM_PAGE_SIZE)]) return 0;
+    }
+
+    //pages that change, to drop cached instructions from
+    uint32_t lo = 65536, hi = 0;
+    for (uint16_t i = 0; i < VM_PAGE_COUNT; i++) {
+        uint8_t in = pages > 0 && *p == i;
+        if (VM_PAGE_WINDOW(vm, i)) {
+            //its contents belong to whatever the window shows
+        } else if (in) {
+            if (memcmp(vm->page[i], p + 1, VM_PAGE_SIZE) != 0) {
+                if (!VM_PAGE_OWNED(vm, i) && vm_page_own(vm, i) == 0) return 0;
+                memcpy((uint8_t *)vm->page[i], p + 1, VM_PAGE_SIZE);
+                if (lo > i * VM_PAGE_SIZE) lo = i * VM_PAGE_SIZE;
+                hi = (i + 1) * VM_PAGE_SIZE;
+            }
+        } else if (vm->page[i] != vm_zero_page) {
+            vm_page_release(vm, i);
+            if (lo > i * VM_PAGE_SIZE) lo = i * VM_PAGE_SIZE;
+            hi = (i + 1) * VM_PAGE_SIZE;
+        }
+        if (in) {
+            p += 1 + VM_PAGE_SIZE;
+            pages--;
+        }
+    }
+    if (lo < hi) vm_invalidate(vm, lo, hi - lo > 0xffff ? 0xffff : hi - lo);
+
+    vm->pc = vm_get16(data + 9);
+    for (uint8_t i = 0; i < VM_REG_COUNT; i++) vm->reg[i] = vm_get16(data + 11 + i * 2);
+    vm->flags = vm_get16(data + 33);
+    vm->lazy = 0;
+    vm->stack_limit = vm_get16(data + 35);
+    vm->fault = data[37];
+    vm->wait = data[38];
+    vm->wake_us = vm_time_us() + vm_get32(data + 39);
+    vm->icount = vm_get32(data + 43) | (uint64_t)vm_get32(data + 47) << 32;
+    vm->yield = 0;
+    return length;
+}
+
+
+//sets up an empty log in 'events', attach it with vm_replay_record() or vm_replay_load() and vm_replay_play()
+void vm_replay_init (VM_Replay *replay, VM_ReplayEvent *events, uint32_t capacity) {
+    memset(replay, 0, sizeof(VM_Replay));
+    replay->events = events;
+    replay->capacity = capacity;
+}
+
+
+//attaches 'replay' to 'vm' and starts recording its reads from the beginning of the log
+void vm_replay_record (struct VM *vm, VM_Replay *replay) {
+    replay->mode = VM_REPLAY_RECORD;
+    replay->count = 0;
+    replay->dropped = 0;
+    replay->start_us = vm_time_us();
+    vm->replay = replay;
+}
+
+
+//attaches 'replay' to 'vm' and plays the log back from its first event
+void vm_replay_play (struct VM *vm, VM_Replay *replay) {
+    replay->mode = VM_REPLAY_PLAY;
+    replay->next = 0;
+    replay->diverged = 0;
+    replay->start_us = vm_time_us();
+    vm->replay = replay;
+}
+
+
+/*
+*  Called before reading a value of 'kind' from outside. Returns 1 with the recorded
+*  value in 'value' if it's being played back, 0 if the value should be read (and
+*  passed to vm_replay_log()).
+*/
+uint8_t vm_replay_next (struct VM *vm, uint8_t kind, uint32_t *value) {
+    VM_Replay *replay = vm->replay;
+    if (replay == NULL || replay->mode != VM_REPLAY_PLAY) return 0;
+    VM_ReplayEvent *event = &replay->events[replay->next];
+    if (replay->next == replay->count || event->kind != kind || event->pc != vm->pc) {
+        replay->diverged = 1;
+        return 0;
+    }
+    replay->next++;
+    *value = event->value;
+    return 1;
+}
+
+
+//records a value read from outside while recording
+void vm_replay_log (struct VM *vm, uint8_t kind, uint32_t value) {
+    VM_Replay *replay = vm->replay;
+    if (replay == NULL || replay->mode != VM_REPLAY_RECORD) return;
+    if (replay->count == replay->capacity) {
+        replay->dropped++;
+        return;
+    }
+    VM_ReplayEvent *event = &replay->events[replay->count++];
+    event->pc = vm->pc;
+    event->kind = kind;
+    event->value = value;
+}
+
+
+//vm_time_us() as the VM reads it, played back relative to when playback started
+uint64_t vm_replay_time_us (struct VM *vm) {
+    uint32_t value;
+    if (vm->replay == NULL || vm->replay->mode == VM_REPLAY_OFF) return vm_time_us();
+    if (vm_replay_next(vm, VM_INPUT_TIME, &value)) return vm->replay->start_us + value;
+    uint64_t now = vm_time_us();
+    vm_replay_log(vm, VM_INPUT_TIME, now - vm->replay->start_us);
+    return now;
+}
+
+
+//writes the log to 'buffer' if it fits in 'size' bytes, returns its length either way
+uint32_t vm_replay_save (VM_Replay *replay, uint8_t *buffer, uint32_t size) {
+    uint32_t length = VM_REPLAY_SIZE(replay->count);
+    if (length > size) return length;
+    memcpy(buffer, VM_REPLAY_MAGIC, 4);
+    buffer[4] = VM_REPLAY_VERSION;
+    vm_put32(buffer + 5, length);
+    vm_put32(buffer + 9, replay->count);
+    uint8_t *p = buffer + VM_REPLAY_HEADER;
+    for (uint32_t i = 0; i < replay->count; i++, p += VM_REPLAY_EVENT) {
+        vm_put16(p, replay->events[i].pc);
+        p[2] = replay->events[i].kind;
+        vm_put32(p + 3, replay->events[i].value);
+    }
+    return length;
+}
+
+
+//reads a log written by vm_replay_save() into 'replay', returns its length or 0 if it isn't one or doesn't fit
+uint32_t vm_replay_load (VM_Replay *replay, const uint8_t *data, uint32_t size) {
+    if (size < VM_REPLAY_HEADER || memcmp(data, VM_REPLAY_MAGIC, 4) != 0 || data[4] != VM_REPLAY_VERSION) return 0;
+    uint32_t length = vm_get32(data + 5), count = vm_get32(data + 9);
+    if (count > replay->capacity || length != VM_REPLAY_SIZE(count) || length > size) return 0;
+    const uint8_t *p = data + VM_REPLAY_HEADER;
+    for (uint32_t i = 0; i < count; i++, p += VM_REPLAY_EVENT) {
+        replay->events[i].pc = vm_get16(p);
+        replay->events[i].kind = p[2];
+        replay->events[i].value = vm_get32(p + 3);
+    }
+    replay->count = count;
+    replay->next = 0;
+    return length;
+}
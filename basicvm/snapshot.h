@@ -0,0 +1,82 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "vm.h"
+
+/*
+*  Snapshots and deterministic replay.
+*  vm_snapshot() writes what a VM needs to carry on from where it is to a byte buffer:
+*  PC, registers, flags, its wait and fault state, and every page of memory that isn't
+*  all zeroes. Pages mapped with vm_map_window() belong to whoever owns that memory and
+*  are left out. vm_restore() puts a VM back into that state, copying only the pages
+*  that differ from what it has and releasing the ones the snapshot doesn't have, so
+*  restarting a program is a restore of the snapshot taken just after it was loaded.
+*
+*  A VM_Replay attached to a VM records every value it reads from outside (the stdin
+*  instruction, I_WAIT_INPUT's poll, I_GPIO_GET, I_VIDEO_GETPIXEL, I_PROFILE, the time
+*  I_SLEEP reads and what registered interrupts read) with the PC it was read at. Played back from the same snapshot
+*  the VM reads the recorded values instead and runs exactly as it did, so a slow run on
+*  the Pico can be reproduced on the host (tools/vmreplay). A read that doesn't match the
+*  next recorded one sets 'diverged' and gets the live value.
+*  Both are stored little-endian, each starting with its magic, a version byte and
+*  its length, so that they can be found in a capture of the firmware's stdout.
+*/
+
+#define VM_SNAPSHOT_MAGIC "VMSN"
+#define VM_SNAPSHOT_VERSION 1
+#define VM_SNAPSHOT_HEADER 53                   //bytes before the pages
+#define VM_SNAPSHOT_SIZE(pages) (VM_SNAPSHOT_HEADER + (pages) * (1 + VM_PAGE_SIZE))
+
+#define VM_REPLAY_MAGIC "VMRP"
+#define VM_REPLAY_VERSION 1
+#define VM_REPLAY_HEADER 13                     //bytes before the events
+#define VM_REPLAY_EVENT 7                       //bytes per event
+#define VM_REPLAY_SIZE(events) (VM_REPLAY_HEADER + (events) * VM_REPLAY_EVENT)
+
+//VM_ReplayEvent 'kind'
+#define VM_INPUT_STDIN 1 //byte the stdin instruction read, VM_INPUT_NONE if there wasn't one
+#define VM_INPUT_READY 2 //1 if I_WAIT_INPUT found input waiting
+#define VM_INPUT_GPIO  3 //level I_GPIO_GET read
+#define VM_INPUT_TIME  4 //microseconds since recording started, when I_SLEEP read the time
+#define VM_INPUT_PIXEL 5 //colour I_VIDEO_GETPIXEL read from the screen
+#define VM_INPUT_PROFILE 6 //counter I_PROFILE read
+#define VM_INPUT_EXTENSION 7 //value an interrupt registered with vm_int_register() read
+
+#define VM_INPUT_NONE 0x100
+
+//VM_Replay 'mode'
+#define VM_REPLAY_OFF    0
+#define VM_REPLAY_RECORD 1
+#define VM_REPLAY_PLAY   2
+
+
+typedef struct {
+    uint16_t pc;            //of the instruction that read it
+    uint8_t kind;           //VM_INPUT_*
+    uint32_t value;
+} VM_ReplayEvent;
+
+typedef struct VM_Replay {
+    uint8_t mode;           //VM_REPLAY_*
+    VM_ReplayEvent *events; //owned by the caller
+    uint32_t capacity;      //entries in 'events'
+    uint32_t count;         //events recorded (or loaded)
+    uint32_t next;          //next event to play back
+    uint32_t dropped;       //events that didn't fit while recording
+    uint8_t diverged;       //set when playback found a read that wasn't the next one recorded
+    uint64_t start_us;      //when recording or playback started, VM_INPUT_TIME counts from here
+} VM_Replay;
+
+
+uint32_t vm_snapshot (struct VM *vm, uint8_t *buffer, uint32_t size);
+uint32_t vm_restore (struct VM *vm, const uint8_t *data, uint32_t size);
+void vm_replay_init (VM_Replay *replay, VM_ReplayEvent *events, uint32_t capacity);
+void vm_replay_record (struct VM *vm, VM_Replay *replay);
+void vm_replay_play (struct VM *vm, VM_Replay *replay);
+uint8_t vm_replay_next (struct VM *vm, uint8_t kind, uint32_t *value);
+void vm_replay_log (struct VM *vm, uint8_t kind, uint32_t value);
+uint64_t vm_replay_time_us (struct VM *vm);
+uint32_t vm_replay_save (VM_Replay *replay, uint8_t *buffer, uint32_t size);
+uint32_t vm_replay_load (VM_Replay *replay, const uint8_t *data, uint32_t size);
+
+#endif
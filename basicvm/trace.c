@@ -0,0 +1,115 @@
+#include "vm.h"
+#include "trace.h"
+
+
+/*
+*  The VM is the only producer and whoever drains the trace the only consumer.
+*  'head' and 'tail' are free running and masked on access (as in input.c), so head - tail
+*  is the fill level. When the buffer is full the newest record is dropped and counted.
+*/
+
+void vm_trace_init (VM_Trace *trace, uint8_t level) {
+    trace->level = level;
+    trace->head = 0;
+    trace->tail = 0;
+    trace->dropped = 0;
+}
+
+
+#ifdef VM_TRACE
+static VM_TraceRecord *vm_trace_next (VM_Trace *trace) {
+    uint16_t head = trace->head;
+    if ((uint16_t)(head - trace->tail) >= VM_TRACE_SIZE) {
+        trace->dropped++;
+        return NULL;
+    }
+    return &trace->records[head & (VM_TRACE_SIZE - 1)];
+}
+
+
+//records an instruction about to execute, use VM_TRACE_OP() rather than calling this directly
+void vm_trace_op (struct VM *vm, uint16_t pc, VM_Decoded *op) {
+    VM_TraceRecord *rec = vm_trace_next(vm->trace);
+    if (rec == NULL) return;
+    rec->pc = pc;
+    rec->kind = VM_TRACE_REC_OP;
+    rec->opcode = op->opcode;
+    rec->flags = vm_flags(vm);
+    rec->args[0] = op->sval;
+    rec->args[1] = op->dval;
+    rec->args[2] = vm_operand(vm, op->skind, op->sval);
+    rec->args[3] = vm->reg[0];
+    rec->args[4] = 0;
+    vm->trace->head++;
+}
+
+
+//records an interrupt with its argument registers, use VM_TRACE_INT() rather than calling this directly
+void vm_trace_int (struct VM *vm, uint16_t num) {
+    VM_TraceRecord *rec = vm_trace_next(vm->trace);
+    if (rec == NULL) return;
+    rec->pc = vm->pc;
+    rec->kind = VM_TRACE_REC_INT;
+    rec->opcode = LBYTE(num);
+    rec->flags = vm_flags(vm);
+    for (uint8_t i = 0; i < 5; i++) rec->args[i] = vm->reg[i + 1];
+    vm->trace->head++;
+}
+#endif
+
+
+/*
+*  Moves up to 'count' records out of the trace into 'dest'.
+*  Returns the number of records copied.
+*/
+uint16_t vm_trace_read (VM_Trace *trace, VM_TraceRecord *dest, uint16_t count) {
+    uint16_t tail = trace->tail;
+    uint16_t available = (uint16_t)(trace->head - tail);
+    if (available > count) available = count;
+    for (uint16_t i = 0; i < available; i++) {
+        dest[i] = trace->records[(tail + i) & (VM_TRACE_SIZE - 1)];
+    }
+    trace->tail = tail + available;
+    return available;
+}
+
+
+static void vm_trace_put16 (uint8_t *out, uint16_t value) {
+    out[0] = LBYTE(value);
+    out[1] = HBYTE(value);
+}
+
+
+/*
+*  Drains the whole trace to 'out' as binary chunks for tools/vmtrace:
+*    "VMTR", version, record count (1 byte), records dropped so far (4 bytes),
+*    then each record as 16 little-endian bytes.
+*  The magic lets the decoder find chunks in a stream that also carries normal stdout text.
+*  Returns the number of records written.
+*/
+uint32_t vm_trace_dump (VM_Trace *trace, FILE *out) {
+    VM_TraceRecord records[64];
+    uint8_t chunk[10 + sizeof(records) / sizeof(records[0]) * 16];
+    uint32_t total = 0;
+    uint16_t count;
+    while ((count = vm_trace_read(trace, records, sizeof(records) / sizeof(records[0]))) > 0) {
+        uint8_t *p = chunk;
+        memcpy(p, VM_TRACE_MAGIC, 4);
+        p[4] = VM_TRACE_VERSION;
+        p[5] = count;
+        vm_trace_put16(p + 6, trace->dropped & 0xffff);
+        vm_trace_put16(p + 8, trace->dropped >> 16);
+        p += 10;
+        for (uint16_t i = 0; i < count; i++, p += 16) {
+            vm_trace_put16(p, records[i].pc);
+            p[2] = records[i].kind;
+            p[3] = records[i].opcode;
+            vm_trace_put16(p + 4, records[i].flags);
+            for (uint8_t a = 0; a < 5; a++) vm_trace_put16(p + 6 + a * 2, records[i].args[a]);
+        }
+        fwrite(chunk, 1, p - chunk, out);
+        total += count;
+    }
+    fflush(out);
+    return total;
+}
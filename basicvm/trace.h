@@ -0,0 +1,67 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+*  Binary execution trace.
+*  Build with VM_TRACE defined to compile tracing in, otherwise the VM_TRACE_* macros
+*  expand to nothing. At runtime tracing is off until a VM_Trace is attached with a level.
+*  Records are drained in bulk with vm_trace_read() or vm_trace_dump() and decoded on the
+*  host by tools/vmtrace.
+*/
+
+#define VM_TRACE_SIZE 512 //records held by a VM_Trace (power of two)
+
+//Trace levels
+#define VM_TRACE_LEVEL_OFF 0
+#define VM_TRACE_LEVEL_INT 1 //interrupts only
+#define VM_TRACE_LEVEL_OP  2 //every instruction and interrupt
+
+//Record kinds
+#define VM_TRACE_REC_OP  1 //args: sval, dval, source value, R0
+#define VM_TRACE_REC_INT 2 //opcode is the interrupt number, args: R1..R5
+
+//vm_trace_dump() chunk header, followed by 'count' records
+#define VM_TRACE_MAGIC "VMTR"
+#define VM_TRACE_VERSION 1
+
+
+typedef struct {
+    uint16_t pc;
+    uint8_t kind;
+    uint8_t opcode;
+    uint16_t flags;     //bit n is flag n (F_HALT, F_GREATER, ...), before the instruction
+    uint16_t args[5];
+} VM_TraceRecord;
+
+typedef struct {
+    uint8_t level;
+    volatile uint16_t head, tail;
+    uint32_t dropped;   //records lost because the buffer was full
+    VM_TraceRecord records[VM_TRACE_SIZE];
+} VM_Trace;
+
+#ifdef VM_TRACE
+    #define VM_TRACE_OP(vm, pc, op) do { \
+            if ((vm)->trace != NULL && (vm)->trace->level >= VM_TRACE_LEVEL_OP) vm_trace_op(vm, pc, op); \
+        } while (0)
+    #define VM_TRACE_INT(vm, num) do { \
+            if ((vm)->trace != NULL && (vm)->trace->level >= VM_TRACE_LEVEL_INT) vm_trace_int(vm, num); \
+        } while (0)
+    //superinstructions are split back up while every instruction is being traced
+    #define VM_TRACE_HANDLER(vm, op) \
+        ((vm)->trace != NULL && (vm)->trace->level >= VM_TRACE_LEVEL_OP ? (op)->base : (op)->handler)
+#else
+    #define VM_TRACE_OP(vm, pc, op)
+    #define VM_TRACE_INT(vm, num)
+    #define VM_TRACE_HANDLER(vm, op) ((op)->handler)
+#endif
+
+
+void vm_trace_init (VM_Trace *trace, uint8_t level);
+uint16_t vm_trace_read (VM_Trace *trace, VM_TraceRecord *dest, uint16_t count);
+uint32_t vm_trace_dump (VM_Trace *trace, FILE *out);
+
+#endif
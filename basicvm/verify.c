@@ -0,0 +1,119 @@
+#include "vm.h"
+#include "instructions.h"
+#include "verify.h"
+
+
+#define VM_BIT(map, i) (((map)[(i) / 32] >> ((i) % 32)) & 1)
+#define VM_BIT_SET(map, i) ((map)[(i) / 32] |= 1u << ((i) % 32))
+#define VM_BIT_CLEAR(map, i) ((map)[(i) / 32] &= ~(1u << ((i) % 32)))
+
+
+static uint8_t vm_verify_fail (VM_Verify *result, uint8_t error, uint16_t pc) {
+    result->error = error;
+    result->pc = pc;
+    return error;
+}
+
+
+/*
+*  Follows the code from image offset 'at' until it ends or reaches code already walked,
+*  marking instruction starts in 'start', the bytes they cover in 'covered' and where
+*  jumps and calls lead in 'pending'. Returns VM_VERIFY_OK or the error found.
+*/
+static uint8_t vm_verify_walk (struct VM *vm, uint16_t origin, uint32_t length, uint32_t at,
+    uint32_t *start, uint32_t *covered, uint32_t *pending, VM_Verify *result) {
+    VM_Decoded op;
+    while (!VM_BIT(start, at)) {
+        uint16_t pc = origin + at;
+        vm_decode_at(vm, pc, &op);
+        if (op.func == vm_instruction_invalid) return vm_verify_fail(result, VM_VERIFY_OPCODE, pc);
+        if (op.func == vm_instruction_register) return vm_verify_fail(result, VM_VERIFY_REGISTER, pc);
+        if (at + op.size > length) return vm_verify_fail(result, VM_VERIFY_END, pc);
+        if (op.func == vm_instruction_div && op.skind == VM_OPND_IMM && op.sval == 0) {
+            return vm_verify_fail(result, VM_VERIFY_DIVIDE, pc);
+        }
+        for (uint32_t i = at; i < at + op.size; i++) {
+            if (VM_BIT(covered, i) || (i != at && VM_BIT(start, i))) return vm_verify_fail(result, VM_VERIFY_OVERLAP, pc);
+            VM_BIT_SET(covered, i);
+        }
+        VM_BIT_SET(start, at);
+        result->instructions++;
+
+        if (op.func == vm_instruction_hlt || op.func == vm_instruction_ret) return VM_VERIFY_OK;
+        if (vm_op_info(op.opcode)->flags & VM_OP_BRANCH) {
+            if (op.skind != VM_OPND_IMM) return vm_verify_fail(result, VM_VERIFY_INDIRECT, pc);
+            if (op.sval < origin || op.sval >= origin + length) return vm_verify_fail(result, VM_VERIFY_TARGET, pc);
+            if (!VM_BIT(start, op.sval - origin)) VM_BIT_SET(pending, op.sval - origin);
+            if (op.func == vm_instruction_jmp) return VM_VERIFY_OK;
+        }
+        //conditional jumps, calls (which come back after 'ret') and everything else carry on
+        at += op.size;
+        if (at >= length) return vm_verify_fail(result, VM_VERIFY_END, pc);
+    }
+    return VM_VERIFY_OK;
+}
+
+
+/*
+*  Verifies the 'length' bytes of code loaded at 'origin', starting from 'origin', and if
+*  they're sound lets vm_decode_at() skip its checks on the instructions it walked. Call
+*  it after loading (or mapping) the image, loading over it undoes it. Returns VM_VERIFY_OK, or the error
+*  with the PC of the instruction at fault in 'result'.
+*/
+uint8_t vm_verify (struct VM *vm, uint16_t origin, uint32_t length, VM_Verify *result) {
+    memset(result, 0, sizeof(VM_Verify));
+    result->pc = origin;
+    if (length > 65536 - origin) length = 65536 - origin;
+    vm_set_verified(vm, 0, 0, NULL);
+    if (length == 0) return vm_verify_fail(result, VM_VERIFY_END, origin);
+
+    //a bit per byte of the image for each of instruction starts, covered bytes and jump targets to walk
+    uint32_t words = (length + 31) / 32;
+    uint32_t *start = calloc(words, sizeof(uint32_t)), *covered = calloc(words * 2, sizeof(uint32_t));
+    if (start == NULL || covered == NULL) {
+        free(start);
+        free(covered);
+        return vm_verify_fail(result, VM_VERIFY_MEMORY, origin);
+    }
+    uint32_t *pending = covered + words;
+
+    uint8_t error = VM_VERIFY_OK, found = 1;
+    VM_BIT_SET(pending, 0);
+    while (error == VM_VERIFY_OK && found) {
+        found = 0;
+        for (uint32_t at = 0; at < length && error == VM_VERIFY_OK; at++) {
+            if (pending[at / 32] == 0) {
+                at |= 31;
+                continue;
+            }
+            if (!VM_BIT(pending, at)) continue;
+            VM_BIT_CLEAR(pending, at);
+            found = 1;
+            error = vm_verify_walk(vm, origin, length, at, start, covered, pending, result);
+        }
+    }
+    free(covered);
+    if (error != VM_VERIFY_OK) {
+        free(start);
+        return error;
+    }
+    //only the instructions it walked skip the checks, a 'ret' to anywhere else is still checked
+    vm_set_verified(vm, origin, length, start);
+    return VM_VERIFY_OK;
+}
+
+
+const char *vm_verify_message (uint8_t error) {
+    switch (error) {
+        case VM_VERIFY_OK: return "verified";
+        case VM_VERIFY_OPCODE: return "not an instruction";
+        case VM_VERIFY_REGISTER: return "no such register";
+        case VM_VERIFY_TARGET: return "jumps outside the image";
+        case VM_VERIFY_OVERLAP: return "jumps into the middle of an instruction";
+        case VM_VERIFY_END: return "runs past the end of the image";
+        case VM_VERIFY_INDIRECT: return "jumps through a register";
+        case VM_VERIFY_DIVIDE: return "divides by zero";
+        case VM_VERIFY_MEMORY: return "no RAM to verify it";
+    }
+    return "unknown error";
+}
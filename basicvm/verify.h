@@ -0,0 +1,45 @@
+#ifndef _VERIFY_H_
+#define _VERIFY_H_
+
+#include "vm.h"
+
+/*
+*  Load-time verifier.
+*  vm_verify() walks every instruction reachable from the start of a loaded image,
+*  following both ways out of conditional jumps and into calls, and proves that each one
+*  is a valid opcode naming registers that exist, that every jump and call targets the
+*  start of an instruction inside the image and that nothing runs off its end. Jumps and
+*  calls through a register can't be followed, so code using them doesn't verify.
+*
+*  vm_decode_at() checks the register indices of code it hasn't been told is safe and
+*  decodes a bad one to an instruction that faults (VM_FAULT_REGISTER). The instructions
+*  the verifier walked are decoded without those checks until something writes to the
+*  image, which drops all of it back to the checked path (see vm_invalidate()). Anything
+*  else in the image, reached by a 'ret' to an address pushed by hand say, is checked.
+*  Either way the checks are paid once per decode, the instructions in the decode cache
+*  run as they are.
+*/
+
+//VM_Verify 'error'
+#define VM_VERIFY_OK       0
+#define VM_VERIFY_OPCODE   1 //a byte that isn't an instruction
+#define VM_VERIFY_REGISTER 2 //a register past VM_REG_COUNT
+#define VM_VERIFY_TARGET   3 //a jump or call outside the image
+#define VM_VERIFY_OVERLAP  4 //a jump or call into the middle of an instruction
+#define VM_VERIFY_END      5 //execution can run past the end of the image
+#define VM_VERIFY_INDIRECT 6 //a jump or call through a register
+#define VM_VERIFY_DIVIDE   7 //a div by an immediate 0
+#define VM_VERIFY_MEMORY   8 //no RAM for the verifier's bitmaps (a bit per byte, three times)
+
+
+typedef struct {
+    uint8_t error;          //VM_VERIFY_*
+    uint16_t pc;            //of the instruction at fault
+    uint16_t instructions;  //reachable instructions found
+} VM_Verify;
+
+
+uint8_t vm_verify (struct VM *vm, uint16_t origin, uint32_t length, VM_Verify *result);
+const char *vm_verify_message (uint8_t error);
+
+#endif
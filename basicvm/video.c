@@ -0,0 +1,226 @@
+#include "vm.h"
+#include "video.h"
+#include "interrupts.h"
+
+
+//waits a little for the other side of a queue
+static void vm_video_wait () {
+    #ifdef PICO_LCD_BASE
+        tight_loop_contents();
+    #else
+        usleep(10);
+    #endif
+}
+
+
+//sets up an empty display list, a firmware then points 'video' and 'font' at what to draw on
+void vm_display_init (VM_Display *display) {
+    memset(display, 0, sizeof(VM_Display));
+}
+
+
+#ifdef PICO_LCD_BASE
+//draws one command of the list, clipped to the surface
+static void vm_display_exec (VM_Display *display, const VM_VideoCmd *cmd) {
+    Surface *video = display->video;
+    const uint16_t *a = cmd->args;
+    switch (cmd->op) {
+        case VM_VIDEO_RUN: {
+            if (a[1] >= video->height) break;
+            uint16_t *row = video->pixels + a[1] * video->width;
+            const uint16_t *colour = display->pixels + a[3];
+            for (uint32_t x = a[0]; x < (uint32_t)a[0] + a[2] && x < video->width; x++) {
+                row[x] = ((*colour << 8) & 0xff00) | (*colour >> 8);
+                colour++;
+            }
+            break;
+        }
+        case I_VIDEO_FILL: {
+            uint16_t colour = ((a[4] << 8) & 0xff00) | (a[4] >> 8);
+            uint32_t right = (uint32_t)a[0] + a[2], bottom = (uint32_t)a[1] + a[3];
+            if (right > video->width) right = video->width;
+            if (bottom > video->height) bottom = video->height;
+            for (uint32_t y = a[1]; y < bottom; y++) {
+                uint16_t *row = video->pixels + y * video->width;
+                for (uint32_t x = a[0]; x < right; x++) row[x] = colour;
+            }
+            break;
+        }
+        case I_VIDEO_LINE:
+            surface_line(video, a[0], a[1], a[2], a[3], a[4]);
+            break;
+        case I_VIDEO_CIRCLE:
+            //soon(tm)
+            break;
+        case I_VIDEO_PRINT:
+            font_print_cell(video, display->font, LBYTE(a[2]), a[0], a[1], a[3]);
+            break;
+    }
+}
+#endif
+
+
+//draws the list and empties it
+void vm_display_flush (VM_Display *display) {
+    #ifdef PICO_LCD_BASE
+        for (uint16_t i = 0; i < display->count; i++) vm_display_exec(display, &display->cmds[i]);
+    #endif
+    display->executed += display->count;
+    display->count = 0;
+    display->used = 0;
+}
+
+
+static void vm_display_append (VM_Display *display, const VM_VideoCmd *cmd) {
+    if (display->count == VM_DISPLAY_SIZE) vm_display_flush(display);
+    display->cmds[display->count++] = *cmd;
+}
+
+
+//adds a pixel, to the end of the last run if it's just right of it
+static void vm_display_pixel (VM_Display *display, uint16_t x, uint16_t y, uint16_t colour) {
+    if (display->used == VM_DISPLAY_PIXELS || display->count == VM_DISPLAY_SIZE) vm_display_flush(display);
+    VM_VideoCmd *last = display->count > 0 ? &display->cmds[display->count - 1] : NULL;
+    //the last command's colours are always the ones at the end of 'pixels'
+    if (last != NULL && last->op == VM_VIDEO_RUN && last->args[1] == y && last->args[0] + last->args[2] == x) {
+        last->args[2]++;
+    } else {
+        VM_VideoCmd run = { VM_VIDEO_RUN, { x, y, 1, display->used } };
+        vm_display_append(display, &run);
+    }
+    display->pixels[display->used++] = colour;
+}
+
+
+//1 if the fill 'a' paints over everything 'cmd' draws
+static uint8_t vm_display_covers (const uint16_t *a, const VM_VideoCmd *cmd) {
+    const uint16_t *b = cmd->args;
+    uint32_t right = (uint32_t)a[0] + a[2], bottom = (uint32_t)a[1] + a[3];
+    if (cmd->op == VM_VIDEO_RUN) {
+        return b[1] >= a[1] && b[1] < bottom && b[0] >= a[0] && (uint32_t)b[0] + b[2] <= right;
+    }
+    if (cmd->op == I_VIDEO_FILL) {
+        return b[0] >= a[0] && b[1] >= a[1] && (uint32_t)b[0] + b[2] <= right && (uint32_t)b[1] + b[3] <= bottom;
+    }
+    return 0;
+}
+
+
+static void vm_display_fill (VM_Display *display, const VM_VideoCmd *cmd) {
+    const uint16_t *a = cmd->args;
+    while (display->count > 0 && vm_display_covers(a, &display->cmds[display->count - 1])) {
+        VM_VideoCmd *last = &display->cmds[--display->count];
+        if (last->op == VM_VIDEO_RUN) display->used = last->args[3];
+    }
+    if (display->count > 0 && display->cmds[display->count - 1].op == I_VIDEO_FILL) {
+        uint16_t *b = display->cmds[display->count - 1].args;
+        if (b[4] == a[4] && b[0] == a[0] && b[2] == a[2] && b[1] + b[3] == a[1]) {
+            b[3] += a[3]; //one above the other
+            return;
+        }
+        if (b[4] == a[4] && b[1] == a[1] && b[3] == a[3] && b[0] + b[2] == a[0]) {
+            b[2] += a[2]; //side by side
+            return;
+        }
+    }
+    vm_display_append(display, cmd);
+}
+
+
+//adds a command to the display list, I_VIDEO_UPDATE draws the list and updates the LCD
+void vm_display_add (VM_Display *display, const VM_VideoCmd *cmd) {
+    const uint16_t *a = cmd->args;
+    if (cmd->op != VM_VIDEO_DATA && cmd->op != VM_VIDEO_FLUSH && cmd->op != I_VIDEO_UPDATE) display->added++;
+    switch (cmd->op) {
+        case I_VIDEO_PUTPIXEL:
+            vm_display_pixel(display, a[0], a[1], a[2]);
+            break;
+        case I_VIDEO_HLINE:
+            display->hline_x = a[0];
+            display->hline_y = a[1];
+            display->hline_left = a[2];
+            break;
+        case VM_VIDEO_DATA:
+            for (uint8_t i = 0; i < 5 && display->hline_left > 0; i++, display->hline_left--) {
+                vm_display_pixel(display, display->hline_x++, display->hline_y, a[i]);
+            }
+            break;
+        case I_VIDEO_FILL:
+            vm_display_fill(display, cmd);
+            break;
+        case VM_VIDEO_FLUSH:
+            vm_display_flush(display);
+            break;
+        case I_VIDEO_UPDATE:
+            vm_display_flush(display);
+            #ifdef PICO_LCD_BASE
+                lcd_draw_surface(display->video);
+            #endif
+            display->frames++;
+            display->frame_added = display->added;
+            display->frame_executed = display->executed;
+            display->added = 0;
+            display->executed = 0;
+            break;
+        default:
+            vm_display_append(display, cmd);
+            break;
+    }
+}
+
+
+//prints how many commands the last frame had before and after merging
+void vm_display_report (VM_Display *display, const char *name) {
+    printf("[VIDEO] %s: %lu frames, the last one %lu commands drawn as %lu\n",
+        name, (unsigned long)display->frames, (unsigned long)display->frame_added, (unsigned long)display->frame_executed
+    );
+}
+
+
+void vm_video_init (VM_VideoQueue *queue) {
+    memset(queue, 0, sizeof(VM_VideoQueue));
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+}
+
+
+//VM's side: adds a command, waiting for room if the display's side is behind
+void vm_video_push (VM_VideoQueue *queue, const VM_VideoCmd *cmd) {
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&queue->tail, memory_order_acquire) == VM_VIDEO_QUEUE_SIZE) {
+        queue->stalls++;
+        while (head - atomic_load_explicit(&queue->tail, memory_order_acquire) == VM_VIDEO_QUEUE_SIZE) vm_video_wait();
+    }
+    queue->cmds[head & (VM_VIDEO_QUEUE_SIZE - 1)] = *cmd;
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+}
+
+
+//VM's side: waits until every command pushed so far has been taken by the display's side
+void vm_video_sync (VM_VideoQueue *queue) {
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    while (atomic_load_explicit(&queue->tail, memory_order_acquire) != head) vm_video_wait();
+}
+
+
+//sends a command to the VM's display list, or queues it for the side that owns the display
+void vm_video_submit (struct VM *vm, const VM_VideoCmd *cmd) {
+    if (vm->video_queue != NULL) vm_video_push(vm->video_queue, cmd);
+    else if (vm->display != NULL) vm_display_add(vm->display, cmd);
+}
+
+
+/*
+*  Display's side: adds every command queued so far to 'display', in order.
+*  Returns the number taken.
+*/
+uint32_t vm_video_drain (VM_VideoQueue *queue, VM_Display *display) {
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    for (uint32_t i = tail; i != head; i++) {
+        vm_display_add(display, &queue->cmds[i & (VM_VIDEO_QUEUE_SIZE - 1)]);
+        //released one at a time so that the VM can refill the ring during a long command
+        atomic_store_explicit(&queue->tail, i + 1, memory_order_release);
+    }
+    return head - tail;
+}
@@ -0,0 +1,76 @@
+#ifndef _VIDEO_H_
+#define _VIDEO_H_
+
+#include <stdatomic.h>
+
+#include "vm.h"
+
+/*
+*  Video interrupts as commands.
+*  Each I_VIDEO_* interrupt becomes a VM_VideoCmd that is appended to the VM's display
+*  list (a VM_Display) instead of being drawn. The list is executed in bulk when the
+*  program calls I_VIDEO_UPDATE, or early when it fills up or I_VIDEO_GETPIXEL needs the
+*  surface to be current. Commands are merged as they're added: pixels next to each other
+*  on a row become one run, fills of one colour that line up become one fill, and a fill
+*  drops the runs and fills just before it that it paints over. Nothing is reordered,
+*  commands may overlap so the order they were given in is the order they're drawn in.
+*
+*  A VM with a 'video_queue' pushes its commands onto a single-producer single-consumer
+*  ring instead, and whoever owns the display (core 0, or the main thread on the host)
+*  feeds them to its VM_Display with vm_video_drain(). The VM can then run on the other
+*  core (or thread) and keeps going while the display side is busy with an SPI transfer.
+*  The VM's side is lock-free: it only writes 'head' and the display's side only 'tail'.
+*  When the ring is full the VM spins until a slot frees up.
+*  Such a VM can't touch the surface itself, so I_VIDEO_WINDOW maps nothing for it.
+*/
+
+#define VM_VIDEO_QUEUE_SIZE 256 //commands held by a VM_VideoQueue (power of two)
+#define VM_DISPLAY_SIZE 128     //commands a display list holds before it's executed early
+#define VM_DISPLAY_PIXELS 1024  //pixel colours it holds for its runs
+
+//commands other than the I_VIDEO_* interrupts, between the VM and its display list
+#define VM_VIDEO_RUN   0x80 //row of pixels [x, y, length, index of the first colour in 'pixels']
+#define VM_VIDEO_DATA  0x81 //up to five more colours for the row an I_VIDEO_HLINE started
+#define VM_VIDEO_FLUSH 0x82 //execute the list without updating the LCD
+
+
+typedef struct {
+    uint8_t op;             //I_VIDEO_* or VM_VIDEO_*
+    uint16_t args[5];       //R1..R5 of the interrupt
+} VM_VideoCmd;
+
+typedef struct VM_VideoQueue {
+    atomic_uint head;       //commands pushed, written by the VM's side only
+    atomic_uint tail;       //commands executed, written by the display's side only
+    uint32_t stalls;        //pushes that found the queue full (VM's side)
+    VM_VideoCmd cmds[VM_VIDEO_QUEUE_SIZE];
+} VM_VideoQueue;
+
+typedef struct VM_Display {
+    #ifdef PICO_LCD_BASE
+    Surface *video;
+    Font *font;
+    #endif
+    VM_VideoCmd cmds[VM_DISPLAY_SIZE];  //the display list
+    uint16_t count;                     //commands in 'cmds'
+    uint16_t pixels[VM_DISPLAY_PIXELS]; //colours of the VM_VIDEO_RUNs in 'cmds'
+    uint16_t used;                      //entries of 'pixels' in use
+    uint16_t hline_x, hline_y, hline_left; //where the next VM_VIDEO_DATA colours go
+    uint32_t added;         //commands given this frame, an I_VIDEO_PIXELS adds one per pixel
+    uint32_t executed;      //commands drawn this frame, after merging
+    uint32_t frames;        //I_VIDEO_UPDATEs done
+    uint32_t frame_added, frame_executed; //'added' and 'executed' of the last frame
+} VM_Display;
+
+
+void vm_display_init (VM_Display *display);
+void vm_display_add (VM_Display *display, const VM_VideoCmd *cmd);
+void vm_display_flush (VM_Display *display);
+void vm_display_report (VM_Display *display, const char *name);
+void vm_video_init (VM_VideoQueue *queue);
+void vm_video_push (VM_VideoQueue *queue, const VM_VideoCmd *cmd);
+void vm_video_sync (VM_VideoQueue *queue);
+void vm_video_submit (struct VM *vm, const VM_VideoCmd *cmd);
+uint32_t vm_video_drain (VM_VideoQueue *queue, VM_Display *display);
+
+#endif
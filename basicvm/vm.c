@@ -1,183 +1,772 @@
 
 #include "vm.h"
 #include "instructions.h"
+#include "profile.h"
 
 
-uint8_t vm_get_opcode_from_string (struct VM *vm, char *opcode, char smode, char dmode) {
-    for (uint8_t i = 0; i <= 255; i++) {
-        if (strcmp(vm->opcodes[i].name, opcode) == 0 
-         && vm->opcodes[i].smode == smode
-         && vm->opcodes[i].dmode == dmode) {
-            return i;
-        }
+/*
+*  Every instruction the VM implements, sorted by (name, smode, dmode) so that
+*  vm_find_op() can binary search it. Keep it sorted when adding instructions.
+*/
+static const VM_Op vm_op_table[] = {
+    { 0x31, "add",    'I', 'r', VM_OP_RESULT, vm_instruction_add },
+    { 0x30, "add",    'R', 'r', VM_OP_RESULT, vm_instruction_add },
+    { 0x22, "add",    'r', ' ', VM_OP_RESULT, vm_instruction_add },
+    { 0x39, "and",    'I', 'r', VM_OP_RESULT, vm_instruction_and },
+    { 0x38, "and",    'R', 'r', VM_OP_RESULT, vm_instruction_and },
+    { 0x28, "and",    'r', ' ', VM_OP_RESULT, vm_instruction_and },
+    { 0x05, "call",   'i', ' ', VM_OP_BRANCH, vm_instruction_call },
+    { 0x06, "call",   'r', ' ', VM_OP_BRANCH, vm_instruction_call },
+    { 0x07, "cmp",    'i', ' ', 0,            vm_instruction_cmp },
+    { 0x08, "cmp",    'r', ' ', 0,            vm_instruction_cmp },
+    { 0x44, "cmps",   ' ', ' ', 0,            vm_instruction_cmps },
+    { 0x21, "dec",    'r', ' ', VM_OP_RESULT, vm_instruction_dec },
+    { 0x37, "div",    'I', 'r', VM_OP_RESULT, vm_instruction_div },
+    { 0x36, "div",    'R', 'r', VM_OP_RESULT, vm_instruction_div },
+    { 0x25, "div",    'r', ' ', VM_OP_RESULT, vm_instruction_div },
+    { 0x00, "hlt",    ' ', ' ', 0,            vm_instruction_hlt },
+    { 0x20, "inc",    'r', ' ', VM_OP_RESULT, vm_instruction_inc },
+    { 0x04, "int",    'i', ' ', 0,            vm_instruction_int },
+    { 0xe2, "je",     'i', ' ', VM_OP_BRANCH, vm_instruction_je },
+    { 0xe3, "je",     'r', ' ', VM_OP_BRANCH, vm_instruction_je },
+    { 0xee, "jg",     'i', ' ', VM_OP_BRANCH, vm_instruction_jg },
+    { 0xef, "jg",     'r', ' ', VM_OP_BRANCH, vm_instruction_jg },
+    { 0xf0, "jge",    'i', ' ', VM_OP_BRANCH, vm_instruction_jge },
+    { 0xf1, "jge",    'r', ' ', VM_OP_BRANCH, vm_instruction_jge },
+    { 0xea, "jl",     'i', ' ', VM_OP_BRANCH, vm_instruction_jl },
+    { 0xeb, "jl",     'r', ' ', VM_OP_BRANCH, vm_instruction_jl },
+    { 0xec, "jle",    'i', ' ', VM_OP_BRANCH, vm_instruction_jle },
+    { 0xed, "jle",    'r', ' ', VM_OP_BRANCH, vm_instruction_jle },
+    { 0xe0, "jmp",    'i', ' ', VM_OP_BRANCH, vm_instruction_jmp },
+    { 0xe1, "jmp",    'r', ' ', VM_OP_BRANCH, vm_instruction_jmp },
+    { 0xe4, "jne",    'i', ' ', VM_OP_BRANCH, vm_instruction_jne },
+    { 0xe5, "jne",    'r', ' ', VM_OP_BRANCH, vm_instruction_jne },
+    { 0xe8, "jnz",    'i', ' ', VM_OP_BRANCH, vm_instruction_jnz },
+    { 0xe9, "jnz",    'r', ' ', VM_OP_BRANCH, vm_instruction_jnz },
+    { 0xe6, "jz",     'i', ' ', VM_OP_BRANCH, vm_instruction_jz },
+    { 0xe7, "jz",     'r', ' ', VM_OP_BRANCH, vm_instruction_jz },
+    { 0x10, "mov",    'i', 'r', VM_OP_RESULT, vm_instruction_mov },
+    { 0x11, "mov",    'm', 'r', VM_OP_RESULT, vm_instruction_mov },
+    { 0x12, "mov",    'p', 'r', VM_OP_RESULT, vm_instruction_mov },
+    { 0x13, "mov",    'r', 'm', VM_OP_RESULT, vm_instruction_mov },
+    { 0x14, "mov",    'r', 'p', VM_OP_RESULT, vm_instruction_mov },
+    { 0x15, "mov",    'r', 'r', VM_OP_RESULT, vm_instruction_mov },
+    { 0x42, "movs",   ' ', ' ', 0,            vm_instruction_movs },
+    { 0x35, "mul",    'I', 'r', VM_OP_RESULT, vm_instruction_mul },
+    { 0x34, "mul",    'R', 'r', VM_OP_RESULT, vm_instruction_mul },
+    { 0x24, "mul",    'r', ' ', VM_OP_RESULT, vm_instruction_mul },
+    { 0x01, "nop",    ' ', ' ', 0,            vm_instruction_nop },
+    { 0x3b, "or",     'I', 'r', VM_OP_RESULT, vm_instruction_or },
+    { 0x3a, "or",     'R', 'r', VM_OP_RESULT, vm_instruction_or },
+    { 0x29, "or",     'r', ' ', VM_OP_RESULT, vm_instruction_or },
+    { 0x0c, "pop",    ' ', 'r', VM_OP_RESULT, vm_instruction_pop },
+    { 0x0e, "popm",   'i', ' ', 0,            vm_instruction_popm },
+    { 0x0a, "push",   'i', ' ', 0,            vm_instruction_push },
+    { 0x0b, "push",   'r', ' ', 0,            vm_instruction_push },
+    { 0x0d, "pushm",  'i', ' ', 0,            vm_instruction_pushm },
+    { 0x09, "ret",    ' ', ' ', VM_OP_BRANCH, vm_instruction_ret },
+    { 0x3f, "shl",    'I', 'r', VM_OP_RESULT, vm_instruction_shlv },
+    { 0x3e, "shl",    'R', 'r', VM_OP_RESULT, vm_instruction_shlv },
+    { 0x26, "shl",    'r', ' ', VM_OP_RESULT, vm_instruction_shl },
+    { 0x41, "shr",    'I', 'r', VM_OP_RESULT, vm_instruction_shrv },
+    { 0x40, "shr",    'R', 'r', VM_OP_RESULT, vm_instruction_shrv },
+    { 0x27, "shr",    'r', ' ', VM_OP_RESULT, vm_instruction_shr },
+    { 0x03, "stdin",  ' ', 'r', VM_OP_RESULT, vm_instruction_stdin },
+    { 0x02, "stdout", ' ', ' ', 0,            vm_instruction_stdout },
+    { 0x43, "stos",   ' ', ' ', 0,            vm_instruction_stos },
+    { 0x33, "sub",    'I', 'r', VM_OP_RESULT, vm_instruction_sub },
+    { 0x32, "sub",    'R', 'r', VM_OP_RESULT, vm_instruction_sub },
+    { 0x23, "sub",    'r', ' ', VM_OP_RESULT, vm_instruction_sub },
+    { 0x3d, "xor",    'I', 'r', VM_OP_RESULT, vm_instruction_xor },
+    { 0x3c, "xor",    'R', 'r', VM_OP_RESULT, vm_instruction_xor },
+    { 0x2a, "xor",    'r', ' ', VM_OP_RESULT, vm_instruction_xor },
+};
+
+#define VM_OP_TABLE_COUNT (sizeof(vm_op_table) / sizeof(vm_op_table[0]))
+
+//decodes bytes that aren't an instruction
+static const VM_Op vm_op_invalid = { 0x00, "", ' ', ' ', 0, vm_instruction_invalid };
+
+//vm_op_table index + 1 of each opcode, 0 for bytes that aren't an instruction
+static uint8_t vm_op_index[256];
+
+//what every VM's memory reads as until it is written
+const uint8_t vm_zero_page[VM_PAGE_SIZE];
+
+
+
+static int vm_op_compare (const char *name, char smode, char dmode, const VM_Op *op) {
+    int cmp = strcmp(name, op->name);
+    if (cmp != 0) return cmp;
+    if (smode != op->smode) return (uint8_t)smode - (uint8_t)op->smode;
+    return (uint8_t)dmode - (uint8_t)op->dmode;
+}
+
+
+//returns the instruction with this mnemonic and operand modes, or NULL if there isn't one
+const VM_Op *vm_find_op (const char *name, char smode, char dmode) {
+    int lo = 0, hi = (int)VM_OP_TABLE_COUNT - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = vm_op_compare(name, smode, dmode, &vm_op_table[mid]);
+        if (cmp == 0) return &vm_op_table[mid];
+        if (cmp < 0) hi = mid - 1;
+        else lo = mid + 1;
     }
-    #ifdef DEBUG
-        printf("vm_get_opcode_from_string(%s): not found\n", opcode);
-    #endif
-    vm->flags[F_HALT] = 1;
-    return 0x00;
+    return NULL;
+}
+
+
+static void vm_op_index_build () {
+    if (vm_op_index[vm_op_table[0].opcode] != 0) return;
+    for (uint16_t i = 0; i < VM_OP_TABLE_COUNT; i++) vm_op_index[vm_op_table[i].opcode] = i + 1;
+}
+
+
+//returns the instruction encoded as 'opcode', or NULL if the byte isn't a valid opcode
+const VM_Op *vm_find_opcode (uint8_t opcode) {
+    vm_op_index_build();
+    return vm_op_index[opcode] != 0 ? &vm_op_table[vm_op_index[opcode] - 1] : NULL;
+}
+
+
+//as vm_find_opcode(), but bytes that aren't an instruction get an entry with no name that faults
+const VM_Op *vm_op_info (uint8_t opcode) {
+    vm_op_index_build();
+    return vm_op_index[opcode] != 0 ? &vm_op_table[vm_op_index[opcode] - 1] : &vm_op_invalid;
 }
 
 
-void vm_load_instruction (struct VM *vm, uint8_t opcode, char *name, char smode, char dmode, uint8_t (*fn)(struct VM *)) {
-    VM_Op op = {
-        opcode,
-        "",
-        smode, dmode,
-        fn
-    };
-    snprintf(op.name, 20, "%s", name);
-    vm->opcodes[opcode] = op;
+uint8_t vm_get_opcode_from_string (struct VM *vm, char *opcode, char smode, char dmode) {
+    const VM_Op *op = vm_find_op(opcode, smode, dmode);
+    if (op != NULL) return op->opcode;
+    printf("vm_get_opcode_from_string(%s): not found\n", opcode);
+    vm->flags |= VM_FLAG(F_HALT);
+    return 0x00;
 }
 
 
+//sets up a new VM, memory all zero (use vm_free() first when reusing one)
 void vm_init (struct VM *vm) {
-    #ifdef DEBUG
-        printf("[+] initialising vm...\n");
-    #endif
     memset(vm, 0, sizeof(struct VM));
+    vm_op_index_build();
+    for (uint16_t i = 0; i < VM_PAGE_COUNT; i++) vm->page[i] = vm_zero_page;
+    vm->fuse = VM_FUSE_ALL;
+    vm->stack_limit = VM_STACK_LIMIT;
+}
+
+
+//turns page 'n' back into the zero page, freeing it if it was allocated
+void vm_page_release (struct VM *vm, uint8_t n) {
+    if (VM_PAGE_OWNED(vm, n) && !VM_PAGE_WINDOW(vm, n)) {
+        free((void *)vm->page[n]);
+        vm->pages--;
+    }
+    vm->page_own[n / 32] &= ~(1u << (n % 32));
+    vm->page_win[n / 32] &= ~(1u << (n % 32));
+    vm->page[n] = vm_zero_page;
+}
+
+
+//releases the pages 'vm' allocated and unmaps its window, its memory reads as zero again
+void vm_free (struct VM *vm) {
+    for (uint16_t i = 0; i < VM_PAGE_COUNT; i++) vm_page_release(vm, i);
+    vm->native = NULL;
+    vm_set_verified(vm, 0, 0, NULL);
+    vm_invalidate(vm, 0, VM_DECODE_SIZE);
+}
+
+
+//bytes of RAM used by 'vm', pages it shares aren't counted
+uint32_t vm_ram (struct VM *vm) {
+    return sizeof(struct VM) + (uint32_t)vm->pages * VM_PAGE_SIZE;
+}
+
+
+/*
+*  Gives 'vm' its own copy of page 'n' so that it can be written.
+*  Returns 0, having faulted the VM, if there's no RAM left for it. The translation is
+*  detached too, translated code then stops at its next check after the write.
+*/
+uint8_t vm_page_own (struct VM *vm, uint8_t n) {
+    if (VM_PAGE_OWNED(vm, n)) return 1;
+    uint8_t *page = malloc(VM_PAGE_SIZE);
+    if (page == NULL) {
+        vm_fault(vm, VM_FAULT_MEMORY);
+        vm->native = NULL;
+        return 0;
+    }
+    memcpy(page, vm->page[n], VM_PAGE_SIZE);
+    vm->page[n] = page;
+    vm->page_own[n / 32] |= 1u << (n % 32);
+    vm->pages++;
+    return 1;
+}
+
+
+//stores a byte without invalidating decoded instructions, returns 0 if it faulted
+static uint8_t vm_store (struct VM *vm, uint16_t addr, uint8_t value) {
+    uint8_t n = addr / VM_PAGE_SIZE;
+    if (!VM_PAGE_OWNED(vm, n) && vm_page_own(vm, n) == 0) return 0;
+    ((uint8_t *)vm->page[n])[addr % VM_PAGE_SIZE] = value;
+    return 1;
+}
+
+
+//gives 'vm' its own copy of the page holding 'addr', returns a pointer to that byte or NULL if it faulted
+static uint8_t *vm_store_at (struct VM *vm, uint16_t addr) {
+    uint8_t n = addr / VM_PAGE_SIZE;
+    if (!VM_PAGE_OWNED(vm, n) && vm_page_own(vm, n) == 0) return NULL;
+    return (uint8_t *)vm->page[n] + addr % VM_PAGE_SIZE;
+}
+
+
+//bytes from 'addr' to the end of its page
+#define VM_PAGE_LEFT(addr) (VM_PAGE_SIZE - (addr) % VM_PAGE_SIZE)
 
-    vm_load_instruction(vm, 0x00, "hlt",    ' ', ' ', vm_instruction_hlt);
-    vm_load_instruction(vm, 0x01, "nop",    ' ', ' ', vm_instruction_nop);
-    vm_load_instruction(vm, 0x02, "stdout", ' ', ' ', vm_instruction_stdout);
-    vm_load_instruction(vm, 0x03, "stdin",  ' ', 'r', vm_instruction_stdin);
-    vm_load_instruction(vm, 0x04, "int",    'i', ' ', vm_instruction_int);
-    vm_load_instruction(vm, 0x05, "call",   'i', 'i', vm_instruction_call);
-    vm_load_instruction(vm, 0x06, "call",   'r', 'r', vm_instruction_call);
-    vm_load_instruction(vm, 0x07, "cmp",    'i', ' ', vm_instruction_cmp);
-    vm_load_instruction(vm, 0x08, "cmp",    'r', ' ', vm_instruction_cmp);
-    
-    vm_load_instruction(vm, 0x10, "mov",    'i', 'r', vm_instruction_mov);
-    vm_load_instruction(vm, 0x11, "mov",    'm', 'r', vm_instruction_mov);
-    vm_load_instruction(vm, 0x12, "mov",    'p', 'r', vm_instruction_mov);
-    vm_load_instruction(vm, 0x13, "mov",    'r', 'm', vm_instruction_mov);
-    vm_load_instruction(vm, 0x14, "mov",    'r', 'p', vm_instruction_mov);
-    vm_load_instruction(vm, 0x15, "mov",    'r', 'r', vm_instruction_mov);
-    
-
-    vm_load_instruction(vm, 0x20, "inc",    'r', ' ', vm_instruction_inc);
-    vm_load_instruction(vm, 0x21, "dec",    'r', ' ', vm_instruction_dec);
-    vm_load_instruction(vm, 0x22, "add",    'r', ' ', vm_instruction_add);
-    vm_load_instruction(vm, 0x23, "sub",    'r', ' ', vm_instruction_sub);
-    vm_load_instruction(vm, 0x24, "mul",    'r', ' ', vm_instruction_mul);
-    vm_load_instruction(vm, 0x25, "div",    'r', ' ', vm_instruction_div);
-    vm_load_instruction(vm, 0x26, "shl",    'r', ' ', vm_instruction_shl);
-    vm_load_instruction(vm, 0x27, "shr",    'r', ' ', vm_instruction_shr);
-
-    vm_load_instruction(vm, 0xe0, "jmp",    'i', ' ', vm_instruction_jmp);
-    vm_load_instruction(vm, 0xe1, "jmp",    'r', ' ', vm_instruction_jmp);
-    vm_load_instruction(vm, 0xe2, "je",     'i', ' ', vm_instruction_je);
-    vm_load_instruction(vm, 0xe3, "je",     'r', ' ', vm_instruction_je);
-    vm_load_instruction(vm, 0xe4, "jne",    'i', ' ', vm_instruction_jne);
-    vm_load_instruction(vm, 0xe5, "jne",    'r', ' ', vm_instruction_jne);
-    vm_load_instruction(vm, 0xe6, "jz",     'i', ' ', vm_instruction_jz);
-    vm_load_instruction(vm, 0xe7, "jz",     'r', ' ', vm_instruction_jz);
-    vm_load_instruction(vm, 0xe8, "jnz",    'i', ' ', vm_instruction_jnz);
-    vm_load_instruction(vm, 0xe9, "jnz",    'r', ' ', vm_instruction_jnz);
-    vm_load_instruction(vm, 0xea, "jl",     'i', ' ', vm_instruction_jl);
-    vm_load_instruction(vm, 0xeb, "jl",     'r', ' ', vm_instruction_jl);
-    vm_load_instruction(vm, 0xec, "jle",    'i', ' ', vm_instruction_jle);
-    vm_load_instruction(vm, 0xed, "jle",    'r', ' ', vm_instruction_jle);
-    vm_load_instruction(vm, 0xee, "jg",     'i', ' ', vm_instruction_jg);
-    vm_load_instruction(vm, 0xef, "jg",     'r', ' ', vm_instruction_jg);
-    vm_load_instruction(vm, 0xf0, "jge",    'i', ' ', vm_instruction_jge);
-    vm_load_instruction(vm, 0xf1, "jge",    'r', ' ', vm_instruction_jge);
+
+//drops cached instructions in the 'len' bytes written at 'addr', which may wrap past 0xffff
+static void vm_written (struct VM *vm, uint16_t addr, uint32_t len) {
+    uint32_t end = (uint32_t)addr + len;
+    if (end > 65536) {
+        vm_invalidate(vm, addr, 65536 - addr);
+        vm_invalidate(vm, 0, end - 65536);
+    } else if (len > 0 && addr < vm->decoded_hi && end > vm->decoded_lo) {
+        vm_invalidate(vm, addr, len > 0xffff ? 0xffff : len);
+    }
 }
 
 
+//copies 'length' bytes in, a page at a time
 void vm_load (struct VM *vm, char *program, uint16_t length, uint16_t address) {
-    #ifdef DEBUG
-        printf("[+] loading program (%d bytes) at 0x%04x...", length, address);
-        fflush(stdout);
-    #endif
-    for (uint16_t i = 0; i < length; i++) {
-        vm->mem[address + i] = program[i];
-    }
-    #ifdef DEBUG
-        printf("done.\n");
-    #endif
+    for (uint32_t done = 0, n; done < length; done += n) {
+        uint16_t addr = address + done;
+        uint8_t *p = vm_store_at(vm, addr);
+        if (p == NULL) break;
+        n = VM_PAGE_LEFT(addr);
+        if (n > length - done) n = length - done;
+        memcpy(p, program + done, n);
+    }
+    vm_written(vm, address, length);
     vm->pc = address;
 }
 
 
-//called before execution of the instruction
-void vm_fetch (struct VM *vm) {
-    uint16_t addr, ptr_addr, size = 1;
-    vm->opcode = vm->mem[vm->pc];
-    
-    switch (vm->opcodes[vm->opcode].dmode) {
+/*
+*  Like vm_load() but without copying: the whole pages of 'image' become pages of 'vm',
+*  shared with every other VM mapping the same image until one of them writes to them.
+*  The image must stay valid (and unchanged) while mapped. Partial pages are copied.
+*/
+void vm_map (struct VM *vm, const uint8_t *image, uint32_t length, uint16_t address) {
+    uint32_t end = (uint32_t)address + length;
+    if (end > 65536) end = 65536;
+    for (uint32_t addr = address; addr < end; ) {
+        uint8_t n = addr / VM_PAGE_SIZE;
+        if (addr % VM_PAGE_SIZE == 0 && end - addr >= VM_PAGE_SIZE) {
+            vm_page_release(vm, n);
+            vm->page[n] = image + (addr - address);
+            addr += VM_PAGE_SIZE;
+        } else {
+            uint32_t len = VM_PAGE_LEFT(addr);
+            if (len > end - addr) len = end - addr;
+            vm_load(vm, (char *)image + (addr - address), len, addr);
+            addr += len;
+        }
+    }
+    vm_invalidate(vm, address, end - address > 0xffff ? 0xffff : end - address);
+    vm->pc = address;
+}
+
+
+/*
+*  Maps 'length' bytes of outside memory, usually a framebuffer, onto the VM's memory at
+*  'address' as one linear block. Reads and writes then go straight to it, and what the VM
+*  had there before is released. Replaces any previous window. A page can't be mapped in
+*  part, so 'address' and 'length' must be whole pages and fit below 64K. Returns the
+*  bytes mapped, 0 (and no window) if they don't.
+*/
+uint32_t vm_map_window (struct VM *vm, uint16_t address, uint8_t *memory, uint32_t length) {
+    vm_unmap_window(vm);
+    if (address % VM_PAGE_SIZE != 0 || length % VM_PAGE_SIZE != 0 || address + length > 65536) return 0;
+    uint32_t n = address / VM_PAGE_SIZE;
+    for (uint32_t offset = 0; offset < length; offset += VM_PAGE_SIZE, n++) {
+        vm_page_release(vm, n);
+        vm->page[n] = memory + offset;
+        vm->page_own[n / 32] |= 1u << (n % 32);
+        vm->page_win[n / 32] |= 1u << (n % 32);
+    }
+    //whatever was decoded, verified or translated there is gone
+    vm_invalidate(vm, address, length > 0xffff ? 0xffff : length);
+    return length;
+}
+
+
+//puts zero pages back where the window was
+void vm_unmap_window (struct VM *vm) {
+    uint32_t lo = VM_PAGE_COUNT, hi = 0;
+    for (uint16_t i = 0; i < VM_PAGE_COUNT; i++) {
+        if (!VM_PAGE_WINDOW(vm, i)) continue;
+        vm_page_release(vm, i);
+        if (i < lo) lo = i;
+        hi = i + 1;
+    }
+    if (lo < hi) vm_invalidate(vm, lo * VM_PAGE_SIZE, (hi - lo) * VM_PAGE_SIZE > 0xffff ? 0xffff : (hi - lo) * VM_PAGE_SIZE);
+}
+
+
+//writes memory, returns 0 if the VM faulted (VM_FAULT_MEMORY)
+uint8_t vm_write8 (struct VM *vm, uint16_t addr, uint8_t value) {
+    uint8_t ok = vm_store(vm, addr, value);
+    if (addr >= vm->decoded_lo && addr < vm->decoded_hi) {
+        vm_invalidate(vm, addr, 1);
+    }
+    return ok;
+}
+
+
+uint8_t vm_write16 (struct VM *vm, uint16_t addr, uint16_t value) {
+    uint8_t n = addr / VM_PAGE_SIZE, ok = 1;
+    if (VM_PAGE_OWNED(vm, n) && addr % VM_PAGE_SIZE != VM_PAGE_SIZE - 1) {
+        //both bytes in a page of its own already, the usual case for the stack
+        uint8_t *p = (uint8_t *)vm->page[n] + addr % VM_PAGE_SIZE;
+        p[0] = HBYTE(value);
+        p[1] = LBYTE(value);
+    } else {
+        ok = vm_store(vm, addr, HBYTE(value)) && vm_store(vm, addr + 1, LBYTE(value));
+    }
+    if (addr + 1 >= vm->decoded_lo && addr < vm->decoded_hi) {
+        vm_invalidate(vm, addr, 2);
+    }
+    return ok;
+}
+
+
+/*
+*  Copies 'count' bytes from 'src' to 'dst' with memmove(), a page at a time, the blocks
+*  may overlap and wrap past 0xffff. Returns 0 if the VM faulted (VM_FAULT_MEMORY).
+*/
+uint8_t vm_block_move (struct VM *vm, uint16_t dst, uint16_t src, uint16_t count) {
+    //from the end when 'dst' is inside the source, so that nothing is overwritten before it's read
+    uint8_t backward = dst != src && (uint16_t)(dst - src) < count;
+    uint8_t ok = 1;
+    for (uint32_t done = 0, n; done < count; done += n) {
+        uint16_t s = src + done, d = dst + done;
+        n = count - done;
+        if (backward) {
+            uint16_t s_last = src + count - done - 1, d_last = dst + count - done - 1;
+            if (n > s_last % VM_PAGE_SIZE + 1u) n = s_last % VM_PAGE_SIZE + 1;
+            if (n > d_last % VM_PAGE_SIZE + 1u) n = d_last % VM_PAGE_SIZE + 1;
+            s = s_last - (n - 1);
+            d = d_last - (n - 1);
+        } else {
+            if (n > VM_PAGE_LEFT(s)) n = VM_PAGE_LEFT(s);
+            if (n > VM_PAGE_LEFT(d)) n = VM_PAGE_LEFT(d);
+        }
+        //the destination first, it may be the source's page too
+        uint8_t *p = vm_store_at(vm, d);
+        if (p == NULL) {
+            ok = 0;
+            break;
+        }
+        memmove(p, vm->page[s / VM_PAGE_SIZE] + s % VM_PAGE_SIZE, n);
+    }
+    vm_written(vm, dst, count);
+    return ok;
+}
+
+
+//sets 'count' bytes from 'dst' to 'value', returns 0 if the VM faulted (VM_FAULT_MEMORY)
+uint8_t vm_block_set (struct VM *vm, uint16_t dst, uint8_t value, uint16_t count) {
+    uint8_t ok = 1;
+    for (uint32_t done = 0, n; done < count; done += n) {
+        uint16_t d = dst + done;
+        uint8_t *p = vm_store_at(vm, d);
+        if (p == NULL) {
+            ok = 0;
+            break;
+        }
+        n = VM_PAGE_LEFT(d);
+        if (n > count - done) n = count - done;
+        memset(p, value, n);
+    }
+    vm_written(vm, dst, count);
+    return ok;
+}
+
+
+//compares 'count' bytes at 'a' and 'b', returns how many are the same before the first difference
+uint16_t vm_block_compare (struct VM *vm, uint16_t a, uint16_t b, uint16_t count) {
+    for (uint32_t done = 0, n; done < count; done += n) {
+        uint16_t x = a + done, y = b + done;
+        const uint8_t *p = vm->page[x / VM_PAGE_SIZE] + x % VM_PAGE_SIZE;
+        const uint8_t *q = vm->page[y / VM_PAGE_SIZE] + y % VM_PAGE_SIZE;
+        n = count - done;
+        if (n > VM_PAGE_LEFT(x)) n = VM_PAGE_LEFT(x);
+        if (n > VM_PAGE_LEFT(y)) n = VM_PAGE_LEFT(y);
+        if (memcmp(p, q, n) != 0) {
+            uint32_t i = 0;
+            while (p[i] == q[i]) i++;
+            return done + i;
+        }
+    }
+    return count;
+}
+
+
+//widens the address range writes are checked against to include 'lo'..'hi'
+void vm_cover (struct VM *vm, uint32_t lo, uint32_t hi) {
+    if (vm->decoded_lo >= vm->decoded_hi) {
+        vm->decoded_lo = lo;
+        vm->decoded_hi = hi;
+    } else {
+        if (lo < vm->decoded_lo) vm->decoded_lo = lo;
+        if (hi > vm->decoded_hi) vm->decoded_hi = hi;
+    }
+}
+
+
+//drops cached instructions that overlap the 'len' bytes at 'addr' (call after writing code memory)
+void vm_invalidate (struct VM *vm, uint16_t addr, uint16_t len) {
+    const VM_Native *native = vm->native;
+    if (native != NULL && (uint32_t)addr + len > native->origin && addr < native->origin + native->length) {
+        vm->native = native = NULL;
+    }
+    if ((uint32_t)addr + len > vm->verified_lo && addr < vm->verified_hi) {
+        vm_set_verified(vm, 0, 0, NULL);
+    }
+    if (len >= VM_DECODE_SIZE) {
+        for (uint16_t i = 0; i < VM_DECODE_SIZE; i++) vm->decoded[i].size = 0;
+        //translated and verified code stay covered so that writes to them are still noticed
+        vm->decoded_lo = vm->decoded_hi = 0;
+        if (native != NULL) vm_cover(vm, native->origin, native->origin + native->length);
+        if (vm->verified_lo < vm->verified_hi) vm_cover(vm, vm->verified_lo, vm->verified_hi);
+        return;
+    }
+    //an entry starting up to VM_MAX_SPAN - 1 bytes before 'addr' may overlap it
+    for (uint16_t i = 0; i < len + VM_MAX_SPAN - 1; i++) {
+        uint16_t pc = addr - (VM_MAX_SPAN - 1) + i;
+        VM_Decoded *op = &vm->decoded[pc & (VM_DECODE_SIZE - 1)];
+        if (op->size != 0 && op->pc == pc && i + op->span > VM_MAX_SPAN - 1) {
+            op->size = 0;
+        }
+    }
+}
+
+
+/*
+*  Marks the instructions vm_verify() proved in the 'length' bytes at 'origin' as safe to
+*  decode without checks, 'starts' has a bit set for each (bit n for 'origin' + n). The VM
+*  takes 'starts' over and frees it once the code is written to. NULL for 'starts' drops
+*  what was verified before, without touching the decoded instructions.
+*/
+void vm_set_verified (struct VM *vm, uint16_t origin, uint32_t length, uint32_t *starts) {
+    free(vm->verified);
+    vm->verified = starts;
+    vm->verified_lo = vm->verified_hi = 0;
+    if (starts == NULL) return;
+    vm_invalidate(vm, 0, VM_DECODE_SIZE);
+    vm->verified_lo = origin;
+    vm->verified_hi = origin + length;
+    vm_cover(vm, vm->verified_lo, vm->verified_hi);
+}
+
+
+/*
+*  True if vm_verify() proved that an instruction starts at 'pc'. Never for one that reaches
+*  into a window, the display list draws into those pages without telling the VM.
+*/
+static inline uint8_t vm_verified (struct VM *vm, uint16_t pc) {
+    uint32_t n = pc - vm->verified_lo;
+    uint16_t last = pc + VM_MAX_INSTRUCTION_SIZE - 1;
+    return pc >= vm->verified_lo && pc < vm->verified_hi && ((vm->verified[n / 32] >> (n % 32)) & 1) &&
+        !VM_PAGE_WINDOW(vm, pc / VM_PAGE_SIZE) && !VM_PAGE_WINDOW(vm, last / VM_PAGE_SIZE);
+}
+
+
+//picks the specialised vm_run() handler for a decoded instruction, if there is one
+static uint8_t vm_decode_handler (VM_Decoded *op) {
+    uint8_t s = op->skind, d = op->dkind;
+    uint8_t (*f)(struct VM *) = op->func;
+    uint8_t src_reg = s == VM_OPND_REG, dst_r0 = d == VM_OPND_REG && op->dval == 0;
+
+    if (f == vm_instruction_hlt) return VM_H_HLT;
+    if (f == vm_instruction_nop) return VM_H_NOP;
+    if (f == vm_instruction_int && s == VM_OPND_IMM) return VM_H_INT;
+    if (f == vm_instruction_mov) {
+        if (s == VM_OPND_IMM && d == VM_OPND_REG) return VM_H_MOV_IR;
+        if (s == VM_OPND_REG && d == VM_OPND_REG) return VM_H_MOV_RR;
+        if (s == VM_OPND_MEM && d == VM_OPND_REG) return VM_H_MOV_MR;
+        if (s == VM_OPND_REG && d == VM_OPND_MEM) return VM_H_MOV_RM;
+    }
+    if (src_reg && dst_r0) {
+        if (f == vm_instruction_inc) return VM_H_INC;
+        if (f == vm_instruction_dec) return VM_H_DEC;
+        if (f == vm_instruction_add) return VM_H_ADD;
+        if (f == vm_instruction_sub) return VM_H_SUB;
+        if (f == vm_instruction_mul) return VM_H_MUL;
+        if (f == vm_instruction_shl) return VM_H_SHL;
+        if (f == vm_instruction_shr) return VM_H_SHR;
+    }
+    //'dst = a op b' with a register destination, the two-operand and/or/xor (a = R0) included
+    if (d == VM_OPND_REG && (s == VM_OPND_REG || s == VM_OPND_IMM)) {
+        uint8_t imm = s == VM_OPND_IMM;
+        if (f == vm_instruction_add) return VM_H_ADD3_R + imm;
+        if (f == vm_instruction_sub) return VM_H_SUB3_R + imm;
+        if (f == vm_instruction_mul) return VM_H_MUL3_R + imm;
+        if (f == vm_instruction_and) return VM_H_AND3_R + imm;
+        if (f == vm_instruction_or) return VM_H_OR3_R + imm;
+        if (f == vm_instruction_xor) return VM_H_XOR3_R + imm;
+        if (f == vm_instruction_shlv) return VM_H_SHL3_R + imm;
+        if (f == vm_instruction_shrv) return VM_H_SHR3_R + imm;
+    }
+    if (f == vm_instruction_cmp) return s == VM_OPND_IMM ? VM_H_CMP_I : VM_H_CMP_R;
+    if (f == vm_instruction_call && s == VM_OPND_IMM) return VM_H_CALL_I;
+    if (f == vm_instruction_ret) return VM_H_RET;
+    if (f == vm_instruction_push) return s == VM_OPND_IMM ? VM_H_PUSH_I : VM_H_PUSH_R;
+    if (f == vm_instruction_pop) return VM_H_POP;
+    if (f == vm_instruction_pushm) return VM_H_PUSHM;
+    if (f == vm_instruction_popm) return VM_H_POPM;
+    if (s == VM_OPND_IMM) {
+        if (f == vm_instruction_jmp) return VM_H_JMP_I;
+        if (f == vm_instruction_je) return VM_H_JE_I;
+        if (f == vm_instruction_jne) return VM_H_JNE_I;
+        if (f == vm_instruction_jz) return VM_H_JZ_I;
+        if (f == vm_instruction_jnz) return VM_H_JNZ_I;
+        if (f == vm_instruction_jl) return VM_H_JL_I;
+        if (f == vm_instruction_jle) return VM_H_JLE_I;
+        if (f == vm_instruction_jg) return VM_H_JG_I;
+        if (f == vm_instruction_jge) return VM_H_JGE_I;
+    }
+    return VM_H_GENERIC;
+}
+
+
+//decodes the single instruction at 'pc' into 'op', without fusing it or caching it
+void vm_decode_at (struct VM *vm, uint16_t pc, VM_Decoded *op) {
+    uint8_t opcode = vm_read8(vm, pc);
+    const VM_Op *info = vm_op_info(opcode);
+    uint16_t size = 1;
+    op->pc = pc;
+    op->opcode = opcode;
+    op->func = info->func;
+    op->aval = 0;
+
+    //destination operand comes first
+    switch (info->dmode) {
         case 'r':
+            op->dkind = VM_OPND_REG;
+            op->dval = vm_read8(vm, pc + 1);
             size += 1;
             break;
         case 'm':
+            op->dkind = VM_OPND_MEM;
+            op->dval = vm_read16(vm, pc + 1);
             size += 2;
             break;
         case 'p':
+            op->dkind = VM_OPND_PTR;
+            op->dval = vm_read16(vm, pc + 1);
             size += 2;
             break;
+        default: //result (if any) goes to R0
+            op->dkind = (info->flags & VM_OP_RESULT) ? VM_OPND_REG : VM_OPND_NONE;
+            op->dval = 0;
     }
-    
-    //fetch src data for the instruction
-    switch (vm->opcodes[vm->opcode].smode) {
+
+    switch (info->smode) {
         case 'r': //src is a register index
-            vm->op_src = vm->reg[vm->mem[vm->pc + size + 0]];
+            op->skind = VM_OPND_REG;
+            op->sval = vm_read8(vm, pc + size);
             size += 1;
             break;
         case 'i': //src is an immediate value
-            vm->op_src = SHORT(vm->mem[vm->pc + size + 0], vm->mem[vm->pc + size + 1]);
+            op->skind = VM_OPND_IMM;
+            op->sval = vm_read16(vm, pc + size);
             size += 2;
             break;
         case 'm': //src is a memory address
-            addr = SHORT(vm->mem[vm->pc + size], vm->mem[vm->pc + size + 1]);
-            vm->op_src = SHORT(vm->mem[addr], vm->mem[addr + 1]);
+            op->skind = VM_OPND_MEM;
+            op->sval = vm_read16(vm, pc + size);
             size += 2;
             break;
         case 'p': //src is a pointer to a memory address
-            ptr_addr = SHORT(vm->mem[vm->pc + size + 0], vm->mem[vm->pc + size + 1]);
-            addr = SHORT(vm->mem[ptr_addr], vm->mem[ptr_addr + 1]);
-            vm->op_src = SHORT(vm->mem[addr], vm->mem[addr + 1]);
+            op->skind = VM_OPND_PTR;
+            op->sval = vm_read16(vm, pc + size);
             size += 2;
             break;
+        case 'R': //register A then register B
+            op->aval = vm_read8(vm, pc + size);
+            op->skind = VM_OPND_REG;
+            op->sval = vm_read8(vm, pc + size + 1);
+            size += 2;
+            break;
+        case 'I': //register A then immediate B
+            op->aval = vm_read8(vm, pc + size);
+            op->skind = VM_OPND_IMM;
+            op->sval = vm_read16(vm, pc + size + 1);
+            size += 3;
+            break;
         default: //src is R0
-            vm->op_src = vm->reg[0];
+            op->skind = VM_OPND_REG;
+            op->sval = 0;
     }
 
-    //bytes to increment PC after operation
-    vm->op_size = size;
+    //register indices come from memory, once per decode they're checked unless vm_verify() proved this code
+    if (!vm_verified(vm, pc) && (op->aval >= VM_REG_COUNT ||
+        (op->dkind == VM_OPND_REG && op->dval >= VM_REG_COUNT) || (op->skind == VM_OPND_REG && op->sval >= VM_REG_COUNT))) {
+        op->func = vm_instruction_register;
+        op->aval = 0;
+        op->skind = op->dkind = VM_OPND_NONE;
+    }
+    op->size = size;
+    op->handler = op->base = vm_decode_handler(op);
+    op->count = 1;
+    op->span = size;
 }
 
 
-//called after execution of the instruction
-void vm_result (struct VM *vm) {
-    uint16_t ptr_addr, addr;
-    switch (vm->opcodes[vm->opcode].dmode) {
-        case 'r':
-            vm->reg[vm->mem[vm->pc + 1]] = vm->op_dst;
+//VM_COND_* bits of a conditional jump handler, 0 for anything else
+static uint8_t vm_fuse_cond (uint8_t handler) {
+    switch (handler) {
+        case VM_H_JE_I: return VM_COND_EQUAL;
+        case VM_H_JNE_I: return VM_COND_NOT | VM_COND_EQUAL;
+        case VM_H_JZ_I: return VM_COND_ZERO;
+        case VM_H_JNZ_I: return VM_COND_NOT | VM_COND_ZERO;
+        case VM_H_JL_I: return VM_COND_LESS;
+        case VM_H_JLE_I: return VM_COND_LESS | VM_COND_EQUAL;
+        case VM_H_JG_I: return VM_COND_GREATER;
+        case VM_H_JGE_I: return VM_COND_GREATER | VM_COND_EQUAL;
+    }
+    return 0;
+}
+
+
+/*
+*  Looks at the instructions following 'op' and, if they form one of the sequences enabled
+*  in vm->fuse, gives 'op' a superinstruction handler covering all of them.
+*  The fused instructions keep their own cache entries, so jumping into the middle of a
+*  sequence still works, and 'op' itself still describes only the first instruction.
+*/
+static void vm_fuse (struct VM *vm, VM_Decoded *op, VM_Fused *fused) {
+    VM_Decoded next, jump;
+    uint16_t pc = op->pc + op->size;
+
+    if (op->base == VM_H_MOV_IR && (vm->fuse & VM_FUSE_MOVI)) {
+        uint8_t count = 1;
+        fused->reg[0] = op->dval;
+        fused->imm[0] = op->sval;
+        vm_decode_at(vm, pc, &next);
+        while (next.base == VM_H_MOV_IR && count < VM_FUSE_MAX) {
+            fused->reg[count] = next.dval;
+            fused->imm[count] = next.sval;
+            count++;
+            pc += next.size;
+            vm_decode_at(vm, pc, &next);
+        }
+        if (next.base == VM_H_INT) {
+            fused->target = next.sval;
+            op->handler = VM_H_MOVI_INT;
+            op->count = count + 1;
+            op->span = (uint16_t)(pc + next.size - op->pc);
+        } else if (count > 1) {
+            op->handler = VM_H_MOVI_N;
+            op->count = count;
+            op->span = (uint16_t)(pc - op->pc);
+        }
+        return;
+    }
+
+    if ((op->base == VM_H_CMP_I || op->base == VM_H_CMP_R) && (vm->fuse & VM_FUSE_CMP_JCC)) {
+        vm_decode_at(vm, pc, &jump);
+        fused->cond = vm_fuse_cond(jump.base);
+        if (fused->cond == 0) return;
+        fused->target = jump.sval;
+        op->handler = op->base == VM_H_CMP_I ? VM_H_CMPI_JCC : VM_H_CMPR_JCC;
+        op->count = 2;
+        op->span = op->size + jump.size;
+        return;
+    }
+
+    if ((op->base == VM_H_INC || op->base == VM_H_DEC) && (vm->fuse & VM_FUSE_STEP_JCC)) {
+        vm_decode_at(vm, pc, &next);
+        if (next.base != VM_H_CMP_I && next.base != VM_H_CMP_R) return;
+        vm_decode_at(vm, pc + next.size, &jump);
+        fused->cond = vm_fuse_cond(jump.base);
+        if (fused->cond == 0) return;
+        fused->cmp_kind = next.skind;
+        fused->cmp_val = next.sval;
+        fused->target = jump.sval;
+        op->handler = op->base == VM_H_INC ? VM_H_INC_JCC : VM_H_DEC_JCC;
+        op->count = 3;
+        op->span = op->size + next.size + jump.size;
+    }
+}
+
+
+//returns the decoded instruction at 'pc', decoding it into the cache if needed
+VM_Decoded *vm_decode (struct VM *vm, uint16_t pc) {
+    uint16_t index = pc & (VM_DECODE_SIZE - 1);
+    VM_Decoded *op = &vm->decoded[index];
+    if (op->size != 0 && op->pc == pc) return op;
+
+    vm_decode_at(vm, pc, op);
+    if (vm->fuse != 0) vm_fuse(vm, op, &vm->fused[index]);
+    vm_cover(vm, pc, pc + op->span);
+    return op;
+}
+
+
+uint16_t vm_operand (struct VM *vm, uint8_t kind, uint16_t value) {
+    switch (kind) {
+        case VM_OPND_REG: return vm->reg[value];
+        case VM_OPND_IMM: return value;
+        case VM_OPND_MEM: return vm_read16(vm, value);
+        case VM_OPND_PTR: return vm_read16(vm, vm_read16(vm, value));
+    }
+    return 0;
+}
+
+
+void vm_writeback (struct VM *vm, uint8_t kind, uint16_t value) {
+    switch (kind) {
+        case VM_OPND_REG:
+            vm->reg[value] = vm->op_dst;
             break;
-        case 'm':
-            addr = SHORT(vm->mem[vm->pc + 1], vm->mem[vm->pc + 2]);
-            vm->mem[addr] = HBYTE(vm->op_dst);
-            vm->mem[addr + 1] = LBYTE(vm->op_dst);
+        case VM_OPND_MEM:
+            vm_write16(vm, value, vm->op_dst);
             break;
-        case 'p':
-            ptr_addr = SHORT(vm->mem[vm->pc + 1], vm->mem[vm->pc + 2]);
-            addr = SHORT(vm->mem[ptr_addr], vm->mem[ptr_addr + 1]);
-            vm->mem[addr] = HBYTE(vm->op_dst);
-            vm->mem[addr + 1] = LBYTE(vm->op_dst);
+        case VM_OPND_PTR:
+            vm_write16(vm, vm_read16(vm, value), vm->op_dst);
             break;
-        default:
-            vm->reg[0] = vm->op_dst;
     }
 }
 
 
-char *vm_debug_opcode2name (struct VM *vm, uint8_t op) {
-    return vm->opcodes[op].name;
+//called before execution of the instruction
+void vm_fetch (struct VM *vm) {
+    VM_Decoded *op = vm_decode(vm, vm->pc);
+    vm->opcode = op->opcode;
+    vm->op_a = vm->reg[op->aval];
+    vm->op_src = vm_operand(vm, op->skind, op->sval);
+    //bytes to increment PC after operation
+    vm->op_size = op->size;
+}
+
+
+//called after execution of the instruction
+void vm_result (struct VM *vm) {
+    VM_Decoded *op = vm_decode(vm, vm->pc);
+    vm_writeback(vm, op->dkind, op->dval);
+}
+
+
+const char *vm_debug_opcode2name (struct VM *vm, uint8_t op) {
+    return vm_op_info(op)->name;
 }
 
 void vm_debug_op (struct VM *vm) {
-    char dmode = vm->opcodes[vm->opcode].dmode;
-    char smode = vm->opcodes[vm->opcode].smode;
+    char dmode = vm_op_info(vm->opcode)->dmode;
+    char smode = vm_op_info(vm->opcode)->smode;
     if (dmode == ' ') dmode = '.';
     if (smode == ' ') smode = '.';
     printf("0x%04x %s (%c%c) ", 
@@ -186,7 +775,7 @@ void vm_debug_op (struct VM *vm) {
            dmode, smode
     );
     for (int i = 1; i < vm->op_size; i++) {
-        printf("%02x ", vm->mem[vm->pc + i]);
+        printf("%02x ", vm_read8(vm, vm->pc + i));
     }
     printf("\n");
 }
@@ -195,7 +784,7 @@ void vm_debug_mem (struct VM *vm, uint16_t addr, uint16_t len) {
     char fmt[256];
     snprintf(fmt, 256, "0x%04x ", vm->pc);
     for (uint16_t i = addr; i < addr + len; i++) {
-        snprintf(fmt, 256, "%s%02x ", fmt, vm->mem[i]);
+        snprintf(fmt, 256, "%s%02x ", fmt, vm_read8(vm, i));
     }
     printf("[MEM] %s\n", fmt);
 }
@@ -213,28 +802,83 @@ void vm_debug_reg (struct VM *vm, uint8_t start, uint8_t count) {
 void vm_debug_flags (struct VM *vm) {
     printf("[FLAGS] ");
     for (uint8_t i = 0; i < FLAG_COUNT; i++) {
-        printf("%s:%d ", FLAG_NAMES[i], vm->flags[i]);
+        printf("%s:%d ", FLAG_NAMES[i], vm_flag(vm, i));
     }
     printf("\n");
 }
 
 
-void vm_step (struct VM *vm) {
-    if (vm->flags[F_HALT] != 0) return;
-    vm_fetch(vm);
-    #ifdef DEBUG_OP
-        vm_debug_op(vm);
-    #endif
-    if (vm->opcodes[vm->opcode].func(vm) == 0) {
-        vm_result(vm);
-        vm->pc += vm->op_size;
-    }
-    #ifdef DEBUG_REG
-        vm_debug_reg(vm, 0, 10);
-    #endif
-    #ifdef DEBUG_FLAGS
-        vm_debug_flags(vm);
-    #endif
+//works out the flags of the ALU results still pending, use vm_flags() rather than calling this directly
+void vm_flags_eval (struct VM *vm) {
+    uint16_t flags = vm->flags;
+    if (vm->lazy & VM_LAZY_CMP) {
+        uint16_t a = vm->cmp_a, b = vm->cmp_b;
+        flags &= ~(VM_FLAG(F_GREATER) | VM_FLAG(F_LESS) | VM_FLAG(F_EQUAL) | VM_FLAG(F_ZERO));
+        flags |= (a > b) << F_GREATER | (a < b) << F_LESS | (a == b) << F_EQUAL | (a == 0) << F_ZERO;
+    }
+    if (vm->lazy & VM_LAZY_OVR) {
+        flags = (flags & ~VM_FLAG(F_OVERFLOW)) | (vm->ovr_val > 0xffff) << F_OVERFLOW;
+    }
+    if (vm->lazy & VM_LAZY_UND) {
+        flags = (flags & ~VM_FLAG(F_UNDERFLOW)) | (vm->und_val < 0) << F_UNDERFLOW;
+    }
+    vm->flags = flags;
+    vm->lazy = 0;
+}
+
+
+//halts the VM because of an error in the program (VM_FAULT_*)
+void vm_fault (struct VM *vm, uint8_t fault) {
+    vm->fault = fault;
+    vm->flags |= VM_FLAG(F_HALT);
+}
+
+
+/*
+*  Pushes 'value' on the stack. SP points at the last value pushed and starts at 0,
+*  so the first push goes to 0xfffe.
+*  Returns 0, having faulted the VM, if the stack would go below 'stack_limit'.
+*/
+uint8_t vm_push (struct VM *vm, uint16_t value) {
+    uint16_t sp = vm->reg[VM_REG_SP] - 2;
+    if (sp < vm->stack_limit) {
+        vm_fault(vm, VM_FAULT_STACK);
+        return 0;
+    }
+    vm->reg[VM_REG_SP] = sp;
+    vm_write16(vm, sp, value);
+    return 1;
 }
 
 
+uint16_t vm_pop (struct VM *vm) {
+    uint16_t sp = vm->reg[VM_REG_SP];
+    vm->reg[VM_REG_SP] = sp + 2;
+    return vm_read16(vm, sp);
+}
+
+
+//sets or clears one flag (F_*)
+void vm_set_flag (struct VM *vm, uint8_t flag, uint8_t value) {
+    uint16_t flags = vm_flags(vm); //the flag may belong to a pending group
+    vm->flags = value ? flags | VM_FLAG(flag) : flags & ~VM_FLAG(flag);
+}
+
+
+void vm_step (struct VM *vm) {
+    if (vm->flags & VM_FLAG(F_HALT)) return;
+    VM_Decoded *op = vm_decode(vm, vm->pc);
+    uint8_t dkind = op->dkind, size = op->size;
+    uint16_t dval = op->dval;
+    vm->opcode = op->opcode;
+    vm->op_a = vm->reg[op->aval];
+    vm->op_src = vm_operand(vm, op->skind, op->sval);
+    vm->op_size = size;
+    VM_TRACE_OP(vm, vm->pc, op);
+    VM_PROFILE_OP(vm, vm->pc, op);
+    if (op->func(vm) == 0) {
+        vm_writeback(vm, dkind, dval);
+        vm->pc += size;
+    }
+}
+
@@ -15,18 +15,26 @@
 #include "lcd.h"
 #include "surface.h"
 #include "font.h"
+#include "input.h"
 #endif
 
-#define DEBUG
-//#define DEBUG_REG
-//#define DEBUG_FLAGS
-#define DEBUG_OP
+#include "trace.h"
 
 #define SHORT(h,l) ((h & 0x00ff) << 8) + (l & 0x00ff)
 #define HBYTE(i) (i >> 8) & 0xff
 #define LBYTE(i) i & 0xff
 #define OPCODE(vm, opname, smode, dmode) vm_get_opcode_from_string(vm, opname, smode, dmode)
 
+#define VM_DECODE_SIZE 256          //entries in the decoded instruction cache (power of two)
+#define VM_MAX_INSTRUCTION_SIZE 5   //opcode + 2 byte destination + 2 byte source
+#define VM_REG_COUNT 11              //r0..r9 and the stack pointer
+#define VM_REG_SP 10                //stack pointer, 'sp' in assembler
+#define VM_STACK_LIMIT 0xf000       //default lowest stack address, the stack grows down from 0xffff
+#define VM_FUSE_MAX 6               //longest run of 'mov imm, reg' fused into one entry
+#define VM_MAX_SPAN (VM_FUSE_MAX * 4 + 3) //bytes covered by the largest fused entry (movs + int)
+#define VM_PAGE_SIZE 256            //bytes per memory page
+#define VM_PAGE_COUNT (65536 / VM_PAGE_SIZE)
+
 
 #define F_HALT    0
 #define F_GREATER 1
@@ -42,45 +50,310 @@ static const char FLAG_NAMES[][4] = {
     "HLT", " GT", " LT", " EQ", "ZRO", "DAT", "OVR", "UND"
 };
 
+/*
+*  Flags are packed into struct VM 'flags', bit n is flag n.
+*  The ALU instructions set theirs lazily: they store their operands (cmp) or their wide
+*  result (add, sub, mul, inc, dec) and mark the group pending in 'lazy', the bits are only
+*  worked out when something reads them through vm_flags()/vm_flag().
+*/
+#define VM_FLAG(f) (1 << (f))
+
+//struct VM 'lazy' bits, groups of flags still to be evaluated
+#define VM_LAZY_CMP 0x01 //GT, LT, EQ and ZRO from cmp_a <=> cmp_b
+#define VM_LAZY_OVR 0x02 //OVR from ovr_val > 0xffff
+#define VM_LAZY_UND 0x04 //UND from und_val < 0
+
+
+
 
+//VM_Op flags
+#define VM_OP_RESULT 0x01 //writes op_dst to the destination (R0 when there is no destination operand)
+#define VM_OP_BRANCH 0x02 //may change the PC
+
+//Operand kinds of a decoded instruction
+#define VM_OPND_NONE 0 //no operand
+#define VM_OPND_REG  1 //register, value is the register index
+#define VM_OPND_IMM  2 //immediate value
+#define VM_OPND_MEM  3 //memory, value is the address
+#define VM_OPND_PTR  4 //pointer in memory, value is the address of the pointer
 
 
 struct VM;
 
+/*
+*  Operand modes (VM_Op smode/dmode): ' ' none (the ALU's R0), 'r' register, 'i' immediate,
+*  'm' memory, 'p' pointer. The three-operand ALU instructions take a destination register
+*  and smode 'R' (source register A, register B) or 'I' (source register A, immediate B).
+*/
 typedef struct {
     uint8_t opcode;
     char name[20];
     char smode, dmode;
+    uint8_t flags;
     uint8_t (*func)(struct VM *);
 } VM_Op;
 
 
+//Specialised handlers for vm_run(), selected when an instruction is decoded
+#define VM_H_GENERIC 0  //load operands, call the VM_Op function, write the result
+#define VM_H_HLT     1
+#define VM_H_NOP     2
+#define VM_H_INT     3
+#define VM_H_MOV_IR  4
+#define VM_H_MOV_RR  5
+#define VM_H_MOV_MR  6
+#define VM_H_MOV_RM  7
+#define VM_H_INC     8
+#define VM_H_DEC     9
+#define VM_H_ADD     10
+#define VM_H_SUB     11
+#define VM_H_MUL     12
+#define VM_H_SHL     13
+#define VM_H_SHR     14
+#define VM_H_CMP_I   15
+#define VM_H_CMP_R   16
+#define VM_H_JMP_I   17
+#define VM_H_JE_I    18
+#define VM_H_JNE_I   19
+#define VM_H_JZ_I    20
+#define VM_H_JNZ_I   21
+#define VM_H_JL_I    22
+#define VM_H_JLE_I   23
+#define VM_H_JG_I    24
+#define VM_H_JGE_I   25
+#define VM_H_CALL_I  26
+#define VM_H_RET     27
+#define VM_H_PUSH_I  28
+#define VM_H_PUSH_R  29
+#define VM_H_POP     30
+#define VM_H_PUSHM   31
+#define VM_H_POPM    32
+//three-operand ALU, 'dst = a op b' with b a register (_R) or an immediate (_I)
+#define VM_H_ADD3_R  33
+#define VM_H_ADD3_I  34
+#define VM_H_SUB3_R  35
+#define VM_H_SUB3_I  36
+#define VM_H_MUL3_R  37
+#define VM_H_MUL3_I  38
+#define VM_H_AND3_R  39
+#define VM_H_AND3_I  40
+#define VM_H_OR3_R   41
+#define VM_H_OR3_I   42
+#define VM_H_XOR3_R  43
+#define VM_H_XOR3_I  44
+#define VM_H_SHL3_R  45
+#define VM_H_SHL3_I  46
+#define VM_H_SHR3_R  47
+#define VM_H_SHR3_I  48
+//superinstructions, several instructions fused into one cache entry by vm_decode()
+#define VM_H_MOVI_N    49 //2..VM_FUSE_MAX 'mov imm, reg'
+#define VM_H_MOVI_INT  50 //1..VM_FUSE_MAX 'mov imm, reg' then 'int imm'
+#define VM_H_CMPI_JCC  51 //'cmp imm' then a conditional jump
+#define VM_H_CMPR_JCC  52 //'cmp reg' then a conditional jump
+#define VM_H_INC_JCC   53 //'inc reg', 'cmp' then a conditional jump
+#define VM_H_DEC_JCC   54 //'dec reg', 'cmp' then a conditional jump
+#define VM_H_COUNT     55
+
+//struct VM 'fuse' flags, which sequences vm_decode() fuses
+#define VM_FUSE_MOVI     0x01 //runs of 'mov imm, reg', optionally ending with 'int imm'
+#define VM_FUSE_CMP_JCC  0x02 //'cmp' + conditional jump
+#define VM_FUSE_STEP_JCC 0x04 //'inc'/'dec' + 'cmp' + conditional jump
+#define VM_FUSE_ALL      0x07
+
+//struct VM 'fault', why the VM halted other than by 'hlt'
+#define VM_FAULT_NONE   0
+#define VM_FAULT_STACK  1 //a push, pushm or call would have taken SP below 'stack_limit'
+#define VM_FAULT_OPCODE 2 //the byte at PC isn't an instruction
+#define VM_FAULT_MEMORY 3 //no RAM left for a page written to for the first time
+#define VM_FAULT_REGISTER 4 //the instruction at PC names a register past VM_REG_COUNT
+#define VM_FAULT_DIVIDE 5 //a div by zero
+
+//struct VM 'wait', what an interrupt left the VM blocked on (only a scheduler waits, see scheduler.h)
+#define VM_WAIT_NONE  0
+#define VM_WAIT_TIMER 1 //until vm_time_us() reaches 'wake_us'
+#define VM_WAIT_INPUT 2 //until the stdin instruction has something to read
+
+//vm_run() return codes
+#define VM_RUN_HALT      0 //the VM halted
+#define VM_RUN_BUDGET    1 //max_steps instructions were executed
+#define VM_RUN_INTERRUPT 2 //an interrupt handler asked to return control to the host
+
+//returned by translated code (see VM_Native) when the rest of the slice must run in the interpreter
+#define VM_NATIVE_EXIT   3
+
+//interrupt handler return codes
+#define VM_INT_CONTINUE 0
+#define VM_INT_YIELD    1 //return from vm_run() after this instruction
+
+
+//An instruction decoded once from memory, with its operand modes resolved
+typedef struct {
+    uint16_t pc;            //address of the instruction (cache tag)
+    uint8_t opcode;
+    uint8_t size;           //length in bytes, 0 if this cache entry is empty
+    uint8_t skind, dkind;   //VM_OPND_*
+    uint8_t handler;        //VM_H_*
+    uint8_t base;           //VM_H_* for this instruction alone, differs from 'handler' when fused
+    uint8_t count;          //instructions executed by 'handler'
+    uint8_t span;           //bytes covered by 'handler'
+    uint8_t aval;           //register A of a three-operand instruction, 0 (R0) for everything else
+    uint16_t sval, dval;    //register index, immediate value or address
+    uint8_t (*func)(struct VM *);
+} VM_Decoded;
+
+//Operands of a fused entry, kept alongside it (decoded[i] uses fused[i])
+typedef struct {
+    uint8_t reg[VM_FUSE_MAX];   //'mov imm, reg' destinations (including the first instruction)
+    uint16_t imm[VM_FUSE_MAX];  //and values
+    uint8_t cmp_kind;           //VM_OPND_IMM or VM_OPND_REG
+    uint16_t cmp_val;           //cmp immediate or register index
+    uint8_t cond;               //conditional jump, VM_COND_* bits
+    uint16_t target;            //jump target or interrupt number
+} VM_Fused;
+
+//a conditional jump is taken if any masked condition holds (inverted by VM_COND_NOT)
+#define VM_COND_GREATER 0x01
+#define VM_COND_LESS    0x02
+#define VM_COND_EQUAL   0x04
+#define VM_COND_ZERO    0x08
+#define VM_COND_NOT     0x80
+
+
+/*
+*  A program translated ahead of time to C by tools/vm2c.
+*  'run' behaves like vm_run() for the image it was generated from, see vm_run_native().
+*/
+typedef struct {
+    uint16_t origin;            //address the image is loaded at
+    uint32_t length;            //bytes in the image
+    const uint8_t *image;
+    uint8_t (*run)(struct VM *vm, uint32_t max_steps);
+} VM_Native;
+
+
+/*
+*  Memory is 64K in VM_PAGE_SIZE pages. A page starts out as the shared zero page, or as
+*  part of an image mapped with vm_map() (shared by every VM running it), and is copied
+*  to RAM of its own the first time it is written (see vm_write8()). Pages can also be
+*  a window onto memory outside the VM, such as the screen (see vm_map_window()).
+*/
 struct VM {
     uint16_t pc;            //Program Counter
-    uint16_t reg[10];       //Registers
-    uint8_t mem[65536];     //Memory for Program and Data
-    #ifdef PICO_LCD_BASE
-    Surface *video;
-    Font *font;
-    #endif
-    uint8_t flags[10];      //Status Flags
-    VM_Op opcodes[256];     //OpCodes available
-    uint8_t opcount;        //Count of OpCodes loaded
+    uint16_t reg[VM_REG_COUNT]; //Registers, reg[VM_REG_SP] is the stack pointer
+    const uint8_t *page[VM_PAGE_COUNT]; //Memory for Program and Data, read with vm_read8()
+    uint32_t page_own[VM_PAGE_COUNT / 32]; //bit n set if page[n] is writable (allocated by this VM, or a window)
+    uint32_t page_win[VM_PAGE_COUNT / 32]; //bit n set if page[n] is outside memory mapped with vm_map_window()
+    uint16_t pages;         //pages allocated
+    struct VM_Display *display;        //display list video interrupts go to, NULL to ignore them (see video.h)
+    struct VM_VideoQueue *video_queue; //if set they're queued for the display's owner instead
+    struct VM_Replay *replay;          //records or plays back what it reads from outside, NULL for neither (see snapshot.h)
+    struct InputQueue *input;          //where stdin reads from on the Pico, NULL for the stdio queue (see input.h)
+    uint16_t flags;         //Status Flags, bit n is flag n, read with vm_flags()/vm_flag()
+    uint8_t lazy;           //VM_LAZY_* groups not yet evaluated into 'flags'
+    uint16_t cmp_a, cmp_b;  //operands of the last cmp
+    uint32_t ovr_val;       //unwrapped result of the last add, mul or inc
+    int32_t und_val;        //signed result of the last sub or dec
     uint8_t opcode;
     uint16_t op_src, op_dst;
+    uint16_t op_a;          //register A of a three-operand instruction, R0 otherwise
     uint8_t op_size;
+    uint8_t yield;          //set by interrupt handlers returning VM_INT_YIELD
+    uint64_t icount;        //instructions executed
+    uint16_t stack_limit;   //lowest address the stack may use, 0 for no limit
+    uint8_t fault;          //VM_FAULT_*
+    uint8_t wait;           //VM_WAIT_*
+    uint64_t wake_us;       //end of a VM_WAIT_TIMER
+    VM_Decoded decoded[VM_DECODE_SIZE]; //direct-mapped cache of decoded instructions, by PC
+    VM_Fused fused[VM_DECODE_SIZE];     //operands of fused entries in 'decoded'
+    uint8_t fuse;                       //VM_FUSE_* enabled, call vm_invalidate(vm, 0, VM_DECODE_SIZE) after changing
+    uint32_t decoded_lo, decoded_hi;    //address range covered by cached instructions
+    const VM_Native *native;            //translation of the loaded program, NULL once its code is written to
+    uint32_t *verified;                 //a bit per byte from 'verified_lo', set where vm_verify() proved an instruction starts
+    uint32_t verified_lo, verified_hi;  //the image it verified, its instructions are decoded without checks until it's written to
+    #ifdef VM_TRACE
+    VM_Trace *trace;        //NULL when not tracing
+    #endif
+    #ifdef VM_PROFILE
+    struct VM_Profile *profile; //NULL when not profiling (see profile.h)
+    #endif
 };
 
 
+extern const uint8_t vm_zero_page[VM_PAGE_SIZE];
+
+const VM_Op *vm_find_op (const char *name, char smode, char dmode);
+const VM_Op *vm_find_opcode (uint8_t opcode);
+const VM_Op *vm_op_info (uint8_t opcode);
 uint8_t vm_get_opcode_from_string (struct VM *vm, char *opcode, char smode, char dmode);
-void vm_load_instruction (struct VM *vm, uint8_t opcode, char *name, char smode, char dmode, uint8_t (*fn)(struct VM *));
 void vm_init (struct VM *vm);
+void vm_free (struct VM *vm);
+uint32_t vm_ram (struct VM *vm);
 void vm_load (struct VM *vm, char *program, uint16_t length, uint16_t address);
+void vm_map (struct VM *vm, const uint8_t *image, uint32_t length, uint16_t address);
+uint8_t vm_page_own (struct VM *vm, uint8_t page);
+void vm_page_release (struct VM *vm, uint8_t n);
+uint32_t vm_map_window (struct VM *vm, uint16_t address, uint8_t *memory, uint32_t length);
+void vm_unmap_window (struct VM *vm);
+uint8_t vm_write8 (struct VM *vm, uint16_t addr, uint8_t value);
+uint8_t vm_write16 (struct VM *vm, uint16_t addr, uint16_t value);
+uint8_t vm_block_move (struct VM *vm, uint16_t dst, uint16_t src, uint16_t count);
+uint8_t vm_block_set (struct VM *vm, uint16_t dst, uint8_t value, uint16_t count);
+uint16_t vm_block_compare (struct VM *vm, uint16_t a, uint16_t b, uint16_t count);
+void vm_decode_at (struct VM *vm, uint16_t pc, VM_Decoded *op);
+VM_Decoded *vm_decode (struct VM *vm, uint16_t pc);
+void vm_invalidate (struct VM *vm, uint16_t addr, uint16_t len);
+void vm_cover (struct VM *vm, uint32_t lo, uint32_t hi);
+void vm_set_verified (struct VM *vm, uint16_t origin, uint32_t length, uint32_t *starts);
+uint16_t vm_operand (struct VM *vm, uint8_t kind, uint16_t value);
+void vm_writeback (struct VM *vm, uint8_t kind, uint16_t value);
 void vm_fetch (struct VM *vm);
+void vm_result (struct VM *vm);
 void vm_debug_mem (struct VM *vm, uint16_t addr, uint16_t len);
 void vm_debug_reg (struct VM *vm, uint8_t start, uint8_t count);
 void vm_debug_flags (struct VM *vm);
+void vm_flags_eval (struct VM *vm);
+void vm_set_flag (struct VM *vm, uint8_t flag, uint8_t value);
+void vm_fault (struct VM *vm, uint8_t fault);
+uint8_t vm_push (struct VM *vm, uint16_t value);
+uint16_t vm_pop (struct VM *vm);
 void vm_step (struct VM *vm);
+uint8_t vm_run (struct VM *vm, uint32_t max_steps);
+void vm_native_load (struct VM *vm, const VM_Native *native);
+void vm_native_step (struct VM *vm, uint16_t pc);
+uint8_t vm_run_native (struct VM *vm, uint32_t max_steps);
+#ifdef VM_TRACE
+void vm_trace_op (struct VM *vm, uint16_t pc, VM_Decoded *op);
+void vm_trace_int (struct VM *vm, uint16_t num);
+#endif
+
+
+#define VM_PAGE_OWNED(vm, n) (((vm)->page_own[(n) / 32] >> ((n) % 32)) & 1)
+#define VM_PAGE_WINDOW(vm, n) (((vm)->page_win[(n) / 32] >> ((n) % 32)) & 1)
+
+
+static inline uint8_t vm_read8 (struct VM *vm, uint16_t addr) {
+    return vm->page[addr / VM_PAGE_SIZE][addr % VM_PAGE_SIZE];
+}
+
+
+static inline uint16_t vm_read16 (struct VM *vm, uint16_t addr) {
+    if (addr % VM_PAGE_SIZE == VM_PAGE_SIZE - 1) return SHORT(vm_read8(vm, addr), vm_read8(vm, addr + 1));
+    const uint8_t *p = vm->page[addr / VM_PAGE_SIZE] + addr % VM_PAGE_SIZE;
+    return SHORT(p[0], p[1]);
+}
+
+
+//all flags, packed, with any pending ALU results evaluated
+static inline uint16_t vm_flags (struct VM *vm) {
+    if (vm->lazy != 0) vm_flags_eval(vm);
+    return vm->flags;
+}
+
+
+//one flag (F_*), 0 or 1
+static inline uint8_t vm_flag (struct VM *vm, uint8_t flag) {
+    return (vm_flags(vm) >> flag) & 1;
+}
 
 
 #endif
@@ -2,29 +2,256 @@
 #include "font.h"
 
 
+/*
+*  Returns the index of a character's glyph, characters outside the font are drawn as '?'
+*/
+static int font_glyph_index (Font *font, char ch) {
+    uint8_t code = (uint8_t)ch;
+    if (code < font->ascii_start || code > font->ascii_end) code = '?';
+    if (code < font->ascii_start || code > font->ascii_end) return -1;
+    return code - font->ascii_start;
+}
+
+
+/*
+*  Metrics of a glyph, fixed-cell fonts use the whole cell
+*/
+static FontGlyph font_glyph_metrics (Font *font, int index) {
+    if (font->glyphs != NULL) return font->glyphs[index];
+    FontGlyph glyph = { 0, font->width, 0, font->width };
+    return glyph;
+}
+
+
+/*
+*  Kerning adjustment between two characters (binary search of the sorted pair table)
+*/
+static int8_t font_kerning (Font *font, char left, char right) {
+    int lo = 0, hi = (int)font->kerning_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        const FontKern *kern = &font->kerning[mid];
+        int cmp = kern->left != left ? (uint8_t)kern->left - (uint8_t)left
+                                     : (uint8_t)kern->right - (uint8_t)right;
+        if (cmp == 0) return kern->adjust;
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return 0;
+}
+
+
+/*
+*  Moves the pen past the glyph at text[i], including spacing and kerning with the next character
+*/
+static int32_t font_advance (Font *font, FontGlyph *glyph, char *text, size_t i, size_t length) {
+    int32_t advance = glyph->advance + font->spacing;
+    if (font->kerning != NULL && i + 1 < length) advance += font_kerning(font, text[i], text[i + 1]);
+    return advance;
+}
+
+
+/*
+*  Linear interpolation between two RGB565 colours, 'alpha' is 0 (bg) to 32 (fg).
+*  The channels are spread out in a 32-bit word so all three are blended with one multiply.
+*/
+static inline uint16_t font_blend (uint16_t fg, uint16_t bg, uint8_t alpha) {
+    uint32_t f = (fg | ((uint32_t)fg << 16)) & 0x07e0f81f;
+    uint32_t b = (bg | ((uint32_t)bg << 16)) & 0x07e0f81f;
+    uint32_t r = ((((f - b) * alpha) >> 5) + b) & 0x07e0f81f;
+    return (uint16_t)(r | (r >> 16));
+}
+
+
+/*
+*  Blended colours for each coverage level against the most recently seen background.
+*  Entries are filled on first use, so a change of background costs nothing until it repeats.
+*/
+typedef struct {
+    uint16_t fg, bg;
+    uint8_t bpp;
+    uint16_t valid;
+    uint16_t colour[16];
+} FontRamp;
+
+static FontRamp font_ramp = { 0, 0, 0, 0 };
+
+
+static inline uint16_t font_ramp_lookup (uint16_t fg, uint16_t bg, uint8_t level, uint8_t bpp) {
+    if (font_ramp.fg != fg || font_ramp.bg != bg || font_ramp.bpp != bpp) {
+        font_ramp.fg = fg;
+        font_ramp.bg = bg;
+        font_ramp.bpp = bpp;
+        font_ramp.valid = 0;
+    }
+    if ((font_ramp.valid & (1 << level)) == 0) {
+        uint8_t max = (1 << bpp) - 1;
+        font_ramp.colour[level] = font_blend(fg, bg, (level * 32 + max / 2) / max);
+        font_ramp.valid |= 1 << level;
+    }
+    return font_ramp.colour[level];
+}
+
+
+/*
+*  Draws a glyph of packed 2bpp/4bpp coverage, blending 'colour' over the existing pixels
+*/
+static void font_draw_glyph_aa (Surface *surface, Font *font, int index, FontGlyph *glyph, int32_t gx, uint16_t y, uint16_t colour) {
+    uint8_t bpp = font->bpp, max = (1 << bpp) - 1;
+    uint16_t row_bytes = (font->width * bpp + 7) / 8;
+    const uint8_t *cell = (const uint8_t *)font->data + row_bytes * font->height * index;
+    for (uint8_t py = 0; py < font->height && y + py < surface->height; py++) {
+        const uint8_t *row = cell + py * row_bytes;
+        uint16_t *line = &surface->pixels[(y + py) * surface->width];
+        for (uint8_t col = glyph->offset; col < glyph->offset + glyph->width; col++) {
+            uint16_t bit = col * bpp;
+            uint8_t level = (row[bit >> 3] >> (8 - bpp - (bit & 7))) & max;
+            if (level == 0) continue;
+            int32_t px = gx + col;
+            if (px < 0 || px >= surface->width) continue;
+            if (level == max) {
+                surface_putpixel(surface, px, y + py, colour);
+                continue;
+            }
+            uint16_t bg = line[px];
+            bg = ((bg << 8) & 0xff00) | (bg >> 8);
+            surface_putpixel(surface, px, y + py, font_ramp_lookup(colour, bg, level, bpp));
+        }
+    }
+}
+
+
+/*
+*  Draws a glyph of ' '/'#' character cells
+*/
+static void font_draw_glyph (Surface *surface, Font *font, int index, FontGlyph *glyph, int32_t gx, uint16_t y, uint16_t colour) {
+    char *cell = font->data + font->width * font->height * index;
+    for (uint8_t py = 0; py < font->height && y + py < surface->height; py++) {
+        for (uint8_t col = glyph->offset; col < glyph->offset + glyph->width; col++) {
+            if (cell[py * font->width + col] == ' ') continue;
+            int32_t px = gx + col;
+            if (px < 0 || px >= surface->width) continue;
+            surface_putpixel(surface, px, y + py, colour);
+        }
+    }
+}
+
 
 void font_print (Surface *surface, Font *font, char *text, uint16_t x, uint16_t y, uint16_t colour) {
-    uint8_t font_size = font->width * font->height, px = 0, py = 0;
-    for (uint8_t i = 0, l = strlen(text); i < l; i++) {
-        uint8_t code = (text[i] >= font->ascii_start ? text[i] - font->ascii_start : '?');
-        if (code < 0 || code >= font->ascii_end - font->ascii_start) continue;
-        uint16_t idx = font_size * code;
-        px = i * (font->width + font->spacing);
-        py = 0;
-        for (uint16_t offset = 0; offset < font_size; offset++) {
-            char pixel = font->data[idx + offset];
-            if (pixel != ' ' 
-             && x + px < surface->width 
-             && y + py < surface->height) {
-                surface_putpixel(surface, x + px, y + py, colour);
+    int32_t pen = x;
+    for (size_t i = 0, l = strlen(text); i < l; i++) {
+        int index = font_glyph_index(font, text[i]);
+        if (index < 0) continue;
+        FontGlyph glyph = font_glyph_metrics(font, index);
+        int32_t gx = pen + glyph.bearing - glyph.offset;
+        if (font->bpp > 1) font_draw_glyph_aa(surface, font, index, &glyph, gx, y, colour);
+        else font_draw_glyph(surface, font, index, &glyph, gx, y, colour);
+        pen += font_advance(font, &glyph, text, i, l);
+    }
+}
+
+
+/*
+*  Returns the row bitmask of a glyph, built from the character cell if the font has no row table
+*/
+static uint8_t font_glyph_row (Font *font, int index, uint8_t py) {
+    if (font->rows != NULL) return font->rows[index * font->height + py];
+    char *row = font->data + font->width * (font->height * index + py);
+    uint8_t mask = 0;
+    for (uint8_t col = 0; col < font->width; col++) {
+        mask = (mask << 1) | (row[col] != ' ');
+    }
+    return mask;
+}
+
+
+/*
+*  Row bitmask of a character's glyph, for code that generates pixels itself (e.g. scanline rendering)
+*/
+uint8_t font_row (Font *font, char ch, uint8_t py) {
+    int index = font_glyph_index(font, ch);
+    if (index < 0 || py >= font->height || font->width > 8 || font->bpp > 1) return 0;
+    return font_glyph_row(font, index, py);
+}
+
+
+/*
+*  Draws text at an integer multiple of the font size.
+*  Each run of set bits in a glyph row becomes one span of 'scale' pixels per column,
+*  which is then filled on 'scale' consecutive lines.
+*  Only ' '/'#' fonts up to 8 pixels wide are supported.
+*/
+void font_print_scaled (Surface *surface, Font *font, char *text, uint16_t x, uint16_t y, uint8_t scale, uint16_t colour) {
+    if (scale == 0 || font->bpp > 1 || font->width > 8) return;
+    colour = ((colour << 8) & 0xff00) | (colour >> 8);
+    int32_t pen = x;
+    for (size_t i = 0, l = strlen(text); i < l; i++) {
+        int index = font_glyph_index(font, text[i]);
+        if (index < 0) continue;
+        FontGlyph glyph = font_glyph_metrics(font, index);
+        int32_t gx = pen + (glyph.bearing - glyph.offset) * scale;
+        for (uint8_t py = 0; py < font->height; py++) {
+            int32_t dy = y + py * scale;
+            if (dy >= surface->height) break;
+            uint8_t mask = font_glyph_row(font, index, py);
+            int32_t spans[4][2];
+            uint8_t count = 0;
+            for (uint8_t col = glyph.offset; col < glyph.offset + glyph.width; ) {
+                if ((mask & (1 << (font->width - 1 - col))) == 0) {
+                    col++;
+                    continue;
+                }
+                uint8_t start = col;
+                while (col < glyph.offset + glyph.width && (mask & (1 << (font->width - 1 - col)))) col++;
+                int32_t sx = gx + start * scale, ex = gx + col * scale;
+                if (sx < 0) sx = 0;
+                if (ex > surface->width) ex = surface->width;
+                if (sx >= ex) continue;
+                spans[count][0] = sx;
+                spans[count][1] = ex;
+                count++;
             }
-            if (offset % font->width == font->width - 1) {
-                py++;
-                px = i * (font->width + font->spacing);
-            } else {
-                px++;
+            for (uint8_t sy = 0; sy < scale && dy + sy < surface->height; sy++) {
+                uint16_t *line = &surface->pixels[(dy + sy) * surface->width];
+                for (uint8_t s = 0; s < count; s++) {
+                    for (int32_t px = spans[s][0]; px < spans[s][1]; px++) line[px] = colour;
+                }
             }
         }
+        pen += font_advance(font, &glyph, text, i, l) * scale;
     }
 }
 
+
+/*
+*  Returns the box that font_print() would cover for 'text' drawn at (0,0), without drawing.
+*  'x' is negative if the first glyph has a negative bearing.
+*/
+Rect font_measure (Font *font, char *text) {
+    int32_t pen = 0, left = 0, right = 0;
+    for (size_t i = 0, l = strlen(text); i < l; i++) {
+        int index = font_glyph_index(font, text[i]);
+        if (index < 0) continue;
+        FontGlyph glyph = font_glyph_metrics(font, index);
+        if (glyph.width > 0) {
+            if (pen + glyph.bearing < left) left = pen + glyph.bearing;
+            if (pen + glyph.bearing + glyph.width > right) right = pen + glyph.bearing + glyph.width;
+        }
+        if (pen + glyph.advance > right) right = pen + glyph.advance;
+        pen += font_advance(font, &glyph, text, i, l);
+    }
+    Rect bounds = { left, 0, right - left, font->height };
+    return bounds;
+}
+
+
+/*
+*  Draws one character centred in a cell of the font's full width, so that text laid out
+*  on a grid (the terminal, I_VIDEO_PRINT) still lines up with a proportional font
+*/
+void font_print_cell (Surface *surface, Font *font, char ch, uint16_t x, uint16_t y, uint16_t colour) {
+    char text[2] = { ch, 0 };
+    Rect bounds = font_measure(font, text);
+    int32_t cx = x + ((int32_t)font->width - bounds.w) / 2 - bounds.x;
+    font_print(surface, font, text, cx < 0 ? 0 : cx, y, colour);
+}
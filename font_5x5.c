@@ -576,3 +576,213 @@ const char font_5x5[] = "" \
     "     " \
     \
     "";
+
+
+//per-glyph metrics for proportional layout: { offset, width, bearing, advance }
+const FontGlyph font_5x5_glyphs[] = {
+    { 0, 0, 0, 3 }, //' '
+    { 2, 1, 0, 1 }, //'!'
+    { 1, 3, 0, 3 }, //'"'
+    { 0, 5, 0, 5 }, //'#'
+    { 0, 5, 0, 5 }, //'$'
+    { 0, 5, 0, 5 }, //'%'
+    { 0, 5, 0, 5 }, //'&'
+    { 2, 1, 0, 1 }, //'\''
+    { 2, 2, 0, 2 }, //'('
+    { 1, 2, 0, 2 }, //')'
+    { 0, 5, 0, 5 }, //'*'
+    { 1, 3, 0, 3 }, //'+'
+    { 0, 2, 0, 2 }, //','
+    { 1, 3, 0, 3 }, //'-'
+    { 0, 1, 0, 1 }, //'.'
+    { 0, 5, 0, 5 }, //'/'
+    { 0, 5, 0, 5 }, //'0'
+    { 1, 3, 0, 3 }, //'1'
+    { 0, 5, 0, 5 }, //'2'
+    { 0, 5, 0, 5 }, //'3'
+    { 0, 5, 0, 5 }, //'4'
+    { 0, 5, 0, 5 }, //'5'
+    { 0, 5, 0, 5 }, //'6'
+    { 0, 5, 0, 5 }, //'7'
+    { 0, 5, 0, 5 }, //'8'
+    { 0, 5, 0, 5 }, //'9'
+    { 2, 1, 0, 1 }, //':'
+    { 1, 2, 0, 2 }, //';'
+    { 1, 3, 0, 3 }, //'<'
+    { 1, 3, 0, 3 }, //'='
+    { 1, 3, 0, 3 }, //'>'
+    { 1, 4, 0, 4 }, //'?'
+    { 0, 5, 0, 5 }, //'@'
+    { 0, 5, 0, 5 }, //'A'
+    { 0, 5, 0, 5 }, //'B'
+    { 0, 5, 0, 5 }, //'C'
+    { 0, 5, 0, 5 }, //'D'
+    { 0, 5, 0, 5 }, //'E'
+    { 0, 5, 0, 5 }, //'F'
+    { 0, 5, 0, 5 }, //'G'
+    { 0, 5, 0, 5 }, //'H'
+    { 1, 3, 0, 3 }, //'I'
+    { 0, 5, 0, 5 }, //'J'
+    { 0, 4, 0, 4 }, //'K'
+    { 0, 5, 0, 5 }, //'L'
+    { 0, 5, 0, 5 }, //'M'
+    { 0, 5, 0, 5 }, //'N'
+    { 0, 5, 0, 5 }, //'O'
+    { 0, 5, 0, 5 }, //'P'
+    { 0, 5, 0, 5 }, //'Q'
+    { 0, 5, 0, 5 }, //'R'
+    { 0, 5, 0, 5 }, //'S'
+    { 0, 5, 0, 5 }, //'T'
+    { 0, 5, 0, 5 }, //'U'
+    { 0, 5, 0, 5 }, //'V'
+    { 0, 5, 0, 5 }, //'W'
+    { 0, 5, 0, 5 }, //'X'
+    { 0, 5, 0, 5 }, //'Y'
+    { 0, 5, 0, 5 }, //'Z'
+    { 2, 2, 0, 2 }, //'['
+    { 0, 5, 0, 5 }, //'\\'
+    { 1, 2, 0, 2 }, //']'
+    { 1, 3, 0, 3 }, //'^'
+    { 0, 5, 0, 5 }, //'_'
+    { 2, 2, 0, 2 }, //'`'
+    { 0, 5, 0, 5 }, //'a'
+    { 0, 5, 0, 5 }, //'b'
+    { 0, 5, 0, 5 }, //'c'
+    { 0, 5, 0, 5 }, //'d'
+    { 0, 5, 0, 5 }, //'e'
+    { 1, 4, 0, 4 }, //'f'
+    { 0, 5, 0, 5 }, //'g'
+    { 0, 5, 0, 5 }, //'h'
+    { 2, 1, 0, 1 }, //'i'
+    { 0, 3, 0, 3 }, //'j'
+    { 0, 5, 0, 5 }, //'k'
+    { 2, 2, 0, 2 }, //'l'
+    { 0, 5, 0, 5 }, //'m'
+    { 0, 5, 0, 5 }, //'n'
+    { 0, 5, 0, 5 }, //'o'
+    { 0, 5, 0, 5 }, //'p'
+    { 0, 5, 0, 5 }, //'q'
+    { 0, 5, 0, 5 }, //'r'
+    { 0, 5, 0, 5 }, //'s'
+    { 1, 3, 0, 3 }, //'t'
+    { 0, 5, 0, 5 }, //'u'
+    { 0, 5, 0, 5 }, //'v'
+    { 0, 5, 0, 5 }, //'w'
+    { 0, 5, 0, 5 }, //'x'
+    { 0, 5, 0, 5 }, //'y'
+    { 0, 5, 0, 5 }, //'z'
+    { 1, 3, 0, 3 }, //'{'
+    { 2, 1, 0, 1 }, //'|'
+    { 1, 3, 0, 3 }, //'}'
+    { 0, 5, 0, 5 }, //'~'
+};
+
+
+//glyph rows as bitmasks (leftmost column in bit 4), for fast/scaled drawing
+const uint8_t font_5x5_rows[] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, //' '
+    0x04, 0x04, 0x04, 0x00, 0x04, //'!'
+    0x0a, 0x00, 0x00, 0x00, 0x00, //'"'
+    0x0a, 0x1f, 0x0a, 0x1f, 0x0a, //'#'
+    0x0f, 0x14, 0x0e, 0x05, 0x1e, //'$'
+    0x11, 0x02, 0x04, 0x08, 0x11, //'%'
+    0x0e, 0x11, 0x0e, 0x15, 0x0d, //'&'
+    0x04, 0x00, 0x00, 0x00, 0x00, //'\''
+    0x02, 0x04, 0x04, 0x04, 0x02, //'('
+    0x08, 0x04, 0x04, 0x04, 0x08, //')'
+    0x15, 0x0e, 0x15, 0x00, 0x00, //'*'
+    0x00, 0x04, 0x0e, 0x04, 0x00, //'+'
+    0x00, 0x00, 0x00, 0x08, 0x10, //','
+    0x00, 0x00, 0x0e, 0x00, 0x00, //'-'
+    0x00, 0x00, 0x00, 0x00, 0x10, //'.'
+    0x01, 0x02, 0x04, 0x08, 0x10, //'/'
+    0x0e, 0x11, 0x15, 0x11, 0x0e, //'0'
+    0x04, 0x0c, 0x04, 0x04, 0x0e, //'1'
+    0x0e, 0x11, 0x06, 0x08, 0x1f, //'2'
+    0x1e, 0x01, 0x0e, 0x01, 0x1e, //'3'
+    0x10, 0x12, 0x12, 0x1f, 0x02, //'4'
+    0x1f, 0x10, 0x1e, 0x01, 0x1e, //'5'
+    0x0e, 0x10, 0x1e, 0x11, 0x0e, //'6'
+    0x1f, 0x01, 0x02, 0x04, 0x04, //'7'
+    0x0e, 0x11, 0x0e, 0x11, 0x0e, //'8'
+    0x0e, 0x11, 0x0f, 0x01, 0x0e, //'9'
+    0x00, 0x04, 0x00, 0x04, 0x00, //':'
+    0x00, 0x04, 0x00, 0x04, 0x08, //';'
+    0x02, 0x04, 0x08, 0x04, 0x02, //'<'
+    0x00, 0x0e, 0x00, 0x0e, 0x00, //'='
+    0x08, 0x04, 0x02, 0x04, 0x08, //'>'
+    0x0e, 0x01, 0x06, 0x00, 0x04, //'?'
+    0x0e, 0x15, 0x17, 0x10, 0x0f, //'@'
+    0x0e, 0x11, 0x1f, 0x11, 0x11, //'A'
+    0x1e, 0x11, 0x1e, 0x11, 0x1e, //'B'
+    0x0e, 0x11, 0x10, 0x11, 0x0e, //'C'
+    0x1e, 0x11, 0x11, 0x11, 0x1e, //'D'
+    0x1f, 0x10, 0x1c, 0x10, 0x1f, //'E'
+    0x1f, 0x10, 0x1c, 0x10, 0x10, //'F'
+    0x0f, 0x10, 0x13, 0x11, 0x0f, //'G'
+    0x11, 0x11, 0x1f, 0x11, 0x11, //'H'
+    0x0e, 0x04, 0x04, 0x04, 0x0e, //'I'
+    0x07, 0x02, 0x02, 0x12, 0x0c, //'J'
+    0x12, 0x14, 0x18, 0x14, 0x12, //'K'
+    0x10, 0x10, 0x10, 0x10, 0x1f, //'L'
+    0x0e, 0x15, 0x15, 0x11, 0x11, //'M'
+    0x11, 0x19, 0x15, 0x13, 0x11, //'N'
+    0x0e, 0x11, 0x11, 0x11, 0x0e, //'O'
+    0x1e, 0x11, 0x1e, 0x10, 0x10, //'P'
+    0x0e, 0x11, 0x15, 0x13, 0x0d, //'Q'
+    0x1e, 0x11, 0x1e, 0x11, 0x11, //'R'
+    0x0f, 0x10, 0x0e, 0x01, 0x1e, //'S'
+    0x1f, 0x04, 0x04, 0x04, 0x04, //'T'
+    0x11, 0x11, 0x11, 0x11, 0x0e, //'U'
+    0x11, 0x11, 0x11, 0x0a, 0x04, //'V'
+    0x11, 0x11, 0x15, 0x15, 0x0a, //'W'
+    0x11, 0x11, 0x0e, 0x11, 0x11, //'X'
+    0x11, 0x11, 0x0e, 0x04, 0x04, //'Y'
+    0x1f, 0x01, 0x0e, 0x10, 0x1f, //'Z'
+    0x06, 0x04, 0x04, 0x04, 0x06, //'['
+    0x10, 0x08, 0x04, 0x02, 0x01, //'\\'
+    0x0c, 0x04, 0x04, 0x04, 0x0c, //']'
+    0x04, 0x0a, 0x00, 0x00, 0x00, //'^'
+    0x00, 0x00, 0x00, 0x00, 0x1f, //'_'
+    0x04, 0x02, 0x00, 0x00, 0x00, //'`'
+    0x0e, 0x01, 0x0f, 0x11, 0x0f, //'a'
+    0x10, 0x10, 0x1e, 0x11, 0x1e, //'b'
+    0x00, 0x00, 0x0f, 0x10, 0x0f, //'c'
+    0x01, 0x01, 0x0f, 0x11, 0x0f, //'d'
+    0x0e, 0x11, 0x1f, 0x10, 0x0f, //'e'
+    0x07, 0x04, 0x06, 0x04, 0x0c, //'f'
+    0x0e, 0x11, 0x0e, 0x01, 0x1e, //'g'
+    0x10, 0x10, 0x1e, 0x11, 0x11, //'h'
+    0x04, 0x00, 0x04, 0x04, 0x04, //'i'
+    0x04, 0x00, 0x04, 0x04, 0x1c, //'j'
+    0x10, 0x14, 0x18, 0x16, 0x11, //'k'
+    0x04, 0x04, 0x04, 0x04, 0x06, //'l'
+    0x00, 0x0a, 0x15, 0x11, 0x11, //'m'
+    0x00, 0x00, 0x1e, 0x11, 0x11, //'n'
+    0x00, 0x00, 0x0e, 0x11, 0x0e, //'o'
+    0x00, 0x1e, 0x11, 0x1e, 0x10, //'p'
+    0x00, 0x0f, 0x11, 0x0f, 0x01, //'q'
+    0x00, 0x0e, 0x11, 0x10, 0x10, //'r'
+    0x0e, 0x10, 0x0e, 0x01, 0x0e, //'s'
+    0x00, 0x04, 0x0e, 0x04, 0x06, //'t'
+    0x00, 0x00, 0x11, 0x11, 0x0e, //'u'
+    0x00, 0x00, 0x11, 0x0a, 0x04, //'v'
+    0x00, 0x00, 0x11, 0x15, 0x0a, //'w'
+    0x00, 0x00, 0x11, 0x0e, 0x11, //'x'
+    0x00, 0x11, 0x0f, 0x01, 0x0e, //'y'
+    0x00, 0x1f, 0x02, 0x08, 0x1f, //'z'
+    0x06, 0x04, 0x0c, 0x04, 0x06, //'{'
+    0x04, 0x04, 0x04, 0x04, 0x04, //'|'
+    0x0c, 0x04, 0x06, 0x04, 0x0c, //'}'
+    0x0d, 0x12, 0x00, 0x00, 0x00, //'~'
+};
+
+
+Font font_small = {
+    (char *)font_5x5,
+    5, 5, 1,
+    32, 126,
+    font_5x5_glyphs, NULL, 0,
+    0,
+    font_5x5_rows
+};
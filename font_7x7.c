@@ -766,3 +766,212 @@ const char font_7x7[] = "" \
     "       " \
     "";
 
+
+//per-glyph metrics for proportional layout: { offset, width, bearing, advance }
+const FontGlyph font_7x7_glyphs[] = {
+    { 0, 0, 0, 4 }, //' '
+    { 0, 1, 0, 1 }, //'!'
+    { 1, 5, 0, 5 }, //'"'
+    { 1, 5, 0, 5 }, //'#'
+    { 0, 7, 0, 7 }, //'$'
+    { 0, 7, 0, 7 }, //'%'
+    { 0, 7, 0, 7 }, //'&'
+    { 2, 2, 0, 2 }, //'\''
+    { 4, 3, 0, 3 }, //'('
+    { 0, 3, 0, 3 }, //')'
+    { 1, 5, 0, 5 }, //'*'
+    { 1, 5, 0, 5 }, //'+'
+    { 0, 2, 0, 2 }, //','
+    { 1, 5, 0, 5 }, //'-'
+    { 0, 2, 0, 2 }, //'.'
+    { 0, 7, 0, 7 }, //'/'
+    { 0, 7, 0, 7 }, //'0'
+    { 2, 3, 0, 3 }, //'1'
+    { 0, 7, 0, 7 }, //'2'
+    { 0, 7, 0, 7 }, //'3'
+    { 0, 7, 0, 7 }, //'4'
+    { 0, 7, 0, 7 }, //'5'
+    { 0, 7, 0, 7 }, //'6'
+    { 0, 7, 0, 7 }, //'7'
+    { 0, 7, 0, 7 }, //'8'
+    { 0, 7, 0, 7 }, //'9'
+    { 0, 1, 0, 1 }, //':'
+    { 0, 2, 0, 2 }, //';'
+    { 3, 4, 0, 4 }, //'<'
+    { 1, 5, 0, 5 }, //'='
+    { 0, 4, 0, 4 }, //'>'
+    { 0, 5, 0, 5 }, //'?'
+    { 0, 7, 0, 7 }, //'@'
+    { 0, 7, 0, 7 }, //'A'
+    { 0, 7, 0, 7 }, //'B'
+    { 0, 7, 0, 7 }, //'C'
+    { 0, 7, 0, 7 }, //'D'
+    { 0, 7, 0, 7 }, //'E'
+    { 0, 7, 0, 7 }, //'F'
+    { 0, 7, 0, 7 }, //'G'
+    { 0, 7, 0, 7 }, //'H'
+    { 0, 7, 0, 7 }, //'I'
+    { 0, 7, 0, 7 }, //'J'
+    { 0, 7, 0, 7 }, //'K'
+    { 0, 7, 0, 7 }, //'L'
+    { 0, 7, 0, 7 }, //'M'
+    { 0, 7, 0, 7 }, //'N'
+    { 0, 7, 0, 7 }, //'O'
+    { 0, 7, 0, 7 }, //'P'
+    { 0, 7, 0, 7 }, //'Q'
+    { 0, 7, 0, 7 }, //'R'
+    { 0, 7, 0, 7 }, //'S'
+    { 0, 7, 0, 7 }, //'T'
+    { 0, 7, 0, 7 }, //'U'
+    { 0, 7, 0, 7 }, //'V'
+    { 0, 7, 0, 7 }, //'W'
+    { 0, 7, 0, 7 }, //'X'
+    { 0, 7, 0, 7 }, //'Y'
+    { 0, 7, 0, 7 }, //'Z'
+    { 2, 3, 0, 3 }, //'['
+    { 0, 7, 0, 7 }, //'\\'
+    { 2, 3, 0, 3 }, //']'
+    { 1, 5, 0, 5 }, //'^'
+    { 0, 7, 0, 7 }, //'_'
+    { 2, 3, 0, 3 }, //'`'
+    { 0, 7, 0, 7 }, //'a'
+    { 0, 7, 0, 7 }, //'b'
+    { 0, 7, 0, 7 }, //'c'
+    { 0, 7, 0, 7 }, //'d'
+    { 0, 7, 0, 7 }, //'e'
+    { 0, 7, 0, 7 }, //'f'
+    { 0, 7, 0, 7 }, //'g'
+    { 0, 7, 0, 7 }, //'h'
+    { 1, 5, 0, 5 }, //'i'
+    { 0, 7, 0, 7 }, //'j'
+    { 0, 7, 0, 7 }, //'k'
+    { 1, 5, 0, 5 }, //'l'
+    { 0, 7, 0, 7 }, //'m'
+    { 0, 7, 0, 7 }, //'n'
+    { 0, 7, 0, 7 }, //'o'
+    { 0, 7, 0, 7 }, //'p'
+    { 0, 7, 0, 7 }, //'q'
+    { 0, 7, 0, 7 }, //'r'
+    { 0, 7, 0, 7 }, //'s'
+    { 0, 7, 0, 7 }, //'t'
+    { 0, 7, 0, 7 }, //'u'
+    { 0, 7, 0, 7 }, //'v'
+    { 0, 7, 0, 7 }, //'w'
+    { 0, 7, 0, 7 }, //'x'
+    { 0, 7, 0, 7 }, //'y'
+    { 0, 7, 0, 7 }, //'z'
+    { 2, 4, 0, 4 }, //'{'
+    { 3, 1, 0, 1 }, //'|'
+    { 1, 4, 0, 4 }, //'}'
+    { 0, 7, 0, 7 }, //'~'
+};
+
+
+//glyph rows as bitmasks (leftmost column in bit 6), for fast/scaled drawing
+const uint8_t font_7x7_rows[] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, //' '
+    0x40, 0x40, 0x40, 0x40, 0x40, 0x00, 0x40, //'!'
+    0x36, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, //'"'
+    0x00, 0x14, 0x3e, 0x14, 0x3e, 0x14, 0x00, //'#'
+    0x14, 0x3f, 0x54, 0x3e, 0x15, 0x7e, 0x14, //'$'
+    0x61, 0x62, 0x04, 0x08, 0x10, 0x23, 0x43, //'%'
+    0x00, 0x0c, 0x12, 0x3e, 0x52, 0x4e, 0x3b, //'&'
+    0x18, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, //'\''
+    0x01, 0x02, 0x04, 0x04, 0x04, 0x02, 0x01, //'('
+    0x40, 0x20, 0x10, 0x10, 0x10, 0x20, 0x40, //')'
+    0x2a, 0x1c, 0x2a, 0x00, 0x00, 0x00, 0x00, //'*'
+    0x00, 0x08, 0x08, 0x3e, 0x08, 0x08, 0x00, //'+'
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0x20, //','
+    0x00, 0x00, 0x00, 0x3e, 0x00, 0x00, 0x00, //'-'
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0x60, //'.'
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, //'/'
+    0x3e, 0x41, 0x49, 0x49, 0x49, 0x41, 0x3e, //'0'
+    0x08, 0x18, 0x08, 0x08, 0x08, 0x08, 0x1c, //'1'
+    0x3e, 0x41, 0x01, 0x0e, 0x30, 0x40, 0x7f, //'2'
+    0x3e, 0x41, 0x01, 0x06, 0x01, 0x41, 0x3e, //'3'
+    0x40, 0x40, 0x44, 0x44, 0x3f, 0x04, 0x04, //'4'
+    0x7f, 0x40, 0x7e, 0x01, 0x01, 0x41, 0x3e, //'5'
+    0x3e, 0x41, 0x40, 0x7e, 0x41, 0x41, 0x3e, //'6'
+    0x7f, 0x01, 0x02, 0x04, 0x04, 0x04, 0x04, //'7'
+    0x3e, 0x41, 0x3e, 0x41, 0x41, 0x41, 0x3e, //'8'
+    0x3e, 0x41, 0x41, 0x3f, 0x01, 0x41, 0x3e, //'9'
+    0x00, 0x40, 0x40, 0x00, 0x40, 0x40, 0x00, //':'
+    0x00, 0x20, 0x20, 0x00, 0x20, 0x40, 0x00, //';'
+    0x01, 0x02, 0x04, 0x08, 0x04, 0x02, 0x01, //'<'
+    0x00, 0x00, 0x3e, 0x00, 0x3e, 0x00, 0x00, //'='
+    0x40, 0x20, 0x10, 0x08, 0x10, 0x20, 0x40, //'>'
+    0x38, 0x44, 0x44, 0x18, 0x10, 0x00, 0x10, //'?'
+    0x3e, 0x41, 0x4d, 0x51, 0x4e, 0x40, 0x3e, //'@'
+    0x3e, 0x41, 0x41, 0x7f, 0x41, 0x41, 0x41, //'A'
+    0x7e, 0x41, 0x41, 0x7e, 0x41, 0x41, 0x7e, //'B'
+    0x3e, 0x41, 0x40, 0x40, 0x40, 0x41, 0x3e, //'C'
+    0x7c, 0x42, 0x41, 0x41, 0x41, 0x42, 0x7c, //'D'
+    0x7f, 0x40, 0x40, 0x7c, 0x40, 0x40, 0x7f, //'E'
+    0x7f, 0x40, 0x40, 0x7c, 0x40, 0x40, 0x40, //'F'
+    0x3e, 0x41, 0x40, 0x40, 0x47, 0x41, 0x3e, //'G'
+    0x41, 0x41, 0x41, 0x7f, 0x41, 0x41, 0x41, //'H'
+    0x7f, 0x08, 0x08, 0x08, 0x08, 0x08, 0x7f, //'I'
+    0x03, 0x01, 0x01, 0x01, 0x41, 0x41, 0x3e, //'J'
+    0x41, 0x42, 0x4c, 0x70, 0x4c, 0x42, 0x41, //'K'
+    0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x7f, //'L'
+    0x41, 0x63, 0x55, 0x49, 0x41, 0x41, 0x41, //'M'
+    0x41, 0x61, 0x51, 0x49, 0x45, 0x43, 0x41, //'N'
+    0x3e, 0x41, 0x41, 0x41, 0x41, 0x41, 0x3e, //'O'
+    0x7e, 0x41, 0x41, 0x7e, 0x40, 0x40, 0x40, //'P'
+    0x3e, 0x41, 0x41, 0x41, 0x45, 0x42, 0x3d, //'Q'
+    0x7e, 0x41, 0x41, 0x7e, 0x44, 0x42, 0x41, //'R'
+    0x3f, 0x40, 0x40, 0x3e, 0x01, 0x01, 0x7e, //'S'
+    0x7f, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, //'T'
+    0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x3e, //'U'
+    0x41, 0x41, 0x41, 0x41, 0x22, 0x14, 0x08, //'V'
+    0x41, 0x41, 0x41, 0x49, 0x49, 0x49, 0x36, //'W'
+    0x41, 0x41, 0x22, 0x1c, 0x22, 0x41, 0x41, //'X'
+    0x41, 0x41, 0x41, 0x3f, 0x01, 0x41, 0x3e, //'Y'
+    0x7f, 0x02, 0x04, 0x08, 0x10, 0x20, 0x7f, //'Z'
+    0x1c, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1c, //'['
+    0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, //'\\'
+    0x1c, 0x04, 0x04, 0x04, 0x04, 0x04, 0x1c, //']'
+    0x08, 0x14, 0x22, 0x00, 0x00, 0x00, 0x00, //'^'
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7f, //'_'
+    0x18, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x00, //'`'
+    0x00, 0x3e, 0x01, 0x3f, 0x41, 0x41, 0x3e, //'a'
+    0x40, 0x40, 0x7e, 0x41, 0x41, 0x41, 0x3e, //'b'
+    0x00, 0x00, 0x3e, 0x41, 0x40, 0x41, 0x3e, //'c'
+    0x01, 0x01, 0x3f, 0x41, 0x41, 0x41, 0x3e, //'d'
+    0x00, 0x00, 0x3e, 0x41, 0x7e, 0x40, 0x3f, //'e'
+    0x06, 0x09, 0x08, 0x1c, 0x08, 0x08, 0x70, //'f'
+    0x00, 0x3e, 0x41, 0x3e, 0x01, 0x41, 0x3e, //'g'
+    0x40, 0x40, 0x7e, 0x41, 0x41, 0x41, 0x41, //'h'
+    0x00, 0x0c, 0x00, 0x1e, 0x08, 0x08, 0x3c, //'i'
+    0x00, 0x03, 0x00, 0x07, 0x01, 0x41, 0x3e, //'j'
+    0x40, 0x46, 0x48, 0x70, 0x4e, 0x41, 0x41, //'k'
+    0x30, 0x08, 0x08, 0x08, 0x08, 0x08, 0x06, //'l'
+    0x00, 0x00, 0x36, 0x49, 0x49, 0x41, 0x41, //'m'
+    0x00, 0x00, 0x5e, 0x61, 0x41, 0x41, 0x41, //'n'
+    0x00, 0x00, 0x3e, 0x41, 0x41, 0x41, 0x3e, //'o'
+    0x00, 0x00, 0x7e, 0x41, 0x7e, 0x40, 0x40, //'p'
+    0x00, 0x00, 0x3e, 0x42, 0x3e, 0x02, 0x03, //'q'
+    0x00, 0x00, 0x3e, 0x41, 0x40, 0x40, 0x40, //'r'
+    0x00, 0x00, 0x3f, 0x40, 0x3e, 0x01, 0x7e, //'s'
+    0x00, 0x40, 0x78, 0x40, 0x40, 0x41, 0x3e, //'t'
+    0x00, 0x00, 0x41, 0x41, 0x41, 0x41, 0x3f, //'u'
+    0x00, 0x00, 0x41, 0x41, 0x22, 0x14, 0x08, //'v'
+    0x00, 0x00, 0x41, 0x41, 0x49, 0x2a, 0x14, //'w'
+    0x00, 0x00, 0x41, 0x22, 0x1c, 0x22, 0x41, //'x'
+    0x00, 0x00, 0x41, 0x41, 0x3f, 0x01, 0x3e, //'y'
+    0x00, 0x00, 0x7f, 0x02, 0x1c, 0x20, 0x7f, //'z'
+    0x06, 0x08, 0x08, 0x10, 0x08, 0x08, 0x06, //'{'
+    0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, //'|'
+    0x30, 0x08, 0x08, 0x04, 0x08, 0x08, 0x30, //'}'
+    0x00, 0x31, 0x4e, 0x00, 0x00, 0x00, 0x00, //'~'
+};
+
+
+Font font_large = {
+    (char *)font_7x7,
+    7, 7, 1,
+    32, 126,
+    font_7x7_glyphs, NULL, 0,
+    0,
+    font_7x7_rows
+};
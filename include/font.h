@@ -3,16 +3,46 @@
 
 #include "surface.h"
 
-extern const char font_5x5[];
-extern const char font_7x7[];
 
+//Per-glyph metrics, used for proportional layout
+typedef struct {
+    uint8_t offset;     //first column of the glyph cell that is drawn
+    uint8_t width;      //number of columns drawn from the cell
+    int8_t  bearing;    //pixels between the pen position and the first drawn column
+    uint8_t advance;    //pixels the pen moves after this glyph (before spacing/kerning)
+} FontGlyph;
+
+//Spacing adjustment for a pair of characters, tables must be sorted by (left, right)
+typedef struct {
+    char left, right;
+    int8_t adjust;
+} FontKern;
 
 typedef struct {
     char *data;
     uint8_t width, height, spacing;
     uint8_t ascii_start, ascii_end;
+    const FontGlyph *glyphs;    //NULL for fixed-cell layout
+    const FontKern *kerning;    //NULL for no kerning
+    uint16_t kerning_count;
+    uint8_t bpp;                //0 for ' '/'#' character cells, 2 or 4 for packed coverage (anti-aliased)
+    const uint8_t *rows;        //optional glyph rows as bitmasks, leftmost column in bit (width - 1)
 } Font;
 
+extern const char font_5x5[];
+extern const char font_7x7[];
+extern const FontGlyph font_5x5_glyphs[];
+extern const FontGlyph font_7x7_glyphs[];
+extern const uint8_t font_5x5_rows[];
+extern const uint8_t font_7x7_rows[];
+
+extern Font font_small; //5x5
+extern Font font_large; //7x7
+
 void font_print (Surface *surface, Font *font, char *text, uint16_t x, uint16_t y, uint16_t colour);
+void font_print_scaled (Surface *surface, Font *font, char *text, uint16_t x, uint16_t y, uint8_t scale, uint16_t colour);
+Rect font_measure (Font *font, char *text);
+void font_print_cell (Surface *surface, Font *font, char ch, uint16_t x, uint16_t y, uint16_t colour);
+uint8_t font_row (Font *font, char ch, uint8_t py);
 
 #endif
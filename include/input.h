@@ -0,0 +1,38 @@
+#ifndef _INPUT_H_
+#define _INPUT_H_
+
+#include "pico/stdlib.h"
+
+/*
+*  Receive queue for stdio (USB-CDC/UART) input.
+*  Characters are pushed from the stdio "chars available" callback and popped by
+*  whoever is reading input (terminal, shell, VM). Single consumer: one reader at a time,
+*  on one core. The USB and UART drivers both produce, serialised by a lock in input.c.
+*
+*  An InputQueue is a ring of the same kind for passing input on, e.g. from core 0 (the
+*  only reader of the stdio queue) to a VM running on core 1 with input_forward().
+*  One producer and one consumer, which may be on different cores.
+*/
+#define INPUT_BUFFER_SIZE 1024 //must be a power of two
+
+
+typedef struct InputQueue {
+    uint8_t buffer[INPUT_BUFFER_SIZE];
+    volatile uint16_t head;     //free running, only written by the producer
+    volatile uint16_t tail;     //free running, only written by the consumer
+    volatile uint32_t overflow; //characters dropped because the queue was full
+} InputQueue;
+
+
+void        input_init              ();
+uint16_t    input_available         ();
+uint16_t    input_read              (uint8_t *dest, uint16_t len);
+uint16_t    input_read_until        (uint8_t *dest, uint16_t len, uint8_t delim);
+uint32_t    input_dropped           ();
+void        input_queue_init        (InputQueue *queue);
+uint16_t    input_queue_available   (InputQueue *queue);
+uint16_t    input_queue_write       (InputQueue *queue, const uint8_t *src, uint16_t len);
+uint16_t    input_queue_read        (InputQueue *queue, uint8_t *dest, uint16_t len);
+uint16_t    input_forward           (InputQueue *queue);
+
+#endif
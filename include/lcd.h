@@ -79,5 +79,8 @@ void lcd_draw_surface(Surface *surface);
 void lcd_draw_surface_checkered(Surface *surface, uint8_t size, uint32_t prime);
 void lcd_send_command (uint8_t reg);
 void lcd_send_byte (uint8_t val);
+void lcd_stream_begin (Rect *rect);
+void lcd_stream_line (uint16_t *pixels, uint16_t count);
+void lcd_stream_end ();
 
 #endif
\ No newline at end of file
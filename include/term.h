@@ -0,0 +1,41 @@
+#ifndef _TERM_H_
+#define _TERM_H_
+
+#include "pico/stdlib.h"
+
+#include "font.h"
+#include "surface.h"
+
+#define KEY_CR          0x0D
+#define KEY_BACKSPACE   0x08
+#define KEY_ESCAPE      0x1B
+#define KEY_SPACE       0x20
+#define KEY_TILDE       0x7E
+
+
+typedef struct {
+    char input[256], *output, cursor[2];
+    char escape_command[256];
+    uint16_t *colours;
+    bool input_finished;
+    uint8_t width, height, cursor_x, cursor_y;
+    uint8_t font_width, font_height;
+    uint16_t fg_colour, bg_colour, cursor_colour;
+    uint32_t line_time_total, line_time_max; //us spent generating scanlines in the last term_display_direct()
+} TermInfo;
+
+
+TermInfo *  term_create             (uint8_t width, uint8_t height);
+void        term_destroy            (TermInfo *term);
+void        term_clear              (TermInfo *term);
+void        term_gotoxy             (TermInfo *term, uint8_t x, uint8_t y);
+void        term_cursor_down        (TermInfo *term);
+void        term_cursor_right       (TermInfo *term);
+void        term_print              (TermInfo *term, char *text);
+void        term_display            (Surface *surface, TermInfo *term);
+void        term_display_direct     (TermInfo *term, Font *font);
+void        term_special            (TermInfo *term, char *cmd);
+bool        term_input_char         (TermInfo *term, char ch);
+bool        term_input_poll         (TermInfo *term);
+
+#endif
@@ -0,0 +1,153 @@
+#include "pico/stdlib.h"
+#include "pico/stdio.h"
+#include "pico/sync.h"
+
+#include "input.h"
+
+
+/*
+*  Ring buffers with a single producer and a single consumer.
+*  `head` is only written by the producer, `tail` only by the consumer. Both are free
+*  running and masked on access, so head - tail is the fill level.
+*  The stdio queue's producer is the stdio callback. USB and UART stdio each call it from
+*  their own interrupt, so that side holds `input_lock` to stay single. The consumer side
+*  needs no lock.
+*/
+static InputQueue input_stdio;
+static critical_section_t input_lock;
+
+
+/*
+*  Called by the stdio driver (from IRQ context) when characters arrive.
+*  Drains everything the driver has buffered so a pasted block costs one callback.
+*  Each character is queued under the lock, as the other driver may be in here too.
+*/
+static void input_chars_available (void *param) {
+    int ch;
+    while ((ch = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT) {
+        uint8_t byte = (uint8_t)ch;
+        critical_section_enter_blocking(&input_lock);
+        input_queue_write(&input_stdio, &byte, 1);
+        critical_section_exit(&input_lock);
+    }
+}
+
+
+void input_init () {
+    input_queue_init(&input_stdio);
+    if (!critical_section_is_initialized(&input_lock)) critical_section_init(&input_lock);
+    stdio_set_chars_available_callback(input_chars_available, NULL);
+}
+
+
+/*
+*  Number of characters waiting to be read
+*/
+uint16_t input_available () {
+    return input_queue_available(&input_stdio);
+}
+
+
+/*
+*  Copies up to 'len' waiting characters to 'dest' without blocking.
+*  Returns the number of characters copied (0 if nothing is waiting).
+*/
+uint16_t input_read (uint8_t *dest, uint16_t len) {
+    return input_queue_read(&input_stdio, dest, len);
+}
+
+
+/*
+*  As input_read(), but stops after the first 'delim' character (which is included),
+*  leaving anything after it queued for the next call.
+*/
+uint16_t input_read_until (uint8_t *dest, uint16_t len, uint8_t delim) {
+    InputQueue *queue = &input_stdio;
+    uint16_t tail = queue->tail;
+    uint16_t count = (uint16_t)(queue->head - tail), i;
+    __mem_fence_acquire();
+    if (count > len) count = len;
+    for (i = 0; i < count; i++) {
+        dest[i] = queue->buffer[(tail + i) & (INPUT_BUFFER_SIZE - 1)];
+        if (dest[i] == delim) {
+            i++;
+            break;
+        }
+    }
+    __mem_fence_release();
+    queue->tail = tail + i;
+    return i;
+}
+
+
+/*
+*  Characters discarded because the queue was full
+*/
+uint32_t input_dropped () {
+    return input_stdio.overflow;
+}
+
+
+void input_queue_init (InputQueue *queue) {
+    queue->head = 0;
+    queue->tail = 0;
+    queue->overflow = 0;
+}
+
+
+uint16_t input_queue_available (InputQueue *queue) {
+    return (uint16_t)(queue->head - queue->tail);
+}
+
+
+/*
+*  Queues up to 'len' characters from 'src' (producer side).
+*  Returns the number queued, the rest are dropped and counted in 'overflow'.
+*/
+uint16_t input_queue_write (InputQueue *queue, const uint8_t *src, uint16_t len) {
+    uint16_t head = queue->head;
+    uint16_t room = INPUT_BUFFER_SIZE - (uint16_t)(head - queue->tail);
+    uint16_t count = len < room ? len : room;
+    for (uint16_t i = 0; i < count; i++) {
+        queue->buffer[(head + i) & (INPUT_BUFFER_SIZE - 1)] = src[i];
+    }
+    queue->overflow += len - count;
+    __mem_fence_release();
+    queue->head = head + count;
+    return count;
+}
+
+
+/*
+*  Copies up to 'len' queued characters to 'dest' without blocking (consumer side).
+*  Returns the number of characters copied (0 if nothing is waiting).
+*/
+uint16_t input_queue_read (InputQueue *queue, uint8_t *dest, uint16_t len) {
+    uint16_t tail = queue->tail;
+    uint16_t count = (uint16_t)(queue->head - tail);
+    __mem_fence_acquire();
+    if (count > len) count = len;
+    for (uint16_t i = 0; i < count; i++) {
+        dest[i] = queue->buffer[(tail + i) & (INPUT_BUFFER_SIZE - 1)];
+    }
+    __mem_fence_release();
+    queue->tail = tail + count;
+    return count;
+}
+
+
+/*
+*  Moves what is waiting on the stdio queue to 'queue', as much as it has room for.
+*  The caller is then the stdio queue's consumer and 'queue''s producer.
+*  Returns the number of characters moved.
+*/
+uint16_t input_forward (InputQueue *queue) {
+    uint8_t chunk[64];
+    uint16_t moved = 0, count;
+    do {
+        uint16_t room = INPUT_BUFFER_SIZE - input_queue_available(queue);
+        count = input_read(chunk, room < sizeof(chunk) ? room : sizeof(chunk));
+        moved += input_queue_write(queue, chunk, count);
+    } while (count == sizeof(chunk));
+    return moved;
+}
@@ -4,6 +4,8 @@
 #include "surface.h"
 #include "types.h"
 
+#include "hardware/dma.h"
+
 int LCD_BacklightSlice;
 int EPD_RST_PIN;
 int EPD_DC_PIN;
@@ -12,6 +14,8 @@ int EPD_CS_PIN;
 int EPD_CLK_PIN;
 int EPD_MOSI_PIN;
 
+static int lcd_dma_channel = -1;
+
 /*  
 *  Waveshare Pico LCD 1.8inch (C)
 *  https://www.waveshare.com/wiki/Pico-LCD-1.8
@@ -289,3 +293,47 @@ void lcd_draw_surface_checkered(Surface *surface, uint8_t size, uint32_t prime)
         }
     }
 }
+
+
+/*
+*  Starts streaming pixels to 'rect' on the LCD.
+*  Pixels are then sent a line at a time with lcd_stream_line() and finished with lcd_stream_end().
+*/
+void lcd_stream_begin (Rect *rect) {
+    if (lcd_dma_channel < 0) lcd_dma_channel = dma_claim_unused_channel(true);
+    lcd_set_window(rect);
+    gpio_put(EPD_DC_PIN, 1);
+    gpio_put(EPD_CS_PIN, 0);
+}
+
+
+/*
+*  Queues 'count' (byte-swapped, as in a Surface) pixels for DMA to the LCD and returns
+*  without waiting for the transfer, so the caller can build the next line meanwhile.
+*  'pixels' must not be modified until the following lcd_stream_line()/lcd_stream_end() returns,
+*  so callers alternate between two line buffers.
+*/
+void lcd_stream_line (uint16_t *pixels, uint16_t count) {
+    dma_channel_wait_for_finish_blocking(lcd_dma_channel);
+    dma_channel_config config = dma_channel_get_default_config(lcd_dma_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, spi_get_dreq(LCD_SPI_PORT, true));
+    dma_channel_configure(
+        lcd_dma_channel, &config, 
+        &spi_get_hw(LCD_SPI_PORT)->dr, 
+        (uint8_t *)pixels, count * 2, 
+        true
+    );
+}
+
+
+/*
+*  Waits for the last streamed line to leave the SPI port and releases the LCD
+*/
+void lcd_stream_end () {
+    dma_channel_wait_for_finish_blocking(lcd_dma_channel);
+    while (spi_is_busy(LCD_SPI_PORT)) tight_loop_contents();
+    gpio_put(EPD_CS_PIN, 1);
+}
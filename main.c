@@ -10,6 +10,7 @@
 #include "hardware/timer.h"
 #include "hardware/gpio.h"
 #include "hardware/adc.h"
+#include "hardware/clocks.h"
 
 #include "font.h"
 #include "lcd.h"
@@ -17,22 +18,109 @@
 #include "surface.h"
 #include "types.h"
 
+#include "input.h"
+#include "term.h"
 #include "vm.h"
+#include "asm.h"
 #include "interrupts.h"
-
-#define KEY_CR          0x0D
-#define KEY_BACKSPACE   0x08
-#define KEY_ESCAPE      0x1B
-#define KEY_SPACE       0x20
-#define KEY_TILDE       0x7E
-
-
-Font font_small = {
-    font_5x5,
-    5, 5, 1,
-    32, 126
-};
-
+#include "scheduler.h"
+#include "video.h"
+#include "snapshot.h"
+#include "profile.h"
+#include "verify.h"
+
+#ifdef VM_CORE1
+#include "pico/multicore.h"
+#endif
+
+
+//exercises every instruction and interrupt, see basicvm/asm.h for the syntax
+static const char vm_test_source[] =
+    "    nop\n"
+    "    mov r0, 0x1234\n"
+    "    mov [0x5522], r0\n"
+    "    mov r1, [0x5522]\n"
+    "    mov r0, [[0x5522]]\n"
+    "    mov r2, r1\n"
+    "    stdout\n"
+    "    int I_INFO\n"
+    "    cmp 0x5522         ; R0 <=> 0x5522\n"
+    "    cmp r0\n"
+    "    mov r0, 0x1122\n"
+    "    mov r4, 0x0002\n"
+    "    mov r5, 0x3344\n"
+    "    inc r0\n"
+    "    dec r0\n"
+    "    add r5             ; R0 = R0 + R5\n"
+    "    sub r5\n"
+    "    mul r4\n"
+    "    div r4\n"
+    "    shl r0\n"
+    "    shr r0\n"
+    "gpio:\n"
+    "    mov r1, 4          ; pin\n"
+    "    mov r2, 1          ; direction\n"
+    "    mov r3, 1          ; pullup/pulldown\n"
+    "    int I_GPIO_CFG\n"
+    "    mov r1, 4          ; pin\n"
+    "    mov r2, 1          ; level\n"
+    "    int I_GPIO_SET\n"
+    "    mov r1, 4          ; pin\n"
+    "    int I_GPIO_GET\n"
+    "video:\n"
+    "    mov r1, 0x12       ; x\n"
+    "    mov r2, 0x34       ; y\n"
+    "    mov r3, 0xf00f     ; colour\n"
+    "    int I_VIDEO_PUTPIXEL\n"
+    "    mov r1, 0x12\n"
+    "    mov r2, 0x34\n"
+    "    int I_VIDEO_GETPIXEL\n"
+    "    mov r1, 50         ; x\n"
+    "    mov r2, 50         ; y\n"
+    "    mov r3, 100        ; width\n"
+    "    mov r4, 100        ; height\n"
+    "    mov r5, 0xf00f     ; colour\n"
+    "    int I_VIDEO_FILL\n"
+    "    mov r1, 10         ; sx\n"
+    "    mov r2, 10         ; sy\n"
+    "    mov r3, 40         ; dx\n"
+    "    mov r4, 50         ; dy\n"
+    "    mov r5, 0x0ff0     ; colour\n"
+    "    int I_VIDEO_LINE\n"
+    "    mov r1, 10         ; cx\n"
+    "    mov r2, 10         ; cy\n"
+    "    mov r3, 40         ; radius\n"
+    "    mov r4, 0x7ff7     ; colour\n"
+    "    int I_VIDEO_CIRCLE\n"
+    "    mov r1, 50         ; x\n"
+    "    mov r2, 25         ; y\n"
+    "    mov r3, 'A'        ; character\n"
+    "    mov r4, 0xf500     ; colour\n"
+    "    int I_VIDEO_PRINT\n"
+    "    mov r1, 0x5522     ; x, y, colour triples\n"
+    "    mov r2, 2          ; count\n"
+    "    int I_VIDEO_PIXELS\n"
+    "    mov r1, 10         ; x\n"
+    "    mov r2, 60         ; y\n"
+    "    mov r3, 0x0200     ; colours (this program)\n"
+    "    mov r4, 32         ; count\n"
+    "    int I_VIDEO_HLINE\n"
+    "    mov r1, 0x8000     ; address\n"
+    "    mov r2, 100        ; first row\n"
+    "    mov r3, 8          ; rows\n"
+    "    int I_VIDEO_WINDOW\n"
+    "    mov r0, 0xffff\n"
+    "    mov [0x82a0], r0   ; pixel 16 of row 102, rows are 320 bytes\n"
+    "    mov r3, 0\n"
+    "    int I_VIDEO_WINDOW ; unmapped again\n"
+    "    mov r1, 80         ; x\n"
+    "    mov r2, 20         ; y\n"
+    "    mov r3, 8          ; width\n"
+    "    mov r4, 8          ; height\n"
+    "    mov r5, 0x0200     ; colours\n"
+    "    int I_VIDEO_BLIT\n"
+    "    int I_VIDEO_UPDATE\n"
+    "    hlt\n";
 
 float adc_read_temp () {
     adc_select_input(4);
@@ -55,188 +143,256 @@ float adc_read_vsys () {
 }
 
 
-typedef struct {
-    char input[256], *output, cursor[2];
-    char escape_command[256];
-    uint16_t *colours;
-    bool input_finished;
-    uint8_t width, height, cursor_x, cursor_y;
-    uint8_t font_width, font_height;
-    uint16_t fg_colour, bg_colour, cursor_colour;
-} TermInfo;
+/*
+*  Interrupts of the firmware's own, registered with vm_int_register() (see interrupts.h)
+*  from I_USER up. Both read from outside the VM so they go through the replay log.
+*/
+#define I_TEMPERATURE (I_USER + 0) //Read the RP2040's temperature into R0, in hundredths of a degree C
+#define I_TICKS       (I_USER + 1) //Read milliseconds since boot into R0 (low) and R1 (high)
 
+uint8_t vm_int_temperature (struct VM *vm) {
+    uint32_t value;
+    if (!vm_replay_next(vm, VM_INPUT_EXTENSION, &value)) {
+        value = (uint16_t)(int16_t)(adc_read_temp() * 100.0f);
+        vm_replay_log(vm, VM_INPUT_EXTENSION, value);
+    }
+    vm->reg[0] = value;
+    return VM_INT_CONTINUE;
+}
 
-void term_clear (TermInfo *term) {
-    term->cursor_x = 0;
-    term->cursor_y = 0;
-    memset(term->output, 0, term->width * term->height);
-    for (int i = 0, l = term->width * term->height; i < l; i++) term->colours[i] = term->fg_colour;
-    //memset(term->colours, term->fg_colour, term->width * term->height);
+uint8_t vm_int_ticks (struct VM *vm) {
+    uint32_t value;
+    if (!vm_replay_next(vm, VM_INPUT_EXTENSION, &value)) {
+        value = time_us_64() / 1000;
+        vm_replay_log(vm, VM_INPUT_EXTENSION, value);
+    }
+    vm->reg[0] = value & 0xffff;
+    vm->reg[1] = value >> 16;
+    return VM_INT_CONTINUE;
+}
+
+//once at startup, before any VM runs
+void vm_int_modules_init () {
+    adc_init();
+    adc_set_temp_sensor_enabled(true);
+    vm_int_register(I_TEMPERATURE, vm_int_temperature);
+    vm_int_register(I_TICKS, vm_int_ticks);
 }
 
 
-TermInfo *term_create(uint8_t width, uint8_t height) {
-    TermInfo *term = (TermInfo *)malloc(sizeof(TermInfo));
-    term->output = (char *)malloc(width * height);
-    term->colours = (uint16_t *)malloc(width * height);
-    memset(term->input, 0, sizeof(term->input));
-    memset(term->escape_command, 0, sizeof(term->escape_command));
-    term->input_finished = false;
-    term->cursor[0] = '_';
-    term->cursor[1] = 0;
-    term->width = width;
-    term->height = height;
-    term->font_width = 7 + 1;
-    term->font_height = 7 + 1;
-    term->fg_colour = GREEN;
-    term->bg_colour = BLACK;
-    term->cursor_colour = YELLOW;
-    term_clear(term);
-    return term;
+#ifdef VM_TRACE
+#define VM_SLICE (VM_TRACE_SIZE / 2) //an int instruction adds two records
+#define VM_SCHED_US 0                //one slice between dumps
+#else
+#define VM_SLICE 10000
+#define VM_SCHED_US 100000
+#endif
+
+#define VM_DRAIN_US 1000    //how long core 0 sleeps when core 1 has queued no video, with VM_CORE1
+#define VM_REPLAY_EVENTS 512 //reads a run can record with VM_REPLAY
+#define VM_PROFILE_US 100     //sampling period with VM_PROFILE
+
+//the test VM and the scheduler running it, on core 1 when built with VM_CORE1
+static struct VM vm;
+static VM_Sched sched;
+static uint8_t vm_test_program[1024];
+static VM_AsmResult vm_test;
+//the test program as loaded, each run starts from a restore of it (see basicvm/snapshot.h)
+static uint8_t vm_start[VM_SNAPSHOT_SIZE(sizeof(vm_test_program) / VM_PAGE_SIZE + 1)];
+static uint32_t vm_start_length;
+#ifdef VM_REPLAY
+static VM_ReplayEvent vm_events[VM_REPLAY_EVENTS];
+static VM_Replay vm_replay;
+static uint8_t vm_replay_log_buffer[VM_REPLAY_SIZE(VM_REPLAY_EVENTS)];
+#endif
+static VM_Display vm_display;   //drawn by core 0 either way
+#ifdef VM_TRACE
+static VM_Trace vm_trace;
+#endif
+#ifdef VM_PROFILE
+static VM_Profile vm_profile;
+static struct repeating_timer vm_profile_timer;
+#endif
+#ifdef VM_CORE1
+static VM_VideoQueue vm_video;
+static bool vm_running;         //core 1 has a run of the test program, only core 0 uses this
+static InputQueue vm_input;     //input core 0 passes on to the VM, the stdio queue's only reader is core 0
+#endif
+
+
+//initialises the test VM to draw through 'vm_display'
+void vm_setup () {
+    vm_init(&vm);
+    vm.display = &vm_display;
+    #ifdef VM_CORE1
+    vm.video_queue = &vm_video;
+    vm.input = &vm_input;
+    #endif
+    #ifdef VM_TRACE
+    vm.trace = &vm_trace;
+    #endif
+    #ifdef VM_PROFILE
+    vm.profile = &vm_profile;
+    #endif
 }
 
 
-void term_destroy (TermInfo * term) {
-    free(term->output);
-    free(term);
+#ifdef VM_PROFILE
+//samples whatever the test VM runs next, on core 0's timer whichever core the VM is on
+bool vm_profile_sample (struct repeating_timer *timer) {
+    vm_profile_tick(&vm_profile);
+    return true;
 }
+#endif
 
 
-void term_gotoxy (TermInfo *term, uint8_t x, uint8_t y) {
-    if (x >= term->width) term->cursor_x = term->width - 1;
-    else term->cursor_x = x;
-    if (y >= term->height) term->cursor_y = term->height - 1;
-    else term->cursor_y = y;
+//loads and verifies the test program, and takes the snapshot every run starts from
+void vm_load_test () {
+    //mapped rather than copied, the VM only gets RAM for the pages it writes
+    vm_map(&vm, vm_test_program, vm_test.length, 0x0200);
+    VM_Verify verify;
+    if (vm_verify(&vm, 0x0200, vm_test.length, &verify) != VM_VERIFY_OK) {
+        printf("vm: test program not verified, 0x%04x %s\n", verify.pc, vm_verify_message(verify.error));
+    }
+    vm_start_length = vm_snapshot(&vm, vm_start, sizeof(vm_start));
+    if (vm_start_length > sizeof(vm_start)) printf("vm: no room for the test program's snapshot\n");
 }
 
 
-void term_cursor_down (TermInfo *term) {
-    if (++term->cursor_y >= term->height) {
-        memcpy(term->output, (char *)(term->output + term->width), (term->width * term->height) - term->width);
-        memset((char *)(term->output + ((term->width * term->height) - term->width)), 0, term->width);
+//starts a run of the test program
+void vm_begin () {
+    #ifdef VM_REPLAY
+    vm_replay_record(&vm, &vm_replay);
+    #endif
+    vm_sched_add(&sched, &vm, "test", VM_SLICE);
+}
 
-        memcpy(
-            (char *)term->colours, 
-            (char *)(term->colours + (term->width * 2)), 
-            (term->width * term->height * 2) - (term->width * 2)
-        );
 
-        memset(
-            (char *)(term->colours + (term->width * term->height * 2) - (term->width * 2)), 
-            0,
-            term->width * 2
-        );
-        term->cursor_y = term->height - 1;
-    }
+//true while a run of the test program hasn't finished, on either core
+bool vm_active () {
+    #ifdef VM_CORE1
+    return vm_running;
+    #else
+    return vm_sched_task(&sched, &vm) != NULL;
+    #endif
 }
 
 
-void term_cursor_right (TermInfo *term) {
-    if (++term->cursor_x >= term->width) {
-        term->cursor_x = 0;
-        term_cursor_down(term);
-    }
+//starts a run of the test program, on core 1 with VM_CORE1
+void vm_start_run () {
+    #ifdef VM_CORE1
+    //core 1 is idle until the push, so its end of 'vm_input' can be reset from here
+    input_queue_init(&vm_input);
+    multicore_fifo_push_blocking(1);
+    vm_running = true;
+    #else
+    vm_begin();
+    #endif
 }
 
 
-void term_print (TermInfo *term, char *text) {
-    for (int i = 0, l = strlen(text); i < l; i++) {
-        if (text[i] == '\n') {
-            term_cursor_down(term);
-        } else if (text[i] == '\r') {
-            term->cursor_x = 0;
-        } else {
-            int idx = term->cursor_y * term->width + term->cursor_x;
-            term->output[idx] = text[i];
-            term->colours[idx] = term->fg_colour;
-            term_cursor_right(term);
-        }
-    }
+//reports how the test VM ended and restores it for the next run
+void vm_finish () {
+    if (vm.fault == VM_FAULT_STACK) printf("vm: stack overflow at 0x%04x\n", vm.pc);
+    if (vm.fault == VM_FAULT_OPCODE) printf("vm: invalid opcode 0x%02x at 0x%04x\n", vm_read8(&vm, vm.pc), vm.pc);
+    if (vm.fault == VM_FAULT_MEMORY) printf("vm: out of memory at 0x%04x\n", vm.pc);
+    if (vm.fault == VM_FAULT_REGISTER) printf("vm: invalid register at 0x%04x\n", vm.pc);
+    if (vm.fault == VM_FAULT_DIVIDE) printf("vm: division by zero at 0x%04x\n", vm.pc);
+    vm_sched_report(&sched);
+    vm_sched_remove(&sched, &vm);
+    #ifdef VM_REPLAY
+    //the starting snapshot and what the run read, play them back with tools/vmreplay
+    uint32_t length = vm_replay_save(&vm_replay, vm_replay_log_buffer, sizeof(vm_replay_log_buffer));
+    fwrite(vm_start, 1, vm_start_length, stdout);
+    fwrite(vm_replay_log_buffer, 1, length, stdout);
+    fflush(stdout);
+    if (vm_replay.dropped > 0) printf("vm: %lu reads weren't recorded\n", (unsigned long)vm_replay.dropped);
+    #endif
+    #ifdef VM_PROFILE
+    //the run's profile, render it with tools/vmprof
+    vm_profile_dump(&vm_profile, stdout);
+    vm_profile_init(&vm_profile, clock_get_hz(clk_sys));
+    #endif
+    vm_unmap_window(&vm);
+    if (vm_restore(&vm, vm_start, vm_start_length) == 0) printf("vm: no RAM to restart the test program\n");
 }
 
 
-void term_display (Surface *surface, TermInfo *term) {
-    char tmp[2] = { 0, 0 };
-    for (int x = 0, y = 0, i = 0, l = term->width * term->height; i < l; i++) {
-        if (term->output[i] != 0) {
-            tmp[0] = term->output[i];
-            font_print(surface, &font_small, tmp, x * term->font_width, 1 + y * term->font_height, term->colours[i]);
-        }
-        if (++x >= term->width) {
-            x = 0;
-            y++;
-        }
-    }
-    font_print(surface, &font_small, term->cursor, term->cursor_x * term->font_width, 1 + term->cursor_y * term->font_height, term->cursor_colour);
+//draws what the test VM left in its display list after its last I_VIDEO_UPDATE
+void vm_flush_display () {
+    vm_display_flush(&vm_display);
+    lcd_draw_surface(vm_display.video);
+    vm_display_report(&vm_display, "test");
 }
 
 
-void term_special (TermInfo *term, char *cmd) {
-    uint16_t term_colours[] = {
-        BLACK, RED, GREEN, YELLOW, BLUE, MAGENTA, CYAN, WHITE, WHITE, WHITE
-    };
-    if (strlen(cmd) >= 4) {
-        switch(cmd[1]) {
-            case '[':
-                if (cmd[2] == '3' && cmd[3]-48 < 10) 
-                    term->fg_colour = term_colours[cmd[3] - 48];
-                else if (cmd[2] == '4' && cmd[3]-48 < 10) 
-                    term->bg_colour = term_colours[cmd[3] - 48];
-                break;
-            default:
-                break;
-        }
+/*
+*  Carries the running test program on, from the main loop. The LCD is only sent a frame
+*  when the program asks (I_VIDEO_UPDATE) and once when it halts, and this core sleeps
+*  while there's nothing to do rather than redrawing.
+*/
+void vm_poll () {
+    #ifdef VM_CORE1
+    //core 1 runs the VM, this core draws what it asked for and passes input on to it
+    input_forward(&vm_input);
+    uint32_t drained = vm_video_drain(&vm_video, &vm_display);
+    if (multicore_fifo_rvalid()) {
+        multicore_fifo_pop_blocking();
+        vm_video_drain(&vm_video, &vm_display);
+        vm_flush_display();
+        vm_running = false;
+    } else if (drained == 0) {
+        sleep_us(VM_DRAIN_US);
+    }
+    #else
+    //runs the VMs for up to VM_SCHED_US, sleeping while they're all blocked
+    vm_sched_run(&sched, VM_SCHED_US);
+    #ifdef VM_TRACE
+    vm_trace_dump(&vm_trace, stdout);
+    #endif
+    VM_Task *task = vm_sched_task(&sched, &vm);
+    if (task != NULL && task->state == VM_TASK_HALTED) {
+        vm_finish();
+        vm_flush_display();
     }
+    #endif
 }
 
 
-bool term_input_poll (TermInfo *term) {
-    char ch = getchar_timeout_us(500);
-    if (ch == NULL) return false;
-    if (ch == KEY_CR) {
-        printf("\r\n");
-        term->cursor_x = 0;
-        term_cursor_down(term);
-        term->input_finished = true;
-        return true;
-    } else if (ch == KEY_BACKSPACE) {
-        if (strlen(term->input) > 0) {
-            term->input[strlen(term->input)-1] = 0;
-            if (--term->cursor_x < 0) term->cursor_x = 0;
-        }
-    } else if (ch == KEY_ESCAPE) {
-        //start of escape sequence
-        term->escape_command[0] = ch;
-    } else if (ch >= KEY_SPACE && ch <= 126) {
-        if (term->escape_command[0] != 0) {
-            sprintf(term->escape_command, "%s%c", term->escape_command, ch);
-            if (ch == 'm') {
-                //end of escape sequence
-                printf("\r\nterm_special: %s\r\n", (char *)(term->escape_command+1));
-                term_special(term, term->escape_command);
-                memset(term->escape_command, 0, sizeof(term->escape_command));
-            }
-        } else {
-            printf("%c", ch);
-            char tmp[2] = { ch, 0 };
-            term_print(term, tmp);
-            //term->output[term->cursor_y * term->width + term->cursor_x] = ch;
-            snprintf(term->input, 256, "%s%c", term->input, ch);
-            //term_cursor_right(term);
+#ifdef VM_CORE1
+/*
+*  Core 1 runs the test program whenever core 0 posts on the multicore FIFO, and posts
+*  back once it has halted. Core 0 keeps the Surface and the LCD, the VM's video
+*  interrupts reach it through 'vm_video' (see basicvm/video.h).
+*/
+void vm_core1 () {
+    while (1) {
+        multicore_fifo_pop_blocking();
+        vm_begin();
+        while (vm_sched_run(&sched, VM_SCHED_US) != 0) {
+            #ifdef VM_TRACE
+            vm_trace_dump(&vm_trace, stdout);
+            #endif
         }
+        #ifdef VM_TRACE
+        vm_trace_dump(&vm_trace, stdout);
+        #endif
+        vm_finish();
+        multicore_fifo_push_blocking(0);
     }
-    return false;
 }
+#endif
 
 
 int main () {
     //init std in/out
     stdio_init_all();
+    input_init();
 
-    //init the LCD panel and the surface we'll use to draw
+    //init the LCD panel, the shell draws straight to it and a Surface is only made for a VM
     lcd_init();
     lcd_set_backlight(50);
-    Surface *screen = surface_create(LCD_WIDTH, LCD_HEIGHT);
+    Surface *screen = NULL;
 
     /*
     //configure the ADC so we can read temp sensor
@@ -246,98 +402,53 @@ int main () {
     */
 
     TermInfo *term = term_create(LCD_WIDTH / 6, LCD_HEIGHT / 6);
+    term->font_width = font_small.width + 1;
+    term->font_height = font_small.height + 1;
     
 
-    struct VM vm;
-    vm_init(&vm);
-    vm.video = screen;
-    vm.font = &font_small;
-
-    char vm_test_program[] = {
-        OPCODE(&vm, "nop", ' ', ' '),
-        OPCODE(&vm, "mov", 'i', 'r'),    0, 0x12, 0x34,    //mov R0, 0x1234
-        OPCODE(&vm, "mov", 'r', 'm'),    0x55, 0x22, 0,    //mov 0x5522, R0
-        OPCODE(&vm, "mov", 'm', 'r'),    1, 0x55, 0x22,    //mov R1, [0x5522]
-        OPCODE(&vm, "mov", 'p', 'r'),    0, 0x55, 0x22,    //mov R0, [[0x5522]]
-        OPCODE(&vm, "mov", 'r', 'r'),    2, 1,
-        OPCODE(&vm, "stdout", ' ', ' '), 
-        OPCODE(&vm, "int", 'i', ' '),    0x00, I_INFO,
-        OPCODE(&vm, "cmp", 'i', ' '),    0x55, 0x22,       //cmp 0x5522<=>R0
-        OPCODE(&vm, "cmp", 'r', ' '),    0,                //cmp R0<=>R0
-        OPCODE(&vm, "mov", 'i', 'r'),    0, 0x11, 0x22,    //mov R0, 0x1122
-        OPCODE(&vm, "mov", 'i', 'r'),    4, 0x00, 0x02,    //mov R0, 0x0002
-        OPCODE(&vm, "mov", 'i', 'r'),    5, 0x33, 0x44,    //mov R5, 0x3344
-        OPCODE(&vm, "inc", 'r', ' '),    0,                //inc R0
-        OPCODE(&vm, "dec", 'r', ' '),    0,                //dec R0
-        OPCODE(&vm, "add", 'r', ' '),    5,                //add R0, R5
-        OPCODE(&vm, "sub", 'r', ' '),    5,                //sub R0, R5
-        OPCODE(&vm, "mul", 'r', ' '),    4,                //mul R0, R4
-        OPCODE(&vm, "div", 'r', ' '),    4,                //div R0, R4
-        OPCODE(&vm, "shl", 'r', ' '),    0,                //shl R0
-        OPCODE(&vm, "shr", 'r', ' '),    0,                //shr R0
-        //interrupts-----------------
-        //GPIO Configure (pin, direction, pullup/pulldown)
-        OPCODE(&vm, "mov", 'i', 'r'),    1, 0x00, 0x04, //pin
-        OPCODE(&vm, "mov", 'i', 'r'),    2, 0x00, 0x01, //dir
-        OPCODE(&vm, "mov", 'i', 'r'),    3, 0x00, 0x01, //pullup/pulldown
-        OPCODE(&vm, "int", 'i', ' '),    0x00, I_GPIO_CFG,
-        //GPIO Set (pin, level)
-        OPCODE(&vm, "mov", 'i', 'r'),    1, 0x00, 0x04, //pin
-        OPCODE(&vm, "mov", 'i', 'r'),    2, 0x00, 0x01, //level
-        OPCODE(&vm, "int", 'i', ' '),    0x00, I_GPIO_SET,
-        //GPIO Get (pin)
-        OPCODE(&vm, "mov", 'i', 'r'),    1, 0x00, 0x04, //pin
-        OPCODE(&vm, "int", 'i', ' '),    0x00, I_GPIO_GET,
-        //VIDEO Put Pixel (x, y, colour)
-        OPCODE(&vm, "mov", 'i', 'r'),    1, 0x00, 0x12, //x
-        OPCODE(&vm, "mov", 'i', 'r'),    2, 0x00, 0x34, //y
-        OPCODE(&vm, "mov", 'i', 'r'),    3, 0xf0, 0x0f, //colour
-        OPCODE(&vm, "int", 'i', ' '),    0x00, I_VIDEO_PUTPIXEL,
-        //VIDEO Get Pixel (x, y)
-        OPCODE(&vm, "mov", 'i', 'r'),    1, 0x00, 0x12, //x
-        OPCODE(&vm, "mov", 'i', 'r'),    2, 0x00, 0x34, //y
-        OPCODE(&vm, "int", 'i', ' '),    0x00, I_VIDEO_GETPIXEL,
-        //VIDEO Fill (x, y, width, height, colour)
-        OPCODE(&vm, "mov", 'i', 'r'),    1, 0x00, 50, //x
-        OPCODE(&vm, "mov", 'i', 'r'),    2, 0x00, 50, //y
-        OPCODE(&vm, "mov", 'i', 'r'),    3, 0x00, 100,  //width
-        OPCODE(&vm, "mov", 'i', 'r'),    4, 0x00, 100,  //height
-        OPCODE(&vm, "mov", 'i', 'r'),    5, 0xf0, 0x0f, //colour
-        OPCODE(&vm, "int", 'i', ' '),    0x00, I_VIDEO_FILL,
-        //VIDEO Line (sx, sy, dx, dy, colour)
-        OPCODE(&vm, "mov", 'i', 'r'),    1, 0x00, 10, //sx
-        OPCODE(&vm, "mov", 'i', 'r'),    2, 0x00, 10, //sy
-        OPCODE(&vm, "mov", 'i', 'r'),    3, 0x00, 40, //dx
-        OPCODE(&vm, "mov", 'i', 'r'),    4, 0x00, 50, //dy
-        OPCODE(&vm, "mov", 'i', 'r'),    5, 0x0f, 0xf0, //colour
-        OPCODE(&vm, "int", 'i', ' '),    0x00, I_VIDEO_LINE,
-        //VIDEO Circle (cx, cy, radius, colour)
-        OPCODE(&vm, "mov", 'i', 'r'),    1, 0x00, 10, //cx
-        OPCODE(&vm, "mov", 'i', 'r'),    2, 0x00, 10, //cy
-        OPCODE(&vm, "mov", 'i', 'r'),    3, 0x00, 40, //radius
-        OPCODE(&vm, "mov", 'i', 'r'),    4, 0x7f, 0xf7, //colour
-        OPCODE(&vm, "int", 'i', ' '),    0x00, I_VIDEO_CIRCLE,
-        //VIDEO Print (x, y, character, colour)
-        OPCODE(&vm, "mov", 'i', 'r'),    1, 0x00, 50, //x
-        OPCODE(&vm, "mov", 'i', 'r'),    2, 0x00, 25, //y
-        OPCODE(&vm, "mov", 'i', 'r'),    3, 0x00, 'A', //character
-        OPCODE(&vm, "mov", 'i', 'r'),    4, 0xf5, 0x00, //colour
-        OPCODE(&vm, "int", 'i', ' '),    0x00, I_VIDEO_PRINT,
-        //VIDEO Update
-        OPCODE(&vm, "int", 'i', ' '),    0x00, I_VIDEO_UPDATE,
-        //---------------------------
-        OPCODE(&vm, "hlt", ' ', ' ')    
-    };
+    #ifdef VM_TRACE
+    //every instruction is traced and drained to stdout after each slice, decode with tools/vmtrace
+    vm_trace_init(&vm_trace, VM_TRACE_LEVEL_OP);
+    #endif
+    #ifdef VM_PROFILE
+    vm_profile_init(&vm_profile, clock_get_hz(clk_sys));
+    add_repeating_timer_us(-VM_PROFILE_US, vm_profile_sample, NULL, &vm_profile_timer);
+    #endif
+    vm_display_init(&vm_display);
+    vm_display.font = &font_small;
+    vm_int_modules_init();
+    vm_setup();
+
+    //VMs run in the background, between screen updates (or on core 1 with VM_CORE1)
+    vm_sched_init(&sched);
+
+    //assembled once at startup, the source is at the top of this file
+    if (vm_assemble(vm_test_source, 0x0200, vm_test_program, sizeof(vm_test_program), &vm_test) != 0) {
+        printf("vm_test_source:%d: %s\n", vm_test.line, vm_test.error);
+    }
+    vm_load_test();
+    #ifdef VM_REPLAY
+    vm_replay_init(&vm_replay, vm_events, VM_REPLAY_EVENTS);
+    #endif
 
     srand(1337);
 
-    /*
+    #ifdef VM_CORE1
+    vm_video_init(&vm_video);
+    multicore_launch_core1(vm_core1);
+    #endif
+
     char str[256];
-    int frame = 0;
+    bool redraw = true;     //the terminal changed since it was last drawn
     while(1) {
-        //clear screen
-        surface_fill(screen, term->bg_colour);
+        if (vm_active()) {
+            vm_poll();
+            continue;
+        }
 
+        //the shell only reads input while no VM is running, the VM's stdin gets it meanwhile.
+        //Typing echoes into the terminal, a VM's picture stays up until then
+        if (input_available() > 0) redraw = true;
         if (term_input_poll(term)) {
             char *args = NULL;
             for (int i = 0; i < strlen(term->input); i++) {
@@ -367,12 +478,20 @@ int main () {
                 } else {
                     term_print(term, "usage:\r\nbl <value>\r\n");
                 }
+            } else if (strcmp(term->input, "tstat") == 0) {
+                sprintf(str, "LINE: avg %luus max %luus\r\n",
+                    (unsigned long)(term->line_time_total / LCD_HEIGHT), (unsigned long)term->line_time_max);
+                term_print(term, str);
             } else if (strcmp(term->input, "run") == 0) {
-                vm_load(&vm, vm_test_program, sizeof(vm_test_program), 0x0200);
-                while(vm.flags[F_HALT] == 0) {
-                    vm_step(&vm);
+                if (!vm_active()) {
+                    //the Surface is made for the first run and kept for the ones after it
+                    if (screen == NULL) {
+                        screen = surface_create(LCD_WIDTH, LCD_HEIGHT);
+                        vm_display.video = screen;
+                    }
+                    surface_fill(screen, 0x0000);
+                    vm_start_run();
                 }
-                sleep_ms(5000);
             } else {
                 term_clear(term);
             }
@@ -380,28 +499,10 @@ int main () {
             term->input_finished = false;
         }
 
-        term_display(screen, term);
-        lcd_draw_surface(screen);
+        //text mode: scanlines are generated from the cell grid and streamed to the LCD
+        if (redraw && !vm_active()) term_display_direct(term, &font_small);
+        redraw = false;
         sleep_ms(50);
-        frame++;
-    }
-    */
-
-    while(1) {
-        if (term_input_poll(term)) {
-            surface_fill(screen, 0x0000);
-            vm_load(&vm, vm_test_program, sizeof(vm_test_program), 0x0200);
-            while (vm.flags[F_HALT] == 0) {
-                vm_step(&vm);
-            }
-            vm_init(&vm);
-            vm.video = screen;
-            vm.font = &font_small;
-            memset(term->input, 0, sizeof(term->input));
-            term->input_finished = false;
-        }
-        lcd_draw_surface(screen);
-        sleep_ms(100);
     }
 
     free(term);
@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+#include "hardware/timer.h"
+
+#include "font.h"
+#include "input.h"
+#include "lcd.h"
+#include "term.h"
+
+
+void term_clear (TermInfo *term) {
+    term->cursor_x = 0;
+    term->cursor_y = 0;
+    memset(term->output, 0, term->width * term->height);
+    for (int i = 0, l = term->width * term->height; i < l; i++) term->colours[i] = term->fg_colour;
+    //memset(term->colours, term->fg_colour, term->width * term->height);
+}
+
+
+TermInfo *term_create(uint8_t width, uint8_t height) {
+    TermInfo *term = (TermInfo *)malloc(sizeof(TermInfo));
+    term->output = (char *)malloc(width * height);
+    term->colours = (uint16_t *)malloc(width * height * sizeof(uint16_t));
+    memset(term->input, 0, sizeof(term->input));
+    memset(term->escape_command, 0, sizeof(term->escape_command));
+    term->input_finished = false;
+    term->cursor[0] = '_';
+    term->cursor[1] = 0;
+    term->width = width;
+    term->height = height;
+    term->font_width = 7 + 1;
+    term->font_height = 7 + 1;
+    term->fg_colour = GREEN;
+    term->bg_colour = BLACK;
+    term->cursor_colour = YELLOW;
+    term_clear(term);
+    return term;
+}
+
+
+void term_destroy (TermInfo * term) {
+    free(term->output);
+    free(term->colours);
+    free(term);
+}
+
+
+void term_gotoxy (TermInfo *term, uint8_t x, uint8_t y) {
+    if (x >= term->width) term->cursor_x = term->width - 1;
+    else term->cursor_x = x;
+    if (y >= term->height) term->cursor_y = term->height - 1;
+    else term->cursor_y = y;
+}
+
+
+void term_cursor_down (TermInfo *term) {
+    if (++term->cursor_y >= term->height) {
+        memmove(term->output, (char *)(term->output + term->width), (term->width * term->height) - term->width);
+        memset((char *)(term->output + ((term->width * term->height) - term->width)), 0, term->width);
+
+        memmove(
+            term->colours, 
+            term->colours + term->width, 
+            ((term->width * term->height) - term->width) * sizeof(uint16_t)
+        );
+        for (int i = (term->width * term->height) - term->width; i < term->width * term->height; i++) {
+            term->colours[i] = term->fg_colour;
+        }
+        term->cursor_y = term->height - 1;
+    }
+}
+
+
+void term_cursor_right (TermInfo *term) {
+    if (++term->cursor_x >= term->width) {
+        term->cursor_x = 0;
+        term_cursor_down(term);
+    }
+}
+
+
+void term_print (TermInfo *term, char *text) {
+    for (int i = 0, l = strlen(text); i < l; i++) {
+        if (text[i] == '\n') {
+            term_cursor_down(term);
+        } else if (text[i] == '\r') {
+            term->cursor_x = 0;
+        } else {
+            int idx = term->cursor_y * term->width + term->cursor_x;
+            term->output[idx] = text[i];
+            term->colours[idx] = term->fg_colour;
+            term_cursor_right(term);
+        }
+    }
+}
+
+
+void term_display (Surface *surface, TermInfo *term) {
+    for (int x = 0, y = 0, i = 0, l = term->width * term->height; i < l; i++) {
+        if (term->output[i] != 0) {
+            font_print_cell(surface, &font_small, term->output[i], x * term->font_width, 1 + y * term->font_height, term->colours[i]);
+        }
+        if (++x >= term->width) {
+            x = 0;
+            y++;
+        }
+    }
+    font_print_cell(surface, &font_small, term->cursor[0], term->cursor_x * term->font_width, 1 + term->cursor_y * term->font_height, term->cursor_colour);
+}
+
+
+/*
+*  Draws the terminal straight to the LCD one scanline at a time, no Surface is needed.
+*  Each line is generated from the cell grid and the font's glyph rows while the
+*  previous line is still being sent to the panel by DMA.
+*/
+void term_display_direct (TermInfo *term, Font *font) {
+    static uint16_t lines[2][LCD_WIDTH];
+    Rect rect = { 0, 0, LCD_WIDTH, LCD_HEIGHT };
+    uint16_t bg = ((term->bg_colour << 8) & 0xff00) | (term->bg_colour >> 8);
+    uint16_t cursor = ((term->cursor_colour << 8) & 0xff00) | (term->cursor_colour >> 8);
+    term->line_time_total = 0;
+    term->line_time_max = 0;
+    lcd_stream_begin(&rect);
+    for (uint16_t y = 0; y < LCD_HEIGHT; y++) {
+        uint32_t start = time_us_32();
+        uint16_t *line = lines[y & 1];
+        for (uint16_t x = 0; x < LCD_WIDTH; x++) line[x] = bg;
+        uint16_t row = (y - 1) / term->font_height, gy = (y - 1) % term->font_height;
+        if (y >= 1 && row < term->height && gy < font->height) {
+            char *cells = term->output + row * term->width;
+            uint16_t *colours = term->colours + row * term->width;
+            for (uint8_t col = 0; col < term->width; col++) {
+                uint16_t cx = col * term->font_width;
+                if (cx >= LCD_WIDTH) break;
+                uint8_t mask = 0;
+                uint16_t colour;
+                if (row == term->cursor_y && col == term->cursor_x) {
+                    mask = font_row(font, term->cursor[0], gy);
+                    colour = cursor;
+                }
+                if (mask == 0 && cells[col] != 0) {
+                    mask = font_row(font, cells[col], gy);
+                    colour = ((colours[col] << 8) & 0xff00) | (colours[col] >> 8);
+                }
+                for (uint8_t bit = 0; mask != 0 && bit < font->width && cx + bit < LCD_WIDTH; bit++) {
+                    if (mask & (1 << (font->width - 1 - bit))) line[cx + bit] = colour;
+                }
+            }
+        }
+        uint32_t elapsed = time_us_32() - start;
+        term->line_time_total += elapsed;
+        if (elapsed > term->line_time_max) term->line_time_max = elapsed;
+        lcd_stream_line(line, LCD_WIDTH);
+    }
+    lcd_stream_end();
+}
+
+
+void term_special (TermInfo *term, char *cmd) {
+    uint16_t term_colours[] = {
+        BLACK, RED, GREEN, YELLOW, BLUE, MAGENTA, CYAN, WHITE, WHITE, WHITE
+    };
+    if (strlen(cmd) >= 4) {
+        switch(cmd[1]) {
+            case '[':
+                if (cmd[2] == '3' && cmd[3]-48 < 10) 
+                    term->fg_colour = term_colours[cmd[3] - 48];
+                else if (cmd[2] == '4' && cmd[3]-48 < 10) 
+                    term->bg_colour = term_colours[cmd[3] - 48];
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+
+/*
+*  Handles a single character of input, returns true when it completes a line
+*/
+bool term_input_char (TermInfo *term, char ch) {
+    if (ch == KEY_CR) {
+        printf("\r\n");
+        term->cursor_x = 0;
+        term_cursor_down(term);
+        term->input_finished = true;
+        return true;
+    } else if (ch == KEY_BACKSPACE) {
+        if (strlen(term->input) > 0) {
+            term->input[strlen(term->input)-1] = 0;
+            if (--term->cursor_x < 0) term->cursor_x = 0;
+        }
+    } else if (ch == KEY_ESCAPE) {
+        //start of escape sequence
+        term->escape_command[0] = ch;
+    } else if (ch >= KEY_SPACE && ch <= 126) {
+        if (term->escape_command[0] != 0) {
+            sprintf(term->escape_command, "%s%c", term->escape_command, ch);
+            if (ch == 'm') {
+                //end of escape sequence
+                printf("\r\nterm_special: %s\r\n", (char *)(term->escape_command+1));
+                term_special(term, term->escape_command);
+                memset(term->escape_command, 0, sizeof(term->escape_command));
+            }
+        } else {
+            printf("%c", ch);
+            char tmp[2] = { ch, 0 };
+            term_print(term, tmp);
+            //term->output[term->cursor_y * term->width + term->cursor_x] = ch;
+            snprintf(term->input, 256, "%s%c", term->input, ch);
+            //term_cursor_right(term);
+        }
+    }
+    return false;
+}
+
+
+/*
+*  Consumes whatever input is queued (up to the end of the current line).
+*  Returns true once a full line has been entered into term->input.
+*/
+bool term_input_poll (TermInfo *term) {
+    uint8_t chunk[64];
+    uint16_t count;
+    while ((count = input_read_until(chunk, sizeof(chunk), KEY_CR)) > 0) {
+        for (uint16_t i = 0; i < count; i++) {
+            if (term_input_char(term, chunk[i])) return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,41 @@
+; three-operand ALU instructions with a register and an immediate B, destinations
+; that are also sources, and the two-operand and/or/xor
+; used by vmnative to compare the interpreter with translated code
+DATA = 0x4000
+COUNT = 300
+
+start:
+    mov r9, 0x1234          ; running hash
+    mov r1, 1
+loop:
+    add r2, r1, r9          ; may overflow
+    sub r3, r1, 7           ; may underflow
+    mul r4, r2, r3
+    mul r4, r4, 3
+    div r5, r9, r1
+    div r6, r2, 5
+    and r7, r4, 0x0ff0
+    or r7, r7, r5
+    xor r9, r9, r7
+    shl r8, r9, 3
+    shr r2, r9, r1          ; shift counts use the low 4 bits
+    shl r3, r3, r1
+    xor r9, r9, r8
+    xor r9, r9, r2
+    add r9, r9, r3
+    sub r9, r9, r6
+    or r8, r1, 0x8000
+    shr r8, r8, 15
+    add r9, r9, r8
+    ; the two-operand forms work on r0
+    mov r0, r9
+    and r4
+    or r5
+    xor r1
+    add r9, r0, r9
+    add r1, r1, 1
+    mov r0, r1
+    cmp COUNT
+    jl loop
+    mov [DATA], r9
+    hlt
@@ -0,0 +1,57 @@
+; draws frames with the batch video interrupts: a background of fills, a gradient from
+; memory copied to 32 rows with I_VIDEO_HLINE and a few pixels listed in memory with
+; I_VIDEO_PIXELS. vmsched reports how many commands the display list drew them with
+FRAMES = 8
+
+    mov r6, FRAMES
+frame:
+    ; clear the screen, then a band drawn as two fills the display list merges
+    mov r1, 0
+    mov r2, 0
+    mov r3, 128
+    mov r4, 160
+    mov r5, 0
+    int I_VIDEO_FILL
+    mov r4, 8
+    mov r5, 0x001f
+    int I_VIDEO_FILL
+    mov r2, 8
+    int I_VIDEO_FILL
+
+    mov r2, 40
+row:
+    mov r1, 10
+    mov r3, gradient
+    mov r4, 64
+    int I_VIDEO_HLINE
+    add r2, r2, 1
+    mov r0, r2
+    cmp 72
+    jl row
+
+    mov r1, dots
+    mov r2, 4
+    int I_VIDEO_PIXELS
+    int I_VIDEO_UPDATE
+    sub r6, r6, 1
+    mov r0, r6
+    cmp 0
+    jne frame
+    hlt
+
+; x, y, colour
+dots:
+    .word 5, 100, 0xffff
+    .word 6, 100, 0xffff
+    .word 7, 100, 0xf800
+    .word 50, 120, 0x07e0
+
+gradient:
+    .word 0x001f, 0x003f, 0x085e, 0x087e, 0x109d, 0x10bd, 0x18dc, 0x18fc
+    .word 0x211b, 0x213b, 0x295a, 0x297a, 0x3199, 0x31b9, 0x39d8, 0x39f8
+    .word 0x4217, 0x4237, 0x4a56, 0x4a76, 0x5295, 0x52b5, 0x5ad4, 0x5af4
+    .word 0x6313, 0x6333, 0x6b52, 0x6b72, 0x7391, 0x73b1, 0x7bd0, 0x7bf0
+    .word 0x840f, 0x842f, 0x8c4e, 0x8c6e, 0x948d, 0x94ad, 0x9ccc, 0x9cec
+    .word 0xa50b, 0xa52b, 0xad4a, 0xad6a, 0xb589, 0xb5a9, 0xbdc8, 0xbde8
+    .word 0xc607, 0xc627, 0xce46, 0xce66, 0xd685, 0xd6a5, 0xdec4, 0xdee4
+    .word 0xe703, 0xe723, 0xef42, 0xef62, 0xf781, 0xf7a1, 0xffc0, 0xffe0
@@ -0,0 +1,156 @@
+; checks the block instructions: fills and copies across pages and past 0xffff, copies
+; between overlapping blocks in both directions, comparisons and a copy over its own code.
+; Halts with r9 = 0 if everything was right, otherwise with the number of the failed check
+A = 0x1000
+B = 0x1100
+
+    ; A = 64 x 0x01, 64 x 0x02, 64 x 0x03, 64 x 0x04
+    mov r9, 1
+    mov r1, A
+    mov r2, 0x01
+    mov r3, 0x40
+    stos
+    mov r1, A + 0x40
+    mov r2, 0x02
+    stos
+    mov r1, A + 0x80
+    mov r2, 0x03
+    stos
+    mov r1, A + 0xc0
+    mov r2, 0x04
+    stos
+    mov r0, [A + 0x3e]
+    cmp 0x0101
+    jne fail
+    mov r0, [A + 0xfe]
+    cmp 0x0404
+    jne fail
+
+    ; copy A up by 0x40, into the next page: its end is overwritten before it's read
+    mov r9, 2
+    mov r1, A + 0x40
+    mov r2, A
+    mov r3, 0x100
+    movs
+    mov r0, [A + 0x7e]
+    cmp 0x0101
+    jne fail
+    mov r0, [A + 0xfe]
+    cmp 0x0303
+    jne fail
+    mov r0, [A + 0x13e]
+    cmp 0x0404
+    jne fail
+    mov r0, [A + 0x140]
+    cmp 0
+    jne fail
+
+    ; and back down, which overwrites its start
+    mov r9, 3
+    mov r1, A
+    mov r2, A + 0x40
+    movs
+    mov r0, [A + 0x3e]
+    cmp 0x0101
+    jne fail
+    mov r0, [A + 0xbe]
+    cmp 0x0303
+    jne fail
+    mov r0, [A + 0xfe]
+    cmp 0x0404
+    jne fail
+
+    ; a copy of A is the same as A
+    mov r9, 4
+    mov r1, B
+    mov r2, A
+    movs
+    cmps
+    jne fail
+    cmp 0x100
+    jne fail
+
+    ; one byte different, the flags compare it
+    mov r9, 5
+    mov r0, 0x0407
+    mov [B + 0xc2], r0
+    mov r1, B
+    cmps
+    jle fail
+    cmp 0xc3
+    jne fail
+    mov r1, A
+    mov r2, B
+    cmps
+    jge fail
+
+    ; a fill past 0xffff carries on at 0x0000
+    mov r9, 6
+    mov r1, 0xfff0
+    mov r2, 0x11
+    mov r3, 0x20
+    stos
+    mov r0, [0xfffe]
+    cmp 0x1111
+    jne fail
+    mov r0, [0x000e]
+    cmp 0x1111
+    jne fail
+    mov r0, [0x0010]
+    cmp 0
+    jne fail
+
+    ; and so do copies and comparisons
+    mov r9, 7
+    mov r1, 0x2000
+    mov r2, 0xfff0
+    movs
+    cmps
+    jne fail
+    mov r1, 0xfff8
+    mov r2, 0x2000
+    movs
+    mov r0, [0x0016]
+    cmp 0x1111
+    jne fail
+    mov r0, [0x0018]
+    cmp 0
+    jne fail
+
+    ; a copy over an instruction that already ran replaces it
+    mov r9, 8
+    mov r7, 0
+    mov r6, 2
+    jmp patch       ; so that the first pass runs 'patch' as decoded there, not fused into the movs above
+patch:
+    mov r7, 99
+    mov r1, patch
+    mov r2, replacement
+    mov r3, 4
+    movs
+    sub r6, r6, 1
+    mov r0, r6
+    cmp 0
+    jne patch
+    mov r0, r7
+    cmp 1
+    jne fail
+
+    ; nothing to do for a length of 0
+    mov r9, 9
+    mov r1, A
+    mov r2, 0xff
+    mov r3, 0
+    stos
+    cmps
+    jne fail
+    mov r0, [A]
+    cmp 0x0101
+    jne fail
+
+    mov r9, 0
+fail:
+    hlt
+
+replacement:
+    mov r7, 1
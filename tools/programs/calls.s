@@ -0,0 +1,68 @@
+; subroutines: call/ret, push/pop, pushm/popm and finally a stack overflow
+; used by vmnative to compare the interpreter with translated code
+RESULT = 0x4000
+
+start:
+    ; r9 = fib(0) + fib(1) + ... + fib(14), recursively
+    mov r9, 0
+    mov r4, 0
+sum:
+    mov r1, r4
+    call fib
+    mov r0, r9
+    add r2
+    mov r9, r0
+    inc r4
+    mov r4, r0
+    cmp 15
+    jl sum
+    mov [RESULT], r9
+
+    ; immediates and registers on the stack, and a call through a register
+    push 0x1234
+    push r9
+    mov r5, double
+    call r5
+    pop r8
+    pop r6
+    mov r0, sp
+    mov [RESULT + 2], r0
+
+    ; recursion without an end faults when the stack reaches its limit
+    mov r3, 0
+deep:
+    inc r3
+    mov r3, r0
+    pushm 0x0e
+    call deep
+    hlt
+
+fib:                    ; r2 = fib(r1), keeps r1 and r3
+    mov r0, r1
+    cmp 2
+    jl fib_small
+    pushm 0x0a          ; r1, r3
+    dec r1
+    mov r1, r0
+    call fib
+    mov r3, r2
+    mov r0, r1
+    dec r0
+    mov r1, r0
+    call fib
+    mov r0, r3
+    add r2
+    mov r2, r0
+    popm 0x0a
+    ret
+fib_small:
+    mov r2, r1
+    ret
+
+double:                 ; doubles the value under the return address
+    pop r7
+    pop r0
+    shl r0
+    push r0
+    push r7
+    ret
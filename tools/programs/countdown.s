@@ -0,0 +1,16 @@
+; nested counted loops (about 3M instructions)
+; used by vmnative to compare the interpreter with translated code
+start:
+    mov r1, 1000
+outer:
+    mov r0, 1000
+inner:
+    dec r0
+    cmp 0
+    jnz inner
+    mov r0, r1
+    dec r0
+    mov r1, r0
+    cmp 0
+    jnz outer
+    hlt
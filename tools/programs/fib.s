@@ -0,0 +1,27 @@
+; fib(N) by the definition, recursively, about 200K instructions
+; a benchmark of calls, the stack and branches (vmsuite), r9 = 6765 at the end
+N = 20
+
+    mov r1, N
+    call fib
+    mov r9, r2
+    hlt
+
+; r2 = fib(r1), keeps r1
+fib:
+    mov r0, r1
+    cmp 2
+    jl small
+    push r1
+    sub r1, r1, 1
+    call fib
+    push r2
+    sub r1, r1, 1
+    call fib
+    pop r3
+    add r2, r2, r3
+    pop r1
+    ret
+small:
+    mov r2, r1
+    ret
@@ -0,0 +1,23 @@
+; fills 4K at 0x4000 a word at a time through a pointer, PASSES times
+; a benchmark of memory writes (vmsuite), stos does the same in one instruction
+PASSES = 16
+DST = 0x3000
+
+    mov r6, PASSES
+pass:
+    mov r1, 0x4000
+    mov [DST], r1
+    mov r3, 2048
+fill:
+    mov [[DST]], r6
+    add r1, r1, 2
+    mov [DST], r1
+    sub r3, r3, 1
+    mov r0, r3
+    cmp 0
+    jne fill
+    sub r6, r6, 1
+    mov r0, r6
+    cmp 0
+    jne pass
+    hlt
@@ -0,0 +1,26 @@
+; echoes stdin until a 'q' (or until 100 polls in a row find nothing), sleeping 1ms per
+; character and adding them up in r9. Its run depends on nothing but what it reads, so
+; vmreplay can check that a recording of it plays back the same:
+;   printf 'hello' | vmreplay -r programs/input.s -o input.bin && vmreplay input.bin
+    mov r9, 0
+    mov r8, 100
+read:
+    int I_WAIT_INPUT
+    stdin r1
+    jz empty
+    mov r8, 100
+    mov r0, r1
+    cmp 'q'
+    je done
+    stdout
+    add r9, r9, r1
+    mov r1, 1
+    int I_SLEEP
+    jmp read
+empty:
+    sub r8, r8, 1
+    mov r0, r8
+    cmp 0
+    jne read
+done:
+    hlt
@@ -0,0 +1,40 @@
+; sorts a pseudo-random sequence into five ranges with a ladder of compares and jumps
+; a benchmark of branches that change direction from one value to the next (vmsuite),
+; r9 = a checksum of the ranges found at the end
+COUNT = 20000
+
+    mov r6, COUNT
+    mov r5, 1
+    mov r9, 0
+next:
+    ; r5 = r5 * 25173 + 13849, the top four bits are the value
+    mul r5, r5, 25173
+    add r5, r5, 13849
+    shr r0, r5, 12
+    cmp 2
+    jl low
+    cmp 5
+    jl mid
+    cmp 9
+    jl high
+    cmp 14
+    jl top
+    add r9, r9, 5
+    jmp done
+low:
+    add r9, r9, 1
+    jmp done
+mid:
+    add r9, r9, 2
+    jmp done
+high:
+    add r9, r9, 3
+    jmp done
+top:
+    add r9, r9, 4
+done:
+    sub r6, r6, 1
+    mov r0, r6
+    cmp 0
+    jne next
+    hlt
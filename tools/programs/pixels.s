@@ -0,0 +1,32 @@
+; plots a 32x64 RGB565 pattern FRAMES times through the video interrupts, moving it
+; a little each frame, with an I_VIDEO_UPDATE after every frame (try it with vmsched -t)
+FRAMES = 16
+
+    mov r6, FRAMES
+frame:
+    mov r2, 0
+row:
+    mov r1, 0
+col:
+    shl r3, r1, 11
+    shl r4, r2, 5
+    or r3, r3, r4
+    add r4, r1, r2
+    add r4, r4, r6
+    shr r4, r4, 2
+    or r3, r3, r4
+    int I_VIDEO_PUTPIXEL
+    add r1, r1, 1
+    mov r0, r1
+    cmp 32
+    jl col
+    add r2, r2, 1
+    mov r0, r2
+    cmp 64
+    jl row
+    int I_VIDEO_UPDATE
+    sub r6, r6, 1
+    mov r0, r6
+    cmp 0
+    jne frame
+    hlt
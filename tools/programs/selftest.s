@@ -0,0 +1,126 @@
+; exercises every kind of instruction vm2c translates differently:
+; inlined ALU ops and branches, generic instructions (pointers, div, register jumps),
+; an interrupt that yields and finally a write to its own code,
+; plus the sequences the interpreter fuses into superinstructions
+PTR = 0x3000
+DATA = 0x4000
+COUNT = 200
+
+start:
+    mov r2, 2
+    mov r3, 3
+
+    ; DATA[i] = i * 3 for i = COUNT..1
+    mov r1, DATA
+    mov [PTR], r1
+    mov r4, COUNT
+fill:
+    mov r0, r4
+    mul r3
+    mov [[PTR]], r0
+    mov r0, [PTR]
+    add r2
+    mov [PTR], r0
+    dec r4
+    mov r4, r0
+    cmp 0
+    jne fill
+
+    ; r9 = sum of DATA[], with the odd entries halved
+    mov r1, DATA
+    mov [PTR], r1
+    mov r4, COUNT
+    mov r9, 0
+sum:
+    mov r0, [[PTR]]
+    mov r5, r0
+    shr r0
+    shl r0
+    cmp r5
+    je even
+    mov r0, r5
+    div r2
+    mov r5, r0
+even:
+    mov r0, r9
+    add r5
+    mov r9, r0
+    mov r0, [PTR]
+    add r2
+    mov [PTR], r0
+    dec r4
+    mov r4, r0
+    cmp 1
+    jge sum
+
+    ; fused: immediate loads ending in an interrupt, inc/cmp/jcc, dec/cmp reg/jcc, cmp/jcc
+    mov r0, 0
+loads:
+    mov r4, r0
+    mov r1, 4
+    mov r5, 5
+    mov r6, 6
+    int I_GPIO_GET
+    inc r4
+    cmp 40
+    jl loads
+    mov r0, 10
+down:
+    dec r0
+    cmp r5
+    jne down
+    cmp r5
+    jge flags
+    mov r8, 0xbad
+
+    ; flags: overflow, underflow, less/greater
+flags:
+    mov r0, 0xffff
+    inc r0
+    mov r6, r0
+    mov r0, 0
+    sub r3
+    mov r7, r0
+    cmp 0x8000
+    jl wrong
+    jle wrong
+    jg indirect
+wrong:
+    mov r8, 0xdead
+    hlt
+
+    ; jumps through registers go back through the dispatch switch
+indirect:
+    mov r5, landing
+    jmp r5
+    mov r8, 0xbad
+landing:
+    mov r0, 7
+    cmp 7
+    mov r5, yield
+    je r5
+    mov r8, 0xbad
+
+    ; I_VIDEO_UPDATE returns control to the host
+yield:
+    int I_GPIO_GET
+    int I_VIDEO_UPDATE
+
+    ; rewriting the immediate of 'patched' detaches the translation
+    mov r0, 0x1234
+    mov [patched + 2], r0
+patched:
+    mov r6, 0
+
+    ; rewriting the middle of a fused run of loads after it has run once
+    mov r4, 0
+reload:
+    mov r1, 1
+    mov r5, 2
+    mov r0, 0x77
+    mov [reload + 6], r0
+    inc r4
+    mov r4, r0
+    cmp 2
+    jl reload
+    hlt
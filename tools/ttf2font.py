@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""
+Rasterise a TrueType font into an anti-aliased (2bpp or 4bpp) font source file.
+
+    python3 tools/ttf2font.py DejaVuSans.ttf 12 --bpp 4 --name font_sans12 > font_sans12.c
+
+The output defines the packed coverage data, per-glyph metrics and a ready-made
+`Font` named after --name. Add the file to CMakeLists.txt and declare it with
+`extern Font font_sans12;` where it is used.
+
+Glyph rows are packed MSB-first, `bpp` bits per pixel, each row padded to a whole byte.
+Requires Pillow (`pip install pillow`).
+"""
+import argparse
+import os
+import sys
+
+from PIL import Image, ImageDraw, ImageFont
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("ttf", help="path to a .ttf/.otf file")
+    parser.add_argument("size", type=int, help="pixel size to rasterise at")
+    parser.add_argument("--bpp", type=int, choices=(2, 4), default=4)
+    parser.add_argument("--name", default=None, help="C identifier for the Font (default font_<file><size>)")
+    parser.add_argument("--first", type=int, default=32, help="first ascii code (inclusive)")
+    parser.add_argument("--last", type=int, default=126, help="last ascii code (inclusive)")
+    parser.add_argument("--spacing", type=int, default=0, help="extra pixels between glyphs")
+    args = parser.parse_args()
+
+    name = args.name
+    if name is None:
+        base = os.path.splitext(os.path.basename(args.ttf))[0]
+        name = "font_%s%d" % ("".join(c for c in base.lower() if c.isalnum()), args.size)
+
+    font = ImageFont.truetype(args.ttf, args.size)
+    ascent, descent = font.getmetrics()
+    height = ascent + descent
+    chars = [chr(c) for c in range(args.first, args.last + 1)]
+
+    boxes = {ch: font.getbbox(ch, anchor="la") for ch in chars}
+    width = max(max(box[2] - box[0] for box in boxes.values()), 1)
+    levels = (1 << args.bpp) - 1
+    row_bytes = (width * args.bpp + 7) // 8
+
+    data, metrics = [], []
+    for ch in chars:
+        left, top, right, bottom = boxes[ch]
+        image = Image.new("L", (width, height), 0)
+        ImageDraw.Draw(image).text((-left, 0), ch, font=font, fill=255, anchor="la")
+        pixels = image.load()
+        glyph = []
+        for y in range(height):
+            row = [0] * row_bytes
+            for x in range(width):
+                level = (pixels[x, y] * levels + 127) // 255
+                bit = x * args.bpp
+                row[bit >> 3] |= level << (8 - args.bpp - (bit & 7))
+            glyph.extend(row)
+        data.append((ch, glyph))
+        glyph_width = max(right - left, 0) if ch.strip() else 0
+        metrics.append((ch, 0, glyph_width, left, int(round(font.getlength(ch)))))
+
+    out = sys.stdout
+    out.write('#include "surface.h"\n#include "font.h"\n\n')
+    out.write("//font is %s %dpx (%dx%d cells, %dbpp), from ascii code %d to %d (inclusive)\n"
+              % (os.path.basename(args.ttf), args.size, width, height, args.bpp, args.first, args.last))
+    out.write("//generated by tools/ttf2font.py, do not edit\n\n\n")
+    out.write("static const unsigned char %s_data[] = {\n" % name)
+    for ch, glyph in data:
+        out.write("    //%r\n" % ch)
+        for y in range(height):
+            row = glyph[y * row_bytes:(y + 1) * row_bytes]
+            out.write("    " + ", ".join("0x%02x" % b for b in row) + ",\n")
+    out.write("};\n\n")
+    out.write("//per-glyph metrics for proportional layout: { offset, width, bearing, advance }\n")
+    out.write("static const FontGlyph %s_glyphs[] = {\n" % name)
+    for ch, offset, glyph_width, bearing, advance in metrics:
+        out.write("    { %d, %d, %d, %d }, //%r\n" % (offset, glyph_width, bearing, advance, ch))
+    out.write("};\n\n")
+    out.write("Font %s = {\n" % name)
+    out.write("    (char *)%s_data,\n" % name)
+    out.write("    %d, %d, %d,\n" % (width, height, args.spacing))
+    out.write("    %d, %d,\n" % (args.first, args.last))
+    out.write("    %s_glyphs, NULL, 0,\n" % name)
+    out.write("    %d\n" % args.bpp)
+    out.write("};\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,401 @@
+/*
+*  Translates a basicvm image to C, one basic block at a time.
+*  Usage: vm2c image.bin [-a origin] [-e entry] [-n name] [-o out.c]
+*
+*  The output defines `const VM_Native <name>` (default vm_native_program) holding the image
+*  and a function that runs it like vm_run(): registers and flags live in locals, jumps are
+*  gotos and the last cmp is kept as its two operands until a flag is actually needed.
+*  Instructions vm_run() has no specialised handler for go through vm_native_step().
+*  Load it with vm_native_load() and run it with vm_run_native().
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+#include "asm.h"
+
+
+static struct VM vm;
+static uint8_t mem[65536];      //the image, also loaded into 'vm'
+static VM_Decoded code[65536];
+static uint8_t decoded[65536];  //0 not visited, 1 instruction, 2 not translatable (exit to the interpreter)
+static uint8_t leader[65536];
+static uint16_t worklist[65536];
+static uint32_t work_count = 0;
+static uint16_t origin;
+static uint32_t length;
+static FILE *out;
+
+
+static const char *flag_set[] = { "f_gt", "f_lt", "f_eq", "f_zero", "f_data", "f_ovr", "f_und" };
+static const uint8_t flag_index[] = { F_GREATER, F_LESS, F_EQUAL, F_ZERO, F_DATA, F_OVERFLOW, F_UNDERFLOW };
+#define FLAG_LOCALS (sizeof(flag_set) / sizeof(flag_set[0]))
+
+
+static void add_leader (uint32_t addr) {
+    addr &= 0xffff;
+    if (leader[addr] != 0) return;
+    leader[addr] = 1;
+    worklist[work_count++] = addr;
+}
+
+
+//true if the instruction ends a basic block, 'next' is set if execution can continue after it
+static uint8_t ends_block (VM_Decoded *op, uint8_t *next) {
+    *next = 1;
+    switch (op->base) {
+        case VM_H_HLT:
+            *next = 0;
+            return 1;
+        case VM_H_JMP_I:
+            *next = 0;
+            return 1;
+        case VM_H_CALL_I:   //the return address is made a leader by discover()
+        case VM_H_RET:
+            *next = 0;
+            return 1;
+        case VM_H_JE_I: case VM_H_JNE_I: case VM_H_JZ_I: case VM_H_JNZ_I:
+        case VM_H_JL_I: case VM_H_JLE_I: case VM_H_JG_I: case VM_H_JGE_I:
+        case VM_H_INT:      //may yield, resume at the next instruction
+        case VM_H_MOV_RM:   //may write to code
+        case VM_H_PUSH_I: case VM_H_PUSH_R: case VM_H_PUSHM:
+        case VM_H_GENERIC:  //may do any of the above
+            return 1;
+    }
+    return 0;
+}
+
+
+static void discover (uint16_t entry) {
+    add_leader(entry);
+    while (work_count > 0) {
+        uint32_t pc = worklist[--work_count];
+        while (1) {
+            if (decoded[pc] != 0) {
+                leader[pc] = 1;
+                break;
+            }
+            if (pc < origin || pc >= origin + length || vm_find_opcode(mem[pc]) == NULL) {
+                decoded[pc] = 2;
+                break;
+            }
+            VM_Decoded *op = vm_decode(&vm, pc);
+            if (pc + op->size > origin + length) {
+                decoded[pc] = 2;
+                break;
+            }
+            code[pc] = *op;
+            decoded[pc] = 1;
+            uint8_t next;
+            if (op->base >= VM_H_JMP_I && op->base <= VM_H_JGE_I) add_leader(op->sval);
+            if (op->base == VM_H_CALL_I) {
+                add_leader(op->sval);
+                add_leader(pc + op->size); //where 'ret' comes back to through the dispatch switch
+            }
+            if (ends_block(op, &next)) {
+                if (next) add_leader(pc + op->size);
+                break;
+            }
+            pc = (pc + op->size) & 0xffff;
+            if (leader[pc]) break;
+        }
+    }
+}
+
+
+//writes the cmp operands out to the flag locals if they haven't been yet
+static void flush_cmp (uint8_t *pending) {
+    if (*pending == 0) return;
+    fprintf(out, "    f_gt = ca > cb; f_lt = ca < cb; f_eq = ca == cb; f_zero = ca == 0;\n");
+    *pending = 0;
+}
+
+
+static const char *branch_condition (uint8_t handler, uint8_t pending) {
+    switch (handler) {
+        case VM_H_JE_I:  return pending ? "ca == cb" : "f_eq";
+        case VM_H_JNE_I: return pending ? "ca != cb" : "!f_eq";
+        case VM_H_JZ_I:  return pending ? "ca == 0" : "f_zero";
+        case VM_H_JNZ_I: return pending ? "ca != 0" : "!f_zero";
+        case VM_H_JL_I:  return pending ? "ca < cb" : "f_lt";
+        case VM_H_JLE_I: return pending ? "ca <= cb" : "(f_lt || f_eq)";
+        case VM_H_JG_I:  return pending ? "ca > cb" : "f_gt";
+        case VM_H_JGE_I: return pending ? "ca >= cb" : "(f_gt || f_eq)";
+    }
+    return "1";
+}
+
+
+/*
+*  Leaves for the interpreter if 'bytes' more on the stack would go below its limit,
+*  it then runs the instruction again and faults. The instruction isn't counted here.
+*/
+static void emit_stack_check (uint16_t pc, uint16_t bytes) {
+    fprintf(out, "    if ((uint16_t)(r10 - %d) < vm->stack_limit) { budget++; pc = 0x%04x; goto exit_native; }\n", bytes, pc);
+}
+
+
+static void emit_instruction (uint16_t pc, VM_Decoded *op, uint8_t *pending) {
+    char text[64];
+    uint16_t next = pc + op->size;
+    uint16_t s = op->sval, d = op->dval;
+    vm_disassemble(mem, pc, text, sizeof(text));
+    fprintf(out, "    //%04x %s\n", pc, text);
+
+    switch (op->base) {
+        case VM_H_HLT:
+            fprintf(out, "    vm->flags |= VM_FLAG(F_HALT);\n");
+            flush_cmp(pending);
+            fprintf(out, "    pc = 0x%04x;\n    goto exit_halt;\n", next);
+            break;
+        case VM_H_NOP:
+            break;
+        case VM_H_INT:
+            flush_cmp(pending);
+            fprintf(out, "    SAVE();\n    vm->pc = 0x%04x;\n    vm->op_src = 0x%04x;\n", pc, s);
+            fprintf(out, "    result = vm_interrupt(vm, 0x%04x);\n    LOAD();\n", s);
+            fprintf(out, "    pc = vm->pc + %d;\n", op->size);
+            fprintf(out, "    if (vm->flags & VM_FLAG(F_HALT)) goto exit_halt;\n");
+            fprintf(out, "    if (result != VM_INT_CONTINUE) goto exit_yield;\n");
+            break;
+        case VM_H_MOV_IR: fprintf(out, "    r%d = 0x%04x;\n", d, s); break;
+        case VM_H_MOV_RR: fprintf(out, "    r%d = r%d;\n", d, s); break;
+        case VM_H_MOV_MR: fprintf(out, "    r%d = vm_read16(vm, 0x%04x);\n", d, s); break;
+        case VM_H_MOV_RM:
+            fprintf(out, "    vm_write16(vm, 0x%04x, r%d);\n", d, s);
+            flush_cmp(pending);
+            fprintf(out, "    if (vm->native == NULL) { pc = 0x%04x; goto exit_native; }\n", next);
+            break;
+        case VM_H_INC: fprintf(out, "    f_ovr = r%d == 0xffff; r0 = r%d + 1;\n", s, s); break;
+        case VM_H_DEC: fprintf(out, "    f_und = r%d == 0x0000; r0 = r%d - 1;\n", s, s); break;
+        case VM_H_ADD: fprintf(out, "    f_ovr = (uint32_t)(r0 + r%d) > 0xffff; r0 = r0 + r%d;\n", s, s); break;
+        case VM_H_SUB: fprintf(out, "    f_und = (int32_t)(r0 - r%d) < 0x0000; r0 = r0 - r%d;\n", s, s); break;
+        case VM_H_MUL: fprintf(out, "    f_ovr = (uint32_t)r0 * r%d > 0xffff; r0 = r0 * r%d;\n", s, s); break;
+        case VM_H_SHL: fprintf(out, "    r0 = r%d << 1;\n", s); break;
+        case VM_H_SHR: fprintf(out, "    r0 = r%d >> 1;\n", s); break;
+        case VM_H_ADD3_R: case VM_H_ADD3_I: case VM_H_SUB3_R: case VM_H_SUB3_I:
+        case VM_H_MUL3_R: case VM_H_MUL3_I: case VM_H_AND3_R: case VM_H_AND3_I:
+        case VM_H_OR3_R: case VM_H_OR3_I: case VM_H_XOR3_R: case VM_H_XOR3_I:
+        case VM_H_SHL3_R: case VM_H_SHL3_I: case VM_H_SHR3_R: case VM_H_SHR3_I: {
+            char b[8];
+            uint8_t a = op->aval;
+            if ((op->base - VM_H_ADD3_R) & 1) snprintf(b, sizeof(b), "0x%04x", s);
+            else snprintf(b, sizeof(b), "r%d", s);
+            switch ((op->base - VM_H_ADD3_R) / 2) {
+                case 0: fprintf(out, "    f_ovr = (uint32_t)r%d + %s > 0xffff; r%d = r%d + %s;\n", a, b, d, a, b); break;
+                case 1: fprintf(out, "    f_und = (int32_t)r%d - %s < 0x0000; r%d = r%d - %s;\n", a, b, d, a, b); break;
+                case 2: fprintf(out, "    f_ovr = (uint32_t)r%d * %s > 0xffff; r%d = r%d * %s;\n", a, b, d, a, b); break;
+                case 3: fprintf(out, "    r%d = r%d & %s;\n", d, a, b); break;
+                case 4: fprintf(out, "    r%d = r%d | %s;\n", d, a, b); break;
+                case 5: fprintf(out, "    r%d = r%d ^ %s;\n", d, a, b); break;
+                case 6: fprintf(out, "    r%d = r%d << (%s & 15);\n", d, a, b); break;
+                case 7: fprintf(out, "    r%d = r%d >> (%s & 15);\n", d, a, b); break;
+            }
+            break;
+        }
+        case VM_H_CMP_I:
+            fprintf(out, "    ca = r0; cb = 0x%04x;\n", s);
+            *pending = 1;
+            break;
+        case VM_H_CMP_R:
+            fprintf(out, "    ca = r0; cb = r%d;\n", s);
+            *pending = 1;
+            break;
+        case VM_H_JMP_I:
+            flush_cmp(pending);
+            fprintf(out, "    goto L_%04x;\n", s);
+            break;
+        case VM_H_CALL_I:
+            flush_cmp(pending);
+            emit_stack_check(pc, 2);
+            fprintf(out, "    r10 -= 2;\n    vm_write16(vm, r10, 0x%04x);\n", next);
+            fprintf(out, "    if (vm->native == NULL) { pc = 0x%04x; goto exit_native; }\n", s);
+            fprintf(out, "    goto L_%04x;\n", s);
+            break;
+        case VM_H_RET:
+            flush_cmp(pending);
+            fprintf(out, "    pc = vm_read16(vm, r10);\n    r10 += 2;\n    goto dispatch;\n");
+            break;
+        case VM_H_PUSH_I: case VM_H_PUSH_R:
+            flush_cmp(pending);
+            emit_stack_check(pc, 2);
+            fprintf(out, "    r10 -= 2;\n");
+            if (op->base == VM_H_PUSH_I) fprintf(out, "    vm_write16(vm, r10, 0x%04x);\n", s);
+            else fprintf(out, "    vm_write16(vm, r10, r%d);\n", s);
+            fprintf(out, "    if (vm->native == NULL) { pc = 0x%04x; goto exit_native; }\n", next);
+            break;
+        case VM_H_POP:
+            fprintf(out, "    r10 += 2;\n    r%d = vm_read16(vm, r10 - 2);\n", d);
+            break;
+        case VM_H_PUSHM: {
+            uint16_t bytes = 0;
+            for (uint8_t r = 0; r < 10; r++) bytes += (s >> r) & 1 ? 2 : 0;
+            flush_cmp(pending);
+            emit_stack_check(pc, bytes);
+            for (uint8_t r = 0; r < 10; r++) {
+                if ((s >> r) & 1) fprintf(out, "    r10 -= 2;\n    vm_write16(vm, r10, r%d);\n", r);
+            }
+            fprintf(out, "    if (vm->native == NULL) { pc = 0x%04x; goto exit_native; }\n", next);
+            break;
+        }
+        case VM_H_POPM:
+            for (int8_t r = 9; r >= 0; r--) {
+                if ((s >> r) & 1) fprintf(out, "    r%d = vm_read16(vm, r10);\n    r10 += 2;\n", r);
+            }
+            break;
+        case VM_H_JE_I: case VM_H_JNE_I: case VM_H_JZ_I: case VM_H_JNZ_I:
+        case VM_H_JL_I: case VM_H_JLE_I: case VM_H_JG_I: case VM_H_JGE_I: {
+            uint8_t was_pending = *pending;
+            const char *cond = branch_condition(op->base, was_pending);
+            flush_cmp(pending);
+            fprintf(out, "    if (%s) goto L_%04x;\n", cond, s);
+            break;
+        }
+        default: //VM_H_GENERIC
+            flush_cmp(pending);
+            fprintf(out, "    SAVE();\n    vm_native_step(vm, 0x%04x);\n    LOAD();\n    pc = vm->pc;\n", pc);
+            fprintf(out, "    if (vm->flags & VM_FLAG(F_HALT)) goto exit_halt;\n");
+            fprintf(out, "    if (vm->yield != 0) goto exit_yield;\n");
+            fprintf(out, "    if (vm->native == NULL) goto exit_native;\n");
+            if (vm_op_info(op->opcode)->flags & VM_OP_BRANCH) fprintf(out, "    goto dispatch;\n");
+    }
+}
+
+
+static void emit_block (uint16_t start) {
+    uint32_t pc = start;
+    uint16_t count = 0;
+    uint8_t next = 1, pending = 0;
+
+    fprintf(out, "L_%04x:\n", start);
+    if (decoded[start] != 1) {
+        fprintf(out, "    pc = 0x%04x;\n    goto exit_native;\n", start);
+        return;
+    }
+    //count the block's instructions for the budget check
+    while (1) {
+        VM_Decoded *op = &code[pc];
+        count++;
+        if (ends_block(op, &next)) break;
+        pc = (pc + op->size) & 0xffff;
+        if (leader[pc]) break;
+    }
+    fprintf(out, "    if (budget < %d) { pc = 0x%04x; goto exit_budget; }\n    budget -= %d;\n", count, start, count);
+
+    pc = start;
+    while (1) {
+        VM_Decoded *op = &code[pc];
+        emit_instruction(pc, op, &pending);
+        uint8_t end = ends_block(op, &next);
+        pc = (pc + op->size) & 0xffff;
+        if (end || leader[pc]) break;
+    }
+    //carry on into the block that follows
+    if (next) {
+        flush_cmp(&pending);
+        fprintf(out, "    goto L_%04x;\n", pc);
+    }
+    fprintf(out, "\n");
+}
+
+
+static int translate (const char *name, uint16_t entry) {
+    discover(entry);
+
+    fprintf(out, "//generated by tools/vm2c, do not edit\n#include \"vm.h\"\n#include \"instructions.h\"\n\n\n");
+    fprintf(out, "static const uint8_t %s_image[] = {", name);
+    for (uint32_t i = 0; i < length; i++) {
+        fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", mem[origin + i]);
+    }
+    fprintf(out, "\n};\n\n\n");
+
+    fprintf(out, "#define SAVE() do { \\\n");
+    for (uint8_t r = 0; r < VM_REG_COUNT; r++) fprintf(out, "        vm->reg[%d] = r%d; \\\n", r, r);
+    fprintf(out, "        vm->flags = (vm->flags & VM_FLAG(F_HALT))");
+    for (uint8_t f = 0; f < FLAG_LOCALS; f++) fprintf(out, " | %s << %d", flag_set[f], flag_index[f]);
+    fprintf(out, "; \\\n        vm->lazy = 0; \\\n");
+    fprintf(out, "    } while (0)\n\n");
+    fprintf(out, "#define LOAD() do { \\\n");
+    for (uint8_t r = 0; r < VM_REG_COUNT; r++) fprintf(out, "        r%d = vm->reg[%d]; \\\n", r, r);
+    fprintf(out, "        flags = vm_flags(vm); \\\n");
+    for (uint8_t f = 0; f < FLAG_LOCALS; f++) fprintf(out, "        %s = (flags >> %d) & 1; \\\n", flag_set[f], flag_index[f]);
+    fprintf(out, "    } while (0)\n\n\n");
+
+    fprintf(out, "static uint8_t %s_run (struct VM *vm, uint32_t max_steps) {\n", name);
+    fprintf(out, "    uint16_t r0, r1, r2, r3, r4, r5, r6, r7, r8, r9, r10;\n");
+    fprintf(out, "    uint8_t f_gt, f_lt, f_eq, f_zero, f_data, f_ovr, f_und;\n    uint16_t flags;\n");
+    fprintf(out, "    uint16_t ca = 0, cb = 0, pc = vm->pc;\n");
+    fprintf(out, "    uint32_t budget = max_steps;\n    uint8_t result = VM_RUN_BUDGET;\n");
+    fprintf(out, "    (void)ca; (void)cb; (void)result;\n    LOAD();\n\n");
+
+    //the blocks go to a buffer first so that only the labels they jump to are emitted
+    FILE *file = out;
+    char *blocks = NULL;
+    size_t blocks_size = 0;
+    out = open_memstream(&blocks, &blocks_size);
+    if (out == NULL) {
+        perror("open_memstream");
+        return 1;
+    }
+    for (uint32_t a = 0; a < 65536; a++) {
+        if (leader[a]) emit_block(a);
+    }
+    fclose(out);
+    out = file;
+
+    if (strstr(blocks, "goto dispatch;") != NULL) fprintf(out, "dispatch:\n");
+    fprintf(out, "    switch (pc) {\n");
+    for (uint32_t a = 0; a < 65536; a++) {
+        if (leader[a] && decoded[a] == 1) fprintf(out, "        case 0x%04x: goto L_%04x;\n", a, a);
+    }
+    fprintf(out, "    }\n    goto exit_native;\n\n");
+    fputs(blocks, out);
+
+    if (strstr(blocks, "goto exit_halt;") != NULL) fprintf(out, "exit_halt:\n    result = VM_RUN_HALT;\n    goto done;\n");
+    if (strstr(blocks, "goto exit_yield;") != NULL) fprintf(out, "exit_yield:\n    result = VM_RUN_INTERRUPT;\n    goto done;\n");
+    fprintf(out, "exit_native:\n    result = VM_NATIVE_EXIT;\n    goto done;\n");
+    if (strstr(blocks, "goto exit_budget;") != NULL) fprintf(out, "exit_budget:\n    result = VM_RUN_BUDGET;\n    goto done;\n");
+    free(blocks);
+    fprintf(out, "done:\n    SAVE();\n    vm->pc = pc;\n    vm->icount += max_steps - budget;\n    return result;\n}\n\n");
+    fprintf(out, "#undef SAVE\n#undef LOAD\n\n\n");
+    fprintf(out, "const VM_Native %s = { 0x%04x, %u, %s_image, %s_run };\n", name, origin, length, name, name);
+    return 0;
+}
+
+
+int main (int argc, char **argv) {
+    const char *input = NULL, *output = NULL, *name = "vm_native_program";
+    uint32_t entry = 0x10000;
+    origin = 0x0200;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) origin = strtol(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) entry = strtol(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) name = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) output = argv[++i];
+        else input = argv[i];
+    }
+    if (input == NULL) {
+        fprintf(stderr, "usage: vm2c image.bin [-a origin] [-e entry] [-n name] [-o out.c]\n");
+        return 1;
+    }
+    FILE *in = fopen(input, "rb");
+    if (in == NULL) {
+        perror(input);
+        return 1;
+    }
+    vm_init(&vm);
+    length = fread(mem + origin, 1, sizeof(mem) - origin, in);
+    fclose(in);
+    vm_load(&vm, (char *)mem + origin, length, origin);
+
+    out = output != NULL ? fopen(output, "w") : stdout;
+    if (out == NULL) {
+        perror(output);
+        return 1;
+    }
+    translate(name, entry > 0xffff ? origin : entry);
+    if (out != stdout) fclose(out);
+    return 0;
+}
@@ -0,0 +1,210 @@
+/*
+*  basicvm assembler/disassembler.
+*  Usage: vmasm source.s [-o image.bin] [-a origin]   assemble (prints a listing without -o)
+*         vmasm -d image.bin [-a origin]              disassemble
+*         vmasm -b [lines]                            benchmark the assembler
+*  The origin defaults to 0x0200, where main.c loads programs. Assembling also reports
+*  whether the program passes vm_verify() (see basicvm/verify.h).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vm.h"
+#include "asm.h"
+#include "verify.h"
+
+
+static uint8_t mem[65536];
+static struct VM vm;
+
+
+static double now () {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static char *read_file (const char *path, size_t *length) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = malloc(size + 1);
+    if (data == NULL || fread(data, 1, size, f) != (size_t)size) {
+        perror(path);
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+    data[size] = 0;
+    fclose(f);
+    if (length != NULL) *length = size;
+    return data;
+}
+
+
+static void disassemble (uint16_t origin, uint32_t length, uint8_t with_bytes) {
+    char text[64];
+    for (uint32_t addr = origin; addr < (uint32_t)origin + length; ) {
+        uint8_t size = vm_disassemble(mem, addr, text, sizeof(text));
+        if (with_bytes) {
+            char bytes[32] = "";
+            for (uint8_t i = 0; i < size; i++) {
+                snprintf(bytes + i * 3, sizeof(bytes) - i * 3, "%02x ", mem[(uint16_t)(addr + i)]);
+            }
+            printf("%04x  %-16s %s\n", addr, bytes, text);
+        } else {
+            printf("    %-24s ; %04x\n", text, addr);
+        }
+        addr += size;
+    }
+}
+
+
+static int assemble (const char *path, const char *out, uint16_t origin) {
+    char *source = read_file(path, NULL);
+    if (source == NULL) return 1;
+    VM_AsmResult result;
+    if (vm_assemble(source, origin, mem + origin, sizeof(mem) - origin, &result) != 0) {
+        fprintf(stderr, "%s:%d: %s\n", path, result.line, result.error);
+        free(source);
+        return 1;
+    }
+    free(source);
+    VM_Verify verify;
+    vm_init(&vm);
+    vm_load(&vm, (char *)mem + origin, result.length, origin);
+    if (vm_verify(&vm, origin, result.length, &verify) == VM_VERIFY_OK) {
+        fprintf(stderr, "%s: verified, %u instructions reachable\n", path, verify.instructions);
+    } else {
+        fprintf(stderr, "%s: not verified, 0x%04x %s (it runs with checks)\n", path, verify.pc, vm_verify_message(verify.error));
+    }
+    vm_free(&vm);
+    if (out == NULL) {
+        disassemble(origin, result.length, 1);
+        return 0;
+    }
+    FILE *f = fopen(out, "wb");
+    if (f == NULL || fwrite(mem + origin, 1, result.length, f) != result.length) {
+        perror(out);
+        if (f != NULL) fclose(f);
+        return 1;
+    }
+    fclose(f);
+    fprintf(stderr, "%s: %d bytes at 0x%04x\n", out, result.length, origin);
+    return 0;
+}
+
+
+static int disassemble_file (const char *path, uint16_t origin) {
+    size_t length;
+    char *image = read_file(path, &length);
+    if (image == NULL) return 1;
+    if (length > sizeof(mem) - origin) length = sizeof(mem) - origin;
+    memcpy(mem + origin, image, length);
+    free(image);
+    printf(".org 0x%04x\n", origin);
+    disassemble(origin, length, 0);
+    return 0;
+}
+
+
+//the opcode lookup this replaced: a strcmp over every entry of the VM's opcode table
+static uint8_t linear_lookup (const char *name, char smode, char dmode) {
+    for (uint16_t i = 0; i < 256; i++) {
+        const VM_Op *op = vm_op_info(i);
+        if (strcmp(op->name, name) == 0 && op->smode == smode && op->dmode == dmode) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+
+static int benchmark (uint32_t lines) {
+    //a made up program with labels, constants, forward jumps and data
+    size_t size = lines * 48 + 256;
+    char *source = malloc(size), *p = source;
+    p += sprintf(p, "COUNT = 100\nSTEP = 2\n");
+    uint32_t blocks = lines / 8;
+    for (uint32_t b = 0; b < blocks; b++) {
+        p += sprintf(p,
+            "block_%u:\n"
+            "    mov r0, COUNT + %u\n"
+            "    mov r1, [table_%u]\n"
+            "loop_%u: dec r0\n"
+            "    cmp 0 ; done yet?\n"
+            "    jnz loop_%u\n"
+            "    jmp block_%u\n"
+            "table_%u: .word STEP, $, 'x'\n",
+            b, b & 0xff, b, b, b, b + 1 < blocks ? b + 1 : 0, b
+        );
+    }
+    p += sprintf(p, "    hlt\n");
+    uint32_t bytes = p - source;
+
+    VM_AsmResult result;
+    uint32_t runs = 0;
+    double start = now(), elapsed;
+    do {
+        if (vm_assemble(source, 0, mem, sizeof(mem), &result) != 0) {
+            fprintf(stderr, "benchmark source failed at line %d: %s\n", result.line, result.error);
+            free(source);
+            return 1;
+        }
+        runs++;
+        elapsed = now() - start;
+    } while (elapsed < 1.0);
+    printf("assemble: %u lines (%u bytes of source -> %u bytes) in %.3fms, %.0f lines/s\n",
+        blocks * 8 + 3, bytes, result.length, elapsed / runs * 1e3, (blocks * 8 + 3) * runs / elapsed
+    );
+    free(source);
+
+    //opcode lookup, as used by OPCODE()
+    static const struct { const char *name; char smode, dmode; } lookups[] = {
+        { "mov", 'i', 'r' }, { "dec", 'r', ' ' }, { "cmp", 'i', ' ' }, { "jnz", 'i', ' ' },
+        { "int", 'i', ' ' }, { "sub", 'r', ' ' }, { "stdout", ' ', ' ' }, { "hlt", ' ', ' ' },
+    };
+    const uint32_t count = 1000000;
+    volatile uint32_t sink = 0;
+    start = now();
+    for (uint32_t i = 0; i < count; i++) sink += linear_lookup(lookups[i & 7].name, lookups[i & 7].smode, lookups[i & 7].dmode);
+    double linear = now() - start;
+    start = now();
+    for (uint32_t i = 0; i < count; i++) sink += vm_find_op(lookups[i & 7].name, lookups[i & 7].smode, lookups[i & 7].dmode)->opcode;
+    double sorted = now() - start;
+    printf("opcode lookup: linear scan %.1fns, sorted table %.1fns\n", linear / count * 1e9, sorted / count * 1e9);
+    return 0;
+}
+
+
+int main (int argc, char **argv) {
+    const char *input = NULL, *out = NULL;
+    uint16_t origin = 0x0200;
+    uint8_t dis = 0, bench = 0;
+    uint32_t lines = 20000;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) out = argv[++i];
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) origin = strtol(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-d") == 0) dis = 1;
+        else if (strcmp(argv[i], "-b") == 0) bench = 1;
+        else if (bench) lines = atoi(argv[i]);
+        else input = argv[i];
+    }
+    if (bench) return benchmark(lines);
+    if (input == NULL) {
+        fprintf(stderr, "usage: vmasm source.s [-o image.bin] [-a origin]\n"
+                        "       vmasm -d image.bin [-a origin]\n"
+                        "       vmasm -b [lines]\n");
+        return 1;
+    }
+    return dis ? disassemble_file(input, origin) : assemble(input, out, origin);
+}
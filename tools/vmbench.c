@@ -0,0 +1,364 @@
+/*
+*  Measures basicvm interpreter throughput on the host, with and without superinstructions.
+*  Usage: vmbench [iterations]
+*  Also times vm_interrupt()'s handler table against the switch it replaced.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "vm.h"
+#include "interrupts.h"
+#include "instructions.h"
+#include "asm.h"
+
+
+static struct VM vm;
+
+
+/*
+*  Plots a 32x64 RGB565 pattern, colour = x << 11 | y << 5 | (x + y) >> 2, through the
+*  putpixel interrupt. First with the two-operand ALU, which works on R0 and has no
+*  bitwise ops or shift counts (the fields are combined with mul and add), then with the
+*  three-operand instructions.
+*/
+static const char *pixels_2op =
+    "    mov r7, 2048\n"
+    "    mov r8, 32\n"
+    "    mov r2, 0\n"
+    "row:\n"
+    "    mov r1, 0\n"
+    "col:\n"
+    "    mov r0, r1\n"
+    "    mul r7\n"
+    "    mov r3, r0\n"
+    "    mov r0, r2\n"
+    "    mul r8\n"
+    "    add r3\n"
+    "    mov r3, r0\n"
+    "    mov r0, r1\n"
+    "    add r2\n"
+    "    shr r0\n"
+    "    shr r0\n"
+    "    add r3\n"
+    "    mov r3, r0\n"
+    "    int I_VIDEO_PUTPIXEL\n"
+    "    inc r1\n"
+    "    mov r1, r0\n"
+    "    cmp 32\n"
+    "    jl col\n"
+    "    inc r2\n"
+    "    mov r2, r0\n"
+    "    cmp 64\n"
+    "    jl row\n"
+    "    hlt\n";
+
+static const char *pixels_3op =
+    "    mov r2, 0\n"
+    "row:\n"
+    "    mov r1, 0\n"
+    "col:\n"
+    "    shl r3, r1, 11\n"
+    "    shl r4, r2, 5\n"
+    "    or r3, r3, r4\n"
+    "    add r4, r1, r2\n"
+    "    shr r4, r4, 2\n"
+    "    or r3, r3, r4\n"
+    "    int I_VIDEO_PUTPIXEL\n"
+    "    add r1, r1, 1\n"
+    "    mov r0, r1\n"
+    "    cmp 32\n"
+    "    jl col\n"
+    "    add r2, r2, 1\n"
+    "    mov r0, r2\n"
+    "    cmp 64\n"
+    "    jl row\n"
+    "    hlt\n";
+
+
+/*
+*  Copies, fills and compares 4 KB of memory, with the block instructions and with the
+*  loops they replace, which move a word at a time through pointers kept at SRC and DST.
+*/
+#define BLOCK_SETUP \
+    "SRC = 0x3000\n" \
+    "DST = 0x3002\n" \
+    "    mov r1, 0x6000\n" \
+    "    mov [DST], r1\n" \
+    "    mov r2, 0x4000\n" \
+    "    mov [SRC], r2\n"
+
+static const char *copy_loop =
+    BLOCK_SETUP
+    "    mov r3, 2048\n"
+    "copy:\n"
+    "    mov r0, [[SRC]]\n"
+    "    mov [[DST]], r0\n"
+    "    add r1, r1, 2\n"
+    "    mov [DST], r1\n"
+    "    add r2, r2, 2\n"
+    "    mov [SRC], r2\n"
+    "    sub r3, r3, 1\n"
+    "    mov r0, r3\n"
+    "    cmp 0\n"
+    "    jne copy\n"
+    "    hlt\n";
+
+static const char *copy_movs =
+    BLOCK_SETUP
+    "    mov r3, 4096\n"
+    "    movs\n"
+    "    hlt\n";
+
+static const char *fill_loop =
+    BLOCK_SETUP
+    "    mov r3, 2048\n"
+    "fill:\n"
+    "    mov r0, 0x5555\n"
+    "    mov [[DST]], r0\n"
+    "    add r1, r1, 2\n"
+    "    mov [DST], r1\n"
+    "    sub r3, r3, 1\n"
+    "    mov r0, r3\n"
+    "    cmp 0\n"
+    "    jne fill\n"
+    "    hlt\n";
+
+static const char *fill_stos =
+    BLOCK_SETUP
+    "    mov r2, 0x55\n"
+    "    mov r3, 4096\n"
+    "    stos\n"
+    "    hlt\n";
+
+//the blocks are the same, so both run to the end
+static const char *compare_loop =
+    BLOCK_SETUP
+    "    mov r3, 2048\n"
+    "compare:\n"
+    "    mov r4, [[DST]]\n"
+    "    mov r0, [[SRC]]\n"
+    "    cmp r4\n"
+    "    jne done\n"
+    "    add r1, r1, 2\n"
+    "    mov [DST], r1\n"
+    "    add r2, r2, 2\n"
+    "    mov [SRC], r2\n"
+    "    sub r3, r3, 1\n"
+    "    mov r0, r3\n"
+    "    cmp 0\n"
+    "    jne compare\n"
+    "done:\n"
+    "    hlt\n";
+
+static const char *compare_cmps =
+    BLOCK_SETUP
+    "    mov r3, 4096\n"
+    "    cmps\n"
+    "    hlt\n";
+
+
+static double now () {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static double bench (const char *name, char *program, uint16_t length, uint8_t fuse) {
+    vm.fuse = fuse;
+    vm.icount = 0;
+    double start = now(), elapsed;
+    do {
+        vm_set_flag(&vm, F_HALT, 0);
+        vm_load(&vm, program, length, 0x0200);
+        while (vm_run(&vm, UINT32_MAX) != VM_RUN_HALT);
+        elapsed = now() - start;
+    } while (elapsed < 1.0);
+    uint64_t steps = vm.icount;
+
+    printf("%s%s: %llu instructions in %.3fs, %.2f MIPS\n",
+        name, fuse != 0 ? "" : " (no superinstructions)", (unsigned long long)steps, elapsed, steps / elapsed / 1e6
+    );
+    return steps / elapsed;
+}
+
+
+/*
+*  The switch vm_interrupt() dispatched with before the handler table, kept to compare
+*  against. Not inlined, as vm_interrupt() can't be from here.
+*/
+__attribute__((noinline)) static uint8_t switch_interrupt (struct VM *vm, uint16_t num) {
+    switch (num) {
+        case I_INFO:           return vm_int_info(vm);
+        case I_GPIO_CFG:       return vm_int_gpio_cfg(vm);
+        case I_GPIO_SET:       return vm_int_gpio_set(vm);
+        case I_GPIO_GET:       return vm_int_gpio_get(vm);
+        case I_VIDEO_PUTPIXEL: return vm_int_video_putpixel(vm);
+        case I_VIDEO_GETPIXEL: return vm_int_video_getpixel(vm);
+        case I_VIDEO_FILL:     return vm_int_video_fill(vm);
+        case I_VIDEO_LINE:     return vm_int_video_line(vm);
+        case I_VIDEO_CIRCLE:   return vm_int_video_circle(vm);
+        case I_VIDEO_PRINT:    return vm_int_video_print(vm);
+        case I_VIDEO_UPDATE:   return vm_int_video_update(vm);
+        case I_SLEEP:          return vm_int_sleep(vm);
+        case I_WAIT_INPUT:     return vm_int_wait_input(vm);
+        case I_VIDEO_PIXELS:   return vm_int_video_pixels(vm);
+        case I_VIDEO_HLINE:    return vm_int_video_hline(vm);
+        case I_VIDEO_WINDOW:   return vm_int_video_window(vm);
+        case I_VIDEO_BLIT:     return vm_int_video_blit(vm);
+        case I_PROFILE:        return vm_int_profile(vm);
+    }
+    return 0;
+}
+
+
+//ns per interrupt dispatched by 'dispatch', round the cheap ones (no display) and an unused number
+static double bench_dispatch (const char *name, uint8_t (*dispatch)(struct VM *vm, uint16_t num)) {
+    static const uint16_t nums[8] = { I_GPIO_GET, I_GPIO_CFG, I_PROFILE, I_GPIO_SET, 0x40, I_GPIO_GET, I_PROFILE, I_USER };
+    uint64_t count = 0;
+    double start = now(), elapsed;
+    do {
+        for (uint32_t i = 0; i < 1000000; i++) dispatch(&vm, nums[i & 7]);
+        count += 1000000;
+        elapsed = now() - start;
+    } while (elapsed < 1.0);
+    printf("%s: %.2fns per interrupt\n", name, elapsed * 1e9 / count);
+    return elapsed * 1e9 / count;
+}
+
+
+//assembles 'source', benchmarks it and returns the seconds one run of it takes
+static double bench_source (const char *name, const char *source) {
+    static uint8_t image[1024];
+    VM_AsmResult result;
+    if (vm_assemble(source, 0x0200, image, sizeof(image), &result) != 0) {
+        fprintf(stderr, "%s:%d: %s\n", name, result.line, result.error);
+        exit(1);
+    }
+    vm.icount = 0;
+    vm_set_flag(&vm, F_HALT, 0);
+    vm_load(&vm, (char *)image, result.length, 0x0200);
+    while (vm_run(&vm, UINT32_MAX) != VM_RUN_HALT);
+    uint64_t steps = vm.icount;
+    double rate = bench(name, (char *)image, result.length, VM_FUSE_ALL);
+    printf("%s: %llu instructions per run, %.1fus\n", name, (unsigned long long)steps, steps / rate * 1e6);
+    return steps / rate;
+}
+
+
+int main (int argc, char **argv) {
+    uint16_t iterations = argc > 1 ? atoi(argv[1]) : 60000;
+    vm_init(&vm);
+
+    //counted loop: R0 = iterations, loop { dec, cmp 0, jnz }
+    char loop[] = {
+        OPCODE(&vm, "mov", 'i', 'r'),    0, HBYTE(iterations), LBYTE(iterations),
+        OPCODE(&vm, "dec", 'r', ' '),    0,                 //0x0204: R0 = R0 - 1
+        OPCODE(&vm, "cmp", 'i', ' '),    0x00, 0x00,
+        OPCODE(&vm, "jnz", 'i', ' '),    0x02, 0x04,
+        OPCODE(&vm, "hlt", ' ', ' ')
+    };
+
+    //interrupt calls like the video ones: R6 = iterations, loop { 5 x mov imm, int, dec, cmp 0, jnz }
+    char calls[] = {
+        OPCODE(&vm, "mov", 'i', 'r'),    6, HBYTE(iterations), LBYTE(iterations),
+        OPCODE(&vm, "mov", 'i', 'r'),    1, 0x00, 50,       //0x0204
+        OPCODE(&vm, "mov", 'i', 'r'),    2, 0x00, 50,
+        OPCODE(&vm, "mov", 'i', 'r'),    3, 0x00, 100,
+        OPCODE(&vm, "mov", 'i', 'r'),    4, 0x00, 100,
+        OPCODE(&vm, "mov", 'i', 'r'),    5, 0xf0, 0x0f,
+        OPCODE(&vm, "int", 'i', ' '),    0x00, I_GPIO_GET,
+        OPCODE(&vm, "dec", 'r', ' '),    6,
+        OPCODE(&vm, "mov", 'r', 'r'),    6, 0,
+        OPCODE(&vm, "cmp", 'i', ' '),    0x00, 0x00,
+        OPCODE(&vm, "jnz", 'i', ' '),    0x02, 0x04,
+        OPCODE(&vm, "hlt", ' ', ' ')
+    };
+
+    //ALU-heavy loop, most flags it sets are never read: R6 = iterations, loop { add, sub, mul, inc, dec, cmp, ... }
+    char alu[] = {
+        OPCODE(&vm, "mov", 'i', 'r'),    6, HBYTE(iterations), LBYTE(iterations),
+        OPCODE(&vm, "mov", 'r', 'r'),    0, 1,              //0x0204
+        OPCODE(&vm, "add", 'r', ' '),    2,
+        OPCODE(&vm, "mov", 'r', 'r'),    1, 0,
+        OPCODE(&vm, "sub", 'r', ' '),    3,
+        OPCODE(&vm, "mul", 'r', ' '),    4,
+        OPCODE(&vm, "mov", 'r', 'r'),    5, 0,
+        OPCODE(&vm, "inc", 'r', ' '),    5,
+        OPCODE(&vm, "cmp", 'r', ' '),    1,
+        OPCODE(&vm, "add", 'r', ' '),    1,
+        OPCODE(&vm, "mov", 'r', 'r'),    2, 0,
+        OPCODE(&vm, "dec", 'r', ' '),    6,
+        OPCODE(&vm, "mov", 'r', 'r'),    6, 0,
+        OPCODE(&vm, "cmp", 'i', ' '),    0x00, 0x00,
+        OPCODE(&vm, "jnz", 'i', ' '),    0x02, 0x04,
+        OPCODE(&vm, "hlt", ' ', ' ')
+    };
+
+    //subroutine calls saving R1-R4: R6 = iterations, loop { call, dec, cmp 0, jnz }, once with
+    //single register push/pop and once with pushm/popm
+    char saves[] = {
+        OPCODE(&vm, "mov", 'i', 'r'),    6, HBYTE(iterations), LBYTE(iterations),
+        OPCODE(&vm, "call", 'i', ' '),   0x02, 0x13,        //0x0204
+        OPCODE(&vm, "dec", 'r', ' '),    6,
+        OPCODE(&vm, "mov", 'r', 'r'),    6, 0,
+        OPCODE(&vm, "cmp", 'i', ' '),    0x00, 0x00,
+        OPCODE(&vm, "jnz", 'i', ' '),    0x02, 0x04,
+        OPCODE(&vm, "hlt", ' ', ' '),
+        OPCODE(&vm, "push", 'r', ' '),   1,                 //0x0213
+        OPCODE(&vm, "push", 'r', ' '),   2,
+        OPCODE(&vm, "push", 'r', ' '),   3,
+        OPCODE(&vm, "push", 'r', ' '),   4,
+        OPCODE(&vm, "mov", 'i', 'r'),    1, 0x00, 0x07,
+        OPCODE(&vm, "pop", ' ', 'r'),    4,
+        OPCODE(&vm, "pop", ' ', 'r'),    3,
+        OPCODE(&vm, "pop", ' ', 'r'),    2,
+        OPCODE(&vm, "pop", ' ', 'r'),    1,
+        OPCODE(&vm, "ret", ' ', ' ')
+    };
+    char savem[] = {
+        OPCODE(&vm, "mov", 'i', 'r'),    6, HBYTE(iterations), LBYTE(iterations),
+        OPCODE(&vm, "call", 'i', ' '),   0x02, 0x13,        //0x0204
+        OPCODE(&vm, "dec", 'r', ' '),    6,
+        OPCODE(&vm, "mov", 'r', 'r'),    6, 0,
+        OPCODE(&vm, "cmp", 'i', ' '),    0x00, 0x00,
+        OPCODE(&vm, "jnz", 'i', ' '),    0x02, 0x04,
+        OPCODE(&vm, "hlt", ' ', ' '),
+        OPCODE(&vm, "pushm", 'i', ' '),  0x00, 0x1e,        //0x0213
+        OPCODE(&vm, "mov", 'i', 'r'),    1, 0x00, 0x07,
+        OPCODE(&vm, "popm", 'i', ' '),   0x00, 0x1e,
+        OPCODE(&vm, "ret", ' ', ' ')
+    };
+
+    double a = bench("counted loop", loop, sizeof(loop), 0);
+    double b = bench("counted loop", loop, sizeof(loop), VM_FUSE_ALL);
+    printf("counted loop: %.2fx\n", b / a);
+    a = bench("interrupt calls", calls, sizeof(calls), 0);
+    b = bench("interrupt calls", calls, sizeof(calls), VM_FUSE_ALL);
+    printf("interrupt calls: %.2fx\n", b / a);
+    a = bench_dispatch("interrupt dispatch, switch", switch_interrupt);
+    b = bench_dispatch("interrupt dispatch, table", vm_interrupt);
+    printf("interrupt dispatch: %+.2fns with the table\n", b - a);
+    a = bench("alu loop", alu, sizeof(alu), 0);
+    b = bench("alu loop", alu, sizeof(alu), VM_FUSE_ALL);
+    printf("alu loop: %.2fx\n", b / a);
+    //15 and 9 instructions per call
+    a = bench("calls with push/pop", saves, sizeof(saves), VM_FUSE_ALL) / 15;
+    b = bench("calls with pushm/popm", savem, sizeof(savem), VM_FUSE_ALL) / 9;
+    printf("calls: %.1fns with push/pop, %.1fns with pushm/popm\n", 1e9 / a, 1e9 / b);
+    a = bench_source("pixels, two-operand", pixels_2op);
+    b = bench_source("pixels, three-operand", pixels_3op);
+    printf("pixels: %.2fx\n", a / b);
+    a = bench_source("4K copy, loop", copy_loop);
+    b = bench_source("4K copy, movs", copy_movs);
+    printf("4K copy: %.1fx\n", a / b);
+    //the copy above left the blocks the same
+    a = bench_source("4K compare, loop", compare_loop);
+    b = bench_source("4K compare, cmps", compare_cmps);
+    printf("4K compare: %.1fx\n", a / b);
+    a = bench_source("4K fill, loop", fill_loop);
+    b = bench_source("4K fill, stos", fill_stos);
+    printf("4K fill: %.1fx\n", a / b);
+    return 0;
+}
@@ -0,0 +1,340 @@
+/*
+*  Mines execution traces for hot straight-line instruction sequences, to pick the
+*  superinstructions vm_decode() fuses (struct VM 'fuse', VM_FUSE_*).
+*  Usage: vmhot [options] trace.bin              traces written by vm_trace_dump()
+*         vmhot [options] -r image.bin [-a origin] [-s steps]
+*                                                runs the image here with tracing on
+*  Options: -n longest sequence (default 6), -t sequences listed (default 20),
+*           -m minimum share of dispatches saved for a fusion to be suggested (default 1%)
+*
+*  Every run of 2..n instructions that executed one after the other without a jump is
+*  counted. A sequence executed 'count' times saves count * (length - 1) dispatches when
+*  fused, which is what the list is ordered by.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+#include "trace.h"
+
+
+#define MAX_LENGTH 8
+#define TABLE_INITIAL 1024
+
+typedef struct {
+    uint8_t length;
+    uint8_t opcodes[MAX_LENGTH];
+    uint64_t count;
+} Sequence;
+
+static struct VM vm;
+static Sequence *table = NULL;
+static uint32_t table_size = 0, table_used = 0;
+
+//the last instructions executed, newest at [run - 1]
+static uint16_t window_pc[MAX_LENGTH];
+static uint8_t window_op[MAX_LENGTH];
+static uint8_t run = 0, max_length = 6;
+static uint64_t executed = 0;
+
+
+static uint16_t get16 (uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+
+static uint8_t opcode_size (uint8_t opcode) {
+    const VM_Op *op = vm_op_info(opcode);
+    uint8_t size = 1;
+    if (op->dmode == 'r') size += 1;
+    else if (op->dmode == 'm' || op->dmode == 'p') size += 2;
+    if (op->smode == 'r') size += 1;
+    else if (op->smode == 'i' || op->smode == 'm' || op->smode == 'p' || op->smode == 'R') size += 2;
+    else if (op->smode == 'I') size += 3;
+    return size;
+}
+
+
+static uint32_t sequence_hash (const uint8_t *opcodes, uint8_t length) {
+    uint32_t hash = 2166136261u ^ length;
+    for (uint8_t i = 0; i < length; i++) hash = (hash ^ opcodes[i]) * 16777619u;
+    return hash;
+}
+
+
+static Sequence *sequence_find (const uint8_t *opcodes, uint8_t length) {
+    uint32_t i = sequence_hash(opcodes, length) & (table_size - 1);
+    while (table[i].length != 0) {
+        if (table[i].length == length && memcmp(table[i].opcodes, opcodes, length) == 0) break;
+        i = (i + 1) & (table_size - 1);
+    }
+    return &table[i];
+}
+
+
+static void table_grow () {
+    Sequence *old = table;
+    uint32_t old_size = table_size;
+    table_size = table_size == 0 ? TABLE_INITIAL : table_size * 2;
+    table = calloc(table_size, sizeof(Sequence));
+    if (table == NULL) {
+        fprintf(stderr, "vmhot: out of memory\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < old_size; i++) {
+        if (old[i].length != 0) *sequence_find(old[i].opcodes, old[i].length) = old[i];
+    }
+    free(old);
+}
+
+
+static void count_sequence (const uint8_t *opcodes, uint8_t length) {
+    if ((table_used + 1) * 2 > table_size) table_grow();
+    Sequence *seq = sequence_find(opcodes, length);
+    if (seq->length == 0) {
+        seq->length = length;
+        memcpy(seq->opcodes, opcodes, length);
+        table_used++;
+    }
+    seq->count++;
+}
+
+
+//feeds one executed instruction to the miner
+static void mine (uint16_t pc, uint8_t opcode) {
+    executed++;
+    if (run > 0 && pc == (uint16_t)(window_pc[run - 1] + opcode_size(window_op[run - 1]))) {
+        if (run == max_length) {
+            memmove(window_pc, window_pc + 1, (run - 1) * sizeof(window_pc[0]));
+            memmove(window_op, window_op + 1, run - 1);
+            run--;
+        }
+    } else {
+        run = 0;
+    }
+    window_pc[run] = pc;
+    window_op[run] = opcode;
+    run++;
+    for (uint8_t length = 2; length <= run; length++) count_sequence(window_op + run - length, length);
+}
+
+
+static void mine_record (uint8_t *p, uint32_t *dropped, uint32_t chunk_dropped) {
+    if (chunk_dropped != *dropped) {
+        run = 0; //records are missing, don't join sequences across the gap
+        *dropped = chunk_dropped;
+    }
+    if (p[2] == VM_TRACE_REC_OP) mine(get16(p), p[3]);
+}
+
+
+static int mine_file (const char *path) {
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        perror(path);
+        return 1;
+    }
+    uint8_t header[10], record[16];
+    uint32_t dropped = 0;
+    size_t matched = 0;
+    int ch;
+    while ((ch = fgetc(in)) != EOF) {
+        //chunks are found the same way as in vmtrace
+        if (ch != VM_TRACE_MAGIC[matched]) {
+            matched = ch == VM_TRACE_MAGIC[0];
+            continue;
+        }
+        if (++matched < 4) continue;
+        matched = 0;
+        if (fread(header + 4, 1, 6, in) != 6) break;
+        if (header[4] != VM_TRACE_VERSION) continue;
+        uint32_t chunk_dropped = get16(header + 6) | ((uint32_t)get16(header + 8) << 16);
+        for (uint8_t i = 0; i < header[5]; i++) {
+            if (fread(record, 1, sizeof(record), in) != sizeof(record)) break;
+            mine_record(record, &dropped, chunk_dropped);
+        }
+    }
+    fclose(in);
+    if (dropped != 0) fprintf(stderr, "vmhot: %u records were dropped from the trace\n", dropped);
+    return 0;
+}
+
+
+static int mine_image (const char *path, uint16_t origin, uint64_t steps) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    static uint8_t image[65536];
+    size_t length = fread(image, 1, sizeof(image) - origin, f);
+    fclose(f);
+    vm_load(&vm, (char *)image, length, origin);
+
+    static VM_Trace trace;
+    VM_TraceRecord records[VM_TRACE_SIZE];
+    vm_trace_init(&trace, VM_TRACE_LEVEL_OP);
+    vm.trace = &trace;
+    uint8_t result;
+    do {
+        //at most an instruction and an interrupt record per step, so nothing is dropped
+        result = vm_run(&vm, VM_TRACE_SIZE / 2);
+        uint16_t count = vm_trace_read(&trace, records, VM_TRACE_SIZE);
+        for (uint16_t i = 0; i < count; i++) {
+            if (records[i].kind == VM_TRACE_REC_OP) mine(records[i].pc, records[i].opcode);
+        }
+    } while (result != VM_RUN_HALT && vm.icount < steps);
+    fprintf(stderr, "vmhot: %s, %zu bytes at 0x%04x, %s after %llu instructions\n", path, length, origin,
+        result == VM_RUN_HALT ? "halted" : "stopped", (unsigned long long)vm.icount
+    );
+    return 0;
+}
+
+
+static uint8_t is_op (uint8_t opcode, const char *name, char smode, char dmode) {
+    const VM_Op *op = vm_op_info(opcode);
+    return strcmp(op->name, name) == 0 && op->smode == smode && op->dmode == dmode;
+}
+
+
+static uint8_t is_jcc (uint8_t opcode) {
+    static const char *names[] = { "je", "jne", "jz", "jnz", "jl", "jle", "jg", "jge" };
+    for (uint8_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (is_op(opcode, names[i], 'i', ' ')) return 1;
+    }
+    return 0;
+}
+
+
+static uint8_t is_cmp (uint8_t opcode) {
+    return is_op(opcode, "cmp", 'i', ' ') || is_op(opcode, "cmp", 'r', ' ');
+}
+
+
+//the VM_FUSE_* flag that makes vm_decode() fuse a sequence, 0 if none does (mirrors vm_fuse())
+static uint8_t fused_by (const Sequence *seq) {
+    const uint8_t *s = seq->opcodes;
+    uint8_t n = seq->length, movs = 0;
+    while (movs < n && is_op(s[movs], "mov", 'i', 'r')) movs++;
+    if (movs == n && n <= VM_FUSE_MAX) return VM_FUSE_MOVI;
+    if (movs == n - 1 && movs <= VM_FUSE_MAX && is_op(s[movs], "int", 'i', ' ')) return VM_FUSE_MOVI;
+    if (n == 2 && is_cmp(s[0]) && is_jcc(s[1])) return VM_FUSE_CMP_JCC;
+    if (n == 3 && (is_op(s[0], "inc", 'r', ' ') || is_op(s[0], "dec", 'r', ' ')) && is_cmp(s[1]) && is_jcc(s[2])) {
+        return VM_FUSE_STEP_JCC;
+    }
+    return 0;
+}
+
+
+static const char *fuse_name (uint8_t flag) {
+    switch (flag) {
+        case VM_FUSE_MOVI: return "VM_FUSE_MOVI";
+        case VM_FUSE_CMP_JCC: return "VM_FUSE_CMP_JCC";
+        case VM_FUSE_STEP_JCC: return "VM_FUSE_STEP_JCC";
+    }
+    return "-";
+}
+
+
+static void sequence_text (const Sequence *seq, char *text, size_t size) {
+    size_t used = 0;
+    text[0] = 0;
+    for (uint8_t i = 0; i < seq->length && used < size; i++) {
+        const VM_Op *op = vm_op_info(seq->opcodes[i]);
+        used += snprintf(text + used, size - used, "%s%s", i > 0 ? "; " : "", op->name[0] != 0 ? op->name : "???");
+        //operand modes in assembler order, destination first
+        if (op->dmode != ' ' && used < size) used += snprintf(text + used, size - used, " %c", op->dmode);
+        if (op->smode != ' ' && used < size) used += snprintf(text + used, size - used, "%s%c", op->dmode != ' ' ? "," : " ", op->smode);
+    }
+}
+
+
+static uint64_t saved (const Sequence *seq) {
+    return seq->count * (seq->length - 1);
+}
+
+
+static int by_saved (const void *a, const void *b) {
+    uint64_t x = saved(a), y = saved(b);
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+
+static void report (uint32_t top, double minimum) {
+    if (executed == 0) {
+        printf("no instructions traced\n");
+        return;
+    }
+    Sequence *list = malloc(table_used * sizeof(Sequence));
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < table_size; i++) {
+        if (table[i].length != 0) list[count++] = table[i];
+    }
+    qsort(list, count, sizeof(Sequence), by_saved);
+
+    printf("%llu instructions, %u distinct sequences\n\n", (unsigned long long)executed, count);
+    printf("  saved      count  len  %-44s fused by\n", "sequence");
+    char text[128];
+    for (uint32_t i = 0; i < count && i < top; i++) {
+        sequence_text(&list[i], text, sizeof(text));
+        printf("%6.2f%% %10llu  %3u  %-44s %s\n", saved(&list[i]) * 100.0 / executed,
+            (unsigned long long)list[i].count, list[i].length, text, fuse_name(fused_by(&list[i]))
+        );
+    }
+
+    //a fusion is worth having if its best sequence saves at least 'minimum' of all dispatches
+    uint8_t suggested = 0, seen = 0;
+    printf("\n  saved  fusion            best sequence\n");
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t flag = fused_by(&list[i]);
+        if (flag == 0 || (seen & flag) != 0) continue;
+        seen |= flag;
+        double share = saved(&list[i]) * 100.0 / executed;
+        if (share >= minimum) suggested |= flag;
+        sequence_text(&list[i], text, sizeof(text));
+        printf("%6.2f%%  %-17s %s\n", share, fuse_name(flag), text);
+    }
+    printf("\nsuggested: vm.fuse = ");
+    if (suggested == 0) printf("0");
+    for (uint8_t flag = 1, first = 1; flag < VM_FUSE_ALL; flag <<= 1) {
+        if ((suggested & flag) == 0) continue;
+        printf("%s%s", first ? "" : " | ", fuse_name(flag));
+        first = 0;
+    }
+    printf(";\n");
+    free(list);
+}
+
+
+int main (int argc, char **argv) {
+    const char *input = NULL;
+    uint8_t image = 0;
+    uint16_t origin = 0x0200;
+    uint64_t steps = 10000000;
+    uint32_t top = 20;
+    double minimum = 1.0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0) image = 1;
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) origin = strtol(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) steps = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) max_length = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) top = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) minimum = atof(argv[++i]);
+        else input = argv[i];
+    }
+    if (input == NULL) {
+        fprintf(stderr, "usage: vmhot [-n length] [-t top] [-m percent] trace.bin\n"
+                        "       vmhot [-n length] [-t top] [-m percent] -r image.bin [-a origin] [-s steps]\n");
+        return 1;
+    }
+    if (max_length < 2) max_length = 2;
+    if (max_length > MAX_LENGTH) max_length = MAX_LENGTH;
+
+    vm_init(&vm);
+    table_grow();
+    if ((image ? mine_image(input, origin, steps) : mine_file(input)) != 0) return 1;
+    report(top, minimum);
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+*  Checks programs translated by vm2c against the interpreter and compares their speed.
+*  Usage: vmnative
+*  Each program is run by the interpreter without superinstructions (the reference), by the
+*  interpreter as configured by vm_init() and as native code, with varying slice sizes, and
+*  the VM state is compared after every slice. Then each form is timed running to completion.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vm.h"
+
+
+extern const VM_Native native_countdown;
+extern const VM_Native native_selftest;
+extern const VM_Native native_calls;
+extern const VM_Native native_alu3;
+extern const VM_Native native_blocks;
+
+static const struct {
+    const char *name;
+    const VM_Native *native;
+} programs[] = {
+    { "countdown", &native_countdown },
+    { "selftest", &native_selftest },
+    { "calls", &native_calls },
+    { "alu3", &native_alu3 },
+    { "blocks", &native_blocks },
+};
+
+static struct VM plain, interp, native;
+
+
+static double now () {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+//copies the image into 'vm', where the native VM maps it shared
+static void load_interpreted (struct VM *vm, const VM_Native *program) {
+    vm_free(vm);
+    vm_init(vm);
+    vm_load(vm, (char *)program->image, program->length, program->origin);
+}
+
+
+//1 if 'a' and 'b' don't hold the same 64K
+static int memory_differs (struct VM *a, struct VM *b) {
+    for (uint16_t i = 0; i < VM_PAGE_COUNT; i++) {
+        if (a->page[i] != b->page[i] && memcmp(a->page[i], b->page[i], VM_PAGE_SIZE) != 0) return 1;
+    }
+    return 0;
+}
+
+
+static int compare (const char *name, const char *form, uint32_t slice, struct VM *vm, uint8_t a, uint8_t b) {
+    const char *what = NULL;
+    if (a != b) what = "return code";
+    else if (plain.pc != vm->pc) what = "pc";
+    else if (plain.icount != vm->icount) what = "instruction count";
+    else if (memcmp(plain.reg, vm->reg, sizeof(plain.reg)) != 0) what = "registers";
+    else if (vm_flags(&plain) != vm_flags(vm)) what = "flags";
+    else if (plain.fault != vm->fault) what = "fault";
+    if (what == NULL) return 0;
+    printf("%s: %s %s differs after slice %u (reference pc 0x%04x, %s pc 0x%04x)\n",
+        name, form, what, slice, plain.pc, form, vm->pc
+    );
+    return 1;
+}
+
+
+static int differential (const char *name, const VM_Native *program) {
+    static const uint32_t slices[] = { 1, 2, 3, 5, 7, 64, 1000, 4093 };
+    for (uint8_t s = 0; s < sizeof(slices) / sizeof(slices[0]); s++) {
+        load_interpreted(&plain, program);
+        plain.fuse = 0;
+        load_interpreted(&interp, program);
+        vm_free(&native);
+        vm_init(&native);
+        vm_native_load(&native, program);
+        uint32_t count = 0;
+        uint8_t r, a, b;
+        do {
+            r = vm_run(&plain, slices[s]);
+            a = vm_run(&interp, slices[s]);
+            b = vm_run_native(&native, slices[s]);
+            if (compare(name, "interpreter", count, &interp, r, a) != 0) return 1;
+            if (compare(name, "native", count, &native, r, b) != 0) return 1;
+            count++;
+        } while (r != VM_RUN_HALT);
+        if (memory_differs(&plain, &interp) || memory_differs(&plain, &native)) {
+            printf("%s: memory differs at halt (slices of %u)\n", name, slices[s]);
+            return 1;
+        }
+    }
+    printf("%s: interpreter, superinstructions and native agree (%llu instructions)\n", name, (unsigned long long)plain.icount);
+    printf("%s: %u bytes of RAM with the image copied, %u with it mapped\n", name, vm_ram(&plain), vm_ram(&native));
+    return 0;
+}
+
+
+static double throughput (const VM_Native *program, uint8_t use_native) {
+    struct VM *vm = use_native ? &native : &interp;
+    uint64_t steps = 0;
+    double start = now(), elapsed;
+    do {
+        if (use_native) {
+            vm_free(vm);
+            vm_init(vm);
+            vm_native_load(vm, program);
+            while (vm_run_native(vm, UINT32_MAX) != VM_RUN_HALT);
+        } else {
+            load_interpreted(vm, program);
+            while (vm_run(vm, UINT32_MAX) != VM_RUN_HALT);
+        }
+        steps += vm->icount;
+        elapsed = now() - start;
+    } while (elapsed < 1.0);
+    return steps / elapsed / 1e6;
+}
+
+
+int main (int argc, char **argv) {
+    int failed = 0;
+    for (uint8_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        failed |= differential(programs[i].name, programs[i].native);
+    }
+    for (uint8_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        double a = throughput(programs[i].native, 0), b = throughput(programs[i].native, 1);
+        printf("%s: interpreter %.2f MIPS, native %.2f MIPS (%.1fx)\n", programs[i].name, a, b, b / a);
+    }
+    return failed;
+}
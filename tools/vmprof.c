@@ -0,0 +1,253 @@
+/*
+*  Flat profile of a basicvm program (see basicvm/profile.h).
+*  Usage: vmprof -r prog.s [-n lines]                 run prog.s (loaded at 0x0200) on the host under
+*                                                    the profiler, sampling every 100us
+*         vmprof capture.bin [-s prog.s] [-n lines]   the last profile in a capture of a firmware built
+*                                                    with VM_PROFILE, annotated with prog.s
+*  Prints instructions by opcode and by addressing mode, interrupts, each handler's share
+*  of the samples with its estimated time per instruction, and the most sampled PCs with
+*  their disassembly.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include "vm.h"
+#include "asm.h"
+#include "profile.h"
+#include "video.h"
+
+#define SAMPLE_US 100
+
+
+static struct VM vm;
+static VM_Profile profile;
+static VM_Display display;
+static uint8_t mem[65536];
+static uint8_t have_code;
+
+static const char *modes[VM_PROFILE_MODES] = { "none", "register", "immediate", "memory", "pointer" };
+
+static const char *handlers[VM_H_COUNT] = {
+    [VM_H_GENERIC] = "generic", [VM_H_HLT] = "hlt", [VM_H_NOP] = "nop", [VM_H_INT] = "int",
+    [VM_H_MOV_IR] = "mov_ir", [VM_H_MOV_RR] = "mov_rr", [VM_H_MOV_MR] = "mov_mr", [VM_H_MOV_RM] = "mov_rm",
+    [VM_H_INC] = "inc", [VM_H_DEC] = "dec", [VM_H_ADD] = "add", [VM_H_SUB] = "sub", [VM_H_MUL] = "mul",
+    [VM_H_SHL] = "shl", [VM_H_SHR] = "shr", [VM_H_CMP_I] = "cmp_i", [VM_H_CMP_R] = "cmp_r",
+    [VM_H_JMP_I] = "jmp", [VM_H_JE_I] = "je", [VM_H_JNE_I] = "jne", [VM_H_JZ_I] = "jz", [VM_H_JNZ_I] = "jnz",
+    [VM_H_JL_I] = "jl", [VM_H_JLE_I] = "jle", [VM_H_JG_I] = "jg", [VM_H_JGE_I] = "jge",
+    [VM_H_CALL_I] = "call", [VM_H_RET] = "ret", [VM_H_PUSH_I] = "push_i", [VM_H_PUSH_R] = "push_r",
+    [VM_H_POP] = "pop", [VM_H_PUSHM] = "pushm", [VM_H_POPM] = "popm",
+    [VM_H_ADD3_R] = "add3_r", [VM_H_ADD3_I] = "add3_i", [VM_H_SUB3_R] = "sub3_r", [VM_H_SUB3_I] = "sub3_i",
+    [VM_H_MUL3_R] = "mul3_r", [VM_H_MUL3_I] = "mul3_i", [VM_H_AND3_R] = "and3_r", [VM_H_AND3_I] = "and3_i",
+    [VM_H_OR3_R] = "or3_r", [VM_H_OR3_I] = "or3_i", [VM_H_XOR3_R] = "xor3_r", [VM_H_XOR3_I] = "xor3_i",
+    [VM_H_SHL3_R] = "shl3_r", [VM_H_SHL3_I] = "shl3_i", [VM_H_SHR3_R] = "shr3_r", [VM_H_SHR3_I] = "shr3_i",
+    [VM_H_MOVI_N] = "movi_n", [VM_H_MOVI_INT] = "movi_int", [VM_H_CMPI_JCC] = "cmpi_jcc",
+    [VM_H_CMPR_JCC] = "cmpr_jcc", [VM_H_INC_JCC] = "inc_jcc", [VM_H_DEC_JCC] = "dec_jcc",
+};
+
+
+static uint8_t *read_file (const char *path, long *size) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*size + 1);
+    if (data == NULL || fread(data, 1, *size, f) != (size_t)*size) {
+        perror(path);
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+    data[*size] = 0;
+    fclose(f);
+    return data;
+}
+
+
+//assembles 'path' into 'mem' at 0x0200, returns its length or -1
+static long assemble (const char *path) {
+    long size;
+    char *source = (char *)read_file(path, &size);
+    if (source == NULL) return -1;
+    VM_AsmResult result;
+    int status = vm_assemble(source, 0x0200, mem + 0x0200, sizeof(mem) - 0x0200, &result);
+    free(source);
+    if (status != 0) {
+        fprintf(stderr, "%s:%d: %s\n", path, result.line, result.error);
+        return -1;
+    }
+    have_code = 1;
+    return result.length;
+}
+
+
+static void tick (int sig) {
+    vm_profile_tick(&profile);
+}
+
+
+static int run (const char *path) {
+    long length = assemble(path);
+    if (length < 0) return 1;
+    vm_init(&vm);
+    vm_load(&vm, (char *)mem + 0x0200, length, 0x0200);
+    vm_display_init(&display);
+    vm.display = &display;
+    vm_profile_init(&profile, 0);
+    vm.profile = &profile;
+
+    struct itimerval timer = { { 0, SAMPLE_US }, { 0, SAMPLE_US } };
+    signal(SIGPROF, tick);
+    setitimer(ITIMER_PROF, &timer, NULL);
+    while (vm_run(&vm, 10000) != VM_RUN_HALT);
+    timer.it_value.tv_usec = 0;
+    setitimer(ITIMER_PROF, &timer, NULL);
+    if (vm.fault != VM_FAULT_NONE) printf("%s: fault %d at 0x%04x\n", path, vm.fault, vm.pc);
+    return 0;
+}
+
+
+//loads the last profile in a capture
+static int load (const char *path) {
+    long size;
+    uint8_t *data = read_file(path, &size);
+    if (data == NULL) return 1;
+    uint32_t found = 0;
+    for (long i = 0; i + 4 <= size; i++) {
+        if (memcmp(data + i, VM_PROFILE_MAGIC, 4) == 0 && vm_profile_load(&profile, data + i, size - i) != 0) found++;
+    }
+    free(data);
+    if (found == 0) {
+        fprintf(stderr, "%s: no profile (was the firmware built with VM_PROFILE?)\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+
+static double percent (uint64_t part, uint64_t whole) {
+    return whole > 0 ? 100.0 * part / whole : 0;
+}
+
+
+//prints the entries of 'counts' that aren't 0, most first, at most 'lines' of them
+static void print_sorted (const uint32_t *counts, uint16_t length, uint64_t total, uint16_t lines, void (*print_name)(uint16_t i)) {
+    uint8_t *done = calloc(length, 1);
+    for (uint16_t line = 0; line < lines; line++) {
+        int32_t best = -1;
+        for (uint16_t i = 0; i < length; i++) {
+            if (!done[i] && counts[i] > 0 && (best < 0 || counts[i] > counts[best])) best = i;
+        }
+        if (best < 0) break;
+        done[best] = 1;
+        printf("  %12lu %6.2f%%  ", (unsigned long)counts[best], percent(counts[best], total));
+        print_name(best);
+        printf("\n");
+    }
+    free(done);
+}
+
+static void print_opcode (uint16_t i) {
+    const VM_Op *op = vm_op_info(i);
+    printf("%s %c%c (0x%02x)", op->name, op->smode, op->dmode, i);
+}
+
+static void print_mode (uint16_t i) {
+    printf("%s", modes[i]);
+}
+
+static void print_int (uint16_t i) {
+    printf("int 0x%02x", i);
+}
+
+
+static void report (uint16_t lines) {
+    double us_per_sample = profile.samples > 0 ? (double)profile.run_us / profile.samples : 0;
+    printf("%llu instructions in %.3fms of vm_run(), %lu samples\n",
+        (unsigned long long)profile.instructions, profile.run_us / 1000.0, (unsigned long)profile.samples
+    );
+
+    printf("\nby opcode:\n");
+    print_sorted(profile.ops, 256, profile.instructions, lines, print_opcode);
+    printf("\nby source operand:\n");
+    print_sorted(profile.smodes, VM_PROFILE_MODES, profile.instructions, lines, print_mode);
+    printf("\nby destination operand:\n");
+    print_sorted(profile.dmodes, VM_PROFILE_MODES, profile.instructions, lines, print_mode);
+    uint64_t ints = 0;
+    for (uint16_t i = 0; i < 256; i++) ints += profile.ints[i];
+    printf("\ninterrupts:\n");
+    print_sorted(profile.ints, 256, ints, lines, print_int);
+
+    //a handler's share of the time is its share of the samples
+    printf("\nby handler:     instructions   samples   time/instruction\n");
+    for (uint16_t line = 0; line < VM_H_COUNT; line++) {
+        int32_t best = -1;
+        for (uint16_t i = 0; i < VM_H_COUNT; i++) {
+            if (profile.handlers[i] > 0 && (best < 0 || profile.handler_samples[i] > profile.handler_samples[best])) best = i;
+        }
+        if (best < 0) break;
+        double ns = profile.handler_samples[best] * us_per_sample * 1000 / profile.handlers[best];
+        printf("  %-10s %14lu %6.2f%%   %8.1fns", handlers[best], (unsigned long)profile.handlers[best],
+            percent(profile.handler_samples[best], profile.samples), ns
+        );
+        if (profile.clock_hz != 0) printf(" %8.1f cycles", ns * profile.clock_hz / 1e9);
+        printf("\n");
+        profile.handlers[best] = 0;
+    }
+
+    printf("\nhottest PCs:\n");
+    for (uint16_t line = 0; line < lines; line++) {
+        int32_t best = -1;
+        for (uint32_t i = 0; i < VM_PROFILE_BUCKETS; i++) {
+            if (profile.pcs[i] > 0 && (best < 0 || profile.pcs[i] > profile.pcs[best])) best = i;
+        }
+        if (best < 0) break;
+        uint16_t start = best << VM_PROFILE_SHIFT;
+        printf("  0x%04x-0x%04x %6.2f%%\n", start, start + VM_PROFILE_BUCKET - 1, percent(profile.pcs[best], profile.samples));
+        profile.pcs[best] = 0;
+        if (!have_code) continue;
+        //instructions starting in the bucket, found by disassembling from the start of the program
+        char text[64];
+        for (uint32_t pc = 0x0200; pc < (uint32_t)start + VM_PROFILE_BUCKET; ) {
+            uint8_t size = vm_disassemble(mem, pc, text, sizeof(text));
+            if (pc >= start) printf("      %04x  %s\n", pc, text);
+            pc += size > 0 ? size : 1;
+        }
+    }
+}
+
+
+int main (int argc, char **argv) {
+    const char *source = NULL, *capture = NULL;
+    uint8_t running = 0;
+    uint16_t lines = 10;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            source = argv[++i];
+            running = 1;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            source = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            lines = atoi(argv[++i]);
+        } else {
+            capture = argv[i];
+        }
+    }
+    if (running) {
+        if (run(source) != 0) return 1;
+    } else if (capture != NULL) {
+        if (load(capture) != 0) return 1;
+        if (source != NULL && assemble(source) < 0) return 1;
+    } else {
+        fprintf(stderr, "usage: vmprof -r prog.s [-n lines]\n       vmprof capture.bin [-s prog.s] [-n lines]\n");
+        return 1;
+    }
+    report(lines);
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+*  Regression checks for the basicvm interpreter on the host.
+*  Usage: vmregress
+*  Each check sets up a case that once went wrong and prints ok or FAIL, the exit status is
+*  the number that failed. `ctest` in the host build runs it.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+#include "asm.h"
+#include "instructions.h"
+#include "verify.h"
+
+
+static struct VM vm;
+static uint8_t image[256];
+static uint8_t window[VM_PAGE_SIZE];
+static int failed = 0;
+
+
+static void check (const char *name, int ok) {
+    printf("%-50s %s\n", name, ok ? "ok" : "FAIL");
+    if (!ok) failed++;
+}
+
+
+//assembles 'source' at 0x0200 into a fresh VM and verifies it, returns 0 if either failed
+static int load (const char *source) {
+    VM_AsmResult result;
+    if (vm_assemble(source, 0x0200, image, sizeof(image), &result) != 0) {
+        fprintf(stderr, "%d: %s\n", result.line, result.error);
+        return 0;
+    }
+    vm_free(&vm);
+    vm_init(&vm);
+    vm_load(&vm, (char *)image, result.length, 0x0200);
+    VM_Verify verify;
+    return vm_verify(&vm, 0x0200, result.length, &verify) == VM_VERIFY_OK;
+}
+
+
+/*
+*  A window mapped over verified code must not inherit its verification, or the bytes
+*  in the window (a register index of 200 here) are decoded without the register check.
+*/
+static void window_over_verified () {
+    check("window: program verifies", load("    mov r1, 5\n    hlt\n"));
+    uint8_t code[] = { OPCODE(&vm, "mov", 'i', 'r'), 200, 0x00, 0x05, OPCODE(&vm, "hlt", ' ', ' ') };
+    memset(window, 0, sizeof(window));
+    memcpy(window, code, sizeof(code));
+    check("window: mapped over the program", vm_map_window(&vm, 0x0200, window, sizeof(window)) == sizeof(window));
+    check("window: verification dropped", vm.verified_hi <= vm.verified_lo);
+    check("window: bad register decoded to a fault", vm_decode(&vm, 0x0200)->func == vm_instruction_register);
+    vm.pc = 0x0200;
+    while (vm_run(&vm, 1000) != VM_RUN_HALT);
+    check("window: running it faults", vm.fault == VM_FAULT_REGISTER);
+    vm_unmap_window(&vm);
+}
+
+
+//with the window elsewhere the verified program is left alone
+static void window_beside_verified () {
+    load("    mov r1, 5\n    hlt\n");
+    vm_map_window(&vm, 0x8000, window, sizeof(window));
+    check("window elsewhere: verification kept", vm.verified_hi > vm.verified_lo);
+    vm.pc = 0x0200;
+    while (vm_run(&vm, 1000) != VM_RUN_HALT);
+    check("window elsewhere: program runs", vm.fault == VM_FAULT_NONE && vm.reg[1] == 5);
+    vm_unmap_window(&vm);
+    check("window elsewhere: unmapped reads zero", vm_read8(&vm, 0x8000) == 0);
+}
+
+
+int main () {
+    vm_init(&vm);
+    window_over_verified();
+    window_beside_verified();
+    vm_free(&vm);
+    return failed;
+}
@@ -0,0 +1,158 @@
+/*
+*  Records a basicvm program's run on the host, or plays a recorded run back.
+*  Usage: vmreplay -r prog.s [-o run.bin]   run prog.s (loaded at 0x0200) reading stdin, and write
+*                                           its starting snapshot and what it read to run.bin
+*         vmreplay run.bin                  play back every run in run.bin, which can also be a
+*                                           capture of a firmware built with VM_REPLAY
+*  Either way it reports the time the run took under the scheduler and a hash of the VM's
+*  state at the end, which a playback of the same run should match (see basicvm/snapshot.h).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+#include "asm.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include "video.h"
+
+#define EVENTS 65536 //reads a run can record
+
+
+static struct VM vm;
+static VM_Sched sched;
+static VM_Display display;
+static VM_ReplayEvent events[EVENTS];
+static VM_Replay replay;
+static uint8_t state[VM_SNAPSHOT_SIZE(VM_PAGE_COUNT)];
+
+
+static uint8_t *read_file (const char *path, long *size) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*size + 1);
+    if (data == NULL || fread(data, 1, *size, f) != (size_t)*size) {
+        perror(path);
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+    data[*size] = 0;
+    fclose(f);
+    return data;
+}
+
+
+//runs 'vm' to the end under the scheduler, as the firmware does, and reports it
+static void run (const char *name) {
+    vm_display_init(&display);
+    vm.display = &display;
+    vm_sched_init(&sched);
+    vm_sched_add(&sched, &vm, name, VM_SCHED_SLICE);
+    while (vm_sched_run(&sched, 1000000) != 0);
+    vm_display_flush(&display);
+    vm_sched_report(&sched);
+    vm_sched_remove(&sched, &vm);
+
+    //FNV-1a of everything a snapshot holds
+    uint32_t length = vm_snapshot(&vm, state, sizeof(state)), hash = 2166136261u;
+    for (uint32_t i = 0; i < length; i++) hash = (hash ^ state[i]) * 16777619u;
+    printf("%s: %llu instructions, ended at 0x%04x with fault %d, state %08x\n",
+        name, (unsigned long long)vm.icount, vm.pc, vm.fault, hash
+    );
+}
+
+
+static int record (const char *path, const char *out_path) {
+    static uint8_t image[65536 - 0x0200];
+    long size;
+    char *source = (char *)read_file(path, &size);
+    if (source == NULL) return 1;
+    VM_AsmResult result;
+    int status = vm_assemble(source, 0x0200, image, sizeof(image), &result);
+    free(source);
+    if (status != 0) {
+        fprintf(stderr, "%s:%d: %s\n", path, result.line, result.error);
+        return 1;
+    }
+    vm_init(&vm);
+    vm_load(&vm, (char *)image, result.length, 0x0200);
+    uint32_t start_length = vm_snapshot(&vm, NULL, 0);
+    uint8_t *start = malloc(start_length);
+    vm_snapshot(&vm, start, start_length);
+
+    vm_replay_init(&replay, events, EVENTS);
+    vm_replay_record(&vm, &replay);
+    run("recorded");
+    printf("recorded: %lu reads, %lu more didn't fit\n", (unsigned long)replay.count, (unsigned long)replay.dropped);
+
+    if (out_path != NULL) {
+        uint32_t log_length = vm_replay_save(&replay, NULL, 0);
+        uint8_t *log = malloc(log_length);
+        vm_replay_save(&replay, log, log_length);
+        FILE *f = fopen(out_path, "wb");
+        if (f == NULL || fwrite(start, 1, start_length, f) != start_length || fwrite(log, 1, log_length, f) != log_length) {
+            perror(out_path);
+            return 1;
+        }
+        fclose(f);
+        free(log);
+    }
+    free(start);
+    return 0;
+}
+
+
+//plays back each snapshot in 'path' along with the log after it
+static int play (const char *path) {
+    long size;
+    uint8_t *data = read_file(path, &size);
+    if (data == NULL) return 1;
+    uint32_t runs = 0;
+    for (long i = 0; i + 4 <= size; i++) {
+        if (memcmp(data + i, VM_SNAPSHOT_MAGIC, 4) != 0) continue;
+        vm_init(&vm);
+        uint32_t length = vm_restore(&vm, data + i, size - i);
+        if (length == 0) continue;
+        i += length;
+        vm_replay_init(&replay, events, EVENTS);
+        length = vm_replay_load(&replay, data + i, size - i);
+        if (length == 0) printf("%s: run %lu has no log, its reads are live\n", path, (unsigned long)runs + 1);
+        i += length;
+        vm_replay_play(&vm, &replay);
+        run("played");
+        printf("played: %lu of %lu reads%s\n",
+            (unsigned long)replay.next, (unsigned long)replay.count, replay.diverged ? ", diverged from the recording" : ""
+        );
+        runs++;
+        i--;
+    }
+    if (runs == 0) fprintf(stderr, "%s: no snapshots\n", path);
+    free(data);
+    return runs == 0;
+}
+
+
+int main (int argc, char **argv) {
+    const char *source = NULL, *out_path = NULL, *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            source = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else {
+            path = argv[i];
+        }
+    }
+    if (source != NULL) return record(source, out_path);
+    if (path != NULL) return play(path);
+    fprintf(stderr, "usage: vmreplay -r prog.s [-o run.bin]\n       vmreplay run.bin\n");
+    return 1;
+}
@@ -0,0 +1,126 @@
+/*
+*  Runs several basicvm programs at once under the cooperative scheduler and reports how
+*  the time was shared between them.
+*  Usage: vmsched [-s slice] [-t] prog.s ...
+*  Each program gets its own VM (loaded at 0x0200) and runs until every one of them halts.
+*  With -t the VMs run on a second thread and their video interrupts are queued for the
+*  main thread, like the firmware built with VM_CORE1 (see basicvm/video.h).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "vm.h"
+#include "asm.h"
+#include "scheduler.h"
+#include "video.h"
+
+
+static struct VM vms[VM_SCHED_MAX];
+static VM_Sched sched;
+static VM_Display displays[VM_SCHED_MAX];
+static VM_VideoQueue video;
+static atomic_int halted;
+
+
+static char *read_file (const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = malloc(size + 1);
+    if (data == NULL || fread(data, 1, size, f) != (size_t)size) {
+        perror(path);
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+    data[size] = 0;
+    fclose(f);
+    return data;
+}
+
+
+static int load (struct VM *vm, const char *path, uint32_t slice) {
+    static uint8_t image[65536 - 0x0200];
+    char *source = read_file(path);
+    if (source == NULL) return 1;
+    VM_AsmResult result;
+    int status = vm_assemble(source, 0x0200, image, sizeof(image), &result);
+    free(source);
+    if (status != 0) {
+        fprintf(stderr, "%s:%d: %s\n", path, result.line, result.error);
+        return 1;
+    }
+    vm_init(vm);
+    vm_load(vm, (char *)image, result.length, 0x0200);
+    const char *name = strrchr(path, '/');
+    return vm_sched_add(&sched, vm, name != NULL ? name + 1 : path, slice) < 0;
+}
+
+
+//runs the VMs to the end, reporting every second
+static void *run (void *arg) {
+    while (vm_sched_run(&sched, 1000000) != 0) vm_sched_report(&sched);
+    atomic_store(&halted, 1);
+    return NULL;
+}
+
+
+int main (int argc, char **argv) {
+    uint32_t slice = VM_SCHED_SLICE;
+    uint8_t count = 0, threaded = 0;
+
+    vm_sched_init(&sched);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            slice = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            threaded = 1;
+        } else if (count == VM_SCHED_MAX) {
+            fprintf(stderr, "at most %d programs\n", VM_SCHED_MAX);
+            return 1;
+        } else if (load(&vms[count++], argv[i], slice) != 0) {
+            return 1;
+        }
+    }
+    if (count == 0) {
+        fprintf(stderr, "usage: vmsched [-s slice] [-t] prog.s ...\n");
+        return 1;
+    }
+
+    //the host has no screen, the display lists only count what would be drawn
+    for (uint8_t i = 0; i < count; i++) {
+        vm_display_init(&displays[i]);
+        vms[i].display = &displays[i];
+    }
+    if (threaded) {
+        //every VM runs on the one thread, so they can share a queue (and a display) and keep it single-producer
+        pthread_t thread;
+        vm_video_init(&video);
+        for (uint8_t i = 0; i < count; i++) vms[i].video_queue = &video;
+        pthread_create(&thread, NULL, run, NULL);
+        while (!atomic_load(&halted)) {
+            if (vm_video_drain(&video, &displays[0]) == 0) usleep(100);
+        }
+        pthread_join(thread, NULL);
+        vm_video_drain(&video, &displays[0]);
+        printf("[VIDEO] queue full %lu times\n", (unsigned long)video.stalls);
+    } else {
+        run(NULL);
+    }
+    for (uint8_t i = 0; i < (threaded ? 1 : count); i++) {
+        vm_display_flush(&displays[i]);
+        vm_display_report(&displays[i], threaded ? "all" : vm_sched_task(&sched, &vms[i])->name);
+    }
+    vm_sched_report(&sched);
+    for (uint8_t i = 0; i < count; i++) {
+        if (vms[i].fault != VM_FAULT_NONE) printf("%s: fault %d at 0x%04x\n", vm_sched_task(&sched, &vms[i])->name, vms[i].fault, vms[i].pc);
+    }
+    return 0;
+}
@@ -0,0 +1,231 @@
+/*
+*  Benchmark suite for the basicvm interpreter on the host.
+*  Usage: vmsuite [-j results.json] [-t seconds] prog.s ...
+*  Runs each program (loaded at 0x0200, restarted from a snapshot) over and over for
+*  'seconds' (default 1) and reports its throughput, then times a loop of each class of
+*  instruction against the same loop empty to give the cost of dispatching one. The
+*  classes run without superinstructions so that every instruction is dispatched on its
+*  own, the programs run as the firmware runs them. With -j the results are also written
+*  as JSON, to compare from one build to the next. `cmake --build build-host --target bench`
+*  runs it on programs/countdown.s, fib.s, fill.s, ladder.s and pixels.s.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vm.h"
+#include "asm.h"
+#include "snapshot.h"
+#include "video.h"
+#include "verify.h"
+
+#define PROGRAMS 32        //most programs a run takes
+#define UNROLL 16          //copies of a class's instructions in its loop
+#define LOOPS 1000         //times round the loop in one run of a class
+
+
+typedef struct {
+    const char *name;
+    const char *code;       //one of each, 'code' UNROLL times makes the loop's body
+    uint8_t instructions;   //in 'code'
+} Class;
+
+//'sub' (a 'ret') and the data at 0x3000 are there for the classes that use them
+static const Class classes[] = {
+    { "empty",      "",                                 0 },
+    { "move",       "    mov r1, r2\n",                 1 },
+    { "immediate",  "    mov r1, 0x1234\n",             1 },
+    { "load",       "    mov r1, [0x3000]\n",           1 },
+    { "store",      "    mov [0x3000], r1\n",           1 },
+    { "pointer",    "    mov r1, [[0x3002]]\n",         1 },
+    { "alu3",       "    add r1, r2, r3\n",             1 },
+    { "alu2",       "    add r2\n",                     1 },
+    { "compare",    "    cmp r1\n",                     1 },
+    { "branch",     "    jmp $ + 3\n",                  1 },
+    { "stack",      "    push r1\n    pop r1\n",        2 },
+    { "call",       "    call sub\n",                   2 },
+    { "interrupt",  "    int I_GPIO_GET\n",             1 },
+};
+#define CLASSES (sizeof(classes) / sizeof(classes[0]))
+
+typedef struct {
+    char name[64];
+    uint64_t instructions;
+    uint32_t runs;
+    double seconds;
+} Result;
+
+
+static struct VM vm;
+static VM_Display display;
+static uint8_t image[65536 - 0x0200];
+static uint8_t start[VM_SNAPSHOT_SIZE(VM_PAGE_COUNT)];
+static Result programs[PROGRAMS];
+static double class_ns[CLASSES];
+
+
+static double now () {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static char *read_file (const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = malloc(size + 1);
+    if (data == NULL || fread(data, 1, size, f) != (size_t)size) {
+        perror(path);
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+    data[size] = 0;
+    fclose(f);
+    return data;
+}
+
+
+/*
+*  Assembles 'source' into a fresh VM, verified if it can be as the firmware does, and runs
+*  it from the start until 'seconds' of vm_run() have gone by. Only the runs are timed,
+*  not the restores between them.
+*/
+static int bench (const char *name, const char *source, uint8_t fuse, double seconds, Result *result) {
+    VM_AsmResult assembled;
+    if (vm_assemble(source, 0x0200, image, sizeof(image), &assembled) != 0) {
+        fprintf(stderr, "%s:%d: %s\n", name, assembled.line, assembled.error);
+        return 1;
+    }
+    vm_free(&vm);
+    vm_init(&vm);
+    vm.fuse = fuse;
+    vm_display_init(&display);
+    vm.display = &display;
+    vm_load(&vm, (char *)image, assembled.length, 0x0200);
+    VM_Verify verify;
+    vm_verify(&vm, 0x0200, assembled.length, &verify);
+    uint32_t length = vm_snapshot(&vm, start, sizeof(start));
+
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->instructions = 0;
+    result->runs = 0;
+    result->seconds = 0;
+    do {
+        vm_restore(&vm, start, length);
+        uint64_t icount = vm.icount;
+        double begin = now();
+        while (vm_run(&vm, UINT32_MAX) != VM_RUN_HALT);
+        result->seconds += now() - begin;
+        result->instructions += vm.icount - icount;
+        result->runs++;
+        if (vm.fault != VM_FAULT_NONE) {
+            fprintf(stderr, "%s: fault %d at 0x%04x\n", name, vm.fault, vm.pc);
+            return 1;
+        }
+    } while (result->seconds < seconds);
+    return 0;
+}
+
+
+//the loop for class 'c': UNROLL copies of its code, LOOPS times
+static void class_source (const Class *c, char *source, size_t size) {
+    int used = snprintf(source, size, "    mov r2, 0x4000\n    mov [0x3002], r2\n    mov r6, %d\nloop:\n", LOOPS);
+    for (uint8_t i = 0; i < UNROLL; i++) used += snprintf(source + used, size - used, "%s", c->code);
+    snprintf(source + used, size - used,
+        "    sub r6, r6, 1\n    mov r0, r6\n    cmp 0\n    jne loop\n    hlt\nsub:\n    ret\n"
+    );
+}
+
+
+static double ns (const Result *result) {
+    return result->instructions > 0 ? result->seconds * 1e9 / result->instructions : 0;
+}
+
+
+static void write_json (FILE *f, uint16_t count) {
+    fprintf(f, "{\n  \"programs\": [\n");
+    for (uint16_t i = 0; i < count; i++) {
+        fprintf(f, "    { \"name\": \"%s\", \"instructions\": %llu, \"seconds\": %.6f, \"mips\": %.3f, \"ns_per_instruction\": %.3f }%s\n",
+            programs[i].name, (unsigned long long)programs[i].instructions, programs[i].seconds,
+            programs[i].instructions / programs[i].seconds / 1e6, ns(&programs[i]), i + 1 < count ? "," : ""
+        );
+    }
+    fprintf(f, "  ],\n  \"classes\": [\n");
+    for (uint16_t i = 1; i < CLASSES; i++) {
+        fprintf(f, "    { \"name\": \"%s\", \"ns_per_instruction\": %.3f }%s\n",
+            classes[i].name, class_ns[i], i + 1 < CLASSES ? "," : ""
+        );
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+
+int main (int argc, char **argv) {
+    const char *json = NULL;
+    double seconds = 1.0;
+    uint16_t count = 0;
+    vm_init(&vm);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            json = argv[++i];
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (count < PROGRAMS) {
+            //named after the file, without the directory or '.s'
+            const char *name = strrchr(argv[i], '/') != NULL ? strrchr(argv[i], '/') + 1 : argv[i];
+            char *source = read_file(argv[i]);
+            if (source == NULL) return 1;
+            int status = bench(argv[i], source, VM_FUSE_ALL, seconds, &programs[count]);
+            free(source);
+            if (status != 0) return 1;
+            snprintf(programs[count].name, sizeof(programs[count].name), "%.*s", (int)strcspn(name, "."), name);
+            printf("%-12s %12llu instructions in %.3fs, %8.2f MIPS, %6.2fns per instruction\n",
+                programs[count].name, (unsigned long long)programs[count].instructions, programs[count].seconds,
+                programs[count].instructions / programs[count].seconds / 1e6, ns(&programs[count])
+            );
+            count++;
+        }
+    }
+    if (count == 0) {
+        fprintf(stderr, "usage: vmsuite [-j results.json] [-t seconds] prog.s ...\n");
+        return 1;
+    }
+
+    //a class costs what its loop takes over the empty loop, per instruction it adds
+    static char source[4096];
+    Result result;
+    double empty = 0;
+    printf("\nper instruction, without superinstructions:\n");
+    for (uint16_t i = 0; i < CLASSES; i++) {
+        class_source(&classes[i], source, sizeof(source));
+        if (bench(classes[i].name, source, 0, seconds / 4, &result) != 0) return 1;
+        double loop_ns = result.seconds * 1e9 / ((uint64_t)result.runs * LOOPS);
+        if (i == 0) {
+            empty = loop_ns;
+            continue;
+        }
+        class_ns[i] = (loop_ns - empty) / (UNROLL * classes[i].instructions);
+        printf("  %-12s %6.2fns\n", classes[i].name, class_ns[i]);
+    }
+
+    if (json != NULL) {
+        FILE *f = fopen(json, "w");
+        if (f == NULL) {
+            perror(json);
+            return 1;
+        }
+        write_json(f, count);
+        fclose(f);
+        printf("\nwrote %s\n", json);
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*
+*  Decodes binary basicvm traces written by vm_trace_dump().
+*  Usage: vmtrace [file]     (reads stdin if no file is given)
+*  Anything between trace chunks (e.g. the program's own stdout) is skipped.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+#include "trace.h"
+
+
+static uint16_t get16 (uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+
+static void print_flags (uint16_t flags) {
+    printf(" [");
+    for (uint8_t i = 0; i < FLAG_COUNT; i++) {
+        const char *name = FLAG_NAMES[i];
+        while (*name == ' ') name++;
+        if (flags & (1 << i)) printf(" %s", name);
+    }
+    printf(" ]\n");
+}
+
+
+static void print_record (uint8_t *p) {
+    uint16_t pc = get16(p);
+    uint8_t kind = p[2], opcode = p[3];
+    uint16_t flags = get16(p + 4), args[5];
+    for (uint8_t i = 0; i < 5; i++) args[i] = get16(p + 6 + i * 2);
+
+    if (kind == VM_TRACE_REC_INT) {
+        printf("0x%04x  int 0x%02x  R1:%04x R2:%04x R3:%04x R4:%04x R5:%04x",
+            pc, opcode, args[0], args[1], args[2], args[3], args[4]
+        );
+        print_flags(flags);
+        return;
+    }
+    if (kind != VM_TRACE_REC_OP) {
+        printf("0x%04x  ? record kind %d\n", pc, kind);
+        return;
+    }
+    const VM_Op *op = vm_op_info(opcode);
+    char dmode = op->dmode == ' ' ? '.' : op->dmode;
+    char smode = op->smode == ' ' ? '.' : op->smode;
+    printf("0x%04x  %-6s (%c%c)  src:%04x dst:%04x val:%04x R0:%04x",
+        pc, op->name[0] != 0 ? op->name : "???", dmode, smode, args[0], args[1], args[2], args[3]
+    );
+    print_flags(flags);
+}
+
+
+int main (int argc, char **argv) {
+    FILE *in = stdin;
+    if (argc > 1 && (in = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    uint8_t header[10], record[16];
+    uint32_t records = 0, dropped = 0;
+    size_t matched = 0;
+    int ch;
+    while ((ch = fgetc(in)) != EOF) {
+        //look for the chunk magic one byte at a time
+        if (ch != VM_TRACE_MAGIC[matched]) {
+            matched = ch == VM_TRACE_MAGIC[0];
+            continue;
+        }
+        if (++matched < 4) continue;
+        matched = 0;
+        if (fread(header + 4, 1, 6, in) != 6) break;
+        if (header[4] != VM_TRACE_VERSION) {
+            fprintf(stderr, "vmtrace: unsupported trace version %d\n", header[4]);
+            continue;
+        }
+        uint32_t chunk_dropped = get16(header + 6) | ((uint32_t)get16(header + 8) << 16);
+        if (chunk_dropped != dropped) {
+            printf("--- %u records dropped ---\n", chunk_dropped - dropped);
+            dropped = chunk_dropped;
+        }
+        for (uint8_t i = 0; i < header[5]; i++) {
+            if (fread(record, 1, sizeof(record), in) != sizeof(record)) break;
+            print_record(record);
+            records++;
+        }
+    }
+    fprintf(stderr, "vmtrace: %u records, %u dropped\n", records, dropped);
+    if (in != stdin) fclose(in);
+    return 0;
+}